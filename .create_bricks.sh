@@ -15,7 +15,7 @@ done < src/bricks/bricks.in
 
 # Finalize src/brick.c file
 echo -e "\t/* delimiter */" >> src/brick.c
-echo -e "\telibs[$COUNTER] = (brick_funcs){NULL, NULL, NULL, NULL, NULL};" >> src/brick.c
+echo -e "\telibs[$COUNTER] = (brick_funcs){NULL, NULL, NULL, NULL, NULL, NULL};" >> src/brick.c
 echo -e "\tTRACE_BRICK_FUNC_END();" >> src/brick.c
 echo "}" >> src/brick.c
 echo "/*---------------------------------------------------------------------*/" >> src/brick.c
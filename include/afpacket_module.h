@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __AFPACKET_MODULE_H__
+#define __AFPACKET_MODULE_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for engine definition */
+#include "pkt_engine.h"
+/* for CommNode definition */
+#include "netmap_module.h"
+/* for tpacket_req3 & friends */
+#include <linux/if_packet.h>
+/* for sendmmsg() */
+#include <sys/socket.h>
+/* for PLAN_MAX_BURST */
+#include "dispatch_plan.h"
+/*---------------------------------------------------------------------*/
+/**
+ * Private per-engine AF_PACKET module context. The RX ring is a
+ * TPACKET_V3 block-mapped ring: the kernel fills whole blocks and
+ * hands them over once full (or once AFP_BLOCK_TIMEOUT expires), and
+ * the engine returns each block only after the entire block has been
+ * pushed through the dispatch plan.
+ */
+typedef struct afpacket_module_context {
+	int32_t fd;				/* PF_PACKET socket */
+	uint8_t *map;				/* mmap()ed RX ring */
+	size_t map_len;				/* length of the mapping */
+	struct tpacket_req3 req;		/* RX ring geometry */
+	uint32_t cur_block;			/* next block to be read */
+	uint16_t batch_size;			/* burst size */
+	engine *eng;				/* ptr to host engine */
+} afpacket_module_context __attribute__((aligned(__WORDSIZE)));
+
+/**
+ * System-wide AF_PACKET-specific iface context. Engines that share an
+ * interface (each reading one "queue" of it) join the same fanout group.
+ */
+typedef struct afpacket_iface_context {
+	uint16_t fanout_id;			/* PACKET_FANOUT group id */
+} afpacket_iface_context __attribute__((aligned(__WORDSIZE)));
+
+/**
+ * Output side of a CommNode (hung off cn->out_ctx). Every burst bound
+ * to the node goes out with a single sendmmsg() call.
+ */
+typedef struct afpacket_channel {
+	int32_t fd;				/* PF_PACKET tx socket (-1: none) */
+	struct mmsghdr msgs[PLAN_MAX_BURST];	/* sendmmsg() vector */
+	struct iovec iov[PLAN_MAX_BURST];	/* one iovec per packet */
+} afpacket_channel __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/* RX ring geometry: 64 x 1MB blocks */
+#define AFP_BLOCK_SIZE			(1 << 20)
+#define AFP_BLOCK_NR			64
+#define AFP_FRAME_SIZE			2048
+/* retire a partially filled block after this many msecs */
+#define AFP_BLOCK_TIMEOUT		10
+/* fanout mode used when an iface is shared by several engines */
+#define AFP_FANOUT_MODE			(PACKET_FANOUT_HASH |	\
+					 PACKET_FANOUT_FLAG_DEFRAG)
+/*---------------------------------------------------------------------*/
+#endif /* !__AFPACKET_MODULE_H__ */
@@ -53,6 +53,12 @@
 #define POLL_TIMEOUT			2500
 /* passive sock port */
 #define PKTENGINE_LISTEN_PORT		1234
+/* advances the filter expiry timers; once per engine loop iteration */
+#define EXPIRE_FILTERS(eng)					\
+	do {							\
+		if (!TAILQ_EMPTY(&(eng)->filter_list))		\
+			expire_filters(eng, time(NULL));	\
+	} while (0)
 /* listen queue length */
 #define LISTEN_BACKLOG			10
 enum {RULE_ACC=0, RULE_REQUEST=2};
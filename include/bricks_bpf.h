@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_BPF_H__
+#define __BRICKS_BPF_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for struct bpf_insn */
+#include <pcap/bpf.h>
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * THREADED-CODE BPF
+ *
+ * A classic BPF program (as produced by pcap_compile()) is translated
+ * once into an array of pre-decoded instructions. Each of them holds
+ * the address of the code that runs it and the resolved targets of
+ * its branches, so that executing an instruction is a single indirect
+ * jump: no opcode decoding and no switch, unlike bpf_filter().
+ *
+ * A load of a packet word followed by a compare against a constant
+ * (the bulk of what pcap_compile() emits, e.g. "ldh [12]; jeq #0x800")
+ * is fused into one instruction unless the compare is a branch target.
+ *
+ * Loads past the end of the packet reject the packet, as in
+ * bpf_filter().
+ */
+/*---------------------------------------------------------------------*/
+typedef struct bpf_tc_insn {
+	const void *op;				/* code running the insn */
+	uint32_t k;				/* operand */
+	uint32_t k2;				/* compare operand of fused insns */
+	const struct bpf_tc_insn *jt;		/* branch targets */
+	const struct bpf_tc_insn *jf;
+} bpf_tc_insn;
+
+typedef struct bpf_tc {
+	bpf_tc_insn *insns;
+	uint32_t len;				/* no. of insns */
+} bpf_tc;
+/*---------------------------------------------------------------------*/
+/**
+ * Translates the len BPF instructions of insns. Returns -1 if the
+ * program is invalid (or uses unsupported opcodes) or if memory could
+ * not be allocated, and 0 otherwise.
+ */
+int
+bpf_tc_compile(bpf_tc *tc, const struct bpf_insn *insns, uint32_t len);
+
+/**
+ * Runs the program on the len bytes of pkt. Returns what the program
+ * returned, i.e. 0 if the packet is rejected.
+ */
+uint32_t
+bpf_tc_run(const bpf_tc *tc, const uint8_t *pkt, uint32_t len);
+
+/**
+ * Releases the translated program
+ */
+void
+bpf_tc_free(bpf_tc *tc);
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_BPF_H__ */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_CLASSIFY_H__
+#define __BRICKS_CLASSIFY_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * MULTI-FIELD PACKET CLASSIFIER
+ *
+ * Rules match on VLAN id, ethertype, IP protocol, source/destination
+ * prefix and source/destination port; fields a rule leaves out are
+ * wildcards. The first rule (in rule order) that matches a packet
+ * decides its output links.
+ *
+ * Rules are compiled into a tuple space: rules that specify the same
+ * set of fields and the same prefix lengths share a tuple, which is a
+ * hash table of their (masked) field values. A lookup masks the key
+ * of the packet once per tuple and probes its table; only the words
+ * of the key the tuple looks at are masked and hashed. Tuples are kept
+ * in the order of the first rule they hold, so the search stops as
+ * soon as no remaining tuple can hold an earlier rule than the best
+ * match found so far.
+ */
+/*---------------------------------------------------------------------*/
+/* fields of a rule (besides the prefixes) */
+#define CLS_VLAN			0x01
+#define CLS_ETHER			0x02
+#define CLS_PROTO			0x04
+#define CLS_SPORT			0x08
+#define CLS_DPORT			0x10
+/* VLAN id of untagged packets */
+#define CLS_VLAN_NONE			0xFFFF
+/* initial no. of buckets of a tuple (power of 2) */
+#define CLS_MIN_BUCKETS			16
+/*---------------------------------------------------------------------*/
+/**
+ * Header fields of a packet. Addresses are kept in network byte
+ * order (IPv4 only uses [0]), the rest in host byte order.
+ */
+typedef struct cls_key {
+	uint32_t src[4];
+	uint32_t dst[4];
+	uint16_t vlan;
+	uint16_t ether;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t proto;
+} cls_key;
+#define CLS_KEY_WORDS			(sizeof(cls_key) / sizeof(uint32_t))
+
+typedef struct cls_rule {
+	cls_key key;				/* values of the fields */
+	uint8_t fields;				/* CLS_* fields matched on */
+	uint8_t src_len;			/* prefix lengths (0: any) */
+	uint8_t dst_len;
+	uint64_t out;				/* bitmap of output links */
+} cls_rule;
+
+typedef struct cls_entry {
+	uint32_t w[CLS_KEY_WORDS];		/* masked words of the key */
+	uint32_t hash;				/* cached hash of key */
+	uint32_t prio;				/* rule index; lower wins */
+	uint64_t out;
+	struct cls_entry *next;			/* next entry of the bucket */
+} cls_entry;
+
+typedef struct cls_tuple {
+	uint32_t mask[CLS_KEY_WORDS];		/* non-zero words of the mask */
+	uint8_t word[CLS_KEY_WORDS];		/* their index in the key */
+	uint8_t nwords;
+	uint8_t fields;
+	uint8_t src_len;
+	uint8_t dst_len;
+	uint32_t best;				/* lowest prio of its entries */
+	cls_entry **buckets;
+	uint32_t bmask;				/* no. of buckets - 1 */
+	uint32_t count;				/* no. of entries */
+} cls_tuple;
+
+typedef struct classifier {
+	cls_tuple *tuples;			/* in order of ->best */
+	uint32_t count;				/* no. of tuples */
+} classifier;
+/*---------------------------------------------------------------------*/
+/**
+ * Compiles the n rules into c; rules[i] has priority over rules[j]
+ * for i < j. Returns -1 if memory could not be allocated.
+ */
+int
+cls_build(classifier *c, const cls_rule *rules, uint32_t n);
+
+/**
+ * Fills key with the header fields of the Ethernet frame pkt, of which
+ * len bytes were captured
+ */
+void
+cls_key_from_pkt(cls_key *key, const uint8_t *pkt, uint32_t len);
+
+/**
+ * Returns the output links of the first rule matching key, or 0 if
+ * no rule matches
+ */
+uint64_t
+cls_lookup(const classifier *c, const cls_key *key);
+
+/**
+ * Returns 1 if rule r matches key (what cls_lookup() computes for a
+ * single rule)
+ */
+int
+cls_rule_match(const cls_rule *r, const cls_key *key);
+
+/**
+ * Releases the compiled rules
+ */
+void
+cls_free(classifier *c);
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_CLASSIFY_H__ */
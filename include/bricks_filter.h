@@ -31,8 +31,14 @@
 /*---------------------------------------------------------------------*/
 /* for polling */
 #include <sys/poll.h>
+/* for the rule lock */
+#include <pthread.h>
 /* for flist */
 #include "netmap_module.h"
+/* for prefix tables */
+#include "bricks_lpm.h"
+/* for filter expiry */
+#include "bricks_timer.h"
 /*---------------------------------------------------------------------*/
 #define INET_MASK			32
 #ifdef ENABLE_BROKER
@@ -42,6 +48,75 @@
 #define BROKER_PORT			9999
 #endif
 /*---------------------------------------------------------------------*/
+/* initial no. of buckets of the connection table (power of 2) */
+#define CONN_TABLE_MIN_BUCKETS		1024
+/* max. no. of replaced tables the engine may still be reading */
+#define FILTER_MAX_RETIRED		4
+/*---------------------------------------------------------------------*/
+/**
+ * Key of a connection filter. Both end points are stored in a fixed
+ * order (lower address/port pair first), so that the two directions
+ * of a connection map to the same key. Addresses and ports are kept
+ * in network byte order.
+ */
+typedef struct conn_key {
+	uint32_t lo_addr[4];			/* IPv4 only uses [0] */
+	uint32_t hi_addr[4];
+	uint16_t lo_port;
+	uint16_t hi_port;
+	uint32_t proto;				/* IPVERSION or IPV6_VERSION */
+} conn_key;
+
+typedef struct conn_entry {
+	conn_key key;
+	uint32_t hash;				/* cached hash of key */
+	Filter *f;				/* the connection filter */
+	struct conn_entry *next;		/* next entry of the bucket */
+} conn_entry;
+
+/**
+ * Exact-match (chained) hash table of connection filters
+ */
+typedef struct conn_table {
+	conn_entry **buckets;
+	uint32_t mask;				/* no. of buckets - 1 */
+	uint32_t count;				/* no. of entries */
+} conn_table;
+/**
+ * Filters attached to a prefix of the IPv4/IPv6 prefix tables: IP
+ * filters on the prefix, and flow filters whose source is the prefix
+ */
+typedef struct filter_set {
+	flist ip_filters;
+	flist flow_filters;
+} filter_set;
+/*---------------------------------------------------------------------*/
+/**
+ * One version of the filters of a FilterContext. A table is built
+ * from the rules by commit_filters() and then published; from then on
+ * only the engine touches it (lookups, and removal of expired filters)
+ * until it is replaced and its grace period is over.
+ */
+typedef struct filter_table {
+	/* Filter list */
+	flist filter_list;
+
+	/* connection filters on exact addresses (instead of filter_list) */
+	conn_table conn_tbl;
+
+	/* IP and flow filters, indexed by prefix (instead of filter_list) */
+	lpm4 ip4_lpm;
+	lpm6 ip6_lpm;
+
+	/* expiry timers of timed filters (one tick per second) */
+	timer_wheel expiry;
+
+	/* engine's qs_seq at the time the table was replaced */
+	uint64_t retire_seq;
+	/* next table waiting for its grace period */
+	struct filter_table *next;
+} filter_table;
+/*---------------------------------------------------------------------*/
 struct FilterContext {
 	/* name of output node */
 	char name[IFNAMSIZ];
@@ -52,24 +127,84 @@ struct FilterContext {
 	 */
 	TAILQ_ENTRY(FilterContext) entry;
 
-	/* Filter list */
-	flist filter_list;
+	/* the published table; replaced with an atomic store */
+	filter_table *tbl;
+	/* no. of quiescent points the engine has gone through */
+	uint64_t qs_seq;
+
+	/* writer side (protected by lock) */
+	pthread_mutex_t lock;
+	/* rules in the published table and in the one it replaced */
+	flist rules;
+	/* rules of the last commit (only in the published table) */
+	flist recent;
+	/* rules added since the last commit (in neither table) */
+	flist added;
+	/* no. of rules on added */
+	uint32_t pending;
+	/*
+	 * replaced tables, latest first. Once the engine has moved on,
+	 * the latest one is brought up to date and published again by
+	 * the next commit; the others are freed.
+	 */
+	filter_table *retired;
+	/* set when a commit waits for the engine's next quiescent point */
+	uint32_t deferred;
 	
 } __attribute__((aligned(__WORDSIZE)));
 /*---------------------------------------------------------------------*/
 /**
- * Analyze the packet across the filter. And pass it along
- * the communication node, if the filter allows...
+ * Analyze the packet (len bytes captured) across the filter. And pass
+ * it along the communication node, if the filter allows...
+ */
+int
+analyze_packet(unsigned char *buf, uint32_t len, FilterContext *cn);
+
+/**
+ * Set up the (empty) filter table of a CommNode
  */
 int
-analyze_packet(unsigned char *buf, FilterContext *cn, time_t t);
+init_filters(FilterContext *cn);
 
 /**
- * Add the filter to the selected CommNode
+ * Add the filter to the selected CommNode. The filter takes effect
+ * with the next commit_filters(). Safe to call from any thread.
  */
 int
 apply_filter(FilterContext *cn, Filter *f);
 
+/**
+ * Publish a filter table with all filters added so far. The table
+ * replaced by the previous commit is reused if the engine is done
+ * with it: only the filters it lacks are added to it. Otherwise a new
+ * table is built. Other replaced tables are released once the engine
+ * has passed a quiescent point. If FILTER_MAX_RETIRED of them are still
+ * waiting for one, the commit is left to the engine's next quiescent
+ * point instead. Returns 1 if a table was published, 0 if there was
+ * nothing to commit (or it was deferred) and -1 on error. Safe to call
+ * from any thread.
+ */
+int
+commit_filters(FilterContext *cn);
+
+/**
+ * Advance the expiry timers of all filter bricks of the engine to
+ * now and drop the filters that have run out. Called by the engine
+ * loop; the packet path never looks at the clock. This also marks a
+ * quiescent point: the engine holds no reference to any filter table
+ * while outside of packet processing. Deferred commits are published
+ * here.
+ */
+void
+expire_filters(engine *eng, time_t now);
+
+/**
+ * Release all filters of the selected CommNode. The engine must have
+ * stopped; the CommNode can't be used for lookups afterwards.
+ */
+void
+flush_filters(FilterContext *cn);
+
 /**
  * Initialize the filter communication backend
  */
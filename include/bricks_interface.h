@@ -35,6 +35,8 @@
 #include <net/if.h>
 /* for queue management */
 #include "queue.h"
+/* for filter expiry timers */
+#include "bricks_timer.h"
 /*---------------------------------------------------------------------*/
 #define __FAVOR_BSD		1
 /*---------------------------------------------------------------------*/
@@ -90,6 +92,7 @@ typedef struct {
 		uint16_t addr16[8];
 		uint32_t addr32[4];
 	};
+	uint8_t mask;
 } IP6Address __attribute__((aligned(__WORDSIZE)));;
 /*---------------------------------------------------------------------*/
 /* XXX: These may be converted into individual structs */
@@ -183,6 +186,8 @@ typedef struct Filter {
 	time_t filt_start_time;
 	/* target */
 	Target tgt;
+	/* expiry timer (armed if filt_time_period >= 0) */
+	timer_entry tm;
 
 	/* comm node name */
 	char node_name[IFNAMSIZ];
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_LB_H__
+#define __BRICKS_LB_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for NULL */
+#include <stddef.h>
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * LOAD BALANCER LOOKUP TABLES
+ *
+ * In its default mode the LoadBalancer sends a packet to output
+ * (hash % n). The other modes map the hash through a table of output
+ * link indices instead:
+ *
+ *	weighted:   output i owns weight[i] slots of a table of
+ *		    sum(weight) slots, so it gets that share of the flows.
+ *
+ *	consistent: a Maglev table of LB_TABLE_SIZE slots. Each output
+ *		    fills slots in the order of its own permutation of
+ *		    the table, which is derived from its link name; the
+ *		    outputs take turns (weight[i] slots per turn). As the
+ *		    permutations do not depend on the other outputs,
+ *		    adding or removing one output only moves about 1/n
+ *		    of the slots, and thus of the flows.
+ *
+ * In every mode, a flow whose output is down (its consumer stalled
+ * or went away) is rehashed until it lands on a live output; see
+ * lb_failover().
+ *
+ * The sticky mode keeps state instead: a flow table pins each new
+ * flow to the output that carries the least traffic at that time, and
+ * the flow stays there until it has been idle for a while. Flows are
+ * told apart by their 64-bit key (see pkt_flow_key()), not by the
+ * hash of the other modes, so that they rarely share an entry.
+ * A few elephant flows thus push new flows to the other outputs
+ * instead of sharing their output with a fixed 1/n of them.
+ */
+/*---------------------------------------------------------------------*/
+/* LoadBalancer modes (Linker_Intf's lb_mode) */
+enum {LB_MODULO = 0,
+      LB_WEIGHTED,
+      LB_CONSISTENT,
+      LB_STICKY};
+/* no. of slots of a consistent table (prime, >> MAX_OUTLINKS) */
+#define LB_TABLE_SIZE			65521
+/* rehashes before lb_failover() settles for the first live output */
+#define LB_FAILOVER_TRIES		8
+/* max. no. of outputs (MAX_OUTLINKS) */
+#define LB_MAX_OUTPUTS			64
+/* flows per bucket of the sticky mode's flow table (tags fill a uint64_t) */
+#define LB_FLOW_WAYS			8
+/* default no. of buckets of the flow table (power of 2) */
+#define LB_FLOW_BUCKETS			(1 << 15)
+/* default idle timeout of a flow (secs) */
+#define LB_FLOW_IDLE			30
+/* flows whose buckets are prefetched ahead of their lookups */
+#define LB_FLOW_BATCH			32
+/*---------------------------------------------------------------------*/
+typedef struct lb_table {
+	uint8_t *slot;				/* output link of each slot */
+	uint32_t size;				/* no. of slots */
+} lb_table;
+/**
+ * One cache line of the flow table. The low bits of a flow's key pick
+ * its bucket and tag[] holds its top 8 bits (0: free way), so that one
+ * 64-bit compare finds the candidate ways of a bucket.
+ */
+typedef struct lb_flow_bucket {
+	uint8_t tag[LB_FLOW_WAYS];		/* 0: free */
+	uint32_t key[LB_FLOW_WAYS];		/* bits 24..55 of the flow key */
+	uint16_t seen[LB_FLOW_WAYS];		/* clock of the last packet */
+	uint8_t out[LB_FLOW_WAYS];		/* pinned output link */
+} lb_flow_bucket __attribute__((aligned(64)));
+
+typedef struct lb_flows {
+	lb_flow_bucket *bucket;			/* the table */
+	uint32_t mask;				/* no. of buckets - 1 */
+	uint16_t idle;				/* idle timeout (secs) */
+	uint16_t now;				/* clock (secs, wraps) */
+	uint32_t load[LB_MAX_OUTPUTS];		/* pkts per output, halved every sec */
+} lb_flows;
+/*---------------------------------------------------------------------*/
+/* murmur3 finalizer: spreads the bits of a flow hash */
+static inline uint32_t
+lb_mix32(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Builds the table of the weighted mode for n outputs. Returns -1 if
+ * all weights are 0, if they add up to more than LB_TABLE_SIZE or if
+ * memory could not be allocated.
+ */
+int
+lb_table_weighted(lb_table *t, const uint32_t *weight, uint32_t n);
+
+/**
+ * Builds the Maglev table of the consistent mode for n outputs named
+ * name[i] (NULL: use the index). weight may be NULL (all 1). Returns
+ * -1 if all weights are 0 or if memory could not be allocated.
+ */
+int
+lb_table_consistent(lb_table *t, const char * const *name,
+		    const uint32_t *weight, uint32_t n);
+
+/**
+ * Output link of a packet with the given hash
+ */
+static inline uint32_t
+lb_table_pick(const lb_table *t, uint32_t hash)
+{
+	return t->slot[hash % t->size];
+}
+
+/**
+ * Output link of a packet with the given hash whose output (key) is
+ * down. down has the bit of each of the n outputs that is down set.
+ * The hash is remixed until it picks a live output (through t, or
+ * modulo n if t has no slots), so only the flows of the outputs that
+ * are down move, and they spread over the others in the proportion
+ * of the mode. They go back once their output is up again. Returns
+ * key if all outputs are down.
+ */
+static inline uint32_t
+lb_failover(const lb_table *t, uint64_t down, uint32_t n,
+	    uint32_t hash, uint32_t key)
+{
+	uint64_t live;
+	uint32_t k;
+	int i;
+
+	for (i = 0; i < LB_FAILOVER_TRIES; i++) {
+		hash = lb_mix32(hash);
+		k = (t->slot == NULL) ? hash % n : lb_table_pick(t, hash);
+		if (k < n && ((down >> k) & 1) == 0)
+			return k;
+	}
+	live = ~down & ((n < 64) ? ((uint64_t)1 << n) - 1 : ~(uint64_t)0);
+	return (live != 0) ? (uint32_t)__builtin_ctzll(live) : key;
+}
+
+/**
+ * Releases the table
+ */
+void
+lb_table_free(lb_table *t);
+
+/**
+ * Sets up a flow table of (buckets) buckets (rounded up to a power
+ * of 2; 0: LB_FLOW_BUCKETS) whose flows expire after (idle) secs
+ * without packets (0: LB_FLOW_IDLE). Returns -1 if memory could not
+ * be allocated.
+ */
+int
+lb_flows_init(lb_flows *f, uint32_t buckets, uint16_t idle);
+
+/**
+ * Advances the clock of the table to now (secs) and ages the loads
+ * of the outputs. Meant to be called once per burst.
+ */
+void
+lb_flows_tick(lb_flows *f, uint16_t now);
+
+/**
+ * Output link of a packet of the flow with the given key (well mixed,
+ * as pkt_flow_key() makes them). A known flow keeps its
+ * output unless that one is down. A new flow is pinned to the live
+ * output (of n; down as in lb_failover()) with the least load per
+ * weight (weight may be NULL: all 1), taking the way of an idle or
+ * else the least recently seen flow if its bucket is full.
+ */
+uint32_t
+lb_flows_pick(lb_flows *f, uint64_t key, uint32_t n, uint64_t down,
+	      const uint32_t *weight);
+
+/**
+ * Pulls the bucket of the flow with the given key into the cache
+ */
+static inline void
+lb_flows_prefetch(const lb_flows *f, uint64_t key)
+{
+	__builtin_prefetch(&f->bucket[key & f->mask]);
+}
+
+/**
+ * Releases the flow table
+ */
+void
+lb_flows_free(lb_flows *f);
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_LB_H__ */
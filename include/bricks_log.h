@@ -93,6 +93,38 @@
 #define TRACE_NETMAP_FUNC_END()		(void)0
 #endif /* !DNMP */
 
+#ifdef DAFP
+#define TRACE_AFPACKET_FUNC_START()	TRACE_FUNC_START()
+#define TRACE_AFPACKET_FUNC_END()	TRACE_FUNC_END()
+#else /* DAFP */
+#define TRACE_AFPACKET_FUNC_START()	(void)0
+#define TRACE_AFPACKET_FUNC_END()	(void)0
+#endif /* !DAFP */
+
+#ifdef DXDP
+#define TRACE_XDP_FUNC_START()		TRACE_FUNC_START()
+#define TRACE_XDP_FUNC_END()		TRACE_FUNC_END()
+#else /* DXDP */
+#define TRACE_XDP_FUNC_START()		(void)0
+#define TRACE_XDP_FUNC_END()		(void)0
+#endif /* !DXDP */
+
+#ifdef DFILE
+#define TRACE_FILE_FUNC_START()		TRACE_FUNC_START()
+#define TRACE_FILE_FUNC_END()		TRACE_FUNC_END()
+#else /* DFILE */
+#define TRACE_FILE_FUNC_START()		(void)0
+#define TRACE_FILE_FUNC_END()		(void)0
+#endif /* !DFILE */
+
+#ifdef DSYNTH
+#define TRACE_SYNTH_FUNC_START()	TRACE_FUNC_START()
+#define TRACE_SYNTH_FUNC_END()		TRACE_FUNC_END()
+#else /* DSYNTH */
+#define TRACE_SYNTH_FUNC_START()	(void)0
+#define TRACE_SYNTH_FUNC_END()		(void)0
+#endif /* !DSYNTH */
+
 #ifdef DUTIL
 #define TRACE_UTIL_FUNC_START()		TRACE_FUNC_START()
 #define TRACE_UTIL_FUNC_END()		TRACE_FUNC_END()
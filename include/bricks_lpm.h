@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_LPM_H__
+#define __BRICKS_LPM_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for NULL */
+#include <stddef.h>
+/* for ntohl() */
+#include <arpa/inet.h>
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * LONGEST PREFIX MATCH
+ *
+ * IPv4 prefixes are kept in a DIR-24-8 table: tbl24 is indexed with
+ * the upper 24 bits of the address, and entries of prefixes longer
+ * than /24 are expanded into 256-entry tbl8 groups. A lookup costs
+ * one or two memory reads. IPv6 prefixes are kept in a path-compressed
+ * binary trie. Both structures are updated in place when a prefix is
+ * added; nothing is ever rebuilt.
+ *
+ * Every prefix links to the longest shorter prefix that covers it, so
+ * that all prefixes covering an address can be visited by following
+ * ->parent from the result of a lookup.
+ */
+/*---------------------------------------------------------------------*/
+typedef struct lpm_prefix {
+	uint32_t addr[4];			/* network byte order, host bits cleared */
+	uint8_t len;				/* prefix length */
+	struct lpm_prefix *parent;		/* next shorter covering prefix */
+	void *data;				/* owner's data */
+} lpm_prefix;
+
+typedef struct lpm4 {
+	uint32_t *tbl24;			/* 2^24 entries, allocated on demand */
+	uint32_t *tbl8;				/* tbl8 groups */
+	uint32_t tbl8_used;			/* no. of tbl8 groups in use */
+	uint32_t tbl8_size;			/* no. of tbl8 groups allocated */
+	lpm_prefix **prefixes;			/* entry value - 1 indexes this */
+	uint32_t count;				/* no. of prefixes (w/o default) */
+	uint32_t size;				/* no. of slots in prefixes */
+	lpm_prefix *def;			/* the /0 prefix */
+} lpm4;
+
+typedef struct lpm6_node {
+	uint8_t addr[16];			/* path of the node */
+	uint8_t len;				/* no. of significant bits */
+	lpm_prefix *prefix;			/* NULL for branching nodes */
+	struct lpm6_node *child[2];
+} lpm6_node;
+
+typedef struct lpm6 {
+	lpm6_node *root;
+	uint32_t count;				/* no. of prefixes */
+} lpm6;
+/*---------------------------------------------------------------------*/
+/* tbl24 entry refers to a tbl8 group */
+#define LPM4_EXT			0x80000000
+/* no. of tbl8 groups allocated at a time */
+#define LPM4_TBL8_CHUNK			256
+/*---------------------------------------------------------------------*/
+/**
+ * Adds addr/len (addr in network byte order) to the table. Returns the
+ * prefix (an existing one if it has been added before) or NULL if
+ * memory could not be allocated.
+ */
+lpm_prefix *
+lpm4_insert(lpm4 *t, uint32_t addr, uint8_t len);
+
+/**
+ * Returns the longest prefix covering addr or NULL
+ */
+static inline lpm_prefix *
+lpm4_lookup(const lpm4 *t, uint32_t addr)
+{
+	uint32_t a = ntohl(addr);
+	uint32_t v;
+
+	if (t->tbl24 == NULL)
+		return t->def;
+	v = t->tbl24[a >> 8];
+	if (v & LPM4_EXT)
+		v = t->tbl8[((v & ~LPM4_EXT) << 8) | (a & 0xFF)];
+	return (v != 0) ? t->prefixes[v - 1] : t->def;
+}
+
+/**
+ * Releases the table; free_data (if not NULL) is called for the data
+ * of every prefix.
+ */
+void
+lpm4_free(lpm4 *t, void (*free_data)(void *));
+
+/**
+ * IPv6 counterparts of the above (addresses are 16-byte arrays)
+ */
+lpm_prefix *
+lpm6_insert(lpm6 *t, const void *addr, uint8_t len);
+
+lpm_prefix *
+lpm6_lookup(const lpm6 *t, const void *addr);
+
+void
+lpm6_free(lpm6 *t, void (*free_data)(void *));
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_LPM_H__ */
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_RATELIMIT_H__
+#define __BRICKS_RATELIMIT_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for read_cycles() */
+#include "bricks_cycles.h"
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * RATE LIMITING
+ *
+ * A rate limit is a token bucket kept the GCRA way: rather than a
+ * token count that has to be topped up as time goes by, a bucket
+ * holds the time at which it will be full again (its theoretical
+ * arrival time, tat). A packet fits if tat is at most the burst
+ * tolerance ahead of now, and moves tat ahead by what the packet
+ * costs. Costs are worked out in clock ticks up front, so a packet
+ * costs a compare and an add per limit: no division, no refill.
+ * A bucket limits packets/sec, bits/sec or both.
+ *
+ * The clock is read_cycles(): the TSC on x86, CLOCK_MONOTONIC (nsecs)
+ * elsewhere. Bricks read it once per burst. rl_clock_hz() calibrates
+ * the TSC against CLOCK_MONOTONIC once; it assumes an invariant TSC,
+ * as any x86 CPU of the last decade has.
+ */
+/*---------------------------------------------------------------------*/
+/* default burst tolerance (msecs) */
+#define RL_BURST_MS			10
+/* default no. of per-flow buckets (power of 2) */
+#define RL_FLOW_BUCKETS			(1 << 16)
+/* max. no. of outputs (MAX_OUTLINKS) */
+#define RL_MAX_OUTPUTS			64
+/* flows whose buckets are prefetched ahead of their lookups */
+#define RL_BATCH			32
+/* fraction bits of the per-byte cost */
+#define RL_FRAC				16
+/* longest frame a bucket is charged for (bytes) */
+#define RL_MAX_LEN			0xFFFF
+/* how long rl_clock_hz() calibrates the TSC for (msecs) */
+#define RL_CALIBRATE_MS			20
+/*---------------------------------------------------------------------*/
+typedef struct rl_rate {
+	uint64_t pkt_cost;			/* ticks/pkt (0: no pps limit) */
+	uint64_t byte_cost;			/* ticks/byte << RL_FRAC (0: no bps limit) */
+	uint64_t burst;				/* tolerance (ticks) */
+} rl_rate;
+
+typedef struct rl_bucket {
+	uint64_t pkt_tat;			/* ticks */
+	uint64_t byte_tat;			/* ticks */
+} rl_bucket;
+/*---------------------------------------------------------------------*/
+/**
+ * Ticks of read_cycles() per sec. The first call takes RL_CALIBRATE_MS
+ * on x86.
+ */
+uint64_t
+rl_clock_hz(void);
+
+/**
+ * Sets up a limit of pps packets/sec and bps bits/sec (0: no such
+ * limit) with a clock of hz ticks/sec. Bursts of up to burst_ms
+ * (0: RL_BURST_MS) worth of the rate go through at once. Returns -1
+ * if neither limit is set.
+ */
+int
+rl_rate_init(rl_rate *r, uint64_t hz, uint64_t pps, uint64_t bps,
+	     uint32_t burst_ms);
+
+/**
+ * Tells whether a packet of len bytes fits into bucket b at time now.
+ * If it does, returns 1 and stores the bucket with the packet taken
+ * in *next; the caller commits it (*b = *next) once the packet is
+ * sure to go, so that a packet held back by one bucket does not use
+ * up another. A zeroed bucket is full.
+ */
+static inline int
+rl_take(const rl_rate *r, const rl_bucket *b, uint64_t now, uint32_t len,
+	rl_bucket *next)
+{
+	uint64_t pt = b->pkt_tat, bt = b->byte_tat;
+
+	if (r->pkt_cost != 0) {
+		if (pt < now)
+			pt = now;
+		if (pt - now > r->burst)
+			return 0;
+		pt += r->pkt_cost;
+	}
+	if (r->byte_cost != 0) {
+		if (bt < now)
+			bt = now;
+		if (bt - now > r->burst)
+			return 0;
+		if (len > RL_MAX_LEN)
+			len = RL_MAX_LEN;
+		bt += (len * r->byte_cost) >> RL_FRAC;
+	}
+	next->pkt_tat = pt;
+	next->byte_tat = bt;
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_RATELIMIT_H__ */
+/*---------------------------------------------------------------------*/
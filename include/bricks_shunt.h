@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_SHUNT_H__
+#define __BRICKS_SHUNT_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * FLOW SHUNTING
+ *
+ * Most of what an IDS gets out of a connection is in its first few
+ * KBs. A shunt table counts the bytes and packets of each flow (both
+ * directions together) and tells when a flow has gone past its cutoff,
+ * so that the rest of it can be kept from the analysis outputs.
+ *
+ * Flows are keyed by a 64-bit symmetric hash of VLAN, addresses,
+ * protocol and ports (see pkt_flow_key()). The table is open
+ * addressed: a bucket is one cache line of SHUNT_WAYS flows. A new
+ * flow takes a free way of its bucket, else the way of the least
+ * recently seen flow; a flow that has been idle for longer than the
+ * idle timeout starts over from zero.
+ */
+/*---------------------------------------------------------------------*/
+/* flows per bucket (one cache line) */
+#define SHUNT_WAYS			4
+/* default no. of buckets (power of 2) */
+#define SHUNT_BUCKETS			(1 << 16)
+/* default cutoff (bytes) */
+#define SHUNT_CUTOFF			(1 << 20)
+/* default idle timeout of a flow (secs) */
+#define SHUNT_IDLE			60
+/* flows whose buckets are prefetched ahead of their lookups */
+#define SHUNT_BATCH			32
+/*---------------------------------------------------------------------*/
+typedef struct shunt_bucket {
+	uint32_t key[SHUNT_WAYS];		/* top half of flow key (0: free) */
+	uint32_t bytes[SHUNT_WAYS];		/* saturate at UINT32_MAX */
+	uint32_t pkts[SHUNT_WAYS];
+	uint16_t seen[SHUNT_WAYS];		/* clock of the last packet */
+	uint8_t pad[8];				/* to a full cache line */
+} shunt_bucket __attribute__((aligned(64)));
+
+typedef struct shunt_table {
+	shunt_bucket *bucket;			/* the table */
+	uint32_t mask;				/* no. of buckets - 1 */
+	uint32_t cutoff_bytes;			/* 0: no byte limit */
+	uint32_t cutoff_pkts;			/* 0: no packet limit */
+	uint16_t idle;				/* idle timeout (secs) */
+	uint16_t now;				/* clock (secs, wraps) */
+} shunt_table;
+/*---------------------------------------------------------------------*/
+/**
+ * Sets up a table of (buckets) buckets (rounded up to a power of 2;
+ * 0: SHUNT_BUCKETS) that cuts flows off after cutoff_bytes bytes or
+ * cutoff_pkts packets, whichever comes first (both 0: SHUNT_CUTOFF
+ * bytes). Flows expire after (idle) secs without packets (0:
+ * SHUNT_IDLE). Returns -1 if memory could not be allocated.
+ */
+int
+shunt_table_init(shunt_table *t, uint32_t buckets, uint32_t cutoff_bytes,
+		 uint32_t cutoff_pkts, uint16_t idle);
+
+/**
+ * Sets the clock of the table (secs). Meant to be called once per
+ * burst.
+ */
+static inline void
+shunt_table_tick(shunt_table *t, uint16_t now)
+{
+	t->now = now;
+}
+
+/**
+ * Pulls the bucket of the flow into the cache
+ */
+static inline void
+shunt_table_prefetch(const shunt_table *t, uint64_t key)
+{
+	__builtin_prefetch(&t->bucket[key & t->mask]);
+}
+
+/**
+ * Accounts a packet of len bytes to the flow. Returns 1 if the flow
+ * had already reached its cutoff before this packet, 0 otherwise.
+ */
+int
+shunt_table_account(shunt_table *t, uint64_t key, uint32_t len);
+
+/**
+ * Releases the table
+ */
+void
+shunt_table_free(shunt_table *t);
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_SHUNT_H__ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+#ifndef __BRICKS_TIMER_H__
+#define __BRICKS_TIMER_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for LIST macros */
+#include "queue.h"
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * HIERARCHICAL TIMER WHEEL
+ *
+ * TW_LEVELS wheels of TW_SLOTS slots each. A timer due within TW_SLOTS
+ * ticks sits on the innermost wheel; later ones sit on an outer wheel
+ * and are moved inwards (cascaded) as the outer slot comes around.
+ * Adding and removing a timer is O(1), and advancing the wheel by a
+ * tick touches one inner slot plus an occasional cascade, no matter
+ * how many timers are pending.
+ *
+ * The wheel is not thread-safe; it is meant to be owned and advanced
+ * by a single engine thread.
+ */
+/*---------------------------------------------------------------------*/
+#define TW_SLOT_BITS			6
+#define TW_SLOTS			(1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK			(TW_SLOTS - 1)
+#define TW_LEVELS			4
+/* timers further out than this are re-cascaded until they are due */
+#define TW_RANGE			(1ULL << (TW_SLOT_BITS * TW_LEVELS))
+/*---------------------------------------------------------------------*/
+typedef struct timer_entry {
+	uint64_t expires;			/* tick it fires at; 0 if idle */
+	void *arg;				/* owner's data */
+	LIST_ENTRY(timer_entry) entry;
+} timer_entry;
+
+typedef LIST_HEAD(tlist, timer_entry) tlist;
+
+typedef struct timer_wheel {
+	uint64_t now;				/* last tick processed */
+	uint32_t count;				/* no. of pending timers */
+	tlist slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel;
+
+/* called for every timer that fires; te has already been removed */
+typedef void (*timer_fn)(timer_entry *te, void *arg);
+/*---------------------------------------------------------------------*/
+/**
+ * Empties the wheel and sets its clock to now
+ */
+void
+timer_wheel_init(timer_wheel *tw, uint64_t now);
+
+/**
+ * Arms te to fire at tick expires (at the next tick if that has passed)
+ */
+void
+timer_add(timer_wheel *tw, timer_entry *te, uint64_t expires);
+
+/**
+ * Disarms te (no-op if it isn't armed)
+ */
+void
+timer_del(timer_wheel *tw, timer_entry *te);
+
+/**
+ * Moves the clock forward to now, calling fn for every timer that
+ * expires on the way. Returns the no. of timers fired.
+ */
+uint32_t
+timer_advance(timer_wheel *tw, uint64_t now, timer_fn fn, void *arg);
+/*---------------------------------------------------------------------*/
+#endif /* !__BRICKS_TIMER_H__ */
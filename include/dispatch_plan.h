@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __DISPATCH_PLAN_H__
+#define __DISPATCH_PLAN_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for Brick def'n */
+#include "brick.h"
+/* for engine def'n */
+#include "pkt_engine.h"
+/*---------------------------------------------------------------------*/
+/**
+ *
+ * DISPATCH PLAN
+ *
+ * The Brick/CommNode tree of an engine is compiled into a flat array
+ * of nodes when the engine starts. Nodes are laid out in breadth-first
+ * (topological) order so that a parent is always processed before its
+ * children. Each output link of a node either points to a child node,
+ * to an entry of the leaf table (CommNodes that talk to userland) or
+ * to nothing at all.
+ *
+ * A node is marked 'copy' if its brick or any brick upstream of it may
+ * forward a packet to more than one link (li->type == COPY). Leaves of
+ * such nodes have CommNode->copy set and are the only ones that need
+ * to care about packets fanning out; all others keep plain buffer
+ * swapping.
+ *
+ * Packets of an RX burst are referred to by their index within the
+ * burst. Every node (and leaf) keeps the list of burst indices that
+ * it has received so far; dispatch_plan_run() walks the array once
+ * per burst without any recursion. Leaves that receive at least one
+ * packet in a burst are recorded in the plan's touched list, so that
+ * the I/O module only visits those leaves while flushing.
+ */
+/*---------------------------------------------------------------------*/
+/* maximum number of packets in a burst */
+#define PLAN_MAX_BURST			128
+/* link does not lead anywhere */
+#define PLAN_NONE			-1
+/*---------------------------------------------------------------------*/
+typedef struct plan_link {
+	int16_t node;				/* index of the child node */
+	int16_t leaf;				/* index in the leaf table */
+} plan_link;
+
+typedef struct plan_node {
+	Brick *brick;				/* brick run by this node */
+	uint8_t count;				/* # of output links */
+	unsigned char level;			/* nested level (hash seed) */
+	uint8_t copy;				/* this or an upstream brick duplicates */
+	plan_link *links;			/* per output link targets */
+	uint16_t n;				/* # of pkts queued in this burst */
+	uint16_t pkts[PLAN_MAX_BURST];		/* burst indices of queued pkts */
+} plan_node;
+
+typedef struct plan_leaf {
+	CommNode *cn;				/* the userland channel */
+	int16_t parent;				/* index of the feeding node */
+	uint16_t n;				/* # of pkts queued in this burst */
+	uint16_t pkts[PLAN_MAX_BURST];		/* burst indices of queued pkts */
+} plan_leaf;
+
+typedef struct dispatch_plan {
+	uint16_t node_count;			/* # of nodes */
+	uint16_t leaf_count;			/* # of leaf CommNodes */
+	uint16_t copy_count;			/* # of leaves that may share pkts */
+	plan_node *nodes;			/* nodes in topological order */
+	plan_leaf *leaves;			/* leaf CommNode table */
+	uint16_t touched_count;			/* # of leaves hit in this burst */
+	uint16_t *touched;			/* indices of leaves hit in this burst */
+
+	/* leaves that are down (see pipe_health() in netmap_module.c) */
+	uint16_t down_count;			/* # of leaves with cn->down set */
+	uint16_t probe_tick;			/* bursts since the last probe */
+} dispatch_plan;
+/*---------------------------------------------------------------------*/
+/**
+ * Compiles the brick tree rooted at the engine's first source into a
+ * dispatch plan. Returns NULL if the engine has no bricks or if memory
+ * could not be allocated.
+ */
+dispatch_plan *
+dispatch_plan_compile(engine *eng);
+
+/**
+ * Frees up all resources held by the plan
+ */
+void
+dispatch_plan_free(dispatch_plan *dp);
+
+/**
+ * Runs a burst of n packets (lens[i] bytes at bufs[i], as captured)
+ * through the plan. On return, each leaf's
+ * pkts[] holds the burst indices of the packets it needs to forward
+ * and touched[] lists the leaves with a non-empty pkts[]. The caller
+ * is responsible for draining the leaves and resetting their n as
+ * well as touched_count.
+ */
+void
+dispatch_plan_run(dispatch_plan *dp, unsigned char **bufs,
+		  const uint32_t *lens, uint16_t n);
+
+/**
+ * Prints the plan in human-readable form
+ */
+void
+dispatch_plan_print(dispatch_plan *dp, FILE *f);
+/*---------------------------------------------------------------------*/
+#endif /* !__DISPATCH_PLAN_H__ */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __FILE_MODULE_H__
+#define __FILE_MODULE_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for engine definition */
+#include "pkt_engine.h"
+/* for CommNode definition */
+#include "netmap_module.h"
+/*---------------------------------------------------------------------*/
+/**
+ * Private per-source context of the offline (pcap file) module. The
+ * whole file is mapped and walked record by record; every burst of
+ * records is presented to the brick tree in place, just like an RX
+ * burst.
+ */
+typedef struct file_module_context {
+	uint8_t *map;				/* mmap()ed pcap file */
+	size_t map_len;				/* length of the mapping */
+	size_t off;				/* offset of the next record */
+	int32_t evfd[2];			/* pipe kept readable until EOF */
+	uint8_t swapped;			/* file has foreign byte order */
+	uint8_t nsec;				/* timestamps are in nsecs */
+	uint8_t timed;				/* replay with original timing */
+	uint16_t batch_size;			/* burst size */
+	uint32_t snaplen;			/* longest record the file may hold */
+	uint64_t oversize;			/* records skipped for exceeding it */
+	uint64_t first_ts;			/* file time of the first record */
+	uint64_t start_ts;			/* wall time it was replayed at */
+	engine *eng;				/* ptr to host engine */
+} file_module_context __attribute__((aligned(__WORDSIZE)));
+
+/* on-disk pcap headers */
+struct file_pcap_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct file_pcap_rec {
+	uint32_t ts_sec;
+	uint32_t ts_frac;			/* usecs or nsecs */
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+/*---------------------------------------------------------------------*/
+/* pcap magic numbers */
+#define PCAP_MAGIC_USEC			0xa1b2c3d4
+#define PCAP_MAGIC_NSEC			0xa1b23c4d
+/* link name prefix that asks for the original timing */
+#define FILE_TIMED_PREFIX		"timed:"
+/* snaplen assumed when the file header gives none (as in libpcap) */
+#define FILE_MAX_SNAPLEN		262144
+/* never sleep longer than this (in nsecs) while waiting for a record */
+#define FILE_MAX_SLEEP			1000000
+/*---------------------------------------------------------------------*/
+#endif /* !__FILE_MODULE_H__ */
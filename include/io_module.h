@@ -84,7 +84,16 @@ typedef struct io_module_funcs {
 	
 } io_module_funcs __attribute__((aligned(__WORDSIZE)));
 /*---------------------------------------------------------------------*/
-/* only netmap module is enabled at the moment */
 extern io_module_funcs netmap_module;
+/* pcap files, see file_module.c */
+extern io_module_funcs file_module;
+/* synthetic traffic, see synth_module.c */
+extern io_module_funcs synth_module;
+#ifdef __linux__
+/* AF_PACKET (TPACKET_V3), see Linux/afpacket_module.c */
+extern io_module_funcs afpacket_module;
+/* AF_XDP, see Linux/xdp_module.c */
+extern io_module_funcs xdp_module;
+#endif
 /*---------------------------------------------------------------------*/
 #endif /* !__IO_MODULE_H__ */
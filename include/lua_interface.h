@@ -58,14 +58,29 @@ typedef struct PktEngine_Intf {
  * Garbage collection is implemented in LUA...
  */
 #define MAX_INLINKS			20
-#define MAX_OUTLINKS			MAX_INLINKS
+#define MAX_OUTLINKS			64	/* bits in a BITMAP */
 
 typedef struct Linker_Intf {
 	int type;				/* lb/dup/merge/filter? */
 	int hash_split;				/* 2-tuple or 4-tuple split? */
+	int hash_inner;				/* hash the innermost tunneled flow? */
+	int lb_mode;				/* LB_MODULO/WEIGHTED/CONSISTENT/STICKY */
+	uint32_t weight[MAX_OUTLINKS];		/* per output link (lb_mode) */
+	int weight_count;			/* weights count */
+	int flow_idle;				/* idle timeout of flows (secs) */
+	uint32_t cutoff_bytes;			/* Shunt: bytes per flow */
+	uint32_t cutoff_pkts;			/* Shunt: packets per flow */
+	uint64_t rate_pps;			/* RateLimiter: pkts/sec per link */
+	uint64_t rate_bps;			/* RateLimiter: bits/sec per link */
+	uint64_t flow_pps;			/* RateLimiter: pkts/sec per flow */
+	uint64_t flow_bps;			/* RateLimiter: bits/sec per flow */
+	uint32_t burst_ms;			/* RateLimiter: burst tolerance */
+	int divert;				/* RateLimiter: last link takes overflow? */
 	const char *input_link[MAX_INLINKS];	/* ingress interface name */
 	const char *output_link[MAX_OUTLINKS];	/* outgress interface names */
 	int output_count;			/* output links count */
+	const char *filter_expr[MAX_OUTLINKS];	/* string args (BPF exprs, rule file) */
+	int expr_count;				/* string args count */
 	/* 
 	 * input links count (multiple count with merge) 
 	 */
@@ -43,9 +43,18 @@
 /* Filter chain declaration */
 typedef TAILQ_HEAD(flist, Filter) flist;
 /*---------------------------------------------------------------------*/
+/* how a queued packet is handed to the pipe (see zc_packets()) */
+enum txq_mode {
+	TXQ_OWN = 0,		/* single consumer: swap buffers */
+	TXQ_REF,		/* buffer shared by refcount: hand out buf_idx */
+	TXQ_COPY		/* fan-out without spare buffers: memcpy */
+};
+
 struct txq_entry {
         void *ring;
         uint16_t slot_idx;      /* used if ring */
+	uint8_t mode;		/* enum txq_mode */
+	uint32_t buf_idx;	/* buffer holding the packet */
 };
 
 struct CommNode {
@@ -55,8 +64,16 @@ struct CommNode {
 	char nm_ifname[IFNAMSIZ];		/* name of the node */
 	struct txq_entry q[TXQ_MAX];		/* transmission queue used to buffer descs */
 	int32_t cur_txq;			/* current index of the tx entry */
-	uint8_t mark;				/* marking for delivery */
+	uint8_t copy;				/* may share pkts with other nodes */
 	struct Brick *brick;			/* ptrs to child bricks */
+	void *out_ctx;				/* output channel of non-netmap I/O modules */
+
+	/* liveness of the pipe's consumer (see pipe_health()) */
+	linkdata *parent;			/* links of the brick feeding the node */
+	uint8_t idx;				/* index in parent->external_links */
+	uint8_t down;				/* taken out of the parent's targets */
+	uint8_t closed;				/* last NIOCTXSYNC failed */
+	uint16_t stalls;			/* consecutive bursts that did not fit */
 
 }  __attribute__((aligned(__WORDSIZE)));
 
@@ -70,6 +87,12 @@ typedef struct netmap_module_context {
 	uint16_t batch_size;			/* burst size */
 	int32_t local_fd;			/* thread-local fd*/
 	engine *eng;				/* ptr to host engine */
+
+	/* zero-copy fan-out (see netmap_zc_init()) */
+	uint16_t *buf_refcnt;			/* per-buffer reference counts */
+	uint32_t nbufs;				/* # of entries in buf_refcnt */
+	uint32_t *zc_pool;			/* stack of free spare buffers */
+	uint32_t zc_pool_cnt;			/* # of buffers in zc_pool */
 	
 } netmap_module_context __attribute__((aligned(__WORDSIZE)));
 
@@ -97,11 +120,25 @@ netmap_pcap_push_pkt(engine *eng,
  */
 int32_t
 install_filter(req_block *rb, engine *eng);
+
+/**
+ * Locates the CommNode named ifname in the brick tree of brick and
+ * attaches a brick of type t to it (or returns the one already there).
+ * Used by the I/O modules to set up pipelined bricks.
+ */
+Brick *
+enable_pipeline(Brick *brick, const char *ifname, Target t, const char *out_name);
 /*---------------------------------------------------------------------*/
 /* try netmap-specific tx this many times */
 #define TX_RETRIES			20
+/* a pipe that could not take this many bursts in a row is down */
+#define PIPE_STALL_LIMIT		32
+/* while pipes are down, probe them every that many bursts */
+#define PIPE_PROBE_BURSTS		256
 /* for more buffering */
 #define NM_EXTRA_BUFS			8
+/* spare buffers per engine for zero-copy fan-out */
+#define NM_ZC_EXTRA_BUFS		4096
 /* for interface initialization */
 #define NETMAP_LINK_WAIT_TIME		2	/* in secs */
 /* Ethernet MTU frame */
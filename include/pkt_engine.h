@@ -44,10 +44,13 @@
 #include <pcap/pcap.h>
 /*---------------------------------------------------------------------*/
 /**
- *  io_type: Right now, we only support IO_NETMAP.
+ *  io_type: Right now, we support IO_NETMAP, IO_FILE (pcap files),
+ *	     IO_SYNTH (synthetic traffic) and (on Linux) IO_LINUX, i.e.
+ *	     AF_PACKET sockets, and IO_XDP (AF_XDP sockets).
  */
 typedef enum io_type {
-	IO_NETMAP, IO_DPDK, IO_PFRING, IO_PSIO, IO_LINUX, IO_FILE
+	IO_NETMAP, IO_DPDK, IO_PFRING, IO_PSIO, IO_LINUX, IO_FILE, IO_XDP,
+	IO_SYNTH
 } io_type;
 /* the default is set to IO_NETMAP */
 #define IO_DEFAULT		IO_NETMAP
@@ -64,6 +67,9 @@ typedef TAILQ_HEAD(clist, CommNode) clist;
 typedef struct FilterContext FilterContext;
 /* FilterContext list declaration */
 typedef TAILQ_HEAD(fclist, FilterContext) fclist;
+
+/* Declaring dispatch_plan struct */
+struct dispatch_plan;
 /*---------------------------------------------------------------------*/
 /**
  *
@@ -76,7 +82,8 @@ typedef TAILQ_HEAD(fclist, FilterContext) fclist;
 /*---------------------------------------------------------------------*/
 typedef struct engine {
 	uint8_t run; 			/* the engine mode running/stopped */
-	io_type iot;			/* type: currently only supports netmap */
+	io_type iot;			/* type: netmap, pcap file, AF_PACKET or AF_XDP */
+	char *io_args;			/* I/O module options ("<io_type>:<args>") */
 	uint8_t *name;			/* the engine name will be used as an identifier */
 	int8_t cpu;			/* the engine thread will be affinitized to this cpu */
 	uint64_t byte_count;		/* total number of bytes seen by this engine */
@@ -89,9 +96,9 @@ typedef struct engine {
 	struct engine_src **esrc;	/* list of sources connected to the engine */
 	pthread_t t;			/* thread context */
 	uint no_of_sources;		/* no. of engine sources */
-	uint8_t mark_for_copy;		/* marking for copy */
 	int32_t buffer_sz;		/* buffer sizes in between each brick */
 	void *pcapr_context;		/* private_context for pcap reading */
+	struct dispatch_plan *plan;	/* flattened brick tree (see dispatch_plan.h) */
 
 	/* the commnode list that shall be referred to by netmodule */
 	clist commnode_list;
@@ -141,7 +148,18 @@ typedef struct engine_src {
 void
 pktengine_new(const unsigned char *name, 
 	      const int32_t buffer_sz,
-	      const int8_t cpu);
+	      const int8_t cpu,
+	      const io_type iot,
+	      const char *io_args);
+
+/**
+ * Returns the io_type that goes by the given name ("netmap", "file",
+ * "synth", "linux", "xdp")
+ * or -1 if the name is unknown. NULL stands for the default. Anything
+ * after a ':' is left to the I/O module (see engine->io_args).
+ */
+int32_t
+pktengine_io_type(const char *name);
 
 /**
  * Deletes the pkt_engine
@@ -186,6 +204,12 @@ pktengine_stop(const unsigned char *name);
 void
 pktengine_dump_stats(const unsigned char *name);
 
+/**
+ * Print the compiled dispatch plan of the engine
+ */
+void
+pktengine_show_plan(const unsigned char *name);
+
 /**
  * Print all engines' traffic stats to the given file object
  */
@@ -36,6 +36,10 @@
 /*---------------------------------------------------------------------*/
 /* for type def'n */
 #include <stdint.h>
+/* for NULL */
+#include <stddef.h>
+/* for IPPROTO_* */
+#include <netinet/in.h>
 /*---------------------------------------------------------------------*/
 /* Enable this macro if you want a trivial version of the hash */
 /* It only parses till the IP header */
@@ -68,13 +72,110 @@ typedef struct vlanhdr {
 	uint16_t proto;
 } vlanhdr;
 /*---------------------------------------------------------------------*/
+/* longest IPv6 extension header chain that is walked */
+#define IPV6_MAX_EXT_HDRS	8
+#define IPV6_HDR_LEN		40
+/**
+ * Walks the extension headers (hop-by-hop, routing, fragment,
+ * destination options, AH) that follow the IPv6 header at ip6h.
+ * Sets *proto to the upper-layer protocol and returns a pointer to its
+ * header. Nothing at or past the end of the IPv6 payload or end (the
+ * end of the frame, if not NULL) is read. Returns NULL if that header
+ * is not in this packet (a non-first fragment, or the payload ends
+ * first) or if the chain is longer than IPV6_MAX_EXT_HDRS.
+ * If frag is not NULL, *frag is set when a fragment header was seen.
+ */
+static inline const uint8_t *
+ipv6_skip_ext_hdrs(const uint8_t *ip6h, const uint8_t *end, uint8_t *proto,
+		   int *frag)
+{
+	const uint8_t *p = ip6h + IPV6_HDR_LEN;
+	const uint8_t *lim = p + ((ip6h[4] << 8) | ip6h[5]);
+	uint8_t nxt = ip6h[6];
+	long hlen;
+	int i;
+
+	if (end != NULL && end < lim)
+		lim = end;
+	if (frag != NULL)
+		*frag = 0;
+	for (i = 0; i < IPV6_MAX_EXT_HDRS; i++) {
+		/* every extension header is at least 8 bytes long */
+		switch (nxt) {
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+			if (lim - p < 8)
+				goto cut;
+			hlen = (p[1] + 1) << 3;
+			break;
+		case IPPROTO_AH:
+			if (lim - p < 8)
+				goto cut;
+			hlen = (p[1] + 2) << 2;
+			break;
+		case IPPROTO_FRAGMENT:
+			if (lim - p < 8)
+				goto cut;
+			if (frag != NULL)
+				*frag = 1;
+			/* only the first fragment carries the L4 header */
+			if (((p[2] << 8) | p[3]) & 0xFFF8) {
+				*proto = p[0];
+				return NULL;
+			}
+			hlen = 8;
+			break;
+		default:
+			*proto = nxt;
+			return (p < lim) ? p : NULL;
+		}
+		if (lim - p < hlen)
+			goto cut;
+		nxt = p[0];
+		p += hlen;
+	}
+	*proto = nxt;
+	return NULL;
+
+ cut:
+	/* a header runs past the end of the payload */
+	*proto = IPPROTO_NONE;
+	return NULL;
+}
+/*---------------------------------------------------------------------*/
 /**
  * Analyzes the packet header of computes a corresponding 
- * hash function.
+ * hash function. len is the number of bytes captured.
  */
 uint32_t
 pkt_hdr_hash(const unsigned char *buffer,
+	     uint32_t len,
 	     uint8_t hash_split,
 	     uint8_t seed);
+
+/**
+ * Same as pkt_hdr_hash(), but on the innermost IP header of tunneled
+ * (IPIP, GRE, VXLAN, GTP-U), MPLS and VLAN/QinQ tagged traffic.
+ */
+uint32_t
+pkt_inner_hdr_hash(const unsigned char *buffer,
+		   uint32_t len,
+		   uint8_t hash_split,
+		   uint8_t seed);
+
+/* VLAN ID that pkt_flow_key() uses for untagged frames */
+#define FLOW_VLAN_NONE		0xFFFF
+/**
+ * 64-bit key of the flow of the frame (len bytes captured), for flow
+ * tables: the hash of pkt_hdr_hash() has far less entropy. VLAN ID,
+ * ethertype, IP addresses, protocol and (unless hash_split is 2) the
+ * TCP/UDP/SCTP ports count. Both directions of a flow get the same
+ * key. Nothing past buffer + len is read.
+ */
+uint64_t
+pkt_flow_key(const unsigned char *buffer,
+	     uint32_t len,
+	     uint8_t hash_split);
 /*---------------------------------------------------------------------*/
 #endif /* __PKT_HASH__ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SYNTH_MODULE_H__
+#define __SYNTH_MODULE_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for engine definition */
+#include "pkt_engine.h"
+/* for CommNode definition */
+#include "netmap_module.h"
+/*---------------------------------------------------------------------*/
+/* kinds of synthetic frames */
+enum synth_kind {
+	SYNTH_IPV4,				/* TCP/UDP over IPv4 */
+	SYNTH_IPV6,				/* TCP/UDP over IPv6 */
+	SYNTH_VLAN,				/* 802.1Q tagged TCP/UDP over IPv4 */
+	SYNTH_IPIP,				/* TCP/UDP over IPv4-in-IPv4 */
+	SYNTH_KINDS
+};
+/* max. no. of distinct frame sizes in a profile */
+#define SYNTH_MAX_SIZES			16
+/*---------------------------------------------------------------------*/
+/**
+ * Traffic profile, parsed from the I/O options of the engine, e.g.
+ * PktEngine.new("e0", 1024, -1, "synth:flows=4096,zipf=1.1,
+ * mix=ipv4:70/ipv6:20/vlan:5/ipip:5,size=64:60/576:25/1514:15")
+ */
+typedef struct synth_profile {
+	uint32_t flows;				/* no. of distinct flows */
+	double zipf;				/* flow size skew (0: uniform) */
+	uint32_t mix[SYNTH_KINDS];		/* weight of each frame kind */
+	uint8_t udp;				/* % of UDP flows */
+	uint8_t size_count;			/* no. of frame sizes */
+	uint16_t sizes[SYNTH_MAX_SIZES];	/* frame sizes */
+	uint32_t size_weights[SYNTH_MAX_SIZES];	/* weight of each size */
+	uint64_t count;				/* pkts to generate (0: no limit) */
+	uint64_t seed;				/* PRNG seed */
+} synth_profile;
+
+/**
+ * Private per-source context of the synthetic traffic module. Frames
+ * are built once, when the source is linked, into a pool that already
+ * follows the profile; bursts are then handed out of the pool in a
+ * round-robin fashion. Packets that reach netmap pipes are counted and
+ * thrown away (null sink) so that only the brick tree is measured.
+ */
+typedef struct synth_module_context {
+	uint8_t *area;				/* frame storage of the pool */
+	unsigned char **pkts;			/* frames in replay order */
+	uint32_t *lens;				/* lengths of the frames */
+	uint32_t pool_size;			/* no. of frames in the pool */
+	uint32_t cur;				/* next frame to hand out */
+	uint64_t count;				/* pkts to generate (0: no limit) */
+	uint64_t sent;				/* pkts generated so far */
+	uint64_t sunk;				/* pkts that reached the null sink */
+	uint64_t cycles;			/* time spent in the brick tree */
+	uint64_t start_ns;			/* time of the first burst */
+	uint64_t last_ns;			/* time of the latest burst */
+	int32_t evfd[2];			/* pipe kept readable till done */
+	uint16_t batch_size;			/* burst size */
+	engine *eng;				/* ptr to host engine */
+} synth_module_context __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/* no. of frames pre-built per source */
+#define SYNTH_POOL_PKTS			16384
+/* bursts generated per engine wake-up */
+#define SYNTH_BURSTS			16
+/* defaults of the traffic profile */
+#define SYNTH_DEF_FLOWS			1024
+#define SYNTH_DEF_SIZE			64
+/* min./max. frame sizes (without FCS) */
+#define SYNTH_MIN_FRAME			60
+#define SYNTH_MAX_FRAME			1514
+/*---------------------------------------------------------------------*/
+#endif /* !__SYNTH_MODULE_H__ */
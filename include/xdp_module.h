@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __XDP_MODULE_H__
+#define __XDP_MODULE_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/* for engine definition */
+#include "pkt_engine.h"
+/* for CommNode definition */
+#include "netmap_module.h"
+/* for AF_XDP decls */
+#include <linux/if_xdp.h>
+/* for xdp_iface_context */
+#include "xdp_prog.h"
+/*---------------------------------------------------------------------*/
+#ifndef AF_XDP
+#define AF_XDP				44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP				283
+#endif
+/*---------------------------------------------------------------------*/
+/**
+ * One of the four mmap()ed rings of an AF_XDP socket (RX, TX, fill or
+ * completion). Producer/consumer indices are free-running; cached_*
+ * hold the last values read from the kernel-owned side.
+ */
+struct xdp_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;				/* xdp_desc[] or uint64_t[] */
+	uint32_t mask;
+	void *map;				/* mmap()ed area */
+	size_t map_len;
+};
+
+/**
+ * Packet buffer memory (UMEM) shared by all AF_XDP sockets of an
+ * engine: its RX sockets (one per source) as well as the tx sockets of
+ * its output channels. A frame that goes out on several channels is
+ * refcounted and only returns to the free stack after the last tx
+ * completion, so packets are never copied in userland.
+ */
+typedef struct xdp_umem {
+	uint8_t *area;				/* frame memory */
+	size_t size;				/* size of area */
+	int32_t fd;				/* socket the UMEM is registered on */
+	uint16_t *refcnt;			/* per-frame tx references */
+	uint64_t *free_frames;			/* stack of free frame addrs */
+	uint32_t free_cnt;			/* # of frames on the stack */
+	uint32_t users;				/* # of sockets using it */
+} xdp_umem __attribute__((aligned(__WORDSIZE)));
+
+/**
+ * Private per-source AF_XDP module context. Each source is one XSK
+ * bound to one (interface, queue) pair.
+ */
+typedef struct xdp_module_context {
+	int32_t fd;				/* AF_XDP socket */
+	struct xdp_ring rx;			/* RX ring */
+	struct xdp_ring fq;			/* fill ring */
+	struct xdp_ring cq;			/* completion ring (unused) */
+	xdp_umem *umem;				/* shared packet memory */
+	uint16_t batch_size;			/* burst size */
+	uint8_t zerocopy;			/* bound in zero-copy mode */
+	char ifname[IFNAMSIZ];			/* interface of the source */
+	engine *eng;				/* ptr to host engine */
+} xdp_module_context __attribute__((aligned(__WORDSIZE)));
+
+/**
+ * Output side of a CommNode (hung off cn->out_ctx). A tx-only XSK
+ * bound to the output interface on the engine's UMEM.
+ */
+typedef struct xdp_channel {
+	int32_t fd;				/* AF_XDP socket (-1: none) */
+	struct xdp_ring tx;			/* TX ring */
+	struct xdp_ring fq;			/* fill ring (left empty) */
+	struct xdp_ring cq;			/* completion ring */
+	uint32_t outstanding;			/* # of frames not completed */
+} xdp_channel __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/* UMEM geometry: 8K frames of 2KB */
+#define XDP_FRAME_SIZE			2048
+#define XDP_NUM_FRAMES			8192
+/* # of descriptors in each ring */
+#define XDP_RING_SIZE			2048
+/*---------------------------------------------------------------------*/
+#endif /* !__XDP_MODULE_H__ */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __XDP_PROG_H__
+#define __XDP_PROG_H__
+/*---------------------------------------------------------------------*/
+/* for data types */
+#include <stdint.h>
+/*---------------------------------------------------------------------*/
+/**
+ * eBPF side of the AF_XDP module. It is kept apart from xdp_module.c
+ * since <linux/bpf.h> and <pcap/pcap.h> both define struct bpf_insn.
+ */
+/*---------------------------------------------------------------------*/
+/**
+ * System-wide AF_XDP-specific iface context. The XDP program attached
+ * to the interface redirects each queue to the XSK registered for it
+ * in the XSKMAP.
+ */
+typedef struct xdp_iface_context {
+	int32_t map_fd;				/* XSKMAP (queue -> XSK) */
+	int32_t prog_fd;			/* redirecting XDP program */
+	int32_t link_fd;			/* bpf link holding the program */
+	uint8_t generic;			/* attached in generic (skb) mode */
+} xdp_iface_context __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/**
+ * Loads the redirecting program and attaches it to ifindex; native
+ * (driver) mode is tried first, generic mode works on any interface.
+ * Returns -1 (with errno set) on failure.
+ */
+int32_t
+xdp_prog_attach(xdp_iface_context *xic, uint32_t ifindex);
+
+/**
+ * Points queue of the interface to the XSK fd.
+ */
+int32_t
+xdp_prog_set_queue(xdp_iface_context *xic, uint32_t queue, int32_t fd);
+
+/**
+ * Detaches the program and releases the map.
+ */
+void
+xdp_prog_detach(xdp_iface_context *xic);
+/*---------------------------------------------------------------------*/
+/* max. # of queues per interface (XSKMAP size) */
+#define XDP_MAX_QUEUES			64
+/*---------------------------------------------------------------------*/
+#endif /* !__XDP_PROG_H__ */
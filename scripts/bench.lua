@@ -0,0 +1,83 @@
+-- /usr/bin/lua
+---------------------- BENCHMARK SCRIPT -------------------------------
+-- directory of this script (the bricks-scripts directory)
+scriptdir = string.match(debug.getinfo(1, "S").source, "^@(.*/)") or "./"
+-- contains utility functions and macros
+utilObj = dofile(scriptdir .. "utils.lua")
+-- contains example setup scripts
+sampleSetup = dofile(scriptdir .. "configs/single-threaded-setups.lua")
+-----------------------------------------------------------------------
+BENCH_SECS_DEFAULT = 10
+-----------------------------------------------------------------------
+-- B E N C H M A R K
+-----------------------------------------------------------------------
+--init function  __creates an engine that reads synthetic traffic__
+--		 __(see synth_module.h for the traffic options) and__
+--		 __sets up the brick graph to be measured. The graph__
+--		 __is either the name of a setup function of__
+--		 __configs/single-threaded-setups.lua (e.g. lb_config,__
+--		 __dup_config, lbfilt_config or lbmrg_config) or a Lua__
+--		 __file that returns a function(pe, int1, int2). Its__
+--		 __sources are called "syn0" and "syn1" and all its__
+--		 __outputs are null sinks.__
+
+function init(graph, opts)
+	 local pe = PktEngine.new("bench", BUFFER_SZ, NO_CPU_AFF, opts)
+	 if pe == nil then
+	    print 'Invalid synthetic traffic options'
+	    os.exit(-1)
+	 end
+
+	 if sampleSetup[graph] ~= nil then
+	    sampleSetup[graph](sampleSetup, pe, "syn0", "syn1")
+	 else
+	    local setup = dofile(graph)
+	    if type(setup) ~= "function" then
+	       print(graph .. ' does not return a setup function')
+	       os.exit(-1)
+	    end
+	    setup(pe, "syn0", "syn1")
+	 end
+	 pe:show_plan()
+end
+-----------------------------------------------------------------------
+--start function  __runs the engine for $secs seconds; the engine__
+--		  __prints Mpps and cycles/pkt when it stops__
+
+function start(secs)
+	 local pe = PktEngine.retrieve("bench")
+	 pe:start()
+	 os.execute("sleep " .. tostring(secs))
+	 pe:stop()
+	 pe:show_stats()
+end
+-----------------------------------------------------------------------
+
+
+
+
+
+
+
+
+
+
+
+-----------------------------------------------------------------------
+-- S T A R T _ OF _ S C R I P T
+-----------------------------------------------------------------------
+-- retrieve BRICKS_BENCH (graph, traffic options & duration)
+local args = lines_from("/tmp/bricks.bench")
+if args[1] == nil or args[1] == '' then
+   print 'Brick graph to benchmark does not exist'
+   os.exit(-1)
+end
+local opts = "synth"
+if args[2] ~= nil and args[2] ~= '' then
+   opts = "synth:" .. args[2]
+end
+
+init(args[1], opts)
+start(tonumber(args[3]) or BENCH_SECS_DEFAULT)
+os.exit(0)
+-----------------------------------------------------------------------
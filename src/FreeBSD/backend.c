@@ -62,10 +62,12 @@
 #include "pkt_hash.h"
 /* for install_filter */
 #include "netmap_module.h"
-#ifdef ENABLE_BROKER
 /* for filter */
 #include "bricks_filter.h"
-#endif
+/* for time() */
+#include <time.h>
+/* for dispatch plan */
+#include "dispatch_plan.h"
 /*---------------------------------------------------------------------*/
 /**
  * registers fd in the poll fd set
@@ -289,6 +291,14 @@ initiate_backend(engine *eng)
 		eng->pcapr_context = eng->FIRST_BRICK(esrc)->brick->private_data;		
 	}
 
+	/* flatten the brick tree into a dispatch plan */
+	dispatch_plan_free(eng->plan);
+	eng->plan = dispatch_plan_compile(eng);
+	if (eng->plan == NULL) {
+		TRACE_LOG("Engine %s could not compile its dispatch plan\n",
+			  eng->name);
+	}
+
 	/* register iom socket */
 	for (j = 0; j < eng->no_of_sources; j++) {
 		__register_fd(eng->esrc[j]->dev_fd, pollfd);
@@ -307,11 +317,14 @@ initiate_backend(engine *eng)
 	/* keep on running till engine stops */
 	while (eng->run == 1) {
 		/* pcap handling.. */
-		if (eng->pcapr_context != NULL)
+		if (eng->pcapr_context != NULL) {
+			EXPIRE_FILTERS(eng);
 			process_pcap_read_request(eng, eng->pcapr_context);
-		else { /* get input from interface */
+		} else { /* get input from interface */
 			int source_flag;
 			i = poll(pollfd, POLL_MAX_EVENTS, POLL_TIMEOUT);
+			/* filters expire on an idle engine too */
+			EXPIRE_FILTERS(eng);
 			
 			/* if no packet came up, try polling again */
 			if (i <= 0) continue;
@@ -0,0 +1,666 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *
+ * AF_PACKET (TPACKET_V3) I/O module. It lets an engine run on stock
+ * Linux kernels (and veth pairs) without netmap. Ingress packets are
+ * read out of a block-mapped RX ring and outgoing packets are passed to
+ * PF_PACKET sockets bound to the output interfaces.
+ *
+ */
+/* for io_module struct defn */
+#include "io_module.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for afpacket structs */
+#include "afpacket_module.h"
+/* for network_interface definition */
+#include "network_interface.h"
+/* for brick def'n */
+#include "brick.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
+/* for if_nametoindex() */
+#include <net/if.h>
+/* for ETH_P_ALL */
+#include <linux/if_ether.h>
+/* for htons() */
+#include <arpa/inet.h>
+/* for mmap() */
+#include <sys/mman.h>
+/* for gettimeofday() */
+#include <sys/time.h>
+/* for close() */
+#include <unistd.h>
+/* for errno */
+#include <errno.h>
+/* for string functions */
+#include <string.h>
+/*---------------------------------------------------------------------*/
+int32_t
+afpacket_init(void **ctxt_ptr, void *engptr)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_module_context *apc;
+
+	/* create afpacket context */
+	*ctxt_ptr = calloc(1, sizeof(afpacket_module_context));
+	apc = (afpacket_module_context *) (*ctxt_ptr);
+	if (*ctxt_ptr == NULL) {
+		TRACE_LOG("Can't allocate memory for afpacket context\n");
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	apc->fd = -1;
+	apc->eng = (engine *)engptr;
+	TRACE_AFPACKET_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Opens the PF_PACKET socket of the engine, sets up and maps its
+ * TPACKET_V3 RX ring and binds it to the interface. If fanout_id is
+ * non-negative, the socket joins that fanout group so that the flows
+ * of the interface are spread across all engines linked to it.
+ */
+static int32_t
+afpacket_open_rx(afpacket_module_context *apc, const char *iface,
+		 int32_t fanout_id)
+{
+	TRACE_AFPACKET_FUNC_START();
+	struct sockaddr_ll sll;
+	int32_t ver = TPACKET_V3;
+	int32_t fanout;
+	uint32_t ifindex;
+
+	ifindex = if_nametoindex(iface);
+	if (ifindex == 0) {
+		TRACE_LOG("Unable to find %s: %s\n", iface, strerror(errno));
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	apc->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (apc->fd == -1) {
+		TRACE_LOG("Unable to open packet socket for %s: %s\n",
+			  iface, strerror(errno));
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	if (setsockopt(apc->fd, SOL_PACKET, PACKET_VERSION,
+		       &ver, sizeof(ver)) == -1) {
+		TRACE_LOG("TPACKET_V3 is not supported: %s\n",
+			  strerror(errno));
+		goto open_rx_fail;
+	}
+
+	/* ring geometry */
+	memset(&apc->req, 0, sizeof(apc->req));
+	apc->req.tp_block_size = AFP_BLOCK_SIZE;
+	apc->req.tp_block_nr = AFP_BLOCK_NR;
+	apc->req.tp_frame_size = AFP_FRAME_SIZE;
+	apc->req.tp_frame_nr = (AFP_BLOCK_SIZE / AFP_FRAME_SIZE) * AFP_BLOCK_NR;
+	apc->req.tp_retire_blk_tov = AFP_BLOCK_TIMEOUT;
+	apc->req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+	if (setsockopt(apc->fd, SOL_PACKET, PACKET_RX_RING,
+		       &apc->req, sizeof(apc->req)) == -1) {
+		TRACE_LOG("Unable to set up RX ring for %s: %s\n",
+			  iface, strerror(errno));
+		goto open_rx_fail;
+	}
+
+	apc->map_len = (size_t)apc->req.tp_block_size * apc->req.tp_block_nr;
+	apc->map = mmap(NULL, apc->map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_LOCKED | MAP_POPULATE, apc->fd, 0);
+	if (apc->map == MAP_FAILED) {
+		/* MAP_LOCKED may fail due to RLIMIT_MEMLOCK, retry without */
+		apc->map = mmap(NULL, apc->map_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, apc->fd, 0);
+	}
+	if (apc->map == MAP_FAILED) {
+		TRACE_LOG("Unable to map RX ring for %s: %s\n",
+			  iface, strerror(errno));
+		apc->map = NULL;
+		goto open_rx_fail;
+	}
+	apc->cur_block = 0;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(apc->fd, (struct sockaddr *)&sll, sizeof(sll)) == -1) {
+		TRACE_LOG("Unable to bind to %s: %s\n",
+			  iface, strerror(errno));
+		goto open_rx_fail;
+	}
+
+	if (fanout_id >= 0) {
+		fanout = fanout_id | (AFP_FANOUT_MODE << 16);
+		if (setsockopt(apc->fd, SOL_PACKET, PACKET_FANOUT,
+			       &fanout, sizeof(fanout)) == -1) {
+			TRACE_LOG("Unable to join fanout group %d of %s: %s\n",
+				  fanout_id, iface, strerror(errno));
+			goto open_rx_fail;
+		}
+	}
+
+	TRACE_DEBUG_LOG("mapped %zuKB at %p for %s\n",
+			apc->map_len >> 10, apc->map, iface);
+	TRACE_AFPACKET_FUNC_END();
+	return apc->fd;
+
+ open_rx_fail:
+	if (apc->map != NULL)
+		munmap(apc->map, apc->map_len);
+	apc->map = NULL;
+	close(apc->fd);
+	apc->fd = -1;
+	TRACE_AFPACKET_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+afpacket_link_iface(void *ctxt, const unsigned char *iface,
+		    const uint16_t batchsize, int8_t qid)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_module_context *apc = (afpacket_module_context *)ctxt;
+	afpacket_iface_context *aic = NULL;
+
+	/* check if the interface has been registered with some other engine */
+	netiface *nif = interface_find((char *)iface);
+	if (nif == NULL) {
+		aic = calloc(1, sizeof(afpacket_iface_context));
+		if (aic == NULL) {
+			TRACE_ERR("Can't allocate memory for "
+				  "afpacket_iface_context (for %s)\n", iface);
+			TRACE_AFPACKET_FUNC_END();
+			return -1;
+		}
+		/* engines sharing the iface share its fanout group */
+		aic->fanout_id = if_nametoindex((char *)iface) & 0xFFFF;
+
+		/* create interface entry */
+		create_interface_entry(iface, (qid == -1) ? NO_QUEUES : HW_QUEUES,
+				       IO_LINUX, aic, apc->eng);
+	} else { /* otherwise check if that interface can be registered */
+		if (qid == -1) {
+			TRACE_LOG("Qid not given!!! "
+				  "Interface %s is set to read from H/W queues.",
+				  iface);
+			TRACE_AFPACKET_FUNC_END();
+			return -1;
+		}
+		/* its context is only an afpacket_iface_context if we made it */
+		if (nif->iot != IO_LINUX) {
+			TRACE_LOG("Interface %s is already linked to an engine "
+				  "of another I/O type\n", iface);
+			TRACE_AFPACKET_FUNC_END();
+			return -1;
+		}
+		aic = retrieve_and_register_interface_entry(iface, HW_QUEUES,
+							    IO_LINUX, apc->eng);
+		if (aic == NULL) {
+			TRACE_LOG("Error in linking ifname: %s to engine %s\n",
+				  iface, apc->eng->name);
+			TRACE_AFPACKET_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* setting batch size */
+	apc->batch_size = (batchsize == 0 || batchsize > PLAN_MAX_BURST) ?
+		PLAN_MAX_BURST : batchsize;
+
+	/* open handle */
+	if (afpacket_open_rx(apc, (const char *)iface,
+			     (qid == -1) ? -1 : aic->fanout_id) == -1) {
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	TRACE_AFPACKET_FUNC_END();
+	return apc->fd;
+}
+/*---------------------------------------------------------------------*/
+void
+afpacket_unlink_ifaces(void *engptr)
+{
+	TRACE_AFPACKET_FUNC_START();
+	engine *eng = (engine *)engptr;
+	afpacket_module_context *apc;
+	uint i;
+
+	for (i = 0; i < eng->no_of_sources; i++) {
+		apc = (afpacket_module_context *)eng->esrc[i]->private_context;
+		/* if the RX ring is still around, release it */
+		if (apc->map != NULL)
+			munmap(apc->map, apc->map_len);
+		if (apc->fd != -1)
+			close(apc->fd);
+		apc->map = NULL;
+		apc->fd = -1;
+	}
+
+	unregister_all_interfaces(eng);
+
+	TRACE_AFPACKET_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Writes the packets queued on a leaf to its pcap file.
+ * No packets should be dropped.
+ */
+static int32_t
+write_packets(CommNode *cn, plan_leaf *leaf,
+	      unsigned char **bufs, const uint32_t *lens)
+{
+	TRACE_AFPACKET_FUNC_START();
+	struct pcap_pkthdr phdr;
+	uint16_t k;
+
+	gettimeofday(&phdr.ts, NULL);
+	for (k = 0; k < leaf->n; k++) {
+		phdr.caplen = phdr.len = lens[leaf->pkts[k]];
+		pcap_dump((u_char *)cn->pdumper, &phdr, bufs[leaf->pkts[k]]);
+	}
+
+	TRACE_AFPACKET_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Transmits the packets queued on a leaf with one sendmmsg() call.
+ * The kernel copies every packet, so leaves below a duplicating brick
+ * need no special handling here.
+ * Returns no. of packets that were dropped.
+ */
+static int32_t
+send_packets(CommNode *cn, plan_leaf *leaf,
+	     unsigned char **bufs, const uint32_t *lens)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_channel *ch = (afpacket_channel *)cn->out_ctx;
+	int32_t sent, rc;
+	uint16_t k;
+
+	/* nothing is attached to the other end */
+	if (ch == NULL || ch->fd == -1) {
+		TRACE_AFPACKET_FUNC_END();
+		return leaf->n;
+	}
+
+	for (k = 0; k < leaf->n; k++) {
+		ch->iov[k].iov_base = bufs[leaf->pkts[k]];
+		ch->iov[k].iov_len = lens[leaf->pkts[k]];
+	}
+
+	for (sent = 0; sent < leaf->n; sent += rc) {
+		rc = sendmmsg(ch->fd, &ch->msgs[sent], leaf->n - sent,
+			      MSG_DONTWAIT);
+		if (rc <= 0) {
+			TRACE_DEBUG_LOG("Giving up for now: %s\n",
+					strerror(errno));
+			break;
+		}
+	}
+
+	TRACE_AFPACKET_FUNC_END();
+	return leaf->n - sent;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Runs a burst of packets through the dispatch plan and passes the
+ * packets that end up on each touched leaf to that leaf's CommNode.
+ */
+static void
+flush_burst(dispatch_plan *dp, unsigned char **bufs, const uint32_t *lens,
+	    uint16_t n, engine *eng)
+{
+	TRACE_AFPACKET_FUNC_START();
+	plan_leaf *leaf;
+	CommNode *cn;
+	uint16_t i;
+
+	/* hand the whole burst to the brick tree */
+	dispatch_plan_run(dp, bufs, lens, n);
+
+	for (i = 0; i < dp->touched_count; i++) {
+		leaf = &dp->leaves[dp->touched[i]];
+		cn = leaf->cn;
+		if (cn->pdumper != NULL)
+			write_packets(cn, leaf, bufs, lens);
+		else
+			eng->pkt_dropped += send_packets(cn, leaf, bufs, lens);
+		leaf->n = 0;
+	}
+	dp->touched_count = 0;
+	TRACE_AFPACKET_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Walks all packets of a block that the kernel retired to userland.
+ * Packets are dispatched in bursts of apc->batch_size; the caller hands
+ * the block back only after the last burst has been flushed, since the
+ * bursts point straight into the block.
+ */
+static void
+process_block(afpacket_module_context *apc, struct tpacket_block_desc *pbd,
+	      engine *eng, dispatch_plan *dp)
+{
+	TRACE_AFPACKET_FUNC_START();
+	unsigned char *bufs[PLAN_MAX_BURST];
+	uint32_t lens[PLAN_MAX_BURST];
+	struct tpacket3_hdr *ppd;
+	struct sockaddr_ll *sll;
+	uint32_t i, num;
+	uint16_t n;
+
+	num = pbd->hdr.bh1.num_pkts;
+	ppd = (struct tpacket3_hdr *)((uint8_t *)pbd +
+				      pbd->hdr.bh1.offset_to_first_pkt);
+
+	for (i = 0, n = 0; i < num; i++) {
+		sll = (struct sockaddr_ll *)((uint8_t *)ppd +
+					     TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		/* only ingress traffic is of interest (as with netmap) */
+		if (sll->sll_pkttype != PACKET_OUTGOING) {
+			bufs[n] = (uint8_t *)ppd + ppd->tp_mac;
+			lens[n] = ppd->tp_snaplen;
+			__builtin_prefetch(bufs[n]);
+			eng->byte_count += ppd->tp_len;
+			eng->pkt_count++;
+			if (dp != NULL && ++n == apc->batch_size) {
+				flush_burst(dp, bufs, lens, n, eng);
+				n = 0;
+			}
+		}
+		ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+	}
+
+	if (dp != NULL && n != 0)
+		flush_burst(dp, bufs, lens, n, eng);
+	TRACE_AFPACKET_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+int32_t
+afpacket_callback(void *engsrcptr)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_module_context *apc;
+	struct tpacket_block_desc *pbd;
+	engine_src *engsrc;
+	engine *eng;
+	dispatch_plan *dp;
+	uint32_t i;
+
+	engsrc = (engine_src *)engsrcptr;
+	eng = (engine *)engsrc->brick->eng;
+	apc = (afpacket_module_context *)engsrc->private_context;
+
+	if (apc->map == NULL) {
+		TRACE_LOG("afpacket context was not properly initialized\n");
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	/* without a plan, packets are only counted */
+	dp = eng->plan;
+
+	/* consume at most one full turn of the ring */
+	for (i = 0; i < apc->req.tp_block_nr; i++) {
+		pbd = (struct tpacket_block_desc *)
+			(apc->map + (size_t)apc->cur_block * apc->req.tp_block_size);
+		if ((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			break;
+		__sync_synchronize();
+		process_block(apc, pbd, eng, dp);
+		/* retire the block: hand it back to the kernel */
+		__sync_synchronize();
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		apc->cur_block = (apc->cur_block + 1) % apc->req.tp_block_nr;
+	}
+
+	TRACE_AFPACKET_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+afpacket_shutdown(void *engptr)
+{
+	TRACE_AFPACKET_FUNC_START();
+	engine *eng = (engine *)engptr;
+	if (eng->run == 1) {
+		eng->run = 0;
+	} else {
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	TRACE_AFPACKET_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+afpacket_delete_all_channels(Brick *brick)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_channel *ch;
+	CommNode *cn = NULL;
+	uint32_t i;
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+
+	for (i = 0; i < lnd->count; i++) {
+		cn = (CommNode *)lnd->external_links[i];
+		ch = (afpacket_channel *)cn->out_ctx;
+		if (ch != NULL) {
+			if (ch->fd != -1)
+				close(ch->fd);
+			free(ch);
+			cn->out_ctx = NULL;
+		}
+		if (cn->pd != NULL || cn->pdumper) {
+			pcap_close(cn->pd);
+			pcap_dump_close(cn->pdumper);
+			cn->pd = NULL;
+			cn->pdumper = NULL;
+		}
+		if (cn->brick != NULL) {
+			afpacket_delete_all_channels(cn->brick);
+			cn->brick = NULL;
+		}
+		free(cn);
+	}
+
+	brick->elib->deinit(brick);
+	TRACE_AFPACKET_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Creates the tx side of a CommNode. If out_name is not a network
+ * interface (e.g. it only serves as the input of a pipelined brick),
+ * the channel has no socket and packets reaching it are dropped.
+ */
+static afpacket_channel *
+afpacket_open_tx(const char *out_name)
+{
+	TRACE_AFPACKET_FUNC_START();
+	struct sockaddr_ll sll;
+	afpacket_channel *ch;
+	uint32_t ifindex;
+	int32_t one = 1;
+	int i;
+
+	ch = calloc(1, sizeof(afpacket_channel));
+	if (ch == NULL) {
+		TRACE_AFPACKET_FUNC_END();
+		return NULL;
+	}
+	for (i = 0; i < PLAN_MAX_BURST; i++) {
+		ch->msgs[i].msg_hdr.msg_iov = &ch->iov[i];
+		ch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	ch->fd = -1;
+
+	ifindex = if_nametoindex(out_name);
+	if (ifindex == 0) {
+		TRACE_LOG("%s is not a network interface, packets reaching "
+			  "it will be dropped\n", out_name);
+		TRACE_AFPACKET_FUNC_END();
+		return ch;
+	}
+
+	/* protocol 0: the socket never receives anything */
+	ch->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (ch->fd == -1) {
+		TRACE_LOG("Unable to open packet socket for %s: %s\n",
+			  out_name, strerror(errno));
+		TRACE_AFPACKET_FUNC_END();
+		return ch;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifindex;
+	if (bind(ch->fd, (struct sockaddr *)&sll, sizeof(sll)) == -1) {
+		TRACE_LOG("Unable to bind to %s: %s\n",
+			  out_name, strerror(errno));
+		close(ch->fd);
+		ch->fd = -1;
+		TRACE_AFPACKET_FUNC_END();
+		return ch;
+	}
+
+	/* skip the qdisc layer if the kernel allows it */
+	if (setsockopt(ch->fd, SOL_PACKET, PACKET_QDISC_BYPASS,
+		       &one, sizeof(one)) == -1)
+		TRACE_DEBUG_LOG("qdisc bypass is not available for %s\n",
+				out_name);
+
+	TRACE_AFPACKET_FUNC_END();
+	return ch;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+afpacket_create_channel(char *in_name, char *out_name,
+			Target t, void *esrcptr)
+{
+	TRACE_AFPACKET_FUNC_START();
+	afpacket_channel *ch;
+	int32_t fd;
+	engine *eng;
+	CommNode *cn;
+	linkdata *lnd;
+	engine_src *esrc;
+	Brick *brick;
+
+	fd = -1;
+	esrc = (engine_src *)esrcptr;
+	brick = esrc->brick;
+	eng = (engine *)brick->eng;
+
+	lnd = (linkdata *)(&brick->lnd);
+	/* first locate the source */
+	if (strcmp((char *)lnd->ifname, in_name) != 0) {
+		brick = enable_pipeline(brick, in_name, t, out_name);
+		if (brick == NULL) {
+			TRACE_LOG("Pipelining failed!! Could not find an appropriate "
+				  "source (%s) for engine %s!\n", in_name, eng->name);
+			TRACE_AFPACKET_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* reinitialize lnd if brick is reset */
+	lnd = (linkdata *)(&brick->lnd);
+
+	/* create a comm. interface */
+	lnd->external_links[lnd->init_cur_idx] = calloc(1, sizeof(CommNode));
+	if (lnd->external_links[lnd->init_cur_idx] == NULL) {
+		TRACE_ERR("Can't allocate mem for destInfo[%d] for engine %s\n",
+			  lnd->init_cur_idx, eng->name);
+		TRACE_AFPACKET_FUNC_END();
+		return -1;
+	}
+
+	cn = (CommNode *)lnd->external_links[lnd->init_cur_idx];
+
+	if (t == WRITE) {
+		TRACE_LOG("Creating pcap writing element %p to file: %s\n",
+			  brick, out_name);
+		cn->pd = pcap_open_dead(DLT_EN10MB, ETH_FRAME_LEN);
+		cn->pdumper = (cn->pd == NULL) ? NULL :
+			pcap_dump_open(cn->pd, out_name);
+		if (cn->pdumper == NULL) {
+			TRACE_LOG("Can't open %s for writing: %s\n", out_name,
+				  (cn->pd == NULL) ? "no pcap handle" :
+				  pcap_geterr(cn->pd));
+			goto create_channel_fail;
+		}
+		fd = 0;
+	} else {
+		ch = afpacket_open_tx(out_name);
+		if (ch == NULL) {
+			TRACE_LOG("Can't allocate tx channel for %s\n", out_name);
+			goto create_channel_fail;
+		}
+		cn->out_ctx = ch;
+		strcpy_with_reverse_pipe(cn->nm_ifname, out_name);
+		/* a channel without socket may still feed a pipelined brick */
+		fd = (ch->fd == -1) ? 0 : ch->fd;
+	}
+
+	lnd->init_cur_idx++;
+	TRACE_LOG("Created %s interface\n", out_name);
+
+	TRACE_AFPACKET_FUNC_END();
+	return fd;
+
+ create_channel_fail:
+	/* drop the half-built link */
+	if (cn->pd != NULL)
+		pcap_close(cn->pd);
+	free(cn);
+	lnd->external_links[lnd->init_cur_idx] = NULL;
+	TRACE_AFPACKET_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+io_module_funcs afpacket_module = {
+	.init_context  		= 	afpacket_init,
+	.link_iface		= 	afpacket_link_iface,
+	.unlink_ifaces		= 	afpacket_unlink_ifaces,
+	.callback		= 	afpacket_callback,
+	.create_external_link 	=	afpacket_create_channel,
+	.delete_all_channels 	=	afpacket_delete_all_channels,
+	.shutdown		= 	afpacket_shutdown,
+};
+/*---------------------------------------------------------------------*/
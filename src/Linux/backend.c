@@ -55,6 +55,12 @@
 #include "lua_interpreter.h"
 /* for inet_addr */
 #include <arpa/inet.h>
+/* for dispatch plan */
+#include "dispatch_plan.h"
+/* for expire_filters() */
+#include "bricks_filter.h"
+/* for time() */
+#include <time.h>
 /*---------------------------------------------------------------------*/
 int
 connect_to_bricks_server(char *rshell_args)
@@ -405,6 +411,14 @@ initiate_backend(engine *eng)
 	if (!strcmp(eng->FIRST_BRICK(esrc)->brick->elib->getId(), "PcapReader")) {
 		eng->pcapr_context = eng->FIRST_BRICK(esrc)->brick->private_data;		
 	}
+
+	/* flatten the brick tree into a dispatch plan */
+	dispatch_plan_free(eng->plan);
+	eng->plan = dispatch_plan_compile(eng);
+	if (eng->plan == NULL) {
+		TRACE_LOG("Engine %s could not compile its dispatch plan\n",
+			  eng->name);
+	}
 	
 	/* register iom socket */
 	for (i = 0; i < eng->no_of_sources; i++) {
@@ -428,6 +442,7 @@ initiate_backend(engine *eng)
 				  eng->name);
 			TRACE_BACKEND_FUNC_END();
 		}
+		EXPIRE_FILTERS(eng);
 		for (n = 0; n < nfds; n++) {
 			/* process dev work (check for all devs) */
 			for (i = 0; i < eng->no_of_sources; i++) {
@@ -500,6 +515,14 @@ initiate_backend(engine *eng)
 		eng->pcapr_context = eng->FIRST_BRICK(esrc)->brick->private_data;		
 	}
 
+	/* flatten the brick tree into a dispatch plan */
+	dispatch_plan_free(eng->plan);
+	eng->plan = dispatch_plan_compile(eng);
+	if (eng->plan == NULL) {
+		TRACE_LOG("Engine %s could not compile its dispatch plan\n",
+			  eng->name);
+	}
+
 	/* register iom socket */
 	for (i = 0; i < eng->no_of_sources; i++) {
 		pollfd[polli].fd = eng->esrc[i]->dev_fd;
@@ -511,10 +534,13 @@ initiate_backend(engine *eng)
 	/* keep on running till engine stops */
 	while (eng->run == 1) {
 		/* pcap handling.. */
-		if (eng->pcapr_context != NULL)
+		if (eng->pcapr_context != NULL) {
+			EXPIRE_FILTERS(eng);
 			process_pcap_read_request(eng, eng->pcapr_context);
-		else { /* get input from interface */
+		} else { /* get input from interface */
 			i = poll(pollfd, polli+1, 2500);
+			/* filters expire on an idle engine too */
+			EXPIRE_FILTERS(eng);
 			
 			/* if no packet came up, try polling again */
 			if (i <= 0) continue;
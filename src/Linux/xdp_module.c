@@ -0,0 +1,925 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *
+ * AF_XDP I/O module. Every engine source is an XSK bound to one
+ * (interface, queue) pair; a small XDP program attached to the
+ * interface redirects each queue to its XSK through an XSKMAP. All
+ * sockets of an engine share a single UMEM, so the brick tree works on
+ * the RX frames in place and output channels transmit those very
+ * frames. Sockets are bound in zero-copy mode when the driver supports
+ * it and in copy mode otherwise (e.g. generic XDP on veth).
+ *
+ */
+/* for io_module struct defn */
+#include "io_module.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for xdp structs */
+#include "xdp_module.h"
+/* for network_interface definition */
+#include "network_interface.h"
+/* for brick def'n */
+#include "brick.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
+/* for MIN() */
+#include <sys/param.h>
+/* for if_nametoindex() */
+#include <net/if.h>
+/* for mmap() */
+#include <sys/mman.h>
+/* for gettimeofday() */
+#include <sys/time.h>
+/* for close() */
+#include <unistd.h>
+/* for errno */
+#include <errno.h>
+/* for string functions */
+#include <string.h>
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_init(void **ctxt_ptr, void *engptr)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_module_context *xmc;
+
+	/* create xdp context */
+	*ctxt_ptr = calloc(1, sizeof(xdp_module_context));
+	xmc = (xdp_module_context *) (*ctxt_ptr);
+	if (*ctxt_ptr == NULL) {
+		TRACE_LOG("Can't allocate memory for xdp context\n");
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+
+	xmc->fd = -1;
+	xmc->eng = (engine *)engptr;
+	TRACE_XDP_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Attaches the redirecting XDP program to iface.
+ */
+static xdp_iface_context *
+xdp_attach_iface(const char *iface)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_iface_context *xic;
+	uint32_t ifindex;
+
+	ifindex = if_nametoindex(iface);
+	if (ifindex == 0) {
+		TRACE_LOG("Unable to find %s: %s\n", iface, strerror(errno));
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+
+	xic = calloc(1, sizeof(xdp_iface_context));
+	if (xic == NULL) {
+		TRACE_LOG("Can't allocate memory for xdp_iface_context "
+			  "(for %s)\n", iface);
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+
+	if (xdp_prog_attach(xic, ifindex) == -1) {
+		TRACE_LOG("Unable to attach XDP program to %s: %s\n",
+			  iface, strerror(errno));
+		free(xic);
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+
+	TRACE_LOG("Attached XDP program to %s in %s mode\n", iface,
+		  (xic->generic) ? "generic" : "native");
+	TRACE_XDP_FUNC_END();
+	return xic;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Allocates the UMEM frames of an engine. All frames start out free.
+ */
+static xdp_umem *
+xdp_umem_create()
+{
+	TRACE_XDP_FUNC_START();
+	xdp_umem *umem;
+	uint32_t i;
+
+	umem = calloc(1, sizeof(xdp_umem));
+	if (umem == NULL) {
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+	umem->fd = -1;
+	umem->size = (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	umem->area = mmap(NULL, umem->size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	umem->refcnt = calloc(XDP_NUM_FRAMES, sizeof(uint16_t));
+	umem->free_frames = calloc(XDP_NUM_FRAMES, sizeof(uint64_t));
+	if (umem->area == MAP_FAILED || umem->refcnt == NULL ||
+	    umem->free_frames == NULL) {
+		if (umem->area != MAP_FAILED)
+			munmap(umem->area, umem->size);
+		free(umem->refcnt);
+		free(umem->free_frames);
+		free(umem);
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+
+	for (i = 0; i < XDP_NUM_FRAMES; i++)
+		umem->free_frames[umem->free_cnt++] =
+			(uint64_t)(XDP_NUM_FRAMES - 1 - i) * XDP_FRAME_SIZE;
+
+	TRACE_XDP_FUNC_END();
+	return umem;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Drops a socket's hold on the UMEM; the frames go away with the last.
+ */
+static void
+xdp_umem_put(xdp_umem *umem)
+{
+	TRACE_XDP_FUNC_START();
+	if (umem == NULL || (umem->users != 0 && --umem->users != 0)) {
+		TRACE_XDP_FUNC_END();
+		return;
+	}
+	munmap(umem->area, umem->size);
+	free(umem->refcnt);
+	free(umem->free_frames);
+	free(umem);
+	TRACE_XDP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Releases one reference to the frame holding addr. Frames that no tx
+ * channel refers to go straight back to the free stack.
+ */
+static inline void
+frame_put(xdp_umem *umem, uint64_t addr)
+{
+	uint32_t idx = addr / XDP_FRAME_SIZE;
+
+	if (umem->refcnt[idx] == 0 || --umem->refcnt[idx] == 0)
+		umem->free_frames[umem->free_cnt++] =
+			(uint64_t)idx * XDP_FRAME_SIZE;
+}
+/*---------------------------------------------------------------------*/
+static int32_t
+xdp_map_ring(int32_t fd, struct xdp_ring *r, struct xdp_ring_offset *off,
+	     uint64_t pgoff, size_t desc_sz)
+{
+	TRACE_XDP_FUNC_START();
+	r->map_len = off->desc + XDP_RING_SIZE * desc_sz;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+	r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+	r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+	r->flags = (uint32_t *)((uint8_t *)r->map + off->flags);
+	r->desc = (uint8_t *)r->map + off->desc;
+	r->mask = XDP_RING_SIZE - 1;
+	TRACE_XDP_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static void
+xdp_unmap_ring(struct xdp_ring *r)
+{
+	if (r->map != NULL)
+		munmap(r->map, r->map_len);
+	r->map = NULL;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Opens an AF_XDP socket on umem and maps its rings. rx/tx select the
+ * descriptor rings the socket needs; every socket gets its own fill and
+ * completion ring, which the kernel requires for sockets that share a
+ * UMEM across queues or interfaces.
+ */
+static int32_t
+xdp_open_socket(xdp_umem *umem, struct xdp_ring *rx, struct xdp_ring *tx,
+		struct xdp_ring *fq, struct xdp_ring *cq)
+{
+	TRACE_XDP_FUNC_START();
+	struct xdp_mmap_offsets off;
+	struct xdp_umem_reg mr;
+	socklen_t optlen;
+	int32_t fd, ring_sz = XDP_RING_SIZE;
+
+	fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (fd == -1) {
+		TRACE_LOG("Unable to open AF_XDP socket: %s\n",
+			  strerror(errno));
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+
+	/* the first socket of the engine registers the UMEM */
+	if (umem->fd == -1) {
+		memset(&mr, 0, sizeof(mr));
+		mr.addr = (uint64_t)(unsigned long)umem->area;
+		mr.len = umem->size;
+		mr.chunk_size = XDP_FRAME_SIZE;
+		if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1) {
+			TRACE_LOG("Unable to register UMEM: %s\n",
+				  strerror(errno));
+			goto open_socket_fail;
+		}
+	}
+
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING,
+		       &ring_sz, sizeof(ring_sz)) == -1 ||
+	    setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+		       &ring_sz, sizeof(ring_sz)) == -1 ||
+	    (rx != NULL && setsockopt(fd, SOL_XDP, XDP_RX_RING,
+				      &ring_sz, sizeof(ring_sz)) == -1) ||
+	    (tx != NULL && setsockopt(fd, SOL_XDP, XDP_TX_RING,
+				      &ring_sz, sizeof(ring_sz)) == -1)) {
+		TRACE_LOG("Unable to size AF_XDP rings: %s\n",
+			  strerror(errno));
+		goto open_socket_fail;
+	}
+
+	optlen = sizeof(off);
+	if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1 ||
+	    xdp_map_ring(fd, fq, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+			 sizeof(uint64_t)) == -1 ||
+	    xdp_map_ring(fd, cq, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING,
+			 sizeof(uint64_t)) == -1 ||
+	    (rx != NULL && xdp_map_ring(fd, rx, &off.rx, XDP_PGOFF_RX_RING,
+					sizeof(struct xdp_desc)) == -1) ||
+	    (tx != NULL && xdp_map_ring(fd, tx, &off.tx, XDP_PGOFF_TX_RING,
+					sizeof(struct xdp_desc)) == -1)) {
+		TRACE_LOG("Unable to map AF_XDP rings: %s\n",
+			  strerror(errno));
+		goto open_socket_fail;
+	}
+
+	if (umem->fd == -1)
+		umem->fd = fd;
+	umem->users++;
+	TRACE_XDP_FUNC_END();
+	return fd;
+
+ open_socket_fail:
+	xdp_unmap_ring(fq);
+	xdp_unmap_ring(cq);
+	if (rx != NULL) xdp_unmap_ring(rx);
+	if (tx != NULL) xdp_unmap_ring(tx);
+	close(fd);
+	TRACE_XDP_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Binds an XSK to (ifindex, queue). The UMEM owner tries zero-copy
+ * first and falls back to copy mode; every other socket attaches to
+ * the owner's UMEM (and inherits its mode).
+ */
+static int32_t
+xdp_bind_socket(int32_t fd, xdp_umem *umem, uint32_t ifindex,
+		uint32_t queue, uint8_t *zerocopy)
+{
+	TRACE_XDP_FUNC_START();
+	struct sockaddr_xdp sxdp;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue;
+
+	if (umem->fd != fd) {
+		sxdp.sxdp_flags = XDP_SHARED_UMEM;
+		sxdp.sxdp_shared_umem_fd = umem->fd;
+		TRACE_XDP_FUNC_END();
+		return bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+	}
+
+	sxdp.sxdp_flags = XDP_ZEROCOPY;
+	if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0) {
+		*zerocopy = 1;
+		TRACE_XDP_FUNC_END();
+		return 0;
+	}
+	sxdp.sxdp_flags = XDP_COPY;
+	*zerocopy = 0;
+	TRACE_XDP_FUNC_END();
+	return bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Hands free frames to the kernel through the fill ring.
+ */
+static void
+refill_fq(struct xdp_ring *fq, xdp_umem *umem)
+{
+	uint32_t prod, cons, n, i;
+
+	prod = *fq->producer;
+	cons = __atomic_load_n(fq->consumer, __ATOMIC_ACQUIRE);
+	n = MIN(XDP_RING_SIZE - (prod - cons), umem->free_cnt);
+	for (i = 0; i < n; i++)
+		((uint64_t *)fq->desc)[(prod + i) & fq->mask] =
+			umem->free_frames[--umem->free_cnt];
+	__atomic_store_n(fq->producer, prod + n, __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Locates the UMEM of another source of the same engine, if any.
+ */
+static xdp_umem *
+find_engine_umem(xdp_module_context *xmc)
+{
+	TRACE_XDP_FUNC_START();
+	engine *eng = xmc->eng;
+	xdp_module_context *other;
+	uint i;
+
+	for (i = 0; i < eng->no_of_sources; i++) {
+		other = (xdp_module_context *)eng->esrc[i]->private_context;
+		if (other != NULL && other != xmc && other->umem != NULL) {
+			TRACE_XDP_FUNC_END();
+			return other->umem;
+		}
+	}
+	TRACE_XDP_FUNC_END();
+	return NULL;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_link_iface(void *ctxt, const unsigned char *iface,
+	       const uint16_t batchsize, int8_t qid)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_module_context *xmc = (xdp_module_context *)ctxt;
+	xdp_iface_context *xic = NULL;
+	uint32_t queue;
+
+	/* check if the interface has been registered with some other engine */
+	netiface *nif = interface_find((char *)iface);
+	if (nif == NULL) {
+		xic = xdp_attach_iface((const char *)iface);
+		if (xic == NULL) {
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+		/* create interface entry */
+		if (create_interface_entry(iface, (qid == -1) ? NO_QUEUES :
+					   HW_QUEUES, IO_XDP, xic,
+					   xmc->eng) == NULL) {
+			xdp_prog_detach(xic);
+			free(xic);
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+	} else { /* otherwise check if that interface can be registered */
+		if (qid == -1) {
+			TRACE_LOG("Qid not given!!! "
+				  "Interface %s is set to read from H/W queues.",
+				  iface);
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+		/* its context is only an xdp_iface_context if we made it */
+		if (nif->iot != IO_XDP) {
+			TRACE_LOG("Interface %s is already linked to an engine "
+				  "of another I/O type\n", iface);
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+		xic = retrieve_and_register_interface_entry(iface, HW_QUEUES,
+							    IO_XDP, xmc->eng);
+		if (xic == NULL) {
+			TRACE_LOG("Error in linking ifname: %s to engine %s\n",
+				  iface, xmc->eng->name);
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* without a qid the engine reads from the first queue */
+	queue = (qid == -1) ? 0 : qid;
+	if (queue >= XDP_MAX_QUEUES) {
+		TRACE_LOG("Queue %u of %s is out of range\n", queue, iface);
+		goto link_iface_fail;
+	}
+
+	/* setting batch size */
+	xmc->batch_size = (batchsize == 0 || batchsize > PLAN_MAX_BURST) ?
+		PLAN_MAX_BURST : batchsize;
+	strncpy(xmc->ifname, (const char *)iface, IFNAMSIZ - 1);
+
+	/* all sources of an engine share one UMEM */
+	xmc->umem = find_engine_umem(xmc);
+	if (xmc->umem == NULL)
+		xmc->umem = xdp_umem_create();
+	if (xmc->umem == NULL) {
+		TRACE_LOG("Can't allocate UMEM for engine %s\n",
+			  xmc->eng->name);
+		goto link_iface_fail;
+	}
+
+	/* open handle */
+	xmc->fd = xdp_open_socket(xmc->umem, &xmc->rx, NULL, &xmc->fq, &xmc->cq);
+	if (xmc->fd == -1) {
+		/* release the UMEM if it was created just now */
+		if (xmc->umem->users == 0)
+			xdp_umem_put(xmc->umem);
+		xmc->umem = NULL;
+		goto link_iface_fail;
+	}
+	if (xdp_bind_socket(xmc->fd, xmc->umem, if_nametoindex((char *)iface),
+			    queue, &xmc->zerocopy) == -1) {
+		TRACE_LOG("Unable to bind to %s (queue %u): %s\n",
+			  iface, queue, strerror(errno));
+		goto link_socket_fail;
+	}
+
+	/* steer the queue to the new socket */
+	if (xdp_prog_set_queue(xic, queue, xmc->fd) == -1) {
+		TRACE_LOG("Unable to register XSK for %s (queue %u): %s\n",
+			  iface, queue, strerror(errno));
+		goto link_socket_fail;
+	}
+	/* only now, so that the error paths have no frames to take back */
+	refill_fq(&xmc->fq, xmc->umem);
+
+	TRACE_LOG("%s (queue %u) bound in %s mode\n", iface, queue,
+		  (xmc->zerocopy) ? "zero-copy" : "copy");
+	TRACE_XDP_FUNC_END();
+	return xmc->fd;
+
+ link_socket_fail:
+	xdp_unmap_ring(&xmc->rx);
+	xdp_unmap_ring(&xmc->fq);
+	xdp_unmap_ring(&xmc->cq);
+	/* the UMEM outlives its owner socket only if others use it */
+	if (xmc->umem->fd == xmc->fd)
+		xmc->umem->fd = -1;
+	close(xmc->fd);
+	xdp_umem_put(xmc->umem);
+	xmc->fd = -1;
+	xmc->umem = NULL;
+ link_iface_fail:
+	/* the last engine on the iface takes the XDP program along */
+	nif = interface_find((char *)iface);
+	if (nif != NULL &&
+	    TAILQ_FIRST(&nif->registered_engines) == xmc->eng &&
+	    TAILQ_NEXT(xmc->eng, if_entry) == NULL)
+		xdp_prog_detach(xic);
+	unregister_interface_entry(iface, xmc->eng);
+	TRACE_XDP_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+void
+xdp_unlink_ifaces(void *engptr)
+{
+	TRACE_XDP_FUNC_START();
+	engine *eng = (engine *)engptr;
+	xdp_module_context *xmc;
+	xdp_iface_context *xic;
+	netiface *nif;
+	uint i;
+
+	for (i = 0; i < eng->no_of_sources; i++) {
+		xmc = (xdp_module_context *)eng->esrc[i]->private_context;
+		/* the last engine on an iface takes the XDP program along */
+		nif = interface_find(xmc->ifname);
+		if (nif != NULL &&
+		    TAILQ_FIRST(&nif->registered_engines) == eng &&
+		    TAILQ_NEXT(eng, if_entry) == NULL) {
+			xic = (xdp_iface_context *)nif->context;
+			xdp_prog_detach(xic);
+		}
+		if (xmc->fd != -1) {
+			xdp_unmap_ring(&xmc->rx);
+			xdp_unmap_ring(&xmc->fq);
+			xdp_unmap_ring(&xmc->cq);
+			close(xmc->fd);
+			xdp_umem_put(xmc->umem);
+		}
+		xmc->fd = -1;
+		xmc->umem = NULL;
+	}
+
+	unregister_all_interfaces(eng);
+
+	TRACE_XDP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Returns the frames that a tx channel has finished sending.
+ */
+static void
+reap_completions(xdp_channel *ch, xdp_umem *umem)
+{
+	uint32_t prod, cons;
+
+	cons = *ch->cq.consumer;
+	prod = __atomic_load_n(ch->cq.producer, __ATOMIC_ACQUIRE);
+	for (; cons != prod; cons++, ch->outstanding--)
+		frame_put(umem, ((uint64_t *)ch->cq.desc)[cons & ch->cq.mask]);
+	__atomic_store_n(ch->cq.consumer, cons, __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Kicks the kernel into sending what is on the tx ring. In copy mode
+ * each sendto() only drains a slice of the ring, so keep kicking for as
+ * long as the kernel makes progress.
+ */
+static void
+kick_tx(xdp_channel *ch)
+{
+	uint32_t prod, cons, last;
+
+	prod = *ch->tx.producer;
+	cons = __atomic_load_n(ch->tx.consumer, __ATOMIC_ACQUIRE);
+	do {
+		last = cons;
+		if (sendto(ch->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+			TRACE_DEBUG_LOG("tx kick failed: %s\n", strerror(errno));
+			return;
+		}
+		cons = __atomic_load_n(ch->tx.consumer, __ATOMIC_ACQUIRE);
+	} while (cons != prod && cons != last);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Writes the packets queued on a leaf to its pcap file.
+ * No packets should be dropped.
+ */
+static int32_t
+write_packets(CommNode *cn, plan_leaf *leaf,
+	      unsigned char **bufs, struct xdp_desc *descs)
+{
+	TRACE_XDP_FUNC_START();
+	struct pcap_pkthdr phdr;
+	uint16_t k;
+
+	gettimeofday(&phdr.ts, NULL);
+	for (k = 0; k < leaf->n; k++) {
+		phdr.caplen = phdr.len = descs[leaf->pkts[k]].len;
+		pcap_dump((u_char *)cn->pdumper, &phdr, bufs[leaf->pkts[k]]);
+	}
+
+	TRACE_XDP_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Places the RX descriptors queued on a leaf on the tx ring of its
+ * channel. The frames themselves are shared: each tx descriptor holds
+ * a reference that is dropped on completion.
+ * Returns no. of packets that were dropped due to a full tx ring.
+ */
+static int32_t
+send_packets(CommNode *cn, plan_leaf *leaf,
+	     struct xdp_desc *descs, xdp_umem *umem)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_channel *ch = (xdp_channel *)cn->out_ctx;
+	struct xdp_desc *d;
+	uint32_t prod, cons, n, k;
+
+	/* nothing is attached to the other end */
+	if (ch == NULL || ch->fd == -1) {
+		TRACE_XDP_FUNC_END();
+		return leaf->n;
+	}
+
+	prod = *ch->tx.producer;
+	cons = __atomic_load_n(ch->tx.consumer, __ATOMIC_ACQUIRE);
+	n = MIN(leaf->n, XDP_RING_SIZE - (prod - cons));
+	for (k = 0; k < n; k++) {
+		d = &((struct xdp_desc *)ch->tx.desc)[(prod + k) & ch->tx.mask];
+		*d = descs[leaf->pkts[k]];
+		umem->refcnt[d->addr / XDP_FRAME_SIZE]++;
+	}
+	__atomic_store_n(ch->tx.producer, prod + n, __ATOMIC_RELEASE);
+	ch->outstanding += n;
+
+	if (n != 0)
+		kick_tx(ch);
+
+	TRACE_XDP_FUNC_END();
+	return leaf->n - n;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_callback(void *engsrcptr)
+{
+	TRACE_XDP_FUNC_START();
+	unsigned char *bufs[PLAN_MAX_BURST];
+	struct xdp_desc descs[PLAN_MAX_BURST];
+	uint32_t lens[PLAN_MAX_BURST];
+	xdp_module_context *xmc;
+	engine_src *engsrc;
+	engine *eng;
+	dispatch_plan *dp;
+	plan_leaf *leaf;
+	xdp_umem *umem;
+	uint32_t prod, cons, n, i;
+
+	engsrc = (engine_src *)engsrcptr;
+	eng = (engine *)engsrc->brick->eng;
+	xmc = (xdp_module_context *)engsrc->private_context;
+	umem = xmc->umem;
+	dp = eng->plan;
+
+	if (xmc->fd == -1) {
+		TRACE_LOG("xdp context was not properly initialized\n");
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+
+	/* collect frames that went out since the last round */
+	for (i = 0; dp != NULL && i < dp->leaf_count; i++)
+		if (dp->leaves[i].cn->out_ctx != NULL &&
+		    ((xdp_channel *)dp->leaves[i].cn->out_ctx)->outstanding != 0)
+			reap_completions(dp->leaves[i].cn->out_ctx, umem);
+
+	cons = *xmc->rx.consumer;
+	prod = __atomic_load_n(xmc->rx.producer, __ATOMIC_ACQUIRE);
+	n = MIN(prod - cons, xmc->batch_size);
+	for (i = 0; i < n; i++) {
+		descs[i] = ((struct xdp_desc *)xmc->rx.desc)[(cons + i) & xmc->rx.mask];
+		bufs[i] = umem->area + descs[i].addr;
+		lens[i] = descs[i].len;
+		__builtin_prefetch(bufs[i]);
+		eng->byte_count += descs[i].len;
+		eng->pkt_count++;
+	}
+	__atomic_store_n(xmc->rx.consumer, cons + n, __ATOMIC_RELEASE);
+
+	if (dp != NULL && n != 0) {
+		/* hand the whole burst to the brick tree */
+		dispatch_plan_run(dp, bufs, lens, n);
+		for (i = 0; i < dp->touched_count; i++) {
+			leaf = &dp->leaves[dp->touched[i]];
+			if (leaf->cn->pdumper != NULL)
+				write_packets(leaf->cn, leaf, bufs, descs);
+			else
+				eng->pkt_dropped += send_packets(leaf->cn, leaf,
+								 descs, umem);
+			leaf->n = 0;
+		}
+		dp->touched_count = 0;
+	}
+
+	/* frames that were not sent anywhere are free again */
+	for (i = 0; i < n; i++)
+		if (umem->refcnt[descs[i].addr / XDP_FRAME_SIZE] == 0)
+			frame_put(umem, descs[i].addr);
+	refill_fq(&xmc->fq, umem);
+
+	TRACE_XDP_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_shutdown(void *engptr)
+{
+	TRACE_XDP_FUNC_START();
+	engine *eng = (engine *)engptr;
+	if (eng->run == 1) {
+		eng->run = 0;
+	} else {
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+
+	TRACE_XDP_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+xdp_delete_all_channels(Brick *brick)
+{
+	TRACE_XDP_FUNC_START();
+	engine *eng = (engine *)brick->eng;
+	xdp_module_context *xmc;
+	xdp_channel *ch;
+	CommNode *cn = NULL;
+	uint32_t i;
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+
+	xmc = (xdp_module_context *)eng->esrc[0]->private_context;
+	for (i = 0; i < lnd->count; i++) {
+		cn = (CommNode *)lnd->external_links[i];
+		ch = (xdp_channel *)cn->out_ctx;
+		if (ch != NULL) {
+			if (ch->fd != -1) {
+				xdp_unmap_ring(&ch->tx);
+				xdp_unmap_ring(&ch->fq);
+				xdp_unmap_ring(&ch->cq);
+				close(ch->fd);
+				xdp_umem_put(xmc->umem);
+			}
+			free(ch);
+			cn->out_ctx = NULL;
+		}
+		if (cn->pd != NULL || cn->pdumper) {
+			pcap_close(cn->pd);
+			pcap_dump_close(cn->pdumper);
+			cn->pd = NULL;
+			cn->pdumper = NULL;
+		}
+		if (cn->brick != NULL) {
+			xdp_delete_all_channels(cn->brick);
+			cn->brick = NULL;
+		}
+		free(cn);
+	}
+
+	brick->elib->deinit(brick);
+	TRACE_XDP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Creates the tx side of a CommNode: an XSK bound to the first queue of
+ * out_name on the engine's UMEM. If out_name is not a network interface
+ * (e.g. it only serves as the input of a pipelined brick), the channel
+ * has no socket and packets reaching it are dropped.
+ */
+static xdp_channel *
+xdp_open_tx(const char *out_name, xdp_umem *umem)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_channel *ch;
+	uint32_t ifindex;
+	uint8_t zc;
+
+	ch = calloc(1, sizeof(xdp_channel));
+	if (ch == NULL) {
+		TRACE_XDP_FUNC_END();
+		return NULL;
+	}
+	ch->fd = -1;
+
+	ifindex = if_nametoindex(out_name);
+	if (ifindex == 0) {
+		TRACE_LOG("%s is not a network interface, packets reaching "
+			  "it will be dropped\n", out_name);
+		TRACE_XDP_FUNC_END();
+		return ch;
+	}
+
+	ch->fd = xdp_open_socket(umem, NULL, &ch->tx, &ch->fq, &ch->cq);
+	if (ch->fd == -1) {
+		TRACE_XDP_FUNC_END();
+		return ch;
+	}
+	if (xdp_bind_socket(ch->fd, umem, ifindex, 0, &zc) == -1) {
+		TRACE_LOG("Unable to bind to %s: %s\n",
+			  out_name, strerror(errno));
+		xdp_unmap_ring(&ch->tx);
+		xdp_unmap_ring(&ch->fq);
+		xdp_unmap_ring(&ch->cq);
+		close(ch->fd);
+		xdp_umem_put(umem);
+		ch->fd = -1;
+	}
+
+	TRACE_XDP_FUNC_END();
+	return ch;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_create_channel(char *in_name, char *out_name,
+		   Target t, void *esrcptr)
+{
+	TRACE_XDP_FUNC_START();
+	xdp_module_context *xmc;
+	xdp_channel *ch;
+	int32_t fd;
+	engine *eng;
+	CommNode *cn;
+	linkdata *lnd;
+	engine_src *esrc;
+	Brick *brick;
+
+	fd = -1;
+	esrc = (engine_src *)esrcptr;
+	brick = esrc->brick;
+	eng = (engine *)brick->eng;
+	xmc = (xdp_module_context *)esrc->private_context;
+
+	lnd = (linkdata *)(&brick->lnd);
+	/* first locate the source */
+	if (strcmp((char *)lnd->ifname, in_name) != 0) {
+		brick = enable_pipeline(brick, in_name, t, out_name);
+		if (brick == NULL) {
+			TRACE_LOG("Pipelining failed!! Could not find an appropriate "
+				  "source (%s) for engine %s!\n", in_name, eng->name);
+			TRACE_XDP_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* reinitialize lnd if brick is reset */
+	lnd = (linkdata *)(&brick->lnd);
+
+	/* create a comm. interface */
+	lnd->external_links[lnd->init_cur_idx] = calloc(1, sizeof(CommNode));
+	if (lnd->external_links[lnd->init_cur_idx] == NULL) {
+		TRACE_ERR("Can't allocate mem for destInfo[%d] for engine %s\n",
+			  lnd->init_cur_idx, eng->name);
+		TRACE_XDP_FUNC_END();
+		return -1;
+	}
+
+	cn = (CommNode *)lnd->external_links[lnd->init_cur_idx];
+
+	if (t == WRITE) {
+		TRACE_LOG("Creating pcap writing element %p to file: %s\n",
+			  brick, out_name);
+		cn->pd = pcap_open_dead(DLT_EN10MB, ETH_FRAME_LEN);
+		cn->pdumper = (cn->pd == NULL) ? NULL :
+			pcap_dump_open(cn->pd, out_name);
+		if (cn->pdumper == NULL) {
+			TRACE_LOG("Can't open %s for writing: %s\n", out_name,
+				  (cn->pd == NULL) ? "no pcap handle" :
+				  pcap_geterr(cn->pd));
+			goto create_channel_fail;
+		}
+		fd = 0;
+	} else {
+		if (xmc->umem == NULL) {
+			TRACE_LOG("Engine %s has no UMEM to send from\n",
+				  eng->name);
+			goto create_channel_fail;
+		}
+		ch = xdp_open_tx(out_name, xmc->umem);
+		if (ch == NULL) {
+			TRACE_LOG("Can't allocate tx channel for %s\n", out_name);
+			goto create_channel_fail;
+		}
+		cn->out_ctx = ch;
+		strcpy_with_reverse_pipe(cn->nm_ifname, out_name);
+		/* a channel without socket may still feed a pipelined brick */
+		fd = (ch->fd == -1) ? 0 : ch->fd;
+	}
+
+	lnd->init_cur_idx++;
+	TRACE_LOG("Created %s interface\n", out_name);
+
+	TRACE_XDP_FUNC_END();
+	return fd;
+
+ create_channel_fail:
+	/* drop the half-built link */
+	if (cn->pd != NULL)
+		pcap_close(cn->pd);
+	free(cn);
+	lnd->external_links[lnd->init_cur_idx] = NULL;
+	TRACE_XDP_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+io_module_funcs xdp_module = {
+	.init_context  		= 	xdp_init,
+	.link_iface		= 	xdp_link_iface,
+	.unlink_ifaces		= 	xdp_unlink_ifaces,
+	.callback		= 	xdp_callback,
+	.create_external_link 	=	xdp_create_channel,
+	.delete_all_channels 	=	xdp_delete_all_channels,
+	.shutdown		= 	xdp_shutdown,
+};
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/* for xdp_iface_context */
+#include "xdp_prog.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for bpf syscall decls */
+#include <linux/bpf.h>
+/* for XDP_FLAGS_* */
+#include <linux/if_link.h>
+/* for offsetof() */
+#include <stddef.h>
+/* for syscall() */
+#include <sys/syscall.h>
+/* for close() */
+#include <unistd.h>
+/* for memset() */
+#include <string.h>
+/*---------------------------------------------------------------------*/
+static inline int32_t
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_prog_attach(xdp_iface_context *xic, uint32_t ifindex)
+{
+	TRACE_XDP_FUNC_START();
+	union bpf_attr attr;
+	uint32_t flags;
+	char license[] = "Dual BSD/GPL";
+	/* return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS); */
+	struct bpf_insn prog[] = {
+		{ .code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2,
+		  .src_reg = BPF_REG_1,
+		  .off = offsetof(struct xdp_md, rx_queue_index) },
+		{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+		  .src_reg = BPF_PSEUDO_MAP_FD },
+		{ .code = 0 },
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+		  .imm = XDP_PASS },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+
+	xic->map_fd = xic->prog_fd = xic->link_fd = -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(int32_t);
+	attr.max_entries = XDP_MAX_QUEUES;
+	xic->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (xic->map_fd == -1)
+		goto attach_fail;
+
+	prog[1].imm = xic->map_fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(unsigned long)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uint64_t)(unsigned long)license;
+	xic->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (xic->prog_fd == -1)
+		goto attach_fail;
+
+	for (flags = XDP_FLAGS_DRV_MODE; ; flags = XDP_FLAGS_SKB_MODE) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd = xic->prog_fd;
+		attr.link_create.target_ifindex = ifindex;
+		attr.link_create.attach_type = BPF_XDP;
+		attr.link_create.flags = flags;
+		xic->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if (xic->link_fd != -1 || flags == XDP_FLAGS_SKB_MODE)
+			break;
+	}
+	if (xic->link_fd == -1)
+		goto attach_fail;
+
+	xic->generic = (flags == XDP_FLAGS_SKB_MODE);
+	TRACE_XDP_FUNC_END();
+	return 0;
+
+ attach_fail:
+	if (xic->prog_fd != -1)
+		close(xic->prog_fd);
+	if (xic->map_fd != -1)
+		close(xic->map_fd);
+	xic->map_fd = xic->prog_fd = -1;
+	TRACE_XDP_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+xdp_prog_set_queue(xdp_iface_context *xic, uint32_t queue, int32_t fd)
+{
+	TRACE_XDP_FUNC_START();
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xic->map_fd;
+	attr.key = (uint64_t)(unsigned long)&queue;
+	attr.value = (uint64_t)(unsigned long)&fd;
+	TRACE_XDP_FUNC_END();
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+/*---------------------------------------------------------------------*/
+void
+xdp_prog_detach(xdp_iface_context *xic)
+{
+	TRACE_XDP_FUNC_START();
+	/* closing the link detaches the program */
+	if (xic->link_fd != -1)
+		close(xic->link_fd);
+	if (xic->prog_fd != -1)
+		close(xic->prog_fd);
+	if (xic->map_fd != -1)
+		close(xic->map_fd);
+	xic->map_fd = xic->prog_fd = xic->link_fd = -1;
+	TRACE_XDP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
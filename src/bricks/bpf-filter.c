@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for Brick struct */
+#include "brick.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for engine declaration */
+#include "pkt_engine.h"
+/* for pcap_compile() */
+#include <pcap/pcap.h>
+/* for threaded-code bpf */
+#include "bricks_bpf.h"
+/*---------------------------------------------------------------------*/
+/*
+ * Snapshot length the filters are compiled for. It only sets what a
+ * matching filter returns; filters run on the captured bytes of each
+ * packet, and that is the length "less", "greater" and "len" see.
+ */
+#define BPF_SNAPLEN			2048
+/*---------------------------------------------------------------------*/
+typedef struct BPFFilterContext {
+	/* no. of filters; filter i feeds output link i */
+	uint8_t count;
+	bpf_tc prog[MAX_OUTLINKS];
+} BPFFilterContext __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+static void
+bpffilt_free(BPFFilterContext *bfc)
+{
+	TRACE_BRICK_FUNC_START();
+	int i;
+
+	for (i = 0; i < bfc->count; i++)
+		bpf_tc_free(&bfc->prog[i]);
+	free(bfc);
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+int32_t
+bpffilt_init(Brick *brick, Linker_Intf *li)
+{
+	TRACE_BRICK_FUNC_START();
+	BPFFilterContext *bfc;
+	struct bpf_program fp;
+	pcap_t *pd;
+	int i, rc;
+
+	if (li->expr_count == 0 || li->expr_count != li->output_count) {
+		TRACE_LOG("BPFFilter needs one filter expression "
+			  "per output link\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	bfc = calloc(1, sizeof(BPFFilterContext));
+	if (bfc == NULL) {
+		TRACE_LOG("Can't create private context "
+			  "for BPF filter\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	pd = pcap_open_dead(DLT_EN10MB, BPF_SNAPLEN);
+	if (pd == NULL) {
+		TRACE_LOG("Can't create pcap handle for BPF filter\n");
+		free(bfc);
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+
+	for (i = 0; i < li->expr_count; i++) {
+		if (pcap_compile(pd, &fp, li->filter_expr[i], 1,
+				 PCAP_NETMASK_UNKNOWN) == -1) {
+			TRACE_LOG("Can't compile filter \"%s\": %s\n",
+				  li->filter_expr[i], pcap_geterr(pd));
+			goto fail;
+		}
+		rc = bpf_tc_compile(&bfc->prog[i], fp.bf_insns, fp.bf_len);
+		pcap_freecode(&fp);
+		if (rc == -1) {
+			TRACE_LOG("Can't translate filter \"%s\"\n",
+				  li->filter_expr[i]);
+			goto fail;
+		}
+		bfc->count++;
+		TRACE_LOG("Filter \"%s\" feeds %s\n", li->filter_expr[i],
+			  li->output_link[i]);
+	}
+	pcap_close(pd);
+
+	brick->private_data = bfc;
+	/* a packet goes to every link whose filter matches */
+	li->type = COPY;
+	TRACE_BRICK_FUNC_END();
+	return 1;
+
+ fail:
+	pcap_close(pd);
+	bpffilt_free(bfc);
+	TRACE_BRICK_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+BITMAP
+bpffilt_process(Brick *brick, unsigned char *buf, uint32_t len)
+{
+	TRACE_BRICK_FUNC_START();
+	BPFFilterContext *bfc = brick->private_data;
+	BITMAP b;
+	int i;
+
+	INIT_BITMAP(b);
+	for (i = 0; i < bfc->count; i++) {
+		if (bpf_tc_run(&bfc->prog[i], buf, len) != 0)
+			SET_BIT(b, i);
+	}
+	TRACE_BRICK_FUNC_END();
+	return b;
+}
+/*---------------------------------------------------------------------*/
+void
+bpffilt_process_batch(Brick *brick, unsigned char **bufs,
+		      const uint32_t *lens, uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	BPFFilterContext *bfc = brick->private_data;
+	uint16_t j;
+	int i;
+
+	for (j = 0; j < n; j++) {
+		if (j + 1 < n)
+			__builtin_prefetch(bufs[j + 1]);
+		INIT_BITMAP(out[j]);
+		for (i = 0; i < bfc->count; i++) {
+			if (bpf_tc_run(&bfc->prog[i], bufs[j], lens[j]) != 0)
+				SET_BIT(out[j], i);
+		}
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+bpffilt_deinit(Brick *brick)
+{
+	TRACE_BRICK_FUNC_START();
+	if (brick->private_data != NULL) {
+		bpffilt_free(brick->private_data);
+		brick->private_data = NULL;
+	}
+	free(brick);
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+char *
+bpffilt_getid()
+{
+	TRACE_BRICK_FUNC_START();
+	static char *name = "BPFFilter";
+	return name;
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+brick_funcs bpffiltfuncs = {
+	.init			= 	bpffilt_init,
+	.link			=	brick_link,
+	.process		= 	bpffilt_process,
+	.process_batch		=	bpffilt_process_batch,
+	.deinit			= 	bpffilt_deinit,
+	.getId			=	bpffilt_getid
+};
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for Brick struct */
+#include "brick.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for engine declaration */
+#include "pkt_engine.h"
+/* for string functions */
+#include <string.h>
+/* for inet_pton() */
+#include <arpa/inet.h>
+/* for errno */
+#include <errno.h>
+/* for classifier */
+#include "bricks_classify.h"
+/*---------------------------------------------------------------------*/
+/**
+ * Classifier brick. Brick.new("Classifier", <rule-file>) reads one
+ * rule per line:
+ *
+ *	[vlan <id>] [ether <type>] [proto tcp|udp|icmp|sctp|<no>]
+ *	[src <addr>[/<len>]] [dst <addr>[/<len>]]
+ *	[sport <port>] [dport <port>] -> <link>[,<link>...]
+ *
+ * where <link> is the index of an output link. Packets go to the
+ * links of the first rule they match, and are dropped if none does.
+ * Empty lines and lines starting with '#' are skipped.
+ */
+/*---------------------------------------------------------------------*/
+#define CLS_LINE_MAX			512
+#define CLS_RULES_CHUNK			1024
+/*---------------------------------------------------------------------*/
+typedef struct ClassifierContext {
+	classifier cls;
+} ClassifierContext __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/**
+ * Parses an address with an optional prefix length into the key, and
+ * the implied ethertype into the rule. Returns -1 if malformed.
+ */
+static int
+parse_prefix(cls_rule *r, char *str, uint32_t *addr, uint8_t *len)
+{
+	TRACE_BRICK_FUNC_START();
+	char *slash = strchr(str, '/');
+	uint16_t ether;
+	int max;
+
+	if (slash != NULL)
+		*slash++ = '\0';
+	if (inet_pton(AF_INET, str, addr) == 1) {
+		ether = 0x0800;
+		max = 32;
+	} else if (inet_pton(AF_INET6, str, addr) == 1) {
+		ether = 0x86DD;
+		max = 128;
+	} else {
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	*len = (slash == NULL) ? max : atoi(slash);
+	if (*len == 0 || *len > max ||
+	    ((r->fields & CLS_ETHER) && r->key.ether != ether)) {
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	r->fields |= CLS_ETHER;
+	r->key.ether = ether;
+	TRACE_BRICK_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Parses a rule. Returns 0 on success, 1 if the line holds no rule
+ * and -1 if it is malformed.
+ */
+static int
+parse_rule(cls_rule *r, char *line, int nlinks)
+{
+	TRACE_BRICK_FUNC_START();
+	char *save = NULL, *tok, *arg, *end;
+	unsigned long v;
+	uint16_t ether;
+
+	memset(r, 0, sizeof(cls_rule));
+	tok = strtok_r(line, " \t\r\n", &save);
+	if (tok == NULL || tok[0] == '#') {
+		TRACE_BRICK_FUNC_END();
+		return 1;
+	}
+
+	for (; tok != NULL && strcmp(tok, "->");
+	     tok = strtok_r(NULL, " \t\r\n", &save)) {
+		arg = strtok_r(NULL, " \t\r\n", &save);
+		if (arg == NULL)
+			goto malformed;
+		if (!strcmp(tok, "src")) {
+			if (parse_prefix(r, arg, r->key.src, &r->src_len) == -1)
+				goto malformed;
+			continue;
+		}
+		if (!strcmp(tok, "dst")) {
+			if (parse_prefix(r, arg, r->key.dst, &r->dst_len) == -1)
+				goto malformed;
+			continue;
+		}
+		if (!strcmp(tok, "proto") && !strcmp(arg, "tcp"))
+			v = 6;
+		else if (!strcmp(tok, "proto") && !strcmp(arg, "udp"))
+			v = 17;
+		else if (!strcmp(tok, "proto") && !strcmp(arg, "icmp"))
+			v = 1;
+		else if (!strcmp(tok, "proto") && !strcmp(arg, "sctp"))
+			v = 132;
+		else {
+			v = strtoul(arg, &end, 0);
+			if (*end != '\0')
+				goto malformed;
+		}
+
+		if (!strcmp(tok, "vlan") && v <= 0x0FFF) {
+			r->fields |= CLS_VLAN;
+			r->key.vlan = v;
+		} else if (!strcmp(tok, "ether") && v <= 0xFFFF) {
+			ether = v;
+			if ((r->fields & CLS_ETHER) && r->key.ether != ether)
+				goto malformed;
+			r->fields |= CLS_ETHER;
+			r->key.ether = ether;
+		} else if (!strcmp(tok, "proto") && v <= 0xFF) {
+			r->fields |= CLS_PROTO;
+			r->key.proto = v;
+		} else if (!strcmp(tok, "sport") && v <= 0xFFFF) {
+			r->fields |= CLS_SPORT;
+			r->key.sport = v;
+		} else if (!strcmp(tok, "dport") && v <= 0xFFFF) {
+			r->fields |= CLS_DPORT;
+			r->key.dport = v;
+		} else
+			goto malformed;
+	}
+	if (tok == NULL)
+		goto malformed;
+
+	/* output links */
+	arg = strtok_r(NULL, " \t\r\n", &save);
+	for (tok = strtok_r(arg, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		v = strtoul(tok, &end, 10);
+		if (*end != '\0' || v >= (unsigned long)nlinks)
+			goto malformed;
+		SET_BIT(r->out, v);
+	}
+	if (r->out == 0)
+		goto malformed;
+
+	TRACE_BRICK_FUNC_END();
+	return 0;
+
+ malformed:
+	TRACE_BRICK_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Reads the rules of file fname. Returns the no. of rules (with the
+ * array in *rules) or -1.
+ */
+static int
+read_rules(const char *fname, int nlinks, cls_rule **rules)
+{
+	TRACE_BRICK_FUNC_START();
+	char line[CLS_LINE_MAX];
+	cls_rule *r = NULL, *tmp;
+	int n = 0, lineno = 0;
+	FILE *fp;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		TRACE_LOG("Can't open rule file %s: %s\n", fname,
+			  strerror(errno));
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if (n % CLS_RULES_CHUNK == 0) {
+			tmp = realloc(r, (n + CLS_RULES_CHUNK) * sizeof(cls_rule));
+			if (tmp == NULL) {
+				TRACE_LOG("Can't allocate memory for rules\n");
+				goto fail;
+			}
+			r = tmp;
+		}
+		switch (parse_rule(&r[n], line, nlinks)) {
+		case 0:
+			n++;
+			break;
+		case 1:
+			break;
+		default:
+			TRACE_LOG("%s:%d: malformed rule\n", fname, lineno);
+			goto fail;
+		}
+	}
+	fclose(fp);
+	*rules = r;
+	TRACE_BRICK_FUNC_END();
+	return n;
+
+ fail:
+	fclose(fp);
+	free(r);
+	TRACE_BRICK_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+classifier_init(Brick *brick, Linker_Intf *li)
+{
+	TRACE_BRICK_FUNC_START();
+	ClassifierContext *cc;
+	cls_rule *rules = NULL;
+	int n;
+
+	if (li->expr_count != 1 || li->output_count == 0) {
+		TRACE_LOG("Classifier needs a rule file and output links\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	cc = calloc(1, sizeof(ClassifierContext));
+	if (cc == NULL) {
+		TRACE_LOG("Can't create private context "
+			  "for classifier\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	n = read_rules(li->filter_expr[0], li->output_count, &rules);
+	if (n == -1 || cls_build(&cc->cls, rules, n) == -1) {
+		TRACE_LOG("Can't load rules from %s\n", li->filter_expr[0]);
+		free(rules);
+		free(cc);
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	TRACE_LOG("Classifier loaded %d rule(s) in %u tuple(s) from %s\n",
+		  n, cc->cls.count, li->filter_expr[0]);
+	free(rules);
+
+	brick->private_data = cc;
+	/* a rule may name more than one link */
+	li->type = COPY;
+	TRACE_BRICK_FUNC_END();
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+BITMAP
+classifier_process(Brick *brick, unsigned char *buf, uint32_t len)
+{
+	TRACE_BRICK_FUNC_START();
+	ClassifierContext *cc = brick->private_data;
+	cls_key key;
+
+	cls_key_from_pkt(&key, buf, len);
+	TRACE_BRICK_FUNC_END();
+	return cls_lookup(&cc->cls, &key);
+}
+/*---------------------------------------------------------------------*/
+void
+classifier_process_batch(Brick *brick, unsigned char **bufs,
+			 const uint32_t *lens, uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	ClassifierContext *cc = brick->private_data;
+	cls_key key;
+	uint16_t i;
+
+	for (i = 0; i < n; i++) {
+		if (i + 1 < n)
+			__builtin_prefetch(bufs[i + 1]);
+		cls_key_from_pkt(&key, bufs[i], lens[i]);
+		out[i] = cls_lookup(&cc->cls, &key);
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+classifier_deinit(Brick *brick)
+{
+	TRACE_BRICK_FUNC_START();
+	ClassifierContext *cc = brick->private_data;
+
+	if (cc != NULL) {
+		cls_free(&cc->cls);
+		free(cc);
+		brick->private_data = NULL;
+	}
+	free(brick);
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+char *
+classifier_getid()
+{
+	TRACE_BRICK_FUNC_START();
+	static char *name = "Classifier";
+	return name;
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+brick_funcs classifierfuncs = {
+	.init			= 	classifier_init,
+	.link			=	brick_link,
+	.process		= 	classifier_process,
+	.process_batch		=	classifier_process_batch,
+	.deinit			= 	classifier_deinit,
+	.getId			=	classifier_getid
+};
+/*---------------------------------------------------------------------*/
@@ -43,7 +43,7 @@ dummy_init(Brick *brick, Linker_Intf *li)
 }
 /*---------------------------------------------------------------------*/
 BITMAP
-dummy_process(Brick *brick, unsigned char *buf)
+dummy_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	BITMAP b;
@@ -55,6 +55,7 @@ dummy_process(Brick *brick, unsigned char *buf)
 	return b;
 	UNUSED(brick);
 	UNUSED(buf);
+	UNUSED(len);
 }
 /*---------------------------------------------------------------------*/
 void
@@ -46,7 +46,7 @@ dup_init(Brick *brick, Linker_Intf *li)
 }
 /*---------------------------------------------------------------------*/
 BITMAP
-dup_process(Brick *brick, unsigned char *buf)
+dup_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	linkdata *lnd = (linkdata *)(&brick->lnd);
@@ -60,10 +60,33 @@ dup_process(Brick *brick, unsigned char *buf)
 	
 	TRACE_BRICK_FUNC_END();
 	UNUSED(buf);
+	UNUSED(len);
 	return b;
 }
 /*---------------------------------------------------------------------*/
 void
+dup_process_batch(Brick *brick, unsigned char **bufs, const uint32_t *lens,
+		  uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+	BITMAP b;
+	uint16_t i;
+
+	/* every packet goes everywhere; compute the bitmap only once */
+	INIT_BITMAP(b);
+	for (i = 0; i < lnd->count; i++) {
+		SET_BIT(b, i);
+	}
+	for (i = 0; i < n; i++)
+		out[i] = b;
+
+	TRACE_BRICK_FUNC_END();
+	UNUSED(bufs);
+	UNUSED(lens);
+}
+/*---------------------------------------------------------------------*/
+void
 dup_deinit(Brick *brick)
 {
 	TRACE_BRICK_FUNC_START();
@@ -88,6 +111,7 @@ brick_funcs dupfuncs = {
 	.init			= 	dup_init,
 	.link			=	brick_link,
 	.process		= 	dup_process,
+	.process_batch		=	dup_process_batch,
 	.deinit			= 	dup_deinit,
 	.getId			=	dup_getid
 };
@@ -55,11 +55,15 @@ filter_init(Brick *brick, Linker_Intf *li)
 	strcpy_with_reverse_pipe(fc->name, li->output_link[0]);
 	TRACE_LOG("Adding brick filter named %s to the engine\n",
 		  li->output_link[0]);
+	/* initialize the (empty) filter table */
+	if (init_filters(fc) == -1) {
+		free(fc);
+		brick->private_data = NULL;
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
 	/* Adding filter brick to the engine's filter list */
 	TAILQ_INSERT_TAIL(&brick->eng->filter_list, fc, entry);
-
-	/* initialize filter list */
-	TAILQ_INIT(&fc->filter_list);
 	TRACE_BRICK_FUNC_END();
 
 	return 1;
@@ -70,7 +74,7 @@ filter_init(Brick *brick, Linker_Intf *li)
  * based on packet header data for the time being...
  */
 static BITMAP
-filter_dummy(Brick *brick, unsigned char *buf)
+filter_dummy(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	BITMAP b;
@@ -78,16 +82,40 @@ filter_dummy(Brick *brick, unsigned char *buf)
 
 	INIT_BITMAP(b);
 	fc = (FilterContext *)brick->private_data;
-	if (analyze_packet(buf, fc, time(NULL)))
+	if (analyze_packet(buf, len, fc))
 		SET_BIT(b, 0);
 	TRACE_BRICK_FUNC_END();
 	return b;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Batched version of filter_dummy()
+ */
+static void
+filter_dummy_batch(Brick *brick, unsigned char **bufs, const uint32_t *lens,
+		   uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	FilterContext *fc;
+	uint16_t i;
+
+	fc = (FilterContext *)brick->private_data;
+	for (i = 0; i < n; i++) {
+		INIT_BITMAP(out[i]);
+		if (analyze_packet(bufs[i], lens[i], fc))
+			SET_BIT(out[i], 0);
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
 void
 filter_deinit(Brick *brick)
 {
 	TRACE_BRICK_FUNC_START();
+	FilterContext *fc = (FilterContext *)brick->private_data;
+
+	TAILQ_REMOVE(&brick->eng->filter_list, fc, entry);
+	flush_filters(fc);
 	free(brick->private_data);
 	free(brick);
 	TRACE_BRICK_FUNC_END();
@@ -106,6 +134,7 @@ brick_funcs filterfuncs = {
 	.init			= 	filter_init,
 	.link			=	brick_link,
 	.process		= 	filter_dummy,
+	.process_batch		=	filter_dummy_batch,
 	.deinit			= 	filter_deinit,
 	.getId			=	filter_getid
 };
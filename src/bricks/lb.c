@@ -33,8 +33,12 @@
 #include "pkt_engine.h"
 /* for strcmp */
 #include <string.h>
-/* for hash function */
+/* for hash functions and pkt_flow_key() */
 #include "pkt_hash.h"
+/* for weighted/consistent lookup tables */
+#include "bricks_lb.h"
+/* for clock_gettime */
+#include <time.h>
 /*---------------------------------------------------------------------*/
 typedef struct LoadBalancerContext {
 	/* 
@@ -42,8 +46,134 @@ typedef struct LoadBalancerContext {
 	 * load balancer
 	 */
 	uint8_t hash_split;
+	/* hash the innermost flow of tunneled traffic */
+	uint8_t hash_inner;
+	/* hash -> output link (weighted/consistent modes only) */
+	lb_table tbl;
+	/* flow key -> output link (sticky mode only) */
+	uint8_t sticky;
+	lb_flows flows;
+	uint32_t *weight;	/* NULL: all outputs weigh the same */
 } LoadBalancerContext __attribute__((aligned(__WORDSIZE)));
 /*---------------------------------------------------------------------*/
+static int
+lb_build_table(LoadBalancerContext *lbc, Linker_Intf *li)
+{
+	TRACE_BRICK_FUNC_START();
+	const uint32_t *weight = NULL;
+	int rc = 0;
+
+	if (li->weight_count != 0) {
+		if (li->weight_count != li->output_count) {
+			TRACE_LOG("LoadBalancer has %d output links but %d "
+				  "weights\n", li->output_count,
+				  li->weight_count);
+			TRACE_BRICK_FUNC_END();
+			return -1;
+		}
+		weight = li->weight;
+	}
+
+	switch (li->lb_mode) {
+	case LB_WEIGHTED:
+		if (weight == NULL) {
+			TRACE_LOG("Weighted LoadBalancer needs weights\n");
+			TRACE_BRICK_FUNC_END();
+			return -1;
+		}
+		rc = lb_table_weighted(&lbc->tbl, weight, li->output_count);
+		break;
+	case LB_CONSISTENT:
+		rc = lb_table_consistent(&lbc->tbl, li->output_link, weight,
+					 li->output_count);
+		break;
+	case LB_STICKY:
+		if (lb_flows_init(&lbc->flows, 0, li->flow_idle) == -1) {
+			TRACE_LOG("Can't allocate the LoadBalancer flow table\n");
+			TRACE_BRICK_FUNC_END();
+			return -1;
+		}
+		lbc->sticky = 1;
+		if (li->hash_inner)
+			TRACE_LOG("Sticky LoadBalancer tells flows apart by "
+				  "their outer headers\n");
+		if (weight != NULL) {
+			lbc->weight = calloc(li->output_count, sizeof(uint32_t));
+			if (lbc->weight == NULL) {
+				lb_flows_free(&lbc->flows);
+				TRACE_BRICK_FUNC_END();
+				return -1;
+			}
+			memcpy(lbc->weight, weight,
+			       li->output_count * sizeof(uint32_t));
+		}
+		break;
+	default:
+		break;
+	}
+	if (rc == -1)
+		TRACE_LOG("Can't build the LoadBalancer table (weights must "
+			  "not all be 0 and add up to at most %d)\n",
+			  LB_TABLE_SIZE);
+	TRACE_BRICK_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+/* clock of the flow table (secs) */
+static inline uint16_t
+lb_clock()
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint16_t)ts.tv_sec;
+}
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+lb_hash(LoadBalancerContext *lbc, linkdata *lnd, unsigned char *buf,
+	uint32_t len)
+{
+	if (lbc->hash_inner)
+		return pkt_inner_hdr_hash(buf, len, lbc->hash_split,
+					  lnd->level);
+	return pkt_hdr_hash(buf, len, lbc->hash_split, lnd->level);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Key of the flow table: 64 bits (the hash has far less entropy),
+ * the same for both directions
+ */
+static inline uint64_t
+lb_flow_key(LoadBalancerContext *lbc, unsigned char *buf, uint32_t len)
+{
+	return pkt_flow_key(buf, len, lbc->hash_split);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Output link of a packet with hash h (stateless modes). Links that
+ * the I/O module took down (lnd->down) are skipped.
+ */
+static inline uint32_t
+lb_pick(LoadBalancerContext *lbc, linkdata *lnd, uint32_t h)
+{
+	uint32_t key;
+
+	if (lbc->tbl.slot == NULL)
+		key = h % lnd->count;
+	else {
+		key = lb_table_pick(&lbc->tbl, h);
+		if (key >= lnd->count)
+			key = h % lnd->count;
+	}
+	if (lnd->down != 0 && CHECK_BIT(lnd->down, key))
+		key = lb_failover(&lbc->tbl, lnd->down, lnd->count, h, key);
+	return key;
+}
+/*---------------------------------------------------------------------*/
 int32_t
 lb_init(Brick *brick, Linker_Intf *li)
 {
@@ -60,8 +190,16 @@ lb_init(Brick *brick, Linker_Intf *li)
 	lbc = brick->private_data;
 	if (li == NULL)
 		lbc->hash_split = 4;
-	else
+	else {
 		lbc->hash_split = li->hash_split;
+		lbc->hash_inner = (li->hash_inner != 0);
+		if (lb_build_table(lbc, li) == -1) {
+			free(brick->private_data);
+			brick->private_data = NULL;
+			TRACE_BRICK_FUNC_END();
+			return -1;
+		}
+	}
 	li->type = SHARE;
 	TRACE_LOG("Adding brick %s to the engine\n", li->output_link[0]);
 	TRACE_BRICK_FUNC_END();
@@ -70,7 +208,7 @@ lb_init(Brick *brick, Linker_Intf *li)
 }
 /*---------------------------------------------------------------------*/
 BITMAP
-lb_process(Brick *brick, unsigned char *buf)
+lb_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	linkdata *lnd;
@@ -81,18 +219,74 @@ lb_process(Brick *brick, unsigned char *buf)
 	lnd = &(brick->lnd);
 	lbc = brick->private_data;
 	INIT_BITMAP(b);
-	key = pkt_hdr_hash(buf, lbc->hash_split, 
-			   lnd->level) % lnd->count;
+	if (lbc->sticky) {
+		lb_flows_tick(&lbc->flows, lb_clock());
+		key = lb_flows_pick(&lbc->flows, lb_flow_key(lbc, buf, len),
+				    lnd->count, lnd->down, lbc->weight);
+	} else
+		key = lb_pick(lbc, lnd, lb_hash(lbc, lnd, buf, len));
 	SET_BIT(b, key);
 	TRACE_BRICK_FUNC_END();
 	return b;
 }
 /*---------------------------------------------------------------------*/
 void
+lb_process_batch(Brick *brick, unsigned char **bufs, const uint32_t *lens,
+		 uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	linkdata *lnd;
+	LoadBalancerContext *lbc;
+	uint64_t fk[LB_FLOW_BATCH];
+	uint16_t i, k, c;
+
+	lnd = &(brick->lnd);
+	lbc = brick->private_data;
+	if (!lbc->sticky) {
+		for (i = 0; i < n; i++) {
+			if (i + 1 < n)
+				__builtin_prefetch(bufs[i + 1]);
+			INIT_BITMAP(out[i]);
+			SET_BIT(out[i], lb_pick(lbc, lnd,
+						lb_hash(lbc, lnd, bufs[i],
+							lens[i])));
+		}
+		TRACE_BRICK_FUNC_END();
+		return;
+	}
+
+	/* the flow table is far bigger than the cache: key a chunk of
+	   the burst first and fetch its buckets while doing so */
+	lb_flows_tick(&lbc->flows, lb_clock());
+	for (i = 0; i < n; i += c) {
+		c = (n - i < LB_FLOW_BATCH) ? n - i : LB_FLOW_BATCH;
+		for (k = 0; k < c; k++) {
+			if (i + k + 1 < n)
+				__builtin_prefetch(bufs[i + k + 1]);
+			fk[k] = lb_flow_key(lbc, bufs[i + k], lens[i + k]);
+			lb_flows_prefetch(&lbc->flows, fk[k]);
+		}
+		for (k = 0; k < c; k++) {
+			INIT_BITMAP(out[i + k]);
+			SET_BIT(out[i + k],
+				lb_flows_pick(&lbc->flows, fk[k], lnd->count,
+					      lnd->down, lbc->weight));
+		}
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
 lb_deinit(Brick *brick)
 {
 	TRACE_BRICK_FUNC_START();
-	if (brick->private_data != NULL) {
+	LoadBalancerContext *lbc = brick->private_data;
+
+	if (lbc != NULL) {
+		lb_table_free(&lbc->tbl);
+		if (lbc->sticky)
+			lb_flows_free(&lbc->flows);
+		free(lbc->weight);
 		free(brick->private_data);
 		brick->private_data = NULL;
 	}
@@ -113,6 +307,7 @@ brick_funcs lbfuncs = {
 	.init			= 	lb_init,
 	.link			=	brick_link,
 	.process		= 	lb_process,
+	.process_batch		=	lb_process_batch,
 	.deinit			= 	lb_deinit,
 	.getId			=	lb_getid
 };
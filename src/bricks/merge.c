@@ -58,7 +58,7 @@ merge_deinit(Brick *brick)
 }
 /*---------------------------------------------------------------------*/
 BITMAP
-merge_process(Brick *brick, unsigned char *buf)
+merge_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	BITMAP b;
@@ -70,6 +70,7 @@ merge_process(Brick *brick, unsigned char *buf)
 	return b;
 	UNUSED(brick);
 	UNUSED(buf);
+	UNUSED(len);
 }
 /*---------------------------------------------------------------------*/
 /**
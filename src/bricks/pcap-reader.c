@@ -168,7 +168,7 @@ pcapr_init(Brick *brick, Linker_Intf *li)
  * the *sole* (connected) netmap file descriptor
  */
 static BITMAP
-pcapr_process(Brick *brick, unsigned char *buf)
+pcapr_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	PcapReaderContext *prc = (PcapReaderContext *)brick->private_data;
@@ -184,7 +184,7 @@ pcapr_process(Brick *brick, unsigned char *buf)
 		SET_BIT(b, 0);
 		return b;
 	}
-	key = pkt_hdr_hash(buf, 4, lnd->level) % lnd->count;
+	key = pkt_hdr_hash(buf, len, 4, lnd->level) % lnd->count;
 	SET_BIT(b, key);
 	
 	TRACE_BRICK_FUNC_END();
@@ -326,7 +326,7 @@ pcapr_link(struct Brick *from, PktEngine_Intf *pe, Linker_Intf *linker)
 			  eng->name, linker->input_link[1], pe->batch, pe->qid);
 		
 		eng->FIRST_BRICK(esrc)->brick = from;
-		eng->mark_for_copy = (linker->type == COPY) ? 1 : 0;
+		lbd->copy = (linker->type == COPY) ? 1 : 0;
 		lbd->external_links = calloc(lbd->count,
 						sizeof(void *));
 		if (lbd->external_links == NULL) {
@@ -46,7 +46,7 @@ pcapw_init(Brick *brick, Linker_Intf *li)
 }
 /*---------------------------------------------------------------------*/
 BITMAP
-pcapw_process(Brick *brick, unsigned char *buf)
+pcapw_process(Brick *brick, unsigned char *buf, uint32_t len)
 {
 	TRACE_BRICK_FUNC_START();
 	BITMAP b;
@@ -58,6 +58,7 @@ pcapw_process(Brick *brick, unsigned char *buf)
 	return b;
 	UNUSED(brick);
 	UNUSED(buf);
+	UNUSED(len);
 }
 /*---------------------------------------------------------------------*/
 void
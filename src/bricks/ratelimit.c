@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for Brick struct */
+#include "brick.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for engine declaration */
+#include "pkt_engine.h"
+/* for string functions */
+#include <string.h>
+/* for token buckets */
+#include "bricks_ratelimit.h"
+/* for pkt_flow_key() */
+#include "pkt_hash.h"
+/*---------------------------------------------------------------------*/
+/**
+ * RateLimiter brick. Brick.new("RateLimiter", [2|4], {pps=<n>,
+ * bps=<n>, burst=<msecs>, flow_pps=<n>, flow_bps=<n>, divert=true})
+ * caps each of its output links at pps packets/sec and bps bits/sec,
+ * so that a slow consumer (e.g. a full-packet recorder) is not handed
+ * more than it can drain and left to lose packets blindly when its
+ * pipe fills up. flow_pps and flow_bps also cap each flow (both
+ * directions of a connection). Bursts of up to (burst) msecs worth of
+ * the rate (default 10) go through at once.
+ *
+ * Packets are spread over the links by flow, as the LoadBalancer
+ * does. What is over the limit is dropped, or with divert=true sent
+ * to the last output link, which is then not limited itself.
+ */
+/*---------------------------------------------------------------------*/
+typedef struct RateLimitContext {
+	rl_rate link_rate;			/* per limited output link */
+	rl_rate flow_rate;			/* per flow */
+	rl_bucket link[RL_MAX_OUTPUTS];
+	rl_bucket *flow;			/* NULL: no per-flow limit */
+	uint32_t flow_mask;			/* no. of flow buckets - 1 */
+	uint8_t hash_split;
+	uint8_t divert;
+	uint64_t now;				/* read_cycles() of the burst */
+	/* what went over the limits */
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t over_pkts;
+	uint64_t over_bytes;
+} RateLimitContext __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/* no. of output links that are limited */
+static inline uint32_t
+rl_limited(const RateLimitContext *rc, const linkdata *lnd)
+{
+	return (rc->divert && lnd->count > 1) ? lnd->count - 1 : lnd->count;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Flow key of a packet of len bytes. The key is only needed to spread
+ * packets over links and to find their flow's bucket.
+ */
+static inline uint64_t
+rl_key(const RateLimitContext *rc, const linkdata *lnd, const uint8_t *buf,
+       uint32_t len)
+{
+	if (rc->flow != NULL || rl_limited(rc, lnd) > 1)
+		return pkt_flow_key(buf, len, rc->hash_split);
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Output links of a packet of len bytes of flow key
+ */
+static inline BITMAP
+rl_pick(RateLimitContext *rc, linkdata *lnd, uint64_t key, uint32_t len)
+{
+	uint32_t limited = rl_limited(rc, lnd), idx;
+	rl_bucket *fb = NULL, nf, nl;
+	BITMAP b;
+
+	INIT_BITMAP(b);
+	if (limited == 0)
+		return b;
+	rc->pkts++;
+	rc->bytes += len;
+	/* multiply-shift instead of a modulo */
+	idx = (uint32_t)(((key >> 32) * limited) >> 32);
+	if (rc->flow != NULL)
+		fb = &rc->flow[key & rc->flow_mask];
+	if ((fb == NULL || rl_take(&rc->flow_rate, fb, rc->now, len, &nf)) &&
+	    rl_take(&rc->link_rate, &rc->link[idx], rc->now, len, &nl)) {
+		rc->link[idx] = nl;
+		if (fb != NULL)
+			*fb = nf;
+		SET_BIT(b, idx);
+		return b;
+	}
+	rc->over_pkts++;
+	rc->over_bytes += len;
+	if (limited < lnd->count)
+		SET_BIT(b, lnd->count - 1);
+	return b;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+ratelimit_init(Brick *brick, Linker_Intf *li)
+{
+	TRACE_BRICK_FUNC_START();
+	RateLimitContext *rc;
+	uint64_t hz = rl_clock_hz();
+	int has_link, has_flow;
+
+	rc = calloc(1, sizeof(RateLimitContext));
+	if (rc == NULL) {
+		TRACE_LOG("Can't create private context for rate limiter\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	rc->hash_split = (li->hash_split == 2) ? 2 : 4;
+	rc->divert = (li->divert != 0);
+	has_link = (rl_rate_init(&rc->link_rate, hz, li->rate_pps,
+				 li->rate_bps, li->burst_ms) == 0);
+	has_flow = (rl_rate_init(&rc->flow_rate, hz, li->flow_pps,
+				 li->flow_bps, li->burst_ms) == 0);
+	if (has_flow) {
+		rc->flow = calloc(RL_FLOW_BUCKETS, sizeof(rl_bucket));
+		if (rc->flow == NULL) {
+			TRACE_LOG("Can't allocate the rate limiter's flow "
+				  "buckets\n");
+			free(rc);
+			TRACE_BRICK_FUNC_END();
+			return -1;
+		}
+		rc->flow_mask = RL_FLOW_BUCKETS - 1;
+	}
+	if (!has_link && !has_flow)
+		TRACE_LOG("Rate limiter has no pps/bps limit: "
+			  "it lets everything through\n");
+	brick->private_data = rc;
+	li->type = LIMIT;
+	TRACE_LOG("Adding brick rate limiter to the engine (per link: %llu "
+		  "pps, %llu bps, per flow: %llu pps, %llu bps, clock: %llu "
+		  "Hz)\n", (unsigned long long)li->rate_pps,
+		  (unsigned long long)li->rate_bps,
+		  (unsigned long long)li->flow_pps,
+		  (unsigned long long)li->flow_bps, (unsigned long long)hz);
+	TRACE_BRICK_FUNC_END();
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+BITMAP
+ratelimit_process(Brick *brick, unsigned char *buf, uint32_t len)
+{
+	TRACE_BRICK_FUNC_START();
+	RateLimitContext *rc = brick->private_data;
+	uint64_t key;
+
+	rc->now = read_cycles();
+	key = rl_key(rc, &brick->lnd, buf, len);
+	TRACE_BRICK_FUNC_END();
+	return rl_pick(rc, &brick->lnd, key, len);
+}
+/*---------------------------------------------------------------------*/
+void
+ratelimit_process_batch(Brick *brick, unsigned char **bufs,
+			const uint32_t *lens, uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	RateLimitContext *rc = brick->private_data;
+	uint64_t key[RL_BATCH];
+	uint16_t i, k, c;
+
+	/* one clock read for the whole burst */
+	rc->now = read_cycles();
+	/* key a chunk of the burst first and fetch its buckets meanwhile */
+	for (i = 0; i < n; i += c) {
+		c = (n - i < RL_BATCH) ? n - i : RL_BATCH;
+		for (k = 0; k < c; k++) {
+			if (i + k + 1 < n)
+				__builtin_prefetch(bufs[i + k + 1]);
+			key[k] = rl_key(rc, &brick->lnd, bufs[i + k],
+					lens[i + k]);
+			if (rc->flow != NULL)
+				__builtin_prefetch(&rc->flow[key[k] &
+							     rc->flow_mask]);
+		}
+		for (k = 0; k < c; k++)
+			out[i + k] = rl_pick(rc, &brick->lnd, key[k],
+					     lens[i + k]);
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+ratelimit_deinit(Brick *brick)
+{
+	TRACE_BRICK_FUNC_START();
+	RateLimitContext *rc = brick->private_data;
+
+	if (rc != NULL) {
+		TRACE_LOG("Rate limiter held back %llu of %llu pkts, %llu of "
+			  "%llu bytes\n", (unsigned long long)rc->over_pkts,
+			  (unsigned long long)rc->pkts,
+			  (unsigned long long)rc->over_bytes,
+			  (unsigned long long)rc->bytes);
+		free(rc->flow);
+		free(rc);
+		brick->private_data = NULL;
+	}
+	free(brick);
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+char *
+ratelimit_getid()
+{
+	TRACE_BRICK_FUNC_START();
+	static char *name = "RateLimiter";
+	TRACE_BRICK_FUNC_END();
+	return name;
+}
+/*---------------------------------------------------------------------*/
+brick_funcs ratelimitfuncs = {
+	.init			= 	ratelimit_init,
+	.link			=	brick_link,
+	.process		= 	ratelimit_process,
+	.process_batch		=	ratelimit_process_batch,
+	.deinit			= 	ratelimit_deinit,
+	.getId			=	ratelimit_getid
+};
+/*---------------------------------------------------------------------*/
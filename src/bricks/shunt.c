@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/* for Brick struct */
+#include "brick.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for engine declaration */
+#include "pkt_engine.h"
+/* for string functions */
+#include <string.h>
+/* for clock_gettime */
+#include <time.h>
+/* for shunt table */
+#include "bricks_shunt.h"
+/* for pkt_flow_key() */
+#include "pkt_hash.h"
+/*---------------------------------------------------------------------*/
+/**
+ * Shunt brick. Brick.new("Shunt", [2|4], {cutoff=<bytes>,
+ * cutoff_pkts=<n>, idle=<secs>}) forwards each flow to output link 0
+ * until it has carried cutoff bytes (default 1 MB) or cutoff_pkts
+ * packets. The rest of the flow goes to link 1 if there is one, and
+ * is dropped otherwise. Both directions of a connection count
+ * together; with split mode 2 all traffic between two hosts does.
+ */
+/*---------------------------------------------------------------------*/
+typedef struct ShuntContext {
+	shunt_table tbl;
+	uint8_t hash_split;
+	/* what went past the cutoff */
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t cut_pkts;
+	uint64_t cut_bytes;
+} ShuntContext __attribute__((aligned(__WORDSIZE)));
+/*---------------------------------------------------------------------*/
+/* clock of the shunt table (secs) */
+static inline uint16_t
+shunt_clock()
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint16_t)ts.tv_sec;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Output links of a packet of len bytes of flow key
+ */
+static inline BITMAP
+shunt_pick(ShuntContext *sc, linkdata *lnd, uint64_t key, uint32_t len)
+{
+	BITMAP b;
+
+	INIT_BITMAP(b);
+	sc->pkts++;
+	sc->bytes += len;
+	if (shunt_table_account(&sc->tbl, key, len) == 0)
+		SET_BIT(b, 0);
+	else {
+		sc->cut_pkts++;
+		sc->cut_bytes += len;
+		if (lnd->count > 1)
+			SET_BIT(b, 1);
+	}
+	return b;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+shunt_init(Brick *brick, Linker_Intf *li)
+{
+	TRACE_BRICK_FUNC_START();
+	ShuntContext *sc;
+
+	sc = calloc(1, sizeof(ShuntContext));
+	if (sc == NULL) {
+		TRACE_LOG("Can't create private context for shunt\n");
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	sc->hash_split = (li->hash_split == 2) ? 2 : 4;
+	if (shunt_table_init(&sc->tbl, 0, li->cutoff_bytes,
+			     li->cutoff_pkts, li->flow_idle) == -1) {
+		TRACE_LOG("Can't allocate the shunt's flow table\n");
+		free(sc);
+		TRACE_BRICK_FUNC_END();
+		return -1;
+	}
+	brick->private_data = sc;
+	li->type = SHARE;
+	TRACE_LOG("Adding brick shunt to the engine (cutoff: %u bytes, "
+		  "%u pkts)\n", sc->tbl.cutoff_bytes, sc->tbl.cutoff_pkts);
+	TRACE_BRICK_FUNC_END();
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+BITMAP
+shunt_process(Brick *brick, unsigned char *buf, uint32_t len)
+{
+	TRACE_BRICK_FUNC_START();
+	ShuntContext *sc = brick->private_data;
+	uint64_t key;
+
+	shunt_table_tick(&sc->tbl, shunt_clock());
+	key = pkt_flow_key(buf, len, sc->hash_split);
+	TRACE_BRICK_FUNC_END();
+	return shunt_pick(sc, &brick->lnd, key, len);
+}
+/*---------------------------------------------------------------------*/
+void
+shunt_process_batch(Brick *brick, unsigned char **bufs, const uint32_t *lens,
+		    uint16_t n, BITMAP *out)
+{
+	TRACE_BRICK_FUNC_START();
+	ShuntContext *sc = brick->private_data;
+	uint64_t key[SHUNT_BATCH];
+	uint16_t i, k, c;
+
+	shunt_table_tick(&sc->tbl, shunt_clock());
+	/* key a chunk of the burst first and fetch its buckets meanwhile */
+	for (i = 0; i < n; i += c) {
+		c = (n - i < SHUNT_BATCH) ? n - i : SHUNT_BATCH;
+		for (k = 0; k < c; k++) {
+			if (i + k + 1 < n)
+				__builtin_prefetch(bufs[i + k + 1]);
+			key[k] = pkt_flow_key(bufs[i + k], lens[i + k],
+					      sc->hash_split);
+			shunt_table_prefetch(&sc->tbl, key[k]);
+		}
+		for (k = 0; k < c; k++)
+			out[i + k] = shunt_pick(sc, &brick->lnd, key[k],
+						lens[i + k]);
+	}
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+shunt_deinit(Brick *brick)
+{
+	TRACE_BRICK_FUNC_START();
+	ShuntContext *sc = brick->private_data;
+
+	if (sc != NULL) {
+		TRACE_LOG("Shunt cut off %llu of %llu pkts, %llu of %llu "
+			  "bytes\n", (unsigned long long)sc->cut_pkts,
+			  (unsigned long long)sc->pkts,
+			  (unsigned long long)sc->cut_bytes,
+			  (unsigned long long)sc->bytes);
+		shunt_table_free(&sc->tbl);
+		free(sc);
+		brick->private_data = NULL;
+	}
+	free(brick);
+	TRACE_BRICK_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+char *
+shunt_getid()
+{
+	TRACE_BRICK_FUNC_START();
+	static char *name = "Shunt";
+	TRACE_BRICK_FUNC_END();
+	return name;
+}
+/*---------------------------------------------------------------------*/
+brick_funcs shuntfuncs = {
+	.init			= 	shunt_init,
+	.link			=	brick_link,
+	.process		= 	shunt_process,
+	.process_batch		=	shunt_process_batch,
+	.deinit			= 	shunt_deinit,
+	.getId			=	shunt_getid
+};
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for threaded-code bpf */
+#include "bricks_bpf.h"
+/* for memcpy() */
+#include <string.h>
+/* for calloc()/free() */
+#include <stdlib.h>
+/* for ntohl()/ntohs() */
+#include <arpa/inet.h>
+/*---------------------------------------------------------------------*/
+/* not every bpf.h defines these */
+#ifndef BPF_MOD
+#define BPF_MOD				0x90
+#endif
+#ifndef BPF_XOR
+#define BPF_XOR				0xa0
+#endif
+/*---------------------------------------------------------------------*/
+/* the kinds of translated insns; the index into the label table */
+enum {
+	OP_LD_W_ABS = 0, OP_LD_H_ABS, OP_LD_B_ABS,
+	OP_LD_W_IND, OP_LD_H_IND, OP_LD_B_IND,
+	OP_LD_LEN, OP_LD_IMM, OP_LD_MEM,
+	OP_LDX_IMM, OP_LDX_MEM, OP_LDX_LEN, OP_LDX_MSH,
+	OP_ST, OP_STX,
+	OP_ADD_K, OP_SUB_K, OP_MUL_K, OP_DIV_K, OP_MOD_K,
+	OP_AND_K, OP_OR_K, OP_XOR_K, OP_LSH_K, OP_RSH_K,
+	OP_ADD_X, OP_SUB_X, OP_MUL_X, OP_DIV_X, OP_MOD_X,
+	OP_AND_X, OP_OR_X, OP_XOR_X, OP_LSH_X, OP_RSH_X,
+	OP_NEG,
+	OP_JA,
+	OP_JEQ_K, OP_JGT_K, OP_JGE_K, OP_JSET_K,
+	OP_JEQ_X, OP_JGT_X, OP_JGE_X, OP_JSET_X,
+	OP_RET_K, OP_RET_A,
+	OP_TAX, OP_TXA,
+	/* fused: load a packet word, then compare it against k2 */
+	OP_LD_W_ABS_JEQ, OP_LD_H_ABS_JEQ, OP_LD_B_ABS_JEQ,
+	OP_LD_W_ABS_JSET, OP_LD_H_ABS_JSET, OP_LD_B_ABS_JSET,
+	OP_MAX
+};
+/*---------------------------------------------------------------------*/
+/* true if the n bytes at offset off are not all in the packet */
+#define OUT_OF_BOUNDS(off, n)		((uint64_t)(off) + (n) > len)
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+load_w(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+load_h(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Runs the program starting at pc. If labels is not NULL, nothing is
+ * run; the label table is handed out instead (for bpf_tc_compile()).
+ */
+static uint32_t
+bpf_tc_exec(const bpf_tc_insn *pc, const uint8_t *p, uint32_t len,
+	    const void * const **labels)
+{
+	static const void * const ops[OP_MAX] = {
+		[OP_LD_W_ABS] = &&ld_w_abs, [OP_LD_H_ABS] = &&ld_h_abs,
+		[OP_LD_B_ABS] = &&ld_b_abs, [OP_LD_W_IND] = &&ld_w_ind,
+		[OP_LD_H_IND] = &&ld_h_ind, [OP_LD_B_IND] = &&ld_b_ind,
+		[OP_LD_LEN] = &&ld_len, [OP_LD_IMM] = &&ld_imm,
+		[OP_LD_MEM] = &&ld_mem, [OP_LDX_IMM] = &&ldx_imm,
+		[OP_LDX_MEM] = &&ldx_mem, [OP_LDX_LEN] = &&ldx_len,
+		[OP_LDX_MSH] = &&ldx_msh, [OP_ST] = &&st, [OP_STX] = &&stx,
+		[OP_ADD_K] = &&add_k, [OP_SUB_K] = &&sub_k,
+		[OP_MUL_K] = &&mul_k, [OP_DIV_K] = &&div_k,
+		[OP_MOD_K] = &&mod_k, [OP_AND_K] = &&and_k,
+		[OP_OR_K] = &&or_k, [OP_XOR_K] = &&xor_k,
+		[OP_LSH_K] = &&lsh_k, [OP_RSH_K] = &&rsh_k,
+		[OP_ADD_X] = &&add_x, [OP_SUB_X] = &&sub_x,
+		[OP_MUL_X] = &&mul_x, [OP_DIV_X] = &&div_x,
+		[OP_MOD_X] = &&mod_x, [OP_AND_X] = &&and_x,
+		[OP_OR_X] = &&or_x, [OP_XOR_X] = &&xor_x,
+		[OP_LSH_X] = &&lsh_x, [OP_RSH_X] = &&rsh_x,
+		[OP_NEG] = &&neg, [OP_JA] = &&ja,
+		[OP_JEQ_K] = &&jeq_k, [OP_JGT_K] = &&jgt_k,
+		[OP_JGE_K] = &&jge_k, [OP_JSET_K] = &&jset_k,
+		[OP_JEQ_X] = &&jeq_x, [OP_JGT_X] = &&jgt_x,
+		[OP_JGE_X] = &&jge_x, [OP_JSET_X] = &&jset_x,
+		[OP_RET_K] = &&ret_k, [OP_RET_A] = &&ret_a,
+		[OP_TAX] = &&tax, [OP_TXA] = &&txa,
+		[OP_LD_W_ABS_JEQ] = &&ld_w_abs_jeq,
+		[OP_LD_H_ABS_JEQ] = &&ld_h_abs_jeq,
+		[OP_LD_B_ABS_JEQ] = &&ld_b_abs_jeq,
+		[OP_LD_W_ABS_JSET] = &&ld_w_abs_jset,
+		[OP_LD_H_ABS_JSET] = &&ld_h_abs_jset,
+		[OP_LD_B_ABS_JSET] = &&ld_b_abs_jset,
+	};
+	uint32_t A = 0, X = 0;
+	uint32_t mem[BPF_MEMWORDS];
+	uint64_t off;
+
+#define NEXT()		goto *(++pc)->op
+#define BRANCH(c)	do { pc = (c) ? pc->jt : pc->jf; goto *pc->op; } while (0)
+
+	if (labels != NULL) {
+		*labels = ops;
+		return 0;
+	}
+	goto *pc->op;
+
+ ld_w_abs:
+	if (OUT_OF_BOUNDS(pc->k, 4)) return 0;
+	A = load_w(p + pc->k); NEXT();
+ ld_h_abs:
+	if (OUT_OF_BOUNDS(pc->k, 2)) return 0;
+	A = load_h(p + pc->k); NEXT();
+ ld_b_abs:
+	if (OUT_OF_BOUNDS(pc->k, 1)) return 0;
+	A = p[pc->k]; NEXT();
+ ld_w_ind:
+	off = (uint64_t)X + pc->k;
+	if (OUT_OF_BOUNDS(off, 4)) return 0;
+	A = load_w(p + off); NEXT();
+ ld_h_ind:
+	off = (uint64_t)X + pc->k;
+	if (OUT_OF_BOUNDS(off, 2)) return 0;
+	A = load_h(p + off); NEXT();
+ ld_b_ind:
+	off = (uint64_t)X + pc->k;
+	if (OUT_OF_BOUNDS(off, 1)) return 0;
+	A = p[off]; NEXT();
+ ld_len:	A = len; NEXT();
+ ld_imm:	A = pc->k; NEXT();
+ ld_mem:	A = mem[pc->k]; NEXT();
+ ldx_imm:	X = pc->k; NEXT();
+ ldx_mem:	X = mem[pc->k]; NEXT();
+ ldx_len:	X = len; NEXT();
+ ldx_msh:
+	if (OUT_OF_BOUNDS(pc->k, 1)) return 0;
+	X = (p[pc->k] & 0xf) << 2; NEXT();
+ st:		mem[pc->k] = A; NEXT();
+ stx:		mem[pc->k] = X; NEXT();
+
+ add_k:	A += pc->k; NEXT();
+ sub_k:	A -= pc->k; NEXT();
+ mul_k:	A *= pc->k; NEXT();
+ div_k:	A /= pc->k; NEXT();		/* k != 0 (checked) */
+ mod_k:	A %= pc->k; NEXT();
+ and_k:	A &= pc->k; NEXT();
+ or_k:	A |= pc->k; NEXT();
+ xor_k:	A ^= pc->k; NEXT();
+ lsh_k:	A = (pc->k < 32) ? A << pc->k : 0; NEXT();
+ rsh_k:	A = (pc->k < 32) ? A >> pc->k : 0; NEXT();
+ add_x:	A += X; NEXT();
+ sub_x:	A -= X; NEXT();
+ mul_x:	A *= X; NEXT();
+ div_x:	if (X == 0) return 0;
+	A /= X; NEXT();
+ mod_x:	if (X == 0) return 0;
+	A %= X; NEXT();
+ and_x:	A &= X; NEXT();
+ or_x:	A |= X; NEXT();
+ xor_x:	A ^= X; NEXT();
+ lsh_x:	A = (X < 32) ? A << X : 0; NEXT();
+ rsh_x:	A = (X < 32) ? A >> X : 0; NEXT();
+ neg:	A = -A; NEXT();
+
+ ja:		pc = pc->jt; goto *pc->op;
+ jeq_k:	BRANCH(A == pc->k);
+ jgt_k:	BRANCH(A > pc->k);
+ jge_k:	BRANCH(A >= pc->k);
+ jset_k:	BRANCH(A & pc->k);
+ jeq_x:	BRANCH(A == X);
+ jgt_x:	BRANCH(A > X);
+ jge_x:	BRANCH(A >= X);
+ jset_x:	BRANCH(A & X);
+
+ ret_k:	return pc->k;
+ ret_a:	return A;
+ tax:	X = A; NEXT();
+ txa:	A = X; NEXT();
+
+ ld_w_abs_jeq:
+	if (OUT_OF_BOUNDS(pc->k, 4)) return 0;
+	A = load_w(p + pc->k); BRANCH(A == pc->k2);
+ ld_h_abs_jeq:
+	if (OUT_OF_BOUNDS(pc->k, 2)) return 0;
+	A = load_h(p + pc->k); BRANCH(A == pc->k2);
+ ld_b_abs_jeq:
+	if (OUT_OF_BOUNDS(pc->k, 1)) return 0;
+	A = p[pc->k]; BRANCH(A == pc->k2);
+ ld_w_abs_jset:
+	if (OUT_OF_BOUNDS(pc->k, 4)) return 0;
+	A = load_w(p + pc->k); BRANCH(A & pc->k2);
+ ld_h_abs_jset:
+	if (OUT_OF_BOUNDS(pc->k, 2)) return 0;
+	A = load_h(p + pc->k); BRANCH(A & pc->k2);
+ ld_b_abs_jset:
+	if (OUT_OF_BOUNDS(pc->k, 1)) return 0;
+	A = p[pc->k]; BRANCH(A & pc->k2);
+
+#undef NEXT
+#undef BRANCH
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Returns the kind of translated insn for code, or -1 if unsupported
+ */
+static int
+bpf_tc_op(uint16_t code)
+{
+	switch (code) {
+	case BPF_LD|BPF_W|BPF_ABS:	return OP_LD_W_ABS;
+	case BPF_LD|BPF_H|BPF_ABS:	return OP_LD_H_ABS;
+	case BPF_LD|BPF_B|BPF_ABS:	return OP_LD_B_ABS;
+	case BPF_LD|BPF_W|BPF_IND:	return OP_LD_W_IND;
+	case BPF_LD|BPF_H|BPF_IND:	return OP_LD_H_IND;
+	case BPF_LD|BPF_B|BPF_IND:	return OP_LD_B_IND;
+	case BPF_LD|BPF_W|BPF_LEN:	return OP_LD_LEN;
+	case BPF_LD|BPF_IMM:		return OP_LD_IMM;
+	case BPF_LD|BPF_MEM:		return OP_LD_MEM;
+	case BPF_LDX|BPF_W|BPF_IMM:	return OP_LDX_IMM;
+	case BPF_LDX|BPF_W|BPF_MEM:	return OP_LDX_MEM;
+	case BPF_LDX|BPF_W|BPF_LEN:	return OP_LDX_LEN;
+	case BPF_LDX|BPF_B|BPF_MSH:	return OP_LDX_MSH;
+	case BPF_ST:			return OP_ST;
+	case BPF_STX:			return OP_STX;
+	case BPF_ALU|BPF_ADD|BPF_K:	return OP_ADD_K;
+	case BPF_ALU|BPF_SUB|BPF_K:	return OP_SUB_K;
+	case BPF_ALU|BPF_MUL|BPF_K:	return OP_MUL_K;
+	case BPF_ALU|BPF_DIV|BPF_K:	return OP_DIV_K;
+	case BPF_ALU|BPF_MOD|BPF_K:	return OP_MOD_K;
+	case BPF_ALU|BPF_AND|BPF_K:	return OP_AND_K;
+	case BPF_ALU|BPF_OR|BPF_K:	return OP_OR_K;
+	case BPF_ALU|BPF_XOR|BPF_K:	return OP_XOR_K;
+	case BPF_ALU|BPF_LSH|BPF_K:	return OP_LSH_K;
+	case BPF_ALU|BPF_RSH|BPF_K:	return OP_RSH_K;
+	case BPF_ALU|BPF_ADD|BPF_X:	return OP_ADD_X;
+	case BPF_ALU|BPF_SUB|BPF_X:	return OP_SUB_X;
+	case BPF_ALU|BPF_MUL|BPF_X:	return OP_MUL_X;
+	case BPF_ALU|BPF_DIV|BPF_X:	return OP_DIV_X;
+	case BPF_ALU|BPF_MOD|BPF_X:	return OP_MOD_X;
+	case BPF_ALU|BPF_AND|BPF_X:	return OP_AND_X;
+	case BPF_ALU|BPF_OR|BPF_X:	return OP_OR_X;
+	case BPF_ALU|BPF_XOR|BPF_X:	return OP_XOR_X;
+	case BPF_ALU|BPF_LSH|BPF_X:	return OP_LSH_X;
+	case BPF_ALU|BPF_RSH|BPF_X:	return OP_RSH_X;
+	case BPF_ALU|BPF_NEG:		return OP_NEG;
+	case BPF_JMP|BPF_JA:		return OP_JA;
+	case BPF_JMP|BPF_JEQ|BPF_K:	return OP_JEQ_K;
+	case BPF_JMP|BPF_JGT|BPF_K:	return OP_JGT_K;
+	case BPF_JMP|BPF_JGE|BPF_K:	return OP_JGE_K;
+	case BPF_JMP|BPF_JSET|BPF_K:	return OP_JSET_K;
+	case BPF_JMP|BPF_JEQ|BPF_X:	return OP_JEQ_X;
+	case BPF_JMP|BPF_JGT|BPF_X:	return OP_JGT_X;
+	case BPF_JMP|BPF_JGE|BPF_X:	return OP_JGE_X;
+	case BPF_JMP|BPF_JSET|BPF_X:	return OP_JSET_X;
+	case BPF_RET|BPF_K:		return OP_RET_K;
+	case BPF_RET|BPF_A:		return OP_RET_A;
+	case BPF_MISC|BPF_TAX:		return OP_TAX;
+	case BPF_MISC|BPF_TXA:		return OP_TXA;
+	default:			return -1;
+	}
+}
+/*---------------------------------------------------------------------*/
+int
+bpf_tc_compile(bpf_tc *tc, const struct bpf_insn *insns, uint32_t len)
+{
+	const void * const *labels;
+	const struct bpf_insn *in;
+	uint8_t *target = NULL;
+	bpf_tc_insn *out = NULL;
+	uint32_t i, jt, jf;
+	int op;
+
+	if (len == 0 || BPF_CLASS(insns[len - 1].code) != BPF_RET)
+		goto fail;
+	out = calloc(len, sizeof(bpf_tc_insn));
+	target = calloc(len, sizeof(uint8_t));
+	if (out == NULL || target == NULL)
+		goto fail;
+	bpf_tc_exec(NULL, NULL, 0, &labels);
+
+	/* translate, and check what bpf_validate() would */
+	for (i = 0; i < len; i++) {
+		in = &insns[i];
+		op = bpf_tc_op(in->code);
+		if (op == -1)
+			goto fail;
+		out[i].op = labels[op];
+		out[i].k = in->k;
+		switch (BPF_CLASS(in->code)) {
+		case BPF_JMP:
+			if (op == OP_JA) {
+				if (in->k >= len - i - 1)
+					goto fail;
+				jt = jf = i + 1 + in->k;
+			} else {
+				jt = i + 1 + in->jt;
+				jf = i + 1 + in->jf;
+				if (jt >= len || jf >= len)
+					goto fail;
+			}
+			out[i].jt = &out[jt];
+			out[i].jf = &out[jf];
+			target[jt] = target[jf] = 1;
+			break;
+		case BPF_LD:
+		case BPF_LDX:
+			if (BPF_MODE(in->code) == BPF_MEM &&
+			    in->k >= BPF_MEMWORDS)
+				goto fail;
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			if (in->k >= BPF_MEMWORDS)
+				goto fail;
+			break;
+		case BPF_ALU:
+			if ((op == OP_DIV_K || op == OP_MOD_K) && in->k == 0)
+				goto fail;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* fuse a packet load with the compare right after it */
+	for (i = 0; i + 1 < len; i++) {
+		if (BPF_CLASS(insns[i].code) != BPF_LD ||
+		    BPF_MODE(insns[i].code) != BPF_ABS || target[i + 1])
+			continue;
+		if (insns[i + 1].code == (BPF_JMP|BPF_JEQ|BPF_K))
+			op = OP_LD_W_ABS_JEQ;
+		else if (insns[i + 1].code == (BPF_JMP|BPF_JSET|BPF_K))
+			op = OP_LD_W_ABS_JSET;
+		else
+			continue;
+		/* same order of sizes as OP_LD_{W,H,B}_ABS */
+		op += bpf_tc_op(insns[i].code) - OP_LD_W_ABS;
+		out[i].op = labels[op];
+		out[i].k2 = insns[i + 1].k;
+		out[i].jt = out[i + 1].jt;
+		out[i].jf = out[i + 1].jf;
+	}
+
+	free(target);
+	tc->insns = out;
+	tc->len = len;
+	return 0;
+
+ fail:
+	free(target);
+	free(out);
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+uint32_t
+bpf_tc_run(const bpf_tc *tc, const uint8_t *pkt, uint32_t len)
+{
+	return bpf_tc_exec(tc->insns, pkt, len, NULL);
+}
+/*---------------------------------------------------------------------*/
+void
+bpf_tc_free(bpf_tc *tc)
+{
+	free(tc->insns);
+	tc->insns = NULL;
+	tc->len = 0;
+}
+/*---------------------------------------------------------------------*/
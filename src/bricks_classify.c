@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for classifier structs */
+#include "bricks_classify.h"
+/* for string functions */
+#include <string.h>
+/* for calloc()/free()/qsort() */
+#include <stdlib.h>
+/* for [n/h]to[h/n][ls] */
+#include <arpa/inet.h>
+/* for ipv6_skip_ext_hdrs() */
+#include "pkt_hash.h"
+/*---------------------------------------------------------------------*/
+#define ETHERTYPE_IPV4			0x0800
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6			0x86DD
+#endif
+#ifndef ETHERTYPE_VLAN
+#define ETHERTYPE_VLAN			0x8100
+#endif
+#define ETHERTYPE_QINQ			0x88A8
+#define PROTO_TCP			6
+#define PROTO_UDP			17
+#define PROTO_SCTP			132
+/*---------------------------------------------------------------------*/
+/* keys are hashed and masked a word at a time */
+typedef uint32_t __attribute__((__may_alias__)) cls_word;
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+cls_hash(const uint32_t *w, uint32_t n)
+{
+	uint32_t h = 0x9E3779B9;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		h ^= w[i];
+		h *= 0x85EBCA6B;
+		h ^= h >> 15;
+	}
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
+/*---------------------------------------------------------------------*/
+static inline void
+cls_mask_key(cls_key *to, const cls_key *from, const cls_key *mask)
+{
+	const cls_word *f = (const cls_word *)from;
+	const cls_word *m = (const cls_word *)mask;
+	cls_word *t = (cls_word *)to;
+	uint32_t i;
+
+	for (i = 0; i < CLS_KEY_WORDS; i++)
+		t[i] = f[i] & m[i];
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Picks the words of key the tuple looks at, masked, into w
+ */
+static inline void
+tuple_words(uint32_t *w, const cls_tuple *t, const cls_key *key)
+{
+	const cls_word *k = (const cls_word *)key;
+	uint32_t i;
+
+	for (i = 0; i < t->nwords; i++)
+		w[i] = k[t->word[i]] & t->mask[i];
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Sets the first len bits of the (network byte order) address a
+ */
+static void
+prefix_mask(uint32_t *a, uint8_t len)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, len = (len > 32) ? len - 32 : 0)
+		a[i] = (len >= 32) ? 0xFFFFFFFF :
+			(len == 0) ? 0 : htonl(~(0xFFFFFFFF >> len));
+}
+/*---------------------------------------------------------------------*/
+static void
+make_mask(cls_key *mask, uint8_t fields, uint8_t src_len, uint8_t dst_len)
+{
+	memset(mask, 0, sizeof(cls_key));
+	prefix_mask(mask->src, src_len);
+	prefix_mask(mask->dst, dst_len);
+	if (fields & CLS_VLAN)
+		mask->vlan = 0xFFFF;
+	if (fields & CLS_ETHER)
+		mask->ether = 0xFFFF;
+	if (fields & CLS_PROTO)
+		mask->proto = 0xFFFFFFFF;
+	if (fields & CLS_SPORT)
+		mask->sport = 0xFFFF;
+	if (fields & CLS_DPORT)
+		mask->dport = 0xFFFF;
+}
+/*---------------------------------------------------------------------*/
+int
+cls_rule_match(const cls_rule *r, const cls_key *key)
+{
+	cls_key mask, a, b;
+
+	make_mask(&mask, r->fields, r->src_len, r->dst_len);
+	cls_mask_key(&a, key, &mask);
+	cls_mask_key(&b, &r->key, &mask);
+	return !memcmp(&a, &b, sizeof(cls_key));
+}
+/*---------------------------------------------------------------------*/
+void
+cls_key_from_pkt(cls_key *key, const uint8_t *pkt, uint32_t len)
+{
+	const uint8_t *l3, *l4 = NULL;
+	uint8_t proto;
+	uint16_t type;
+	int tags;
+
+	memset(key, 0, sizeof(cls_key));
+	key->vlan = CLS_VLAN_NONE;
+
+	/* the outermost VLAN tag counts; up to two tags are skipped */
+	type = (pkt[12] << 8) | pkt[13];
+	l3 = pkt + 14;
+	for (tags = 0; tags < 2 && (type == ETHERTYPE_VLAN ||
+				    type == ETHERTYPE_QINQ); tags++) {
+		if (tags == 0)
+			key->vlan = ((l3[0] << 8) | l3[1]) & 0x0FFF;
+		type = (l3[2] << 8) | l3[3];
+		l3 += 4;
+	}
+	key->ether = type;
+
+	switch (type) {
+	case ETHERTYPE_IPV4:
+		key->proto = l3[9];
+		memcpy(&key->src[0], l3 + 12, 4);
+		memcpy(&key->dst[0], l3 + 16, 4);
+		/* only the first fragment has the ports */
+		if ((((l3[6] << 8) | l3[7]) & 0x1FFF) == 0)
+			l4 = l3 + ((l3[0] & 0x0F) << 2);
+		break;
+	case ETHERTYPE_IPV6:
+		memcpy(key->src, l3 + 8, 16);
+		memcpy(key->dst, l3 + 24, 16);
+		l4 = ipv6_skip_ext_hdrs(l3, pkt + len, &proto, NULL);
+		key->proto = proto;
+		break;
+	default:
+		return;
+	}
+
+	if (l4 != NULL && (key->proto == PROTO_TCP ||
+			   key->proto == PROTO_UDP ||
+			   key->proto == PROTO_SCTP)) {
+		key->sport = (l4[0] << 8) | l4[1];
+		key->dport = (l4[2] << 8) | l4[3];
+	}
+}
+/*---------------------------------------------------------------------*/
+uint64_t
+cls_lookup(const classifier *c, const cls_key *key)
+{
+	const cls_tuple *t, *end = c->tuples + c->count;
+	const cls_entry *e;
+	uint32_t best = UINT32_MAX;
+	uint64_t out = 0;
+	uint32_t w[CLS_KEY_WORDS];
+	uint32_t h;
+
+	for (t = c->tuples; t < end && t->best < best; t++) {
+		tuple_words(w, t, key);
+		h = cls_hash(w, t->nwords);
+		for (e = t->buckets[h & t->bmask]; e != NULL; e = e->next) {
+			if (e->hash == h && e->prio < best &&
+			    !memcmp(e->w, w, t->nwords * sizeof(uint32_t))) {
+				best = e->prio;
+				out = e->out;
+			}
+		}
+	}
+	return out;
+}
+/*---------------------------------------------------------------------*/
+static int
+cmp_tuples(const void *a, const void *b)
+{
+	const cls_tuple *ta = (const cls_tuple *)a;
+	const cls_tuple *tb = (const cls_tuple *)b;
+
+	return (ta->best > tb->best) - (ta->best < tb->best);
+}
+/*---------------------------------------------------------------------*/
+int
+cls_build(classifier *c, const cls_rule *rules, uint32_t n)
+{
+	const cls_rule *r;
+	cls_tuple *t;
+	cls_entry *e, **pe;
+	uint32_t *idx;
+	uint32_t i, j, k, size, h;
+	uint32_t w[CLS_KEY_WORDS];
+	cls_key mask;
+	const cls_word *m = (const cls_word *)&mask;
+
+	memset(c, 0, sizeof(classifier));
+	idx = calloc(n + 1, sizeof(uint32_t));
+	c->tuples = calloc(n + 1, sizeof(cls_tuple));
+	if (idx == NULL || c->tuples == NULL)
+		goto fail;
+
+	/* group the rules by the fields they match on */
+	for (i = 0; i < n; i++) {
+		r = &rules[i];
+		for (j = 0; j < c->count; j++) {
+			t = &c->tuples[j];
+			if (t->fields == r->fields && t->src_len == r->src_len &&
+			    t->dst_len == r->dst_len)
+				break;
+		}
+		if (j == c->count) {
+			t = &c->tuples[c->count++];
+			t->fields = r->fields;
+			t->src_len = r->src_len;
+			t->dst_len = r->dst_len;
+			t->best = i;
+			make_mask(&mask, r->fields, r->src_len, r->dst_len);
+			for (k = 0; k < CLS_KEY_WORDS; k++) {
+				if (m[k] == 0)
+					continue;
+				t->mask[t->nwords] = m[k];
+				t->word[t->nwords++] = k;
+			}
+		}
+		c->tuples[j].count++;
+		idx[i] = j;
+	}
+
+	for (j = 0; j < c->count; j++) {
+		t = &c->tuples[j];
+		for (size = CLS_MIN_BUCKETS; size < t->count; size <<= 1)
+			;
+		t->buckets = calloc(size, sizeof(cls_entry *));
+		if (t->buckets == NULL)
+			goto fail;
+		t->bmask = size - 1;
+		t->count = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		t = &c->tuples[idx[i]];
+		tuple_words(w, t, &rules[i].key);
+		h = cls_hash(w, t->nwords);
+		pe = &t->buckets[h & t->bmask];
+		/* a rule shadowed by an earlier one is left out */
+		for (e = *pe; e != NULL; e = e->next)
+			if (!memcmp(e->w, w, t->nwords * sizeof(uint32_t)))
+				break;
+		if (e != NULL)
+			continue;
+		e = calloc(1, sizeof(cls_entry));
+		if (e == NULL)
+			goto fail;
+		memcpy(e->w, w, t->nwords * sizeof(uint32_t));
+		e->hash = h;
+		e->prio = i;
+		e->out = rules[i].out;
+		e->next = *pe;
+		*pe = e;
+		t->count++;
+	}
+
+	qsort(c->tuples, c->count, sizeof(cls_tuple), cmp_tuples);
+	free(idx);
+	return 0;
+
+ fail:
+	free(idx);
+	cls_free(c);
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+void
+cls_free(classifier *c)
+{
+	cls_entry *e, *next;
+	cls_tuple *t;
+	uint32_t i, j;
+
+	for (j = 0; c->tuples != NULL && j < c->count; j++) {
+		t = &c->tuples[j];
+		for (i = 0; t->buckets != NULL && i <= t->bmask; i++) {
+			for (e = t->buckets[i]; e != NULL; e = next) {
+				next = e->next;
+				free(e);
+			}
+		}
+		free(t->buckets);
+	}
+	free(c->tuples);
+	memset(c, 0, sizeof(classifier));
+}
+/*---------------------------------------------------------------------*/
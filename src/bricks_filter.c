@@ -30,6 +30,8 @@
 #include "bricks_log.h"
 /* for string functions */
 #include <string.h>
+/* for offsetof() */
+#include <stddef.h>
 /* for io modules */
 #include "io_module.h"
 /* for function prototypes */
@@ -48,6 +50,8 @@
 #include <netinet/ip.h>
 /* ipv6hdr */
 #include <netinet/ip6.h>
+/* for ipv6_skip_ext_hdrs() */
+#include "pkt_hash.h"
 
 #if linux
 #define IPV6_VERSION 0x60
@@ -76,6 +80,11 @@
 	(faddr.addr32 == 0 || (a.s_addr & faddr.ip_mask) == faddr.ip_masked)
 #define FLOW_PORT_CHECK(p_a, p_b)		\
 	(p_a == 0 || (p_a == p_b))
+#define IP6_PREFIX_LEN(faddr)			\
+	((faddr.mask == 0 || faddr.mask > 128) ? 128 : faddr.mask)
+/* a timed filter is gone once more than filt_time_period secs passed */
+#define FILTER_EXPIRES(f)				\
+	((f)->filt_start_time + (f)->filt_time_period + 1)
 /*---------------------------------------------------------------------*/
 static inline int32_t
 HandleConnectionFilterIPv4Tcp(Filter *f, struct ip *iph, struct tcphdr *tcph)
@@ -222,19 +231,32 @@ HandleIPv4Filter(Filter *f, struct ip *iph)
 {
 	TRACE_FILTER_FUNC_START();
 	return (f->proto == IPVERSION &&
-		(f->ip4addr.addr32 == iph->ip_src.s_addr ||
-		 f->ip4addr.addr32 == iph->ip_dst.s_addr)
+		((iph->ip_src.s_addr & f->ip4addr.ip_mask) == f->ip4addr.ip_masked ||
+		 (iph->ip_dst.s_addr & f->ip4addr.ip_mask) == f->ip4addr.ip_masked)
 		) ? 0 : 1;	
 	TRACE_FILTER_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Returns 1 if the first len bits of a and b are the same
+ */
+static inline int
+ip6_prefix_match(const uint8_t *a, const uint8_t *b, uint8_t len)
+{
+	return (memcmp(a, b, len >> 3) == 0 &&
+		((len & 7) == 0 ||
+		 ((a[len >> 3] ^ b[len >> 3]) & (0xFF << (8 - (len & 7)))) == 0));
+}
+/*---------------------------------------------------------------------*/
 static inline int32_t
 HandleIPv6Filter(Filter *f, struct ip6_hdr *ip6h)
 {
 	TRACE_FILTER_FUNC_START();
+	uint8_t len = IP6_PREFIX_LEN(f->ip6addr);
+
 	return (f->proto == IPV6_VERSION &&
-		(!memcmp(f->ip6addr.addr32, ip6h->ip6_src.s6_addr, 16) ||
-		 !memcmp(f->ip6addr.addr32, ip6h->ip6_dst.s6_addr, 16)))
+		(ip6_prefix_match(f->ip6addr.addr8, ip6h->ip6_src.s6_addr, len) ||
+		 ip6_prefix_match(f->ip6addr.addr8, ip6h->ip6_dst.s6_addr, len)))
 		? 0 : 1;
 	TRACE_FILTER_FUNC_END();
 }
@@ -251,9 +273,236 @@ HandleMACFilter(Filter *f, struct ether_header *ethh)
 	TRACE_FILTER_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Fills key with the connection (src, sport) <-> (dst, dport), no
+ * matter which direction it is seen in. len is the address length.
+ */
+static inline void
+make_conn_key(conn_key *key, uint32_t proto, const void *src, const void *dst,
+	      size_t len, uint16_t sport, uint16_t dport)
+{
+	int c = memcmp(src, dst, len);
+
+	memset(key, 0, sizeof(conn_key));
+	key->proto = proto;
+	if (c < 0 || (c == 0 && sport <= dport)) {
+		memcpy(key->lo_addr, src, len);
+		memcpy(key->hi_addr, dst, len);
+		key->lo_port = sport;
+		key->hi_port = dport;
+	} else {
+		memcpy(key->lo_addr, dst, len);
+		memcpy(key->hi_addr, src, len);
+		key->lo_port = dport;
+		key->hi_port = sport;
+	}
+}
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+conn_hash(const conn_key *key)
+{
+	const uint32_t *w = (const uint32_t *)key;
+	uint32_t h = 0x9E3779B9;
+	uint i;
+
+	for (i = 0; i < sizeof(conn_key) / sizeof(uint32_t); i++) {
+		h ^= w[i];
+		h *= 0x85EBCA6B;
+		h ^= h >> 15;
+	}
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Connection filters on host addresses go to the hash table; the ones
+ * with shorter IPv4 prefixes stay on the filter list.
+ */
+static inline int
+is_exact_conn_filter(Filter *f)
+{
+	return (f->filter_type_flag == BRICKS_CONNECTION_FILTER &&
+		(f->proto == IPV6_VERSION ||
+		 ((f->conn.sip4addr.mask == 0 ||
+		   f->conn.sip4addr.mask == INET_MASK) &&
+		  (f->conn.dip4addr.mask == 0 ||
+		   f->conn.dip4addr.mask == INET_MASK))));
+}
+/*---------------------------------------------------------------------*/
+static inline void
+filter_conn_key(conn_key *key, Filter *f)
+{
+	if (f->proto == IPVERSION)
+		make_conn_key(key, IPVERSION, &f->conn.sip4addr.addr32,
+			      &f->conn.dip4addr.addr32, sizeof(uint32_t),
+			      f->conn.sport, f->conn.dport);
+	else
+		make_conn_key(key, IPV6_VERSION, f->conn.sip6addr.addr32,
+			      f->conn.dip6addr.addr32, sizeof(struct in6_addr),
+			      f->conn.sport, f->conn.dport);
+}
+/*---------------------------------------------------------------------*/
+static int
+conn_table_grow(conn_table *ct)
+{
+	TRACE_FILTER_FUNC_START();
+	conn_entry **buckets, *ce, *next;
+	uint32_t size, i;
+
+	size = (ct->buckets == NULL) ? CONN_TABLE_MIN_BUCKETS :
+		(ct->mask + 1) << 1;
+	buckets = calloc(size, sizeof(conn_entry *));
+	if (buckets == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+
+	for (i = 0; ct->buckets != NULL && i <= ct->mask; i++) {
+		for (ce = ct->buckets[i]; ce != NULL; ce = next) {
+			next = ce->next;
+			ce->next = buckets[ce->hash & (size - 1)];
+			buckets[ce->hash & (size - 1)] = ce;
+		}
+	}
+	free(ct->buckets);
+	ct->buckets = buckets;
+	ct->mask = size - 1;
+
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static int
+conn_table_insert(conn_table *ct, Filter *f)
+{
+	TRACE_FILTER_FUNC_START();
+	conn_entry *ce;
+
+	if ((ct->buckets == NULL || ct->count > ct->mask) &&
+	    conn_table_grow(ct) == -1 && ct->buckets == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+	ce = calloc(1, sizeof(conn_entry));
+	if (ce == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+
+	filter_conn_key(&ce->key, f);
+	ce->hash = conn_hash(&ce->key);
+	ce->f = f;
+	ce->next = ct->buckets[ce->hash & ct->mask];
+	ct->buckets[ce->hash & ct->mask] = ce;
+	ct->count++;
+
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static void
+conn_table_remove(conn_table *ct, Filter *f)
+{
+	TRACE_FILTER_FUNC_START();
+	conn_entry **pce, *ce;
+	conn_key key;
+
+	filter_conn_key(&key, f);
+	for (pce = &ct->buckets[conn_hash(&key) & ct->mask];
+	     (ce = *pce) != NULL; pce = &ce->next) {
+		if (ce->f == f) {
+			*pce = ce->next;
+			ct->count--;
+			free(ce);
+			break;
+		}
+	}
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Looks up the connection of the packet. Returns WHITELIST or DROP if
+ * a filter of the connection matches (WHITELIST wins) and 0 otherwise.
+ */
+static inline int
+conn_table_lookup(conn_table *ct, const conn_key *key)
+{
+	TRACE_FILTER_FUNC_START();
+	conn_entry *ce;
+	uint32_t h = conn_hash(key);
+	int rc = 0;
+
+	for (ce = ct->buckets[h & ct->mask]; ce != NULL; ce = ce->next) {
+		if (ce->hash != h || memcmp(&ce->key, key, sizeof(conn_key)))
+			continue;
+		if (ce->f->tgt == WHITELIST) {
+			TRACE_FILTER_FUNC_END();
+			return WHITELIST;
+		}
+		rc = DROP;
+	}
+
+	TRACE_FILTER_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Runs the filters of prefix p and of all prefixes covering it. IP
+ * filters match by virtue of being there; flow filters still need to
+ * check the rest of the flow. Returns WHITELIST, DROP or 0 like
+ * conn_table_lookup() does.
+ */
+static inline int
+prefix_filters(lpm_prefix *p, struct ip *iph, struct ip6_hdr *ip6h,
+	       struct tcphdr *tcph, struct udphdr *udph)
+{
+	TRACE_FILTER_FUNC_START();
+	filter_set *fs;
+	Filter *f;
+	int rc = 0;
+	int match;
+
+	for (; p != NULL; p = p->parent) {
+		fs = (filter_set *)p->data;
+		if (fs == NULL)
+			continue;
+		TAILQ_FOREACH(f, &fs->ip_filters, entry) {
+			if (f->tgt == WHITELIST) {
+				TRACE_FILTER_FUNC_END();
+				return WHITELIST;
+			}
+			rc = DROP;
+		}
+		if (tcph == NULL && udph == NULL)
+			continue;
+		TAILQ_FOREACH(f, &fs->flow_filters, entry) {
+			if (iph != NULL)
+				match = (tcph != NULL) ?
+					HandleFlowFilterIPv4Tcp(f, iph, tcph) :
+					HandleFlowFilterIPv4Udp(f, iph, udph);
+			else
+				match = (tcph != NULL) ?
+					HandleFlowFilterIPv6Tcp(f, ip6h, tcph) :
+					HandleFlowFilterIPv6Udp(f, ip6h, udph);
+			if (match == 0) {
+				if (f->tgt == WHITELIST) {
+					TRACE_FILTER_FUNC_END();
+					return WHITELIST;
+				}
+				rc = DROP;
+			}
+		}
+	}
+
+	TRACE_FILTER_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
 /* Under construction.. */
 int
-analyze_packet(unsigned char *buf, FilterContext *cn, time_t current_time)	
+analyze_packet(unsigned char *buf, uint32_t len, FilterContext *cn)
 {	
 	TRACE_FILTER_FUNC_START();
 	struct ether_header *ethh = NULL;
@@ -262,8 +511,15 @@ analyze_packet(unsigned char *buf, FilterContext *cn, time_t current_time)
 	struct tcphdr *tcph = NULL;
 	struct udphdr *udph = NULL;
 	int rc = 1;
+	int match;
 	Filter *f = NULL;
-	Filter *f_prev = NULL;
+	conn_key key;
+	lpm_prefix *p[2];
+	uint8_t *l4;
+	uint8_t proto;
+	int i;
+	/* stays valid until the engine's next quiescent point */
+	filter_table *t = __atomic_load_n(&cn->tbl, __ATOMIC_ACQUIRE);
 
 	ethh = (struct ether_header *)buf;
 	switch (ntohs(ethh->ether_type)) {
@@ -304,87 +560,126 @@ analyze_packet(unsigned char *buf, FilterContext *cn, time_t current_time)
 
  locate_l46:
 	if (ip6h != NULL) {
-		switch (ntohs(ip6h->ip6_ctlun.ip6_un1.ip6_un1_nxt)) {
+		l4 = (uint8_t *)ipv6_skip_ext_hdrs((uint8_t *)ip6h, buf + len,
+						   &proto, NULL);
+		switch ((l4 != NULL) ? proto : IPPROTO_NONE) {
 		case IPPROTO_TCP:
-			tcph = (struct tcphdr *)(ip6h + 1);
+			tcph = (struct tcphdr *)l4;
 			break;
 		case IPPROTO_UDP:
-			udph = (struct udphdr *)(ip6h + 1);
+			udph = (struct udphdr *)l4;
 			break;
 		case IPPROTO_IPIP:
-			iph = (struct ip *)(ip6h + 1);
+			iph = (struct ip *)l4;
 			ip6h = NULL;
 			goto locate_l4;
 			break;
 		case IPPROTO_IPV6:
-			ip6h = (struct ip6_hdr *)(ip6h + 1);
+			ip6h = (struct ip6_hdr *)l4;
 			iph = NULL;
 			goto locate_l46;
 			break;
 		}
 	}
-	TAILQ_FOREACH_SAFE(f, &cn->filter_list, entry, f_prev) {
-		if (unlikely((f->filt_time_period >= 0) &&
-			     (current_time - f->filt_start_time >
-			      f->filt_time_period))) {
-			/* filter has expired, delete entry */
-			if (f->filter_type_flag != BRICKS_NO_FILTER) {
-				f->filter_type_flag = BRICKS_NO_FILTER;
-				TRACE_LOG("Disabling filter: current_time: %d, filt_start_time: %d, filt_time_period: %d\n",
-					  (int)current_time, (int)f->filt_start_time, (int)f->filt_time_period);
-			}
-			TAILQ_REMOVE(&cn->filter_list, f, entry);
-			free(f);
-			continue;
+
+	/* connection filters on exact addresses: single hash lookup */
+	if (t->conn_tbl.count != 0 && (tcph != NULL || udph != NULL)) {
+		if (iph != NULL)
+			make_conn_key(&key, IPVERSION, &iph->ip_src, &iph->ip_dst,
+				      sizeof(struct in_addr),
+				      (tcph != NULL) ? tcph->th_sport : udph->uh_sport,
+				      (tcph != NULL) ? tcph->th_dport : udph->uh_dport);
+		else
+			make_conn_key(&key, IPV6_VERSION, &ip6h->ip6_src,
+				      &ip6h->ip6_dst, sizeof(struct in6_addr),
+				      (tcph != NULL) ? tcph->th_sport : udph->uh_sport,
+				      (tcph != NULL) ? tcph->th_dport : udph->uh_dport);
+		switch (conn_table_lookup(&t->conn_tbl, &key)) {
+		case WHITELIST:
+			TRACE_FILTER_FUNC_END();
+			return 1;
+		case DROP:
+			rc = 0;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* IP and flow filters: a prefix lookup per address */
+	if (iph != NULL) {
+		p[0] = lpm4_lookup(&t->ip4_lpm, iph->ip_src.s_addr);
+		p[1] = lpm4_lookup(&t->ip4_lpm, iph->ip_dst.s_addr);
+	} else {
+		p[0] = lpm6_lookup(&t->ip6_lpm, &ip6h->ip6_src);
+		p[1] = lpm6_lookup(&t->ip6_lpm, &ip6h->ip6_dst);
+	}
+	for (i = 0; i < 2; i++) {
+		switch (prefix_filters(p[i], iph, ip6h, tcph, udph)) {
+		case WHITELIST:
+			TRACE_FILTER_FUNC_END();
+			return 1;
+		case DROP:
+			rc = 0;
+			break;
+		default:
+			break;
 		}
+	}
 
+	TAILQ_FOREACH(f, &t->filter_list, entry) {
+		match = 1;
 		switch (f->filter_type_flag) {
 		case BRICKS_CONNECTION_FILTER:
 			if (iph != NULL) {
 				if (tcph != NULL)
-					rc = HandleConnectionFilterIPv4Tcp(f, iph, tcph);
+					match = HandleConnectionFilterIPv4Tcp(f, iph, tcph);
 				else if (udph != NULL)
-					rc = HandleConnectionFilterIPv4Udp(f, iph, udph);
+					match = HandleConnectionFilterIPv4Udp(f, iph, udph);
 			} else if (ip6h != NULL) {
 				if (tcph != NULL)
-					rc = HandleConnectionFilterIPv6Tcp(f, ip6h, tcph);
+					match = HandleConnectionFilterIPv6Tcp(f, ip6h, tcph);
 				else if (udph != NULL)
-					rc = HandleConnectionFilterIPv6Udp(f, ip6h, udph);
+					match = HandleConnectionFilterIPv6Udp(f, ip6h, udph);
 			}
 			TRACE_DEBUG_LOG("Connection filter\n");
 			break;
 		case BRICKS_FLOW_FILTER:
 			if (iph != NULL) {
 				if (tcph != NULL)
-					rc = HandleFlowFilterIPv4Tcp(f, iph, tcph);
+					match = HandleFlowFilterIPv4Tcp(f, iph, tcph);
 				else if (udph != NULL)
-					rc = HandleFlowFilterIPv4Udp(f, iph, udph);
+					match = HandleFlowFilterIPv4Udp(f, iph, udph);
 			} else if (ip6h != NULL) {
 				if (tcph != NULL)
-					rc = HandleFlowFilterIPv6Tcp(f, ip6h, tcph);
+					match = HandleFlowFilterIPv6Tcp(f, ip6h, tcph);
 				else if (udph != NULL)
-					rc = HandleFlowFilterIPv6Udp(f, ip6h, udph);
+					match = HandleFlowFilterIPv6Udp(f, ip6h, udph);
 			}
 			TRACE_DEBUG_LOG("Flow filter\n");
 			break;
 		case BRICKS_IP_FILTER:
 			if (iph != NULL) {
-				rc = HandleIPv4Filter(f, iph);
+				match = HandleIPv4Filter(f, iph);
 			} else if (ip6h != NULL) {
-				rc = HandleIPv6Filter(f, ip6h);
+				match = HandleIPv6Filter(f, ip6h);
 			}
 			TRACE_DEBUG_LOG("IP filter\n");
 			break;			
 		case BRICKS_MAC_FILTER:
-			rc = HandleMACFilter(f, ethh);
+			match = HandleMACFilter(f, ethh);
 			TRACE_DEBUG_LOG("MAC filter\n");
 			break;
 		default:
 			break;
 		}
 
-		if (rc == 0 && f->tgt == WHITELIST)
-			return 1;
+		/* a match sticks; a whitelisting match always wins */
+		if (match == 0) {
+			if (f->tgt == WHITELIST)
+				return 1;
+			rc = 0;
+		}
 	}
 
 	TRACE_FILTER_FUNC_END();
@@ -416,6 +711,11 @@ static inline void
 adjustMasks(Filter *f)
 {
 	TRACE_FILTER_FUNC_START();
+	/* the IPv4 masks share their space with IPv6 addresses */
+	if (f->proto != IPVERSION) {
+		TRACE_FILTER_FUNC_END();
+		return;
+	}
 	switch (f->filter_type_flag) {
 	case BRICKS_CONNECTION_FILTER:
 	case BRICKS_FLOW_FILTER:
@@ -425,7 +725,9 @@ adjustMasks(Filter *f)
 		f->conn.dip4addr.ip_masked = f->conn.dip4addr.addr32 & f->conn.dip4addr.ip_mask;		
 		break;
 	case BRICKS_IP_FILTER:
-		f->ip4addr.ip_mask = MaskFromPrefix(f->ip4addr.mask);
+		/* an IP filter without a prefix length is on a host */
+		f->ip4addr.ip_mask = MaskFromPrefix((f->ip4addr.mask == 0) ?
+						    INET_MASK : f->ip4addr.mask);
 		f->ip4addr.ip_masked = f->ip4addr.addr32 & f->ip4addr.ip_mask;
 		break;
 	default:
@@ -435,6 +737,252 @@ adjustMasks(Filter *f)
 	TRACE_FILTER_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Adds an IP or flow filter to the prefix tables. IP filters go under
+ * their prefix and flow filters under their source prefix (the /0
+ * prefix if the source is a wildcard). Returns -1 if the filter can't
+ * be indexed (it then stays on the filter list).
+ */
+static int
+prefix_insert(filter_table *t, Filter *f)
+{
+	TRACE_FILTER_FUNC_START();
+	lpm_prefix *p = NULL;
+	filter_set *fs;
+	IP4Address *a;
+
+	if (f->proto == IPVERSION) {
+		a = (f->filter_type_flag == BRICKS_IP_FILTER) ? &f->ip4addr :
+			&f->conn.sip4addr;
+		if (f->filter_type_flag == BRICKS_IP_FILTER)
+			p = lpm4_insert(&t->ip4_lpm, a->addr32,
+					(a->mask == 0) ? INET_MASK : a->mask);
+		else
+			p = lpm4_insert(&t->ip4_lpm, a->addr32,
+					(a->addr32 == 0) ? 0 : a->mask);
+	} else if (f->proto == IPV6_VERSION) {
+		if (f->filter_type_flag == BRICKS_IP_FILTER)
+			p = lpm6_insert(&t->ip6_lpm, f->ip6addr.addr8,
+					IP6_PREFIX_LEN(f->ip6addr));
+		else
+			p = lpm6_insert(&t->ip6_lpm, f->conn.sip6addr.addr8, 128);
+	}
+	if (p == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+
+	if (p->data == NULL) {
+		fs = calloc(1, sizeof(filter_set));
+		if (fs == NULL) {
+			TRACE_FILTER_FUNC_END();
+			return -1;
+		}
+		TAILQ_INIT(&fs->ip_filters);
+		TAILQ_INIT(&fs->flow_filters);
+		p->data = fs;
+	}
+	fs = (filter_set *)p->data;
+	f->tm.arg = (f->filter_type_flag == BRICKS_IP_FILTER) ?
+		&fs->ip_filters : &fs->flow_filters;
+	TAILQ_INSERT_TAIL((flist *)f->tm.arg, f, entry);
+
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static void
+free_filter_set(void *data)
+{
+	TRACE_FILTER_FUNC_START();
+	filter_set *fs = (filter_set *)data;
+	Filter *f;
+
+	if (fs == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return;
+	}
+	while ((f = TAILQ_FIRST(&fs->ip_filters)) != NULL) {
+		TAILQ_REMOVE(&fs->ip_filters, f, entry);
+		free(f);
+	}
+	while ((f = TAILQ_FIRST(&fs->flow_filters)) != NULL) {
+		TAILQ_REMOVE(&fs->flow_filters, f, entry);
+		free(f);
+	}
+	free(fs);
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Puts a private copy of rule r into table t, and arms its expiry
+ * timer if it is a timed filter. Returns -1 if out of memory.
+ */
+static int
+index_filter(filter_table *t, Filter *r)
+{
+	TRACE_FILTER_FUNC_START();
+	Filter *f = (Filter *)malloc(sizeof(Filter));
+	if (f == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+	memcpy(f, r, sizeof(Filter));
+	memset(&f->tm, 0, sizeof(timer_entry));
+
+	if (is_exact_conn_filter(f) && conn_table_insert(&t->conn_tbl, f) == 0) {
+		/* tm.arg == NULL: the filter is in the connection table */
+	} else if ((f->filter_type_flag == BRICKS_IP_FILTER ||
+		    f->filter_type_flag == BRICKS_FLOW_FILTER) &&
+		   prefix_insert(t, f) == 0) {
+		/* tm.arg was set by prefix_insert() */
+	} else {
+		f->tm.arg = &t->filter_list;
+		TAILQ_INSERT_TAIL(&t->filter_list, f, entry);
+	}
+
+	if (f->filt_time_period >= 0)
+		timer_add(&t->expiry, &f->tm, FILTER_EXPIRES(f));
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static void
+free_filter_table(filter_table *t)
+{
+	TRACE_FILTER_FUNC_START();
+	conn_entry *ce, *next;
+	Filter *f;
+	uint32_t i;
+
+	while ((f = TAILQ_FIRST(&t->filter_list)) != NULL) {
+		TAILQ_REMOVE(&t->filter_list, f, entry);
+		free(f);
+	}
+
+	for (i = 0; t->conn_tbl.buckets != NULL && i <= t->conn_tbl.mask; i++) {
+		for (ce = t->conn_tbl.buckets[i]; ce != NULL; ce = next) {
+			next = ce->next;
+			free(ce->f);
+			free(ce);
+		}
+	}
+	free(t->conn_tbl.buckets);
+
+	lpm4_free(&t->ip4_lpm, free_filter_set);
+	lpm6_free(&t->ip6_lpm, free_filter_set);
+	free(t);
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Puts copies of all rules into table t. Returns -1 if out of memory
+ * (t then holds some of the rules).
+ */
+static int
+index_filters(filter_table *t, flist *rules)
+{
+	TRACE_FILTER_FUNC_START();
+	Filter *r;
+
+	TAILQ_FOREACH(r, rules, entry) {
+		if (index_filter(t, r) == -1) {
+			TRACE_FILTER_FUNC_END();
+			return -1;
+		}
+	}
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Builds a new table out of the rules, with its clock set to now
+ */
+static filter_table *
+build_filter_table(flist *rules, time_t now)
+{
+	TRACE_FILTER_FUNC_START();
+	filter_table *t;
+
+	t = (filter_table *)calloc(1, sizeof(filter_table));
+	if (t == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+	TAILQ_INIT(&t->filter_list);
+	timer_wheel_init(&t->expiry, now);
+
+	if (index_filters(t, rules) == -1) {
+		free_filter_table(t);
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+
+	TRACE_FILTER_FUNC_END();
+	return t;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Frees the replaced tables the engine can no longer be looking at,
+ * i.e. those retired before its latest quiescent point. The latest
+ * one is kept for the next commit to reuse. Called with cn->lock held.
+ */
+static void
+reclaim_filter_tables(FilterContext *cn)
+{
+	TRACE_FILTER_FUNC_START();
+	uint64_t qs_seq = __atomic_load_n(&cn->qs_seq, __ATOMIC_SEQ_CST);
+	filter_table **pt, *t;
+
+	if (cn->retired == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return;
+	}
+	for (pt = &cn->retired->next; (t = *pt) != NULL; ) {
+		if (t->retire_seq < qs_seq) {
+			*pt = t->next;
+			free_filter_table(t);
+		} else
+			pt = &t->next;
+	}
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Tells whether the engine may still be reading FILTER_MAX_RETIRED
+ * replaced tables. Called with cn->lock held, after
+ * reclaim_filter_tables().
+ */
+static inline int
+too_many_retired(FilterContext *cn, uint64_t qs_seq)
+{
+	filter_table *t;
+	uint32_t n = 0;
+
+	for (t = cn->retired; t != NULL; t = t->next)
+		if (t->retire_seq >= qs_seq)
+			n++;
+	return (n >= FILTER_MAX_RETIRED);
+}
+/*---------------------------------------------------------------------*/
+int
+init_filters(FilterContext *cn)
+{
+	TRACE_FILTER_FUNC_START();
+	TAILQ_INIT(&cn->rules);
+	TAILQ_INIT(&cn->recent);
+	TAILQ_INIT(&cn->added);
+	cn->tbl = build_filter_table(&cn->rules, time(NULL));
+	if (cn->tbl == NULL) {
+		TRACE_LOG("Could not allocate memory for the filter table!\n");
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+	pthread_mutex_init(&cn->lock, NULL);
+	TRACE_FILTER_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
 int
 apply_filter(FilterContext *cn, Filter *fin)
 {
@@ -445,6 +993,7 @@ apply_filter(FilterContext *cn, Filter *fin)
 		return 0;
 	}
 	memcpy(f, fin, sizeof(Filter));
+	memset(&f->tm, 0, sizeof(timer_entry));
 	/* set the filter duration */
 	f->filt_start_time = time(NULL) + fin->filt_start_time;
 	/* set mask settings */
@@ -452,12 +1001,200 @@ apply_filter(FilterContext *cn, Filter *fin)
 
 	TRACE_LOG("Applying filter with time period: %d, and start_time: %d\n",
 		  (int)f->filt_time_period, (int)f->filt_start_time);
-	
-	TAILQ_INSERT_TAIL(&cn->filter_list, f, entry);
+
+	/* the engine only sees it once the rules are committed */
+	pthread_mutex_lock(&cn->lock);
+	TAILQ_INSERT_TAIL(&cn->added, f, entry);
+	cn->pending++;
+	pthread_mutex_unlock(&cn->lock);
 	return 1;
 	TRACE_FILTER_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Timer callback: takes an expired filter out of whatever structure it
+ * is in and releases it
+ */
+static void
+expire_filter(timer_entry *te, void *arg)
+{
+	TRACE_FILTER_FUNC_START();
+	filter_table *t = (filter_table *)arg;
+	Filter *f = (Filter *)((char *)te - offsetof(Filter, tm));
+
+	TRACE_LOG("Disabling filter: current_time: %d, filt_start_time: %d, filt_time_period: %d\n",
+		  (int)t->expiry.now, (int)f->filt_start_time,
+		  (int)f->filt_time_period);
+	if (te->arg == NULL)
+		conn_table_remove(&t->conn_tbl, f);
+	else
+		TAILQ_REMOVE((flist *)te->arg, f, entry);
+	free(f);
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Drops the rules whose timers have fired by now, so that they don't
+ * come back with the next table. Returns the no. of rules left.
+ */
+static uint32_t
+purge_rules(flist *rules, time_t now)
+{
+	TRACE_FILTER_FUNC_START();
+	Filter *r, *next;
+	uint32_t n = 0;
+
+	for (r = TAILQ_FIRST(rules); r != NULL; r = next) {
+		next = TAILQ_NEXT(r, entry);
+		if (r->filt_time_period >= 0 && FILTER_EXPIRES(r) <= now) {
+			TAILQ_REMOVE(rules, r, entry);
+			free(r);
+		} else
+			n++;
+	}
+	TRACE_FILTER_FUNC_END();
+	return n;
+}
+/*---------------------------------------------------------------------*/
+int
+commit_filters(FilterContext *cn)
+{
+	TRACE_FILTER_FUNC_START();
+	time_t now = time(NULL);
+	filter_table *t, *old;
+	uint32_t n, live;
+	uint64_t qs_seq;
+
+	pthread_mutex_lock(&cn->lock);
+	reclaim_filter_tables(cn);
+	if (cn->pending == 0) {
+		pthread_mutex_unlock(&cn->lock);
+		TRACE_FILTER_FUNC_END();
+		return 0;
+	}
+	/*
+	 * Each commit the engine has not caught up with costs a table. If
+	 * it isn't moving on (say, it is stuck or not started yet), don't
+	 * pile up more: it publishes the rules itself once it does.
+	 */
+	qs_seq = __atomic_load_n(&cn->qs_seq, __ATOMIC_SEQ_CST);
+	if (too_many_retired(cn, qs_seq)) {
+		__atomic_store_n(&cn->deferred, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&cn->lock);
+		TRACE_DEBUG_LOG("Deferred %u new filter(s) of %s\n",
+				cn->pending, cn->name);
+		TRACE_FILTER_FUNC_END();
+		return 0;
+	}
+
+	/* rules whose timers have fired must not come back */
+	live = purge_rules(&cn->rules, now) + purge_rules(&cn->recent, now) +
+		purge_rules(&cn->added, now);
+
+	/*
+	 * The table replaced last holds cn->rules. Once the engine is done
+	 * with it, it only needs the rules it lacks (and to catch up on
+	 * expiry); unless it is mostly made of prefixes of expired
+	 * filters, as prefixes are never taken out of the prefix tables.
+	 */
+	t = cn->retired;
+	if (t != NULL && t->retire_seq < qs_seq) {
+		cn->retired = t->next;
+		timer_advance(&t->expiry, now, expire_filter, t);
+		if (t->ip4_lpm.count + t->ip6_lpm.count > 2 * live ||
+		    index_filters(t, &cn->recent) == -1 ||
+		    index_filters(t, &cn->added) == -1) {
+			free_filter_table(t);
+			t = NULL;
+		}
+	} else
+		t = NULL;
+	if (t == NULL) {
+		t = build_filter_table(&cn->rules, now);
+		if (t != NULL && (index_filters(t, &cn->recent) == -1 ||
+				  index_filters(t, &cn->added) == -1)) {
+			free_filter_table(t);
+			t = NULL;
+		}
+	}
+	if (t == NULL) {
+		/* the rules stay pending; the next commit retries */
+		pthread_mutex_unlock(&cn->lock);
+		TRACE_LOG("Could not allocate memory for the filter table!\n");
+		TRACE_FILTER_FUNC_END();
+		return -1;
+	}
+
+	/*
+	 * Publish t. The engine may still be running packets against the
+	 * old table; it's done with it by its next quiescent point, i.e.
+	 * once qs_seq has moved past the value read after the swap.
+	 */
+	old = __atomic_exchange_n(&cn->tbl, t, __ATOMIC_SEQ_CST);
+	old->retire_seq = __atomic_load_n(&cn->qs_seq, __ATOMIC_SEQ_CST);
+	old->next = cn->retired;
+	cn->retired = old;
+	/* old holds the rules of the last commit too, t everything */
+	TAILQ_CONCAT(&cn->rules, &cn->recent, entry);
+	TAILQ_CONCAT(&cn->recent, &cn->added, entry);
+	n = cn->pending;
+	cn->pending = 0;
+	__atomic_store_n(&cn->deferred, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cn->lock);
+
+	TRACE_LOG("Committed %u new filter(s) to %s\n", n, cn->name);
+	TRACE_FILTER_FUNC_END();
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+void
+expire_filters(engine *eng, time_t now)
+{
+	TRACE_FILTER_FUNC_START();
+	FilterContext *cn;
+	filter_table *t;
+
+	TAILQ_FOREACH(cn, &eng->filter_list, entry) {
+		/* only the engine modifies the published table */
+		t = __atomic_load_n(&cn->tbl, __ATOMIC_ACQUIRE);
+		if (t->expiry.now < (uint64_t)now)
+			timer_advance(&t->expiry, now, expire_filter, t);
+		/* done with t (and any table before it) */
+		__atomic_add_fetch(&cn->qs_seq, 1, __ATOMIC_SEQ_CST);
+		/* publish what a commit left to us */
+		if (__atomic_load_n(&cn->deferred, __ATOMIC_ACQUIRE))
+			commit_filters(cn);
+	}
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+flush_filters(FilterContext *cn)
+{
+	TRACE_FILTER_FUNC_START();
+	filter_table *t;
+	Filter *r;
+
+	while ((t = cn->retired) != NULL) {
+		cn->retired = t->next;
+		free_filter_table(t);
+	}
+	if (cn->tbl != NULL)
+		free_filter_table(cn->tbl);
+	cn->tbl = NULL;
+
+	TAILQ_CONCAT(&cn->rules, &cn->recent, entry);
+	TAILQ_CONCAT(&cn->rules, &cn->added, entry);
+	while ((r = TAILQ_FIRST(&cn->rules)) != NULL) {
+		TAILQ_REMOVE(&cn->rules, r, entry);
+		free(r);
+	}
+	cn->pending = 0;
+	cn->deferred = 0;
+	pthread_mutex_destroy(&cn->lock);
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
 #ifdef DEBUG
 void
 printFilter(Filter *f)
@@ -640,12 +1377,16 @@ parse_record(broker_data *v, Filter *f)
 				}
 				
 				if (f->filter_type_flag == BRICKS_IP_FILTER) {
-					if (f->proto == IPVERSION)
+					if (f->proto == IPVERSION) {
 						memcpy(&f->ip4addr.addr32,
 						       &addr, sizeof(uint32_t));
-					else /* IPV6_VERSION */
+						f->ip4addr.mask = mask;
+					} else /* IPV6_VERSION */ {
 						memcpy(f->ip6addr.addr32,
 						       &addr6, sizeof(uint32_t)*4);
+						f->ip6addr.mask = (needle == NULL) ?
+							0 : mask;
+					}
 				} else {
 					if (f->proto == IPVERSION) {
 						if (f->conn.sip4addr.addr32 != 0) {
@@ -750,19 +1491,18 @@ brokerize_request(engine *eng, broker_message_queue *q)
 	Filter f;
 	FilterContext *cn = NULL;
 
-	memset(&f, 0, sizeof(f));
-
-	/* reset time period to -1 */
-	f.filt_time_period = (time_t)-1;
-
-	/* reseting the protocol */
-	f.proto = IPVERSION;
-	
 	/* check vector contents */
 	for (i = 0; i < n; ++i) {
 		broker_vector *m = broker_deque_of_message_at(msgs, i);
 		broker_vector_iterator *it = broker_vector_iterator_create(m);
 		int count = RULE_ACC;
+
+		memset(&f, 0, sizeof(f));
+		/* reset time period to -1 */
+		f.filt_time_period = (time_t)-1;
+		/* reseting the protocol */
+		f.proto = IPVERSION;
+
 		while (!broker_vector_iterator_at_last(m, it)) {
 			broker_data *v = broker_vector_iterator_value(it);
 			switch (count) {
@@ -785,25 +1525,29 @@ brokerize_request(engine *eng, broker_message_queue *q)
 			count++;
 		}
 		broker_vector_iterator_delete(it);
-	}
-	
-	broker_deque_of_message_delete(msgs);	
 
-	if (f.node_name != NULL) {
-		/* first locate the right commnode entry */
-		TAILQ_FOREACH(cn, &eng->filter_list, entry) {
-			if (!strcmp((char *)cn->name, (char *)f.node_name)) {
-				/* apply the filter */
-				apply_filter(cn, &f);
-				break;
-			} else {
-				TRACE_LOG("ifname: %s does not match\n", cn->name);
+		if (f.node_name != NULL) {
+			/* first locate the right commnode entry */
+			TAILQ_FOREACH(cn, &eng->filter_list, entry) {
+				if (!strcmp((char *)cn->name, (char *)f.node_name)) {
+					/* queue the filter */
+					apply_filter(cn, &f);
+					break;
+				} else {
+					TRACE_LOG("ifname: %s does not match\n", cn->name);
+				}
 			}
 		}
-	}	
 #ifdef DEBUG
-	printFilter(&f);
+		printFilter(&f);
 #endif
+	}
+	
+	broker_deque_of_message_delete(msgs);	
+
+	/* one table rebuild per commnode for the whole batch */
+	TAILQ_FOREACH(cn, &eng->filter_list, entry)
+		commit_filters(cn);
 	TRACE_FILTER_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
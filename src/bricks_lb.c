@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for lb_table */
+#include "bricks_lb.h"
+/* for string functions */
+#include <string.h>
+/* for calloc()/free() */
+#include <stdlib.h>
+/* for snprintf() */
+#include <stdio.h>
+/*---------------------------------------------------------------------*/
+/* marks a slot that is not taken yet */
+#define LB_SLOT_FREE			0xFF
+/* byte-wise constants of tag_match() */
+#define LB_ONES				0x0101010101010101ULL
+#define LB_HIGHS			0x8080808080808080ULL
+/*---------------------------------------------------------------------*/
+/* 64-bit FNV-1a of a link name */
+static uint64_t
+name_hash(const char *s)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+
+	while (*s != '\0') {
+		h ^= (uint8_t)*s++;
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+/*---------------------------------------------------------------------*/
+static uint32_t
+gcd(uint32_t a, uint32_t b)
+{
+	uint32_t r;
+
+	while (b != 0) {
+		r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+/*---------------------------------------------------------------------*/
+int
+lb_table_weighted(lb_table *t, const uint32_t *weight, uint32_t n)
+{
+	uint32_t i, k, total = 0;
+
+	for (i = 0; i < n; i++) {
+		if (weight[i] > LB_TABLE_SIZE)
+			return -1;
+		total += weight[i];
+	}
+	if (total == 0 || total > LB_TABLE_SIZE)
+		return -1;
+
+	t->slot = calloc(total, sizeof(uint8_t));
+	if (t->slot == NULL)
+		return -1;
+	t->size = total;
+	for (i = 0, total = 0; i < n; i++)
+		for (k = 0; k < weight[i]; k++)
+			t->slot[total++] = i;
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int
+lb_table_consistent(lb_table *t, const char * const *name,
+		    const uint32_t *weight, uint32_t n)
+{
+	uint32_t *offset, *skip, *next;
+	uint32_t i, k, c, w, g, filled;
+	char idx[16];
+	uint64_t h;
+
+	/* turns are kept short (e.g. 2:1 instead of 200:100) */
+	for (i = 0, g = 0; i < n; i++)
+		g = gcd(g, (weight == NULL) ? 1 : weight[i]);
+	if (n == 0 || g == 0)
+		return -1;
+
+	t->slot = malloc(LB_TABLE_SIZE);
+	offset = calloc(n, sizeof(uint32_t));
+	skip = calloc(n, sizeof(uint32_t));
+	next = calloc(n, sizeof(uint32_t));
+	if (t->slot == NULL || offset == NULL || skip == NULL ||
+	    next == NULL) {
+		free(t->slot);
+		t->slot = NULL;
+		free(offset);
+		free(skip);
+		free(next);
+		return -1;
+	}
+	t->size = LB_TABLE_SIZE;
+	memset(t->slot, LB_SLOT_FREE, LB_TABLE_SIZE);
+
+	/* each output's permutation of the slots */
+	for (i = 0; i < n; i++) {
+		if (name == NULL || name[i] == NULL) {
+			snprintf(idx, sizeof(idx), "#%u", i);
+			h = name_hash(idx);
+		} else
+			h = name_hash(name[i]);
+		offset[i] = h % LB_TABLE_SIZE;
+		skip[i] = (h >> 32) % (LB_TABLE_SIZE - 1) + 1;
+	}
+
+	/* outputs take turns to claim their next free preferred slot */
+	for (filled = 0; filled < LB_TABLE_SIZE; ) {
+		for (i = 0; i < n && filled < LB_TABLE_SIZE; i++) {
+			w = (weight == NULL) ? 1 : weight[i] / g;
+			for (k = 0; k < w && filled < LB_TABLE_SIZE; k++) {
+				do {
+					c = (offset[i] + next[i] * skip[i]) %
+						LB_TABLE_SIZE;
+					next[i]++;
+				} while (t->slot[c] != LB_SLOT_FREE);
+				t->slot[c] = i;
+				filled++;
+			}
+		}
+	}
+
+	free(offset);
+	free(skip);
+	free(next);
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+lb_table_free(lb_table *t)
+{
+	free(t->slot);
+	t->slot = NULL;
+	t->size = 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Ways of bucket b whose tag is t: the top bit of each such way's byte
+ * is set. A way right above a match may be set as well (the lowest set
+ * bit is always right), so callers confirm the hash.
+ */
+static inline uint64_t
+tag_match(const lb_flow_bucket *b, uint8_t t)
+{
+	uint64_t w;
+
+	memcpy(&w, b->tag, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	w ^= LB_ONES * t;
+	return (w - LB_ONES) & ~w & LB_HIGHS;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Live output with the least load per weight, scanning from start so
+ * that ties spread. Returns n if no output is live.
+ */
+static uint32_t
+least_loaded(const lb_flows *f, uint32_t n, uint64_t down,
+	     const uint32_t *weight, uint32_t start)
+{
+	uint64_t load = 0, w, best_w = 1;
+	uint32_t i, k, best = n;
+
+	for (i = 0, k = start; i < n; i++, k = (k + 1 == n) ? 0 : k + 1) {
+		w = (weight == NULL) ? 1 : weight[k];
+		if (w == 0 || ((down >> k) & 1))
+			continue;
+		/* load[k] / w < load / best_w */
+		if (best == n || f->load[k] * best_w < load * w) {
+			best = k;
+			load = f->load[k];
+			best_w = w;
+		}
+	}
+	return best;
+}
+/*---------------------------------------------------------------------*/
+int
+lb_flows_init(lb_flows *f, uint32_t buckets, uint16_t idle)
+{
+	uint32_t n = 1;
+	void *mem;
+
+	if (buckets == 0)
+		buckets = LB_FLOW_BUCKETS;
+	/* the bucket takes the low 24 bits of the key at most */
+	while (n < buckets && n < (1U << 24))
+		n <<= 1;
+
+	memset(f, 0, sizeof(*f));
+	if (posix_memalign(&mem, sizeof(lb_flow_bucket),
+			   n * sizeof(lb_flow_bucket)) != 0)
+		return -1;
+	memset(mem, 0, n * sizeof(lb_flow_bucket));
+	f->bucket = mem;
+	f->mask = n - 1;
+	f->idle = (idle == 0) ? LB_FLOW_IDLE : idle;
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+lb_flows_tick(lb_flows *f, uint16_t now)
+{
+	uint16_t secs = now - f->now;
+	uint32_t i;
+
+	if (secs == 0)
+		return;
+	f->now = now;
+	for (i = 0; i < LB_MAX_OUTPUTS; i++)
+		f->load[i] = (secs < 32) ? f->load[i] >> secs : 0;
+}
+/*---------------------------------------------------------------------*/
+uint32_t
+lb_flows_pick(lb_flows *f, uint64_t key, uint32_t n, uint64_t down,
+	      const uint32_t *weight)
+{
+	lb_flow_bucket *b;
+	uint32_t id, k, way, start;
+	uint16_t age, oldest;
+	uint64_t m;
+	uint8_t t;
+
+	b = &f->bucket[key & f->mask];
+	t = ((key >> 56) != 0) ? key >> 56 : 1;
+	id = (uint32_t)(key >> 24);
+	start = (uint32_t)(key % n);
+
+	for (m = tag_match(b, t); m != 0; m &= m - 1) {
+		way = __builtin_ctzll(m) >> 3;
+		if (b->key[way] != id)
+			continue;
+		k = b->out[way];
+		/* an idle flow starts over, one on a dead output moves */
+		if ((uint16_t)(f->now - b->seen[way]) > f->idle ||
+		    k >= n || ((down >> k) & 1)) {
+			k = least_loaded(f, n, down, weight, start);
+			if (k == n)
+				k = start;
+			b->out[way] = k;
+		}
+		b->seen[way] = f->now;
+		f->load[k]++;
+		return k;
+	}
+
+	/* new flow: take a free way, else the least recently seen one */
+	m = tag_match(b, 0);
+	if (m != 0)
+		way = __builtin_ctzll(m) >> 3;
+	else {
+		for (k = 0, way = 0, oldest = 0; k < LB_FLOW_WAYS; k++) {
+			age = f->now - b->seen[k];
+			if (age >= oldest) {
+				oldest = age;
+				way = k;
+			}
+		}
+	}
+	k = least_loaded(f, n, down, weight, start);
+	if (k == n)
+		k = start;
+	b->tag[way] = t;
+	b->key[way] = id;
+	b->seen[way] = f->now;
+	b->out[way] = k;
+	f->load[k]++;
+	return k;
+}
+/*---------------------------------------------------------------------*/
+void
+lb_flows_free(lb_flows *f)
+{
+	free(f->bucket);
+	f->bucket = NULL;
+}
+/*---------------------------------------------------------------------*/
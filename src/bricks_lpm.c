@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for prints etc */
+#include "bricks_log.h"
+/* for lpm structs */
+#include "bricks_lpm.h"
+/* for string functions */
+#include <string.h>
+/* for calloc()/free() */
+#include <stdlib.h>
+/*---------------------------------------------------------------------*/
+static lpm_prefix *
+new_prefix(const uint32_t *addr, uint8_t len, lpm_prefix *parent)
+{
+	lpm_prefix *p = calloc(1, sizeof(lpm_prefix));
+
+	if (p != NULL) {
+		memcpy(p->addr, addr, sizeof(p->addr));
+		p->len = len;
+		p->parent = parent;
+	}
+	return p;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Makes p the parent of q's topmost ancestor below p's own length,
+ * if that ancestor used to hang off p's parent
+ */
+static inline void
+adopt(lpm_prefix *p, lpm_prefix *q)
+{
+	while (q->parent != NULL && q->parent->len > p->len)
+		q = q->parent;
+	if (q != p && q->parent == p->parent)
+		q->parent = p;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Points an entry to the prefix with index idx unless it is already
+ * held by a longer prefix (which then becomes a child of p)
+ */
+static inline void
+lpm4_fill(lpm4 *t, uint32_t *e, uint32_t idx, lpm_prefix *p)
+{
+	if (*e == 0 || t->prefixes[*e - 1]->len < p->len)
+		*e = idx;
+	else if (*e != idx)
+		adopt(p, t->prefixes[*e - 1]);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Turns tbl24 entry i into a tbl8 group. Returns the group index or
+ * -1 if memory could not be allocated.
+ */
+static int64_t
+lpm4_extend(lpm4 *t, uint32_t i)
+{
+	TRACE_FILTER_FUNC_START();
+	uint32_t *tbl8, g, j;
+
+	if (t->tbl24[i] & LPM4_EXT) {
+		TRACE_FILTER_FUNC_END();
+		return t->tbl24[i] & ~LPM4_EXT;
+	}
+
+	if (t->tbl8_used == t->tbl8_size) {
+		tbl8 = realloc(t->tbl8, (size_t)(t->tbl8_size + LPM4_TBL8_CHUNK) *
+			       256 * sizeof(uint32_t));
+		if (tbl8 == NULL) {
+			TRACE_LOG("Can't allocate memory for tbl8 groups\n");
+			TRACE_FILTER_FUNC_END();
+			return -1;
+		}
+		t->tbl8 = tbl8;
+		t->tbl8_size += LPM4_TBL8_CHUNK;
+	}
+
+	/* the group starts out with the /24 (or shorter) prefix */
+	g = t->tbl8_used++;
+	for (j = 0; j < 256; j++)
+		t->tbl8[(g << 8) | j] = t->tbl24[i];
+	t->tbl24[i] = LPM4_EXT | g;
+
+	TRACE_FILTER_FUNC_END();
+	return g;
+}
+/*---------------------------------------------------------------------*/
+lpm_prefix *
+lpm4_insert(lpm4 *t, uint32_t addr, uint8_t len)
+{
+	TRACE_FILTER_FUNC_START();
+	lpm_prefix *p, *q, **prefixes;
+	uint32_t a, i, j, n, idx;
+	uint32_t net[4] = {0, 0, 0, 0};
+	int64_t g;
+
+	len = (len > 32) ? 32 : len;
+	a = (len == 0) ? 0 : ntohl(addr) & (0xFFFFFFFFu << (32 - len));
+	net[0] = htonl(a);
+
+	/* the default prefix lives outside of the tables */
+	if (len == 0) {
+		if (t->def == NULL) {
+			t->def = new_prefix(net, 0, NULL);
+			if (t->def == NULL) {
+				TRACE_FILTER_FUNC_END();
+				return NULL;
+			}
+			for (i = 0; i < t->count; i++)
+				if (t->prefixes[i]->parent == NULL)
+					t->prefixes[i]->parent = t->def;
+		}
+		TRACE_FILTER_FUNC_END();
+		return t->def;
+	}
+
+	if (t->tbl24 == NULL) {
+		t->tbl24 = calloc(1 << 24, sizeof(uint32_t));
+		if (t->tbl24 == NULL) {
+			TRACE_LOG("Can't allocate memory for tbl24\n");
+			TRACE_FILTER_FUNC_END();
+			return NULL;
+		}
+	}
+
+	/* the prefix may exist already; otherwise locate its parent */
+	for (q = lpm4_lookup(t, net[0]); q != NULL && q->len > len; q = q->parent)
+		;
+	if (q != NULL && q->len == len) {
+		TRACE_FILTER_FUNC_END();
+		return q;
+	}
+
+	if (t->count == t->size) {
+		prefixes = realloc(t->prefixes, (t->size + 1024) *
+				   sizeof(lpm_prefix *));
+		if (prefixes == NULL) {
+			TRACE_FILTER_FUNC_END();
+			return NULL;
+		}
+		t->prefixes = prefixes;
+		t->size += 1024;
+	}
+	if (len > 24 && lpm4_extend(t, a >> 8) == -1) {
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+	p = new_prefix(net, len, q);
+	if (p == NULL) {
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+	t->prefixes[t->count++] = p;
+	idx = t->count;
+
+	if (len <= 24) {
+		n = 1 << (24 - len);
+		for (i = a >> 8; i < (a >> 8) + n; i++) {
+			if (t->tbl24[i] & LPM4_EXT) {
+				g = t->tbl24[i] & ~LPM4_EXT;
+				for (j = 0; j < 256; j++)
+					lpm4_fill(t, &t->tbl8[(g << 8) | j], idx, p);
+			} else {
+				lpm4_fill(t, &t->tbl24[i], idx, p);
+			}
+		}
+	} else {
+		g = t->tbl24[a >> 8] & ~LPM4_EXT;
+		n = 1 << (32 - len);
+		for (j = a & 0xFF; j < (a & 0xFF) + n; j++)
+			lpm4_fill(t, &t->tbl8[(g << 8) | j], idx, p);
+	}
+
+	TRACE_FILTER_FUNC_END();
+	return p;
+}
+/*---------------------------------------------------------------------*/
+void
+lpm4_free(lpm4 *t, void (*free_data)(void *))
+{
+	TRACE_FILTER_FUNC_START();
+	uint32_t i;
+
+	for (i = 0; i < t->count; i++) {
+		if (free_data != NULL)
+			free_data(t->prefixes[i]->data);
+		free(t->prefixes[i]);
+	}
+	if (t->def != NULL) {
+		if (free_data != NULL)
+			free_data(t->def->data);
+		free(t->def);
+	}
+	free(t->prefixes);
+	free(t->tbl24);
+	free(t->tbl8);
+	memset(t, 0, sizeof(lpm4));
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+static inline int
+bit_at(const uint8_t *a, uint8_t i)
+{
+	return (a[i >> 3] >> (7 - (i & 7))) & 1;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * No. of leading bits (up to max) that a and b have in common
+ */
+static inline uint8_t
+common_bits(const uint8_t *a, const uint8_t *b, uint8_t max)
+{
+	uint8_t i, n;
+
+	for (i = 0; i < 16 && (i << 3) < max; i++) {
+		if (a[i] != b[i]) {
+			n = (i << 3) + __builtin_clz((uint32_t)(a[i] ^ b[i])) - 24;
+			return (n < max) ? n : max;
+		}
+	}
+	return max;
+}
+/*---------------------------------------------------------------------*/
+static lpm6_node *
+new_node(const uint8_t *addr, uint8_t len)
+{
+	lpm6_node *n = calloc(1, sizeof(lpm6_node));
+
+	if (n != NULL) {
+		memcpy(n->addr, addr, sizeof(n->addr));
+		n->len = len;
+	}
+	return n;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Makes p the parent of the topmost prefixes below node
+ */
+static void
+lpm6_adopt(lpm6_node *node, lpm_prefix *p)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (node->child[i] == NULL)
+			continue;
+		if (node->child[i]->prefix != NULL)
+			node->child[i]->prefix->parent = p;
+		else
+			lpm6_adopt(node->child[i], p);
+	}
+}
+/*---------------------------------------------------------------------*/
+lpm_prefix *
+lpm6_insert(lpm6 *t, const void *addr, uint8_t len)
+{
+	TRACE_FILTER_FUNC_START();
+	lpm6_node **pn, *n, *node, *glue;
+	lpm_prefix *parent = NULL;
+	uint8_t key[16];
+	uint8_t cpl;
+
+	len = (len > 128) ? 128 : len;
+	memset(key, 0, sizeof(key));
+	memcpy(key, addr, (len + 7) >> 3);
+	if (len & 7)
+		key[len >> 3] &= 0xFF << (8 - (len & 7));
+
+	for (pn = &t->root, node = NULL; (n = *pn) != NULL; ) {
+		cpl = common_bits(n->addr, key, (n->len < len) ? n->len : len);
+		if (cpl < n->len) {
+			/* the new node goes above n */
+			node = new_node(key, len);
+			if (node == NULL)
+				break;
+			if (cpl == len) {
+				node->child[bit_at(n->addr, len)] = n;
+			} else {
+				/* or next to it, below a branching node */
+				glue = new_node(key, cpl);
+				if (glue == NULL) {
+					free(node);
+					node = NULL;
+					break;
+				}
+				glue->child[bit_at(n->addr, cpl)] = n;
+				glue->child[bit_at(key, cpl)] = node;
+				*pn = glue;
+				break;
+			}
+			*pn = node;
+			break;
+		}
+		if (n->len == len) {
+			node = n;
+			break;
+		}
+		if (n->prefix != NULL)
+			parent = n->prefix;
+		pn = &n->child[bit_at(key, n->len)];
+	}
+	if (n == NULL) {
+		node = new_node(key, len);
+		*pn = node;
+	}
+	if (node == NULL) {
+		TRACE_LOG("Can't allocate memory for trie node\n");
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+	if (node->prefix != NULL) {
+		TRACE_FILTER_FUNC_END();
+		return node->prefix;
+	}
+
+	node->prefix = new_prefix((uint32_t *)key, len, parent);
+	if (node->prefix == NULL) {
+		/* the (empty) node stays as a branching node */
+		TRACE_FILTER_FUNC_END();
+		return NULL;
+	}
+	lpm6_adopt(node, node->prefix);
+	t->count++;
+
+	TRACE_FILTER_FUNC_END();
+	return node->prefix;
+}
+/*---------------------------------------------------------------------*/
+lpm_prefix *
+lpm6_lookup(const lpm6 *t, const void *addr)
+{
+	const uint8_t *a = (const uint8_t *)addr;
+	lpm_prefix *best = NULL;
+	lpm6_node *n = t->root;
+
+	while (n != NULL && common_bits(n->addr, a, n->len) == n->len) {
+		if (n->prefix != NULL)
+			best = n->prefix;
+		if (n->len == 128)
+			break;
+		n = n->child[bit_at(a, n->len)];
+	}
+	return best;
+}
+/*---------------------------------------------------------------------*/
+static void
+lpm6_free_node(lpm6_node *n, void (*free_data)(void *))
+{
+	if (n == NULL)
+		return;
+	lpm6_free_node(n->child[0], free_data);
+	lpm6_free_node(n->child[1], free_data);
+	if (n->prefix != NULL) {
+		if (free_data != NULL)
+			free_data(n->prefix->data);
+		free(n->prefix);
+	}
+	free(n);
+}
+/*---------------------------------------------------------------------*/
+void
+lpm6_free(lpm6 *t, void (*free_data)(void *))
+{
+	TRACE_FILTER_FUNC_START();
+	lpm6_free_node(t->root, free_data);
+	memset(t, 0, sizeof(lpm6));
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for rl_rate */
+#include "bricks_ratelimit.h"
+/* for string functions */
+#include <string.h>
+/* for clock_gettime()/nanosleep() */
+#include <time.h>
+/*---------------------------------------------------------------------*/
+uint64_t
+rl_clock_hz(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	static uint64_t hz = 0;
+	struct timespec t0, t1, nap = {0, RL_CALIBRATE_MS * 1000000L};
+	uint64_t c0, c1, ns;
+
+	if (hz != 0)
+		return hz;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c0 = read_cycles();
+	nanosleep(&nap, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c1 = read_cycles();
+	ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+		t1.tv_nsec - t0.tv_nsec;
+	hz = (ns != 0) ? (c1 - c0) * 1000000000ULL / ns : 1000000000ULL;
+	return hz;
+#else
+	return 1000000000ULL;
+#endif
+}
+/*---------------------------------------------------------------------*/
+int
+rl_rate_init(rl_rate *r, uint64_t hz, uint64_t pps, uint64_t bps,
+	     uint32_t burst_ms)
+{
+	memset(r, 0, sizeof(*r));
+	if (pps == 0 && bps == 0)
+		return -1;
+
+	if (burst_ms == 0)
+		burst_ms = RL_BURST_MS;
+	r->burst = hz / 1000 * burst_ms;
+	/* a cost of 0 would mean no limit: round faster rates down */
+	if (pps != 0)
+		r->pkt_cost = (hz / pps != 0) ? hz / pps : 1;
+	if (bps != 0) {
+		r->byte_cost = ((hz * 8) << RL_FRAC) / bps;
+		if (r->byte_cost == 0)
+			r->byte_cost = 1;
+		/* keeps len * byte_cost in 64 bits (only below ~10 bps) */
+		if (r->byte_cost > UINT64_MAX / RL_MAX_LEN)
+			r->byte_cost = UINT64_MAX / RL_MAX_LEN;
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------*/
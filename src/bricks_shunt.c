@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for shunt_table */
+#include "bricks_shunt.h"
+/* for string functions */
+#include <string.h>
+/* for posix_memalign()/free() */
+#include <stdlib.h>
+/*---------------------------------------------------------------------*/
+int
+shunt_table_init(shunt_table *t, uint32_t buckets, uint32_t cutoff_bytes,
+		 uint32_t cutoff_pkts, uint16_t idle)
+{
+	uint32_t n = 1;
+	void *mem;
+
+	if (buckets == 0)
+		buckets = SHUNT_BUCKETS;
+	while (n < buckets && n < (1U << 24))
+		n <<= 1;
+
+	memset(t, 0, sizeof(*t));
+	if (posix_memalign(&mem, sizeof(shunt_bucket),
+			   n * sizeof(shunt_bucket)) != 0)
+		return -1;
+	memset(mem, 0, n * sizeof(shunt_bucket));
+	t->bucket = mem;
+	t->mask = n - 1;
+	t->cutoff_bytes = cutoff_bytes;
+	t->cutoff_pkts = cutoff_pkts;
+	if (cutoff_bytes == 0 && cutoff_pkts == 0)
+		t->cutoff_bytes = SHUNT_CUTOFF;
+	t->idle = (idle == 0) ? SHUNT_IDLE : idle;
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int
+shunt_table_account(shunt_table *t, uint64_t key, uint32_t len)
+{
+	shunt_bucket *b = &t->bucket[key & t->mask];
+	uint32_t tag = ((key >> 32) != 0) ? key >> 32 : 1;
+	uint16_t age, oldest;
+	int way, k;
+
+	for (way = 0; way < SHUNT_WAYS; way++)
+		if (b->key[way] == tag)
+			break;
+
+	if (way == SHUNT_WAYS) {
+		/* new flow: take a free way, else the least recently seen */
+		for (k = 0, way = 0, oldest = 0; k < SHUNT_WAYS; k++) {
+			if (b->key[k] == 0) {
+				way = k;
+				break;
+			}
+			age = t->now - b->seen[k];
+			if (age >= oldest) {
+				oldest = age;
+				way = k;
+			}
+		}
+		b->key[way] = tag;
+		b->bytes[way] = b->pkts[way] = 0;
+	} else if ((uint16_t)(t->now - b->seen[way]) > t->idle) {
+		/* idle for too long: a new connection on the same tuple */
+		b->bytes[way] = b->pkts[way] = 0;
+	}
+	b->seen[way] = t->now;
+
+	if ((t->cutoff_bytes != 0 && b->bytes[way] >= t->cutoff_bytes) ||
+	    (t->cutoff_pkts != 0 && b->pkts[way] >= t->cutoff_pkts))
+		return 1;
+	b->bytes[way] = (b->bytes[way] > UINT32_MAX - len) ?
+		UINT32_MAX : b->bytes[way] + len;
+	b->pkts[way]++;
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+shunt_table_free(shunt_table *t)
+{
+	free(t->bucket);
+	t->bucket = NULL;
+}
+/*---------------------------------------------------------------------*/
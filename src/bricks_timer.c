@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for prints etc */
+#include "bricks_log.h"
+/* for timer wheel */
+#include "bricks_timer.h"
+/*---------------------------------------------------------------------*/
+/**
+ * Puts te on the slot matching its expiry, relative to the current
+ * tick. Timers on level l > 0 are always due after the current slot
+ * of that level, so they are cascaded in time.
+ */
+static inline void
+timer_place(timer_wheel *tw, timer_entry *te)
+{
+	uint64_t delta = te->expires - tw->now;
+	uint64_t when = te->expires;
+	int l;
+
+	if (delta >= TW_RANGE)
+		when = tw->now + TW_RANGE - 1;
+	for (l = 0; l < TW_LEVELS - 1; l++)
+		if (delta < (1ULL << (TW_SLOT_BITS * (l + 1))))
+			break;
+	LIST_INSERT_HEAD(&tw->slots[l][(when >> (TW_SLOT_BITS * l)) & TW_SLOT_MASK],
+			 te, entry);
+}
+/*---------------------------------------------------------------------*/
+void
+timer_wheel_init(timer_wheel *tw, uint64_t now)
+{
+	TRACE_FILTER_FUNC_START();
+	int l, s;
+
+	for (l = 0; l < TW_LEVELS; l++)
+		for (s = 0; s < TW_SLOTS; s++)
+			LIST_INIT(&tw->slots[l][s]);
+	tw->now = now;
+	tw->count = 0;
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+timer_add(timer_wheel *tw, timer_entry *te, uint64_t expires)
+{
+	TRACE_FILTER_FUNC_START();
+	if (te->expires != 0)
+		timer_del(tw, te);
+	/* the slot of the current tick has already been run */
+	te->expires = (expires > tw->now) ? expires : tw->now + 1;
+	timer_place(tw, te);
+	tw->count++;
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+timer_del(timer_wheel *tw, timer_entry *te)
+{
+	TRACE_FILTER_FUNC_START();
+	if (te->expires != 0) {
+		LIST_REMOVE(te, entry);
+		te->expires = 0;
+		tw->count--;
+	}
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+static void
+timer_cascade(timer_wheel *tw, int l, uint32_t s)
+{
+	TRACE_FILTER_FUNC_START();
+	tlist *head = &tw->slots[l][s];
+	timer_entry *te;
+
+	while ((te = LIST_FIRST(head)) != NULL) {
+		LIST_REMOVE(te, entry);
+		timer_place(tw, te);
+	}
+	TRACE_FILTER_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+uint32_t
+timer_advance(timer_wheel *tw, uint64_t now, timer_fn fn, void *arg)
+{
+	TRACE_FILTER_FUNC_START();
+	timer_entry *te;
+	uint32_t fired = 0;
+	uint64_t t;
+	tlist *head;
+	int l;
+
+	while (tw->now < now) {
+		/* nothing pending: jump straight to now */
+		if (tw->count == 0) {
+			tw->now = now;
+			break;
+		}
+		t = ++tw->now;
+		/* outer wheels first, so that timers can trickle down */
+		for (l = TW_LEVELS - 1; l > 0; l--)
+			if ((t & ((1ULL << (TW_SLOT_BITS * l)) - 1)) == 0)
+				timer_cascade(tw, l,
+					      (t >> (TW_SLOT_BITS * l)) & TW_SLOT_MASK);
+		head = &tw->slots[0][t & TW_SLOT_MASK];
+		while ((te = LIST_FIRST(head)) != NULL) {
+			LIST_REMOVE(te, entry);
+			te->expires = 0;
+			tw->count--;
+			fired++;
+			fn(te, arg);
+		}
+	}
+
+	TRACE_FILTER_FUNC_END();
+	return fired;
+}
+/*---------------------------------------------------------------------*/
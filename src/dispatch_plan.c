@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/* for func prototypes */
+#include "dispatch_plan.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for CommNode def'n */
+#include "netmap_module.h"
+/* for string functions */
+#include <string.h>
+/*---------------------------------------------------------------------*/
+/**
+ * Counts the nodes and leaves of the tree rooted at brick
+ */
+static void
+plan_count(Brick *brick, uint16_t *nodes, uint16_t *leaves)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+	CommNode *cn;
+	uint32_t i;
+
+	(*nodes)++;
+	for (i = 0; i < lnd->count; i++) {
+		cn = (CommNode *)lnd->external_links[i];
+		if (cn == NULL)
+			continue;
+		if (cn->brick != NULL)
+			plan_count(cn->brick, nodes, leaves);
+		else
+			(*leaves)++;
+	}
+	TRACE_PKTENGINE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+dispatch_plan *
+dispatch_plan_compile(engine *eng)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	dispatch_plan *dp;
+	plan_node *pn;
+	linkdata *lnd;
+	CommNode *cn;
+	uint16_t i, tail, lc;
+	uint32_t j;
+
+	if (eng->esrc == NULL || eng->FIRST_BRICK(esrc)->brick == NULL) {
+		TRACE_LOG("Engine %s has no bricks to compile\n", eng->name);
+		TRACE_PKTENGINE_FUNC_END();
+		return NULL;
+	}
+
+	dp = calloc(1, sizeof(dispatch_plan));
+	if (dp == NULL) {
+		TRACE_LOG("Can't allocate memory for dispatch plan of engine %s\n",
+			  eng->name);
+		TRACE_PKTENGINE_FUNC_END();
+		return NULL;
+	}
+
+	plan_count(eng->FIRST_BRICK(esrc)->brick, &dp->node_count,
+		   &dp->leaf_count);
+	dp->nodes = calloc(dp->node_count, sizeof(plan_node));
+	dp->leaves = calloc((dp->leaf_count == 0) ? 1 : dp->leaf_count,
+			    sizeof(plan_leaf));
+	dp->touched = calloc((dp->leaf_count == 0) ? 1 : dp->leaf_count,
+			     sizeof(uint16_t));
+	if (dp->nodes == NULL || dp->leaves == NULL || dp->touched == NULL) {
+		TRACE_LOG("Can't allocate memory for dispatch plan of engine %s\n",
+			  eng->name);
+		dispatch_plan_free(dp);
+		TRACE_PKTENGINE_FUNC_END();
+		return NULL;
+	}
+
+	/* breadth-first walk: a node's children always get higher indices */
+	dp->nodes[0].brick = eng->FIRST_BRICK(esrc)->brick;
+	dp->nodes[0].level = 1;
+	for (i = 0, tail = 1, lc = 0; i < tail; i++) {
+		pn = &dp->nodes[i];
+		lnd = (linkdata *)(&pn->brick->lnd);
+		/* the seed used by hashing bricks stays the same as before */
+		lnd->level = pn->level;
+		pn->copy |= lnd->copy;
+		pn->count = lnd->count;
+		pn->links = calloc((pn->count == 0) ? 1 : pn->count,
+				   sizeof(plan_link));
+		if (pn->links == NULL) {
+			TRACE_LOG("Can't allocate memory for dispatch plan links\n");
+			dispatch_plan_free(dp);
+			TRACE_PKTENGINE_FUNC_END();
+			return NULL;
+		}
+		for (j = 0; j < pn->count; j++) {
+			pn->links[j].node = pn->links[j].leaf = PLAN_NONE;
+			cn = (CommNode *)lnd->external_links[j];
+			if (cn == NULL)
+				continue;
+			if (cn->brick != NULL) {
+				dp->nodes[tail].brick = cn->brick;
+				dp->nodes[tail].level = pn->level + 1;
+				dp->nodes[tail].copy = pn->copy;
+				pn->links[j].node = tail++;
+			} else {
+				cn->copy = pn->copy;
+				dp->copy_count += pn->copy;
+				/* pipes stay down across a recompile */
+				dp->down_count += cn->down;
+				dp->leaves[lc].cn = cn;
+				dp->leaves[lc].parent = i;
+				pn->links[j].leaf = lc++;
+			}
+		}
+	}
+
+	TRACE_DEBUG_LOG("Compiled plan for engine %s: %u nodes, %u leaves\n",
+			eng->name, dp->node_count, dp->leaf_count);
+	TRACE_PKTENGINE_FUNC_END();
+	return dp;
+}
+/*---------------------------------------------------------------------*/
+void
+dispatch_plan_free(dispatch_plan *dp)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	uint16_t i;
+
+	if (dp == NULL) {
+		TRACE_PKTENGINE_FUNC_END();
+		return;
+	}
+	if (dp->nodes != NULL) {
+		for (i = 0; i < dp->node_count; i++)
+			free(dp->nodes[i].links);
+		free(dp->nodes);
+	}
+	free(dp->leaves);
+	free(dp->touched);
+	free(dp);
+	TRACE_PKTENGINE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+dispatch_plan_run(dispatch_plan *dp, unsigned char **bufs,
+		  const uint32_t *lens, uint16_t n)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	unsigned char *sub_bufs[PLAN_MAX_BURST];
+	uint32_t sub_lens[PLAN_MAX_BURST];
+	BITMAP out[PLAN_MAX_BURST];
+	plan_node *pn, *child;
+	plan_leaf *leaf;
+	plan_link *link;
+	Brick *brick;
+	uint16_t i, k, p;
+	uint32_t j;
+	BITMAP b;
+
+	/* the whole burst enters at the root */
+	pn = &dp->nodes[0];
+	for (k = 0; k < n; k++)
+		pn->pkts[k] = k;
+	pn->n = n;
+
+	for (i = 0; i < dp->node_count; i++) {
+		pn = &dp->nodes[i];
+		if (pn->n == 0)
+			continue;
+		brick = pn->brick;
+
+		/* gather the buffers of this node's sub-burst */
+		for (k = 0; k < pn->n; k++) {
+			sub_bufs[k] = bufs[pn->pkts[k]];
+			sub_lens[k] = lens[pn->pkts[k]];
+		}
+
+		if (brick->elib->process_batch != NULL)
+			brick->elib->process_batch(brick, sub_bufs, sub_lens,
+						   pn->n, out);
+		else {
+			for (k = 0; k < pn->n; k++)
+				out[k] = brick->elib->process(brick, sub_bufs[k],
+							      sub_lens[k]);
+		}
+
+		/* scatter to children and leaves */
+		for (k = 0; k < pn->n; k++) {
+			b = out[k];
+			p = pn->pkts[k];
+			FOR_EACH_BIT(b, j) {
+				if (j >= pn->count)
+					break;
+				link = &pn->links[j];
+				if (link->node != PLAN_NONE) {
+					child = &dp->nodes[link->node];
+					child->pkts[child->n++] = p;
+				} else if (link->leaf != PLAN_NONE) {
+					leaf = &dp->leaves[link->leaf];
+					if (leaf->n == 0)
+						dp->touched[dp->touched_count++] =
+							link->leaf;
+					leaf->pkts[leaf->n++] = p;
+				}
+			}
+		}
+		pn->n = 0;
+	}
+	TRACE_PKTENGINE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
+dispatch_plan_print(dispatch_plan *dp, FILE *f)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	char name[IFNAMSIZ];
+	plan_node *pn;
+	plan_leaf *leaf;
+	CommNode *cn;
+	uint16_t i;
+	uint32_t j;
+
+	fprintf(f, "Nodes (%u):\n", dp->node_count);
+	for (i = 0; i < dp->node_count; i++) {
+		pn = &dp->nodes[i];
+		fprintf(f, "  [%u] %s (ifname: %s, level: %u, links: %u, %s%s)\n",
+			i, pn->brick->elib->getId(), pn->brick->lnd.ifname,
+			pn->level, pn->count,
+			(pn->brick->elib->process_batch != NULL) ?
+			"batched" : "per-packet",
+			(pn->copy) ? ", copy" : "");
+		for (j = 0; j < pn->count; j++) {
+			if (pn->links[j].node != PLAN_NONE)
+				fprintf(f, "      link %u -> node %d\n",
+					j, pn->links[j].node);
+			else if (pn->links[j].leaf != PLAN_NONE)
+				fprintf(f, "      link %u -> leaf %d\n",
+					j, pn->links[j].leaf);
+			else
+				fprintf(f, "      link %u -> (none)\n", j);
+		}
+	}
+	fprintf(f, "Leaves (%u):\n", dp->leaf_count);
+	for (i = 0; i < dp->leaf_count; i++) {
+		leaf = &dp->leaves[i];
+		cn = leaf->cn;
+		memset(name, 0, sizeof(name));
+		if (cn->out_nmd != NULL)
+			strcpy_with_reverse_pipe(name, cn->nm_ifname);
+		fprintf(f, "  [%u] %s %s (parent: node %d, %s)\n",
+			i, (cn->out_nmd != NULL) ? "pipe" : "pcap",
+			(cn->out_nmd != NULL) ? name : "dumper",
+			leaf->parent, (cn->copy) ? "copy" : "share");
+	}
+	TRACE_PKTENGINE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *
+ * Offline I/O module: reads packets from pcap files. Each link of the
+ * engine names a pcap file; "timed:<file>" replays it with the
+ * original inter-packet gaps, a plain file name replays it as fast as
+ * possible. Records are handed to the dispatch plan in bursts straight
+ * out of the mapped file.
+ *
+ */
+/* for io_module struct defn */
+#include "io_module.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for file module structs */
+#include "file_module.h"
+/* for brick def'n */
+#include "brick.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
+/* for MIN() */
+#include <sys/param.h>
+/* for mmap() */
+#include <sys/mman.h>
+/* for fstat() */
+#include <sys/stat.h>
+/* for open() */
+#include <fcntl.h>
+/* for close() */
+#include <unistd.h>
+/* for clock_gettime()/nanosleep() */
+#include <time.h>
+/* for gettimeofday() */
+#include <sys/time.h>
+/* for ioctl() */
+#include <sys/ioctl.h>
+/* for errno */
+#include <errno.h>
+/* for string functions */
+#include <string.h>
+/*---------------------------------------------------------------------*/
+static inline uint32_t
+file_u32(file_module_context *fmc, uint32_t v)
+{
+	return (fmc->swapped) ? __builtin_bswap32(v) : v;
+}
+/*---------------------------------------------------------------------*/
+static inline uint64_t
+now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+file_init(void **ctxt_ptr, void *engptr)
+{
+	TRACE_FILE_FUNC_START();
+	file_module_context *fmc;
+
+	/* create file context */
+	*ctxt_ptr = calloc(1, sizeof(file_module_context));
+	fmc = (file_module_context *) (*ctxt_ptr);
+	if (*ctxt_ptr == NULL) {
+		TRACE_LOG("Can't allocate memory for file context\n");
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	fmc->evfd[0] = fmc->evfd[1] = -1;
+	fmc->eng = (engine *)engptr;
+	TRACE_FILE_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+file_link_iface(void *ctxt, const unsigned char *iface,
+		const uint16_t batchsize, int8_t qid)
+{
+	TRACE_FILE_FUNC_START();
+	file_module_context *fmc = (file_module_context *)ctxt;
+	const char *path = (const char *)iface;
+	struct file_pcap_hdr *fh;
+	struct stat st;
+	uint32_t magic;
+	int32_t fd;
+
+	fmc->timed = 0;
+	if (!strncmp(path, FILE_TIMED_PREFIX, strlen(FILE_TIMED_PREFIX))) {
+		path += strlen(FILE_TIMED_PREFIX);
+		fmc->timed = 1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		TRACE_LOG("Unable to open %s: %s\n", path, strerror(errno));
+		if (fd != -1) close(fd);
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(struct file_pcap_hdr)) {
+		TRACE_LOG("%s is not a pcap file\n", path);
+		close(fd);
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	fmc->map_len = st.st_size;
+	fmc->map = mmap(NULL, fmc->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (fmc->map == MAP_FAILED) {
+		TRACE_LOG("Unable to map %s: %s\n", path, strerror(errno));
+		fmc->map = NULL;
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+	madvise(fmc->map, fmc->map_len, MADV_SEQUENTIAL);
+
+	fh = (struct file_pcap_hdr *)fmc->map;
+	magic = fh->magic;
+	fmc->swapped = (magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+			magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+	magic = file_u32(fmc, magic);
+	if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+		TRACE_LOG("%s is not a pcap file\n", path);
+		munmap(fmc->map, fmc->map_len);
+		fmc->map = NULL;
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+	fmc->nsec = (magic == PCAP_MAGIC_NSEC);
+	if (file_u32(fmc, fh->linktype) != DLT_EN10MB)
+		TRACE_LOG("%s does not hold Ethernet frames (linktype: %u)\n",
+			  path, file_u32(fmc, fh->linktype));
+	fmc->snaplen = file_u32(fmc, fh->snaplen);
+	if (fmc->snaplen == 0 || fmc->snaplen > FILE_MAX_SNAPLEN)
+		fmc->snaplen = FILE_MAX_SNAPLEN;
+	fmc->oversize = 0;
+	fmc->off = sizeof(struct file_pcap_hdr);
+
+	/* the pipe keeps the engine polling this source till EOF */
+	if (pipe(fmc->evfd) == -1 || write(fmc->evfd[1], "", 1) != 1) {
+		TRACE_LOG("Unable to create event pipe for %s: %s\n",
+			  path, strerror(errno));
+		munmap(fmc->map, fmc->map_len);
+		fmc->map = NULL;
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	/* setting batch size */
+	fmc->batch_size = (batchsize == 0 || batchsize > PLAN_MAX_BURST) ?
+		PLAN_MAX_BURST : batchsize;
+
+	TRACE_LOG("Replaying %s (%zu bytes) %s\n", path, fmc->map_len,
+		  (fmc->timed) ? "with original timing" : "as fast as possible");
+	UNUSED(qid);
+	TRACE_FILE_FUNC_END();
+	return fmc->evfd[0];
+}
+/*---------------------------------------------------------------------*/
+void
+file_unlink_ifaces(void *engptr)
+{
+	TRACE_FILE_FUNC_START();
+	engine *eng = (engine *)engptr;
+	file_module_context *fmc;
+	uint i;
+
+	for (i = 0; i < eng->no_of_sources; i++) {
+		fmc = (file_module_context *)eng->esrc[i]->private_context;
+		if (fmc->map != NULL)
+			munmap(fmc->map, fmc->map_len);
+		if (fmc->evfd[0] != -1) {
+			close(fmc->evfd[0]);
+			close(fmc->evfd[1]);
+		}
+		fmc->map = NULL;
+		fmc->evfd[0] = fmc->evfd[1] = -1;
+	}
+
+	TRACE_FILE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Writes the packets queued on a leaf to its pcap file.
+ * No packets should be dropped.
+ */
+static int32_t
+write_packets(CommNode *cn, plan_leaf *leaf,
+	      unsigned char **bufs, uint32_t *lens)
+{
+	TRACE_FILE_FUNC_START();
+	struct pcap_pkthdr phdr;
+	uint16_t k;
+
+	gettimeofday(&phdr.ts, NULL);
+	for (k = 0; k < leaf->n; k++) {
+		phdr.caplen = phdr.len = lens[leaf->pkts[k]];
+		pcap_dump((u_char *)cn->pdumper, &phdr, bufs[leaf->pkts[k]]);
+	}
+
+	TRACE_FILE_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Copies the packets queued on a leaf into its netmap pipe. Records
+ * that do not fit into a slot buffer are dropped: nm_inject() does not
+ * check their size.
+ * Returns no. of packets that were dropped.
+ */
+static int32_t
+inject_packets(CommNode *cn, plan_leaf *leaf,
+	       unsigned char **bufs, uint32_t *lens)
+{
+	TRACE_FILE_FUNC_START();
+	int retry = TX_RETRIES;
+	uint32_t buf_size, len;
+	uint16_t k, oversize = 0;
+
+	/* nothing is attached to the other end */
+	if (cn->out_nmd == NULL) {
+		TRACE_FILE_FUNC_END();
+		return leaf->n;
+	}
+
+	buf_size = NETMAP_TXRING(cn->out_nmd->nifp,
+				 cn->out_nmd->first_tx_ring)->nr_buf_size;
+	for (k = 0; k < leaf->n; ) {
+		len = lens[leaf->pkts[k]];
+		if (len > buf_size) {
+			oversize++;
+			k++;
+			continue;
+		}
+		if (nm_inject(cn->out_nmd, bufs[leaf->pkts[k]], len) != 0) {
+			k++;
+			continue;
+		}
+		if (retry-- == 0)
+			break;
+		ioctl(cn->out_nmd->fd, NIOCTXSYNC);
+	}
+	ioctl(cn->out_nmd->fd, NIOCTXSYNC);
+
+	TRACE_FILE_FUNC_END();
+	return leaf->n - k + oversize;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+file_callback(void *engsrcptr)
+{
+	TRACE_FILE_FUNC_START();
+	unsigned char *bufs[PLAN_MAX_BURST];
+	uint32_t lens[PLAN_MAX_BURST];
+	file_module_context *fmc;
+	struct file_pcap_rec *rec;
+	struct timespec ts;
+	engine_src *engsrc;
+	engine *eng;
+	dispatch_plan *dp;
+	plan_leaf *leaf;
+	uint64_t pkt_ts, now;
+	uint32_t caplen;
+	uint16_t n, i;
+	char c;
+
+	engsrc = (engine_src *)engsrcptr;
+	eng = (engine *)engsrc->brick->eng;
+	fmc = (file_module_context *)engsrc->private_context;
+	dp = eng->plan;
+
+	if (fmc->map == NULL) {
+		TRACE_LOG("file context was not properly initialized\n");
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	now = (fmc->timed) ? now_ns() : 0;
+	n = 0;
+	while (n < fmc->batch_size &&
+	       fmc->off + sizeof(*rec) <= fmc->map_len) {
+		rec = (struct file_pcap_rec *)(fmc->map + fmc->off);
+		caplen = file_u32(fmc, rec->incl_len);
+		if (fmc->off + sizeof(*rec) + caplen > fmc->map_len) {
+			/* truncated record: treat as EOF */
+			fmc->off = fmc->map_len;
+			break;
+		}
+		/* a corrupt record or one no packet buffer can hold */
+		if (caplen > fmc->snaplen) {
+			fmc->oversize++;
+			eng->pkt_dropped++;
+			fmc->off += sizeof(*rec) + caplen;
+			continue;
+		}
+		if (fmc->timed) {
+			pkt_ts = (uint64_t)file_u32(fmc, rec->ts_sec) * 1000000000ULL +
+				(uint64_t)file_u32(fmc, rec->ts_frac) *
+				((fmc->nsec) ? 1 : 1000);
+			if (fmc->start_ts == 0) {
+				fmc->first_ts = pkt_ts;
+				fmc->start_ts = now;
+			}
+			/* not due yet: flush what we have */
+			if (pkt_ts > fmc->first_ts &&
+			    fmc->start_ts + (pkt_ts - fmc->first_ts) > now) {
+				if (n == 0) {
+					ts.tv_sec = 0;
+					ts.tv_nsec = MIN(fmc->start_ts +
+							 (pkt_ts - fmc->first_ts) - now,
+							 FILE_MAX_SLEEP);
+					nanosleep(&ts, NULL);
+				}
+				break;
+			}
+		}
+		bufs[n] = fmc->map + fmc->off + sizeof(*rec);
+		lens[n] = caplen;
+		__builtin_prefetch(bufs[n]);
+		eng->byte_count += caplen;
+		eng->pkt_count++;
+		fmc->off += sizeof(*rec) + caplen;
+		n++;
+	}
+
+	if (dp != NULL && n != 0) {
+		/* hand the whole burst to the brick tree */
+		dispatch_plan_run(dp, bufs, lens, n);
+		for (i = 0; i < dp->touched_count; i++) {
+			leaf = &dp->leaves[dp->touched[i]];
+			if (leaf->cn->pdumper != NULL)
+				write_packets(leaf->cn, leaf, bufs, lens);
+			else
+				eng->pkt_dropped += inject_packets(leaf->cn, leaf,
+								   bufs, lens);
+			leaf->n = 0;
+		}
+		dp->touched_count = 0;
+	}
+
+	/* EOF: stop waking up the engine for this source */
+	if (fmc->off + sizeof(*rec) > fmc->map_len &&
+	    read(fmc->evfd[0], &c, 1) == 1)
+		TRACE_LOG("Engine %s reached the end of its pcap file "
+			  "(%llu records over the snaplen of %u skipped)\n",
+			  eng->name, (unsigned long long)fmc->oversize,
+			  fmc->snaplen);
+
+	TRACE_FILE_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+file_shutdown(void *engptr)
+{
+	TRACE_FILE_FUNC_START();
+	engine *eng = (engine *)engptr;
+	if (eng->run == 1) {
+		eng->run = 0;
+	} else {
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	TRACE_FILE_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+file_delete_all_channels(Brick *brick)
+{
+	TRACE_FILE_FUNC_START();
+	CommNode *cn = NULL;
+	uint32_t i;
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+
+	for (i = 0; i < lnd->count; i++) {
+		cn = (CommNode *)lnd->external_links[i];
+		if (cn->out_nmd != NULL)
+			nm_close(cn->out_nmd);
+		if (cn->pd != NULL || cn->pdumper) {
+			pcap_close(cn->pd);
+			pcap_dump_close(cn->pdumper);
+			cn->pd = NULL;
+			cn->pdumper = NULL;
+		}
+		if (cn->brick != NULL) {
+			file_delete_all_channels(cn->brick);
+			cn->brick = NULL;
+		}
+		free(cn);
+	}
+
+	brick->elib->deinit(brick);
+	TRACE_FILE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+int32_t
+file_create_channel(char *in_name, char *out_name,
+		    Target t, void *esrcptr)
+{
+	TRACE_FILE_FUNC_START();
+	char ifname[IFNAMSIZ];
+	int32_t fd;
+	engine *eng;
+	CommNode *cn;
+	linkdata *lnd;
+	engine_src *esrc;
+	Brick *brick;
+
+	fd = -1;
+	esrc = (engine_src *)esrcptr;
+	brick = esrc->brick;
+	eng = (engine *)brick->eng;
+
+	lnd = (linkdata *)(&brick->lnd);
+	/* first locate the source */
+	if (strcmp((char *)lnd->ifname, in_name) != 0) {
+		brick = enable_pipeline(brick, in_name, t, out_name);
+		if (brick == NULL) {
+			TRACE_LOG("Pipelining failed!! Could not find an appropriate "
+				  "source (%s) for engine %s!\n", in_name, eng->name);
+			TRACE_FILE_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* reinitialize lnd if brick is reset */
+	lnd = (linkdata *)(&brick->lnd);
+
+	/* create a comm. interface */
+	lnd->external_links[lnd->init_cur_idx] = calloc(1, sizeof(CommNode));
+	if (lnd->external_links[lnd->init_cur_idx] == NULL) {
+		TRACE_ERR("Can't allocate mem for destInfo[%d] for engine %s\n",
+			  lnd->init_cur_idx, eng->name);
+		TRACE_FILE_FUNC_END();
+		return -1;
+	}
+
+	cn = (CommNode *)lnd->external_links[lnd->init_cur_idx];
+
+	if (t == WRITE) {
+		TRACE_LOG("Creating pcap writing element %p to file: %s\n",
+			  brick, out_name);
+		/* records may be longer than Ethernet frames */
+		cn->pd = pcap_open_dead(DLT_EN10MB, FILE_MAX_SNAPLEN);
+		cn->pdumper = (cn->pd == NULL) ? NULL :
+			pcap_dump_open(cn->pd, out_name);
+		if (cn->pdumper == NULL) {
+			TRACE_LOG("Can't open %s for writing: %s\n", out_name,
+				  (cn->pd == NULL) ? "no pcap handle" :
+				  pcap_geterr(cn->pd));
+			if (cn->pd != NULL)
+				pcap_close(cn->pd);
+			free(cn);
+			lnd->external_links[lnd->init_cur_idx] = NULL;
+			TRACE_FILE_FUNC_END();
+			return -1;
+		}
+		fd = 0;
+	} else {
+		/* other outputs are netmap pipes (if netmap is around) */
+		snprintf(ifname, IFNAMSIZ, "netmap:%s", out_name);
+		cn->out_nmd = nm_open(ifname, NULL, 0, NULL);
+		if (cn->out_nmd == NULL)
+			TRACE_LOG("Can't open %s, packets reaching it will be "
+				  "dropped\n", ifname);
+		strcpy_with_reverse_pipe(cn->nm_ifname, out_name);
+		/* a channel without pipe may still feed a pipelined brick */
+		fd = (cn->out_nmd == NULL) ? 0 : cn->out_nmd->fd;
+	}
+
+	lnd->init_cur_idx++;
+	TRACE_LOG("Created %s interface\n", out_name);
+
+	TRACE_FILE_FUNC_END();
+	return fd;
+}
+/*---------------------------------------------------------------------*/
+io_module_funcs file_module = {
+	.init_context  		= 	file_init,
+	.link_iface		= 	file_link_iface,
+	.unlink_ifaces		= 	file_unlink_ifaces,
+	.callback		= 	file_callback,
+	.create_external_link 	=	file_create_channel,
+	.delete_all_channels 	=	file_delete_all_channels,
+	.shutdown		= 	file_shutdown,
+};
+/*---------------------------------------------------------------------*/
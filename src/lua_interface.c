@@ -39,6 +39,8 @@
 #include "main.h"
 /* for bricks */
 #include "brick.h"
+/* for LoadBalancer modes */
+#include "bricks_lb.h"
 /* for string functions on FreeBSD */
 #if defined(__FreeBSD__)
 #include <string.h>
@@ -178,12 +180,13 @@ pktengine_help(lua_State *L)
 	TRACE_LUA_FUNC_START();
 	fprintf(stdout, "Packet Engine Commands:\n"
 		"    help()\n"
-		"    new(<ioengine_name>, <queue_sz>, <cpu number>)\n"
+		"    new(<ioengine_name>, <queue_sz>, <cpu number>, <io_type>)\n"
 		"    delete()\n"
 		"    link(<brick>, <chunk_size>, <qid>)\n"
 		"    start()\n"
 		"    stop()\n"
 		"    show_stats()\n"
+		"    show_plan()\n"
 		);
 	UNUSED(L);
 	TRACE_LUA_FUNC_END();
@@ -234,11 +237,22 @@ pkteng_new(lua_State *L)
 	const char *ename = luaL_optstring(L, 1, 0);
 	int cpu = -1;
 	int buffer_sz = 512;
+	const char *io = NULL;
+	int32_t iot;
 	/* only grab cpu metric if it is mentioned */
 	if (nargs >= 2)
 		buffer_sz = luaL_optint(L, 2, 0);
-	if (nargs == 3)
+	if (nargs >= 3)
 		cpu = luaL_optint(L, 3, 0);
+	if (nargs >= 4)
+		io = luaL_optstring(L, 4, 0);
+
+	iot = pktengine_io_type(io);
+	if (iot == -1) {
+		TRACE_LOG("Unknown I/O type: %s\n", io);
+		TRACE_LUA_FUNC_END();
+		return 0;
+	}
 	
 	/* parse and populate the remaining fields */
 	PktEngine_Intf *pe = push_pkteng(L);
@@ -247,7 +261,9 @@ pkteng_new(lua_State *L)
 	pe->buffer_sz = buffer_sz;
 
 	pktengine_new((uint8_t *)pe->eng_name,
-		      pe->buffer_sz, pe->cpu);
+		      pe->buffer_sz, pe->cpu, (io_type)iot,
+		      (io != NULL && strchr(io, ':') != NULL) ?
+		      strchr(io, ':') + 1 : NULL);
 	TRACE_LUA_FUNC_END();
 	return 1;
 }
@@ -296,7 +312,13 @@ pkteng_link(lua_State *L)
 	}
 
 	first_brick->eng = engine_find((unsigned char *)pe->eng_name);
-	first_brick->elib->init(first_brick, linker);
+	if (first_brick->elib->init(first_brick, linker) == -1) {
+		TRACE_LOG("Could not initialize brick %s\n",
+			  first_brick->elib->getId());
+		TRACE_LUA_FUNC_END();
+		free(first_brick);
+		return 1;
+	}
 	if (first_brick->eng == NULL) {
 		TRACE_LOG("Could not find engine with name: %s\n",
 			  pe->eng_name);
@@ -359,6 +381,19 @@ pkteng_show_stats(lua_State *L)
 }
 /*---------------------------------------------------------------------*/
 static int
+pkteng_show_plan(lua_State *L)
+{
+	TRACE_LUA_FUNC_START();
+	PktEngine_Intf *pe = check_pkteng(L, 1);
+	lua_settop(L, 1);
+	
+	pktengine_show_plan((uint8_t *)pe->eng_name);
+	TRACE_LUA_FUNC_END();
+
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+static int
 pkteng_delete(lua_State *L)
 {
 	TRACE_LUA_FUNC_START();
@@ -389,6 +424,7 @@ static const luaL_reg pkteng_methods[] = {
         {"link",          pkteng_link},
         {"start",         pkteng_start},
 	{"show_stats",	  pkteng_show_stats},
+	{"show_plan",	  pkteng_show_plan},
         {"delete",	  pkteng_delete},
         {"stop",          pkteng_stop},
 	{"help",	  pktengine_help},
@@ -482,7 +518,14 @@ linker_help(lua_State *L)
 	TRACE_LUA_FUNC_START();
 	fprintf(stdout, "LoadBalance/Duplicator/Merge/Filter/Dummy/? Commands:\n"
 		"    help()\n"
-		"    new([<split-mode>])\n"
+		"    new(<brick>, [<split-mode> | <bpf-exprs>], [<options>])\n"
+		"        options (LoadBalancer): {inner=true,\n"
+		"            mode=\"modulo\"|\"weighted\"|\"consistent\"|\"sticky\",\n"
+		"            weights={<per output link>}, idle=<secs (sticky)>}\n"
+		"        options (Shunt): {cutoff=<bytes>, cutoff_pkts=<n>,\n"
+		"            idle=<secs>}\n"
+		"        options (RateLimiter): {pps=<n>, bps=<n>, burst=<msecs>,\n"
+		"            flow_pps=<n>, flow_bps=<n>, divert=true}\n"
 		"    connect_input(<interfaces>)\n"
 	     	"    connect_output(<interfaces>)\n"
 		"    connect_outputs(<interface>, split)\n"
@@ -530,6 +573,101 @@ check_linker(lua_State *L, int index)
 	return linker;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Reads a rate (pkts or bits/sec) off the options table; 0 if unset
+ */
+static uint64_t
+linker_rate(lua_State *L, int index, const char *name)
+{
+	lua_Number r;
+
+	lua_getfield(L, index, name);
+	r = lua_isnumber(L, -1) ? lua_tonumber(L, -1) : 0;
+	lua_pop(L, 1);
+	if (r < 1)
+		return 0;
+	return (r < 1e18) ? (uint64_t)r : (uint64_t)1e18;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Reads the options table of Brick.new(), e.g.
+ * {inner=true, mode="weighted", weights={2, 1, 1}}
+ */
+static void
+linker_options(lua_State *L, int index, Linker_Intf *linker)
+{
+	TRACE_LUA_FUNC_START();
+	const char *mode;
+	int i;
+
+	lua_getfield(L, index, "inner");
+	linker->hash_inner = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "mode");
+	mode = lua_tostring(L, -1);
+	if (mode == NULL || !strcmp(mode, "modulo"))
+		linker->lb_mode = LB_MODULO;
+	else if (!strcmp(mode, "weighted"))
+		linker->lb_mode = LB_WEIGHTED;
+	else if (!strcmp(mode, "consistent"))
+		linker->lb_mode = LB_CONSISTENT;
+	else if (!strcmp(mode, "sticky"))
+		linker->lb_mode = LB_STICKY;
+	else
+		TRACE_LOG("Unknown mode: %s (using modulo)\n", mode);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "idle");
+	if (lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0)
+		linker->flow_idle = (lua_tonumber(L, -1) < 0xFFFF) ?
+			lua_tointeger(L, -1) : 0xFFFF;
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "cutoff");
+	if (lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0)
+		linker->cutoff_bytes = (lua_tonumber(L, -1) < UINT32_MAX) ?
+			(uint32_t)lua_tonumber(L, -1) : UINT32_MAX;
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "cutoff_pkts");
+	if (lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0)
+		linker->cutoff_pkts = (lua_tonumber(L, -1) < UINT32_MAX) ?
+			(uint32_t)lua_tonumber(L, -1) : UINT32_MAX;
+	lua_pop(L, 1);
+
+	linker->rate_pps = linker_rate(L, index, "pps");
+	linker->rate_bps = linker_rate(L, index, "bps");
+	linker->flow_pps = linker_rate(L, index, "flow_pps");
+	linker->flow_bps = linker_rate(L, index, "flow_bps");
+
+	lua_getfield(L, index, "burst");
+	if (lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0)
+		linker->burst_ms = (lua_tonumber(L, -1) < UINT32_MAX) ?
+			(uint32_t)lua_tonumber(L, -1) : UINT32_MAX;
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "divert");
+	linker->divert = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "weights");
+	if (lua_istable(L, -1)) {
+		for (i = 1; linker->weight_count < MAX_OUTLINKS; i++) {
+			lua_rawgeti(L, -1, i);
+			if (!lua_isnumber(L, -1)) {
+				lua_pop(L, 1);
+				break;
+			}
+			linker->weight[linker->weight_count++] =
+				(lua_tonumber(L, -1) > 0) ? lua_tointeger(L, -1) : 0;
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+	TRACE_LUA_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
 /**
  * XXX - This function needs to be improved...
  */
@@ -542,7 +680,7 @@ linker_new(lua_State *L)
 	const char *brick_name = luaL_optstring(L, 1, 0);
 	int i;
 
-	if (nargs == 2) {
+	if (nargs >= 2 && lua_isnumber(L, 2)) {
 		arg = luaL_optint(L, 2, 0);
 	}
 
@@ -554,6 +692,29 @@ linker_new(lua_State *L)
 	
 	linker->hash_split = arg;
 	TRACE_DEBUG_LOG("Hash splitting logic: %d\n", linker->hash_split);
+	/* string args are filter expressions, one per output link */
+	linker->expr_count = 0;
+	linker->hash_inner = 0;
+	linker->lb_mode = LB_MODULO;
+	linker->weight_count = 0;
+	linker->flow_idle = 0;
+	linker->cutoff_bytes = 0;
+	linker->cutoff_pkts = 0;
+	linker->rate_pps = linker->rate_bps = 0;
+	linker->flow_pps = linker->flow_bps = 0;
+	linker->burst_ms = 0;
+	linker->divert = 0;
+	for (i = 2; i <= nargs && linker->expr_count < MAX_OUTLINKS; i++) {
+		if (lua_isnumber(L, i))
+			continue;
+		if (lua_istable(L, i)) {
+			linker_options(L, i, linker);
+			continue;
+		}
+		linker->filter_expr[linker->expr_count] =
+			strdup(luaL_checkstring(L, i));
+		linker->expr_count++;
+	}
 	linker->output_count = 0;
 	linker->input_count = 0;
 	linker->next_linker = NULL;
@@ -572,7 +733,8 @@ linker_input(lua_State *L)
 	linker = check_linker(L, 1);
 	/* pick as many input sources as possible */
 	if (linker->type >= LINKER_MERGE) {
-		for (i = 2; i <= nargs; i++) {
+		for (i = 2; i <= nargs && linker->input_count < MAX_INLINKS;
+		     i++) {
 			linker->input_link[linker->input_count] = 
 				luaL_optstring(L, i, 0);
 			linker->input_count++;
@@ -604,7 +766,8 @@ linker_output(lua_State *L)
 			luaL_optstring(L, 2, 0);
 		linker->output_count = 1;
 	} else { /* for LINKER_LB or LINKER_DUP, etc. */
-		for (i = 2; i <= nargs; i++) {
+		for (i = 2; i <= nargs && linker->output_count < MAX_OUTLINKS;
+		     i++) {
 			linker->output_link[linker->output_count] = 
 				luaL_optstring(L, i, 0);
 			linker->output_count++;
@@ -629,6 +792,11 @@ linker_outputs(lua_State *L)
 	linker = check_linker(L, 1);
 	strcpy(iface, luaL_optstring(L, 2, 0));
 	split = luaL_optint(L, 3, 0);
+	if (split > MAX_OUTLINKS - linker->output_count) {
+		TRACE_LOG("A brick can have at most %d output links\n",
+			  MAX_OUTLINKS);
+		split = MAX_OUTLINKS - linker->output_count;
+	}
 	for (i = 0; i < split; i++) {
 		char *tmp = calloc(1, IFNAMSIZ);
 		if (tmp == NULL) {
@@ -685,9 +853,14 @@ static int
 linker_gc(lua_State *L)
 {
 	TRACE_LUA_FUNC_START();
-	TRACE_DEBUG_LOG("Wiping off Linker: %p\n", to_linker(L, 1));
+	Linker_Intf *linker = to_linker(L, 1);
+	int i;
+
+	TRACE_DEBUG_LOG("Wiping off Linker: %p\n", linker);
+	for (i = 0; i < linker->expr_count; i++)
+		free((char *)linker->filter_expr[i]);
+	linker->expr_count = 0;
 	TRACE_LUA_FUNC_END();
-	UNUSED(L);
 	return 0;
 }
 /*---------------------------------------------------------------------*/
@@ -52,12 +52,14 @@
 #include "backend.h"
 /* for filter functions */
 #include "bricks_filter.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
 /*---------------------------------------------------------------------*/
 /*
  * limit the number of packets per cycle based on Luigi's suggestion
  * "Important to release buffers quickly!"
  */
-#define BATCH_SIZE			128
+#define BATCH_SIZE			PLAN_MAX_BURST
 /*---------------------------------------------------------------------*/
 int32_t
 netmap_init(void **ctxt_ptr, void *engptr)
@@ -79,6 +81,110 @@ netmap_init(void **ctxt_ptr, void *engptr)
 	return 0;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Sets up zero-copy fan-out for the engine-local descriptor. The extra
+ * buffers that netmap handed out on NIOCREGIF (chained through
+ * ni_bufs_head) seed a pool of spare buffers. When a packet needs to
+ * reach more than one pipe, its RX slot gets a spare buffer and the
+ * original buffer is given to every pipe with a reference count. The
+ * buffer goes back to the pool once the last pipe slot holding it is
+ * recycled. If netmap gave us no extra buffers, fan-out falls back to
+ * copy_packets().
+ */
+static void
+netmap_zc_init(netmap_module_context *nmc)
+{
+	TRACE_NETMAP_FUNC_START();
+	struct nm_desc *d = nmc->local_nmd;
+	struct netmap_ring *ring = d->some_ring;
+	uint32_t idx;
+
+	if (d->req.nr_arg3 == 0 || d->nifp->ni_bufs_head == 0) {
+		TRACE_LOG("No extra buffers for %s, packet fan-out "
+			  "will be copied\n", d->req.nr_name);
+		TRACE_NETMAP_FUNC_END();
+		return;
+	}
+
+	nmc->nbufs = ((char *)d->buf_end - (char *)d->buf_start) /
+		ring->nr_buf_size;
+	nmc->buf_refcnt = calloc(nmc->nbufs, sizeof(uint16_t));
+	/* the pool may end up holding any buffer displaced from a pipe */
+	nmc->zc_pool = calloc(nmc->nbufs, sizeof(uint32_t));
+	if (nmc->buf_refcnt == NULL || nmc->zc_pool == NULL) {
+		TRACE_LOG("Can't allocate zero-copy context, packet fan-out "
+			  "will be copied\n");
+		free(nmc->buf_refcnt);
+		free(nmc->zc_pool);
+		nmc->buf_refcnt = NULL;
+		nmc->zc_pool = NULL;
+		TRACE_NETMAP_FUNC_END();
+		return;
+	}
+
+	for (idx = d->nifp->ni_bufs_head;
+	     idx != 0 && nmc->zc_pool_cnt < nmc->nbufs;
+	     idx = *(uint32_t *)NETMAP_BUF(ring, idx))
+		nmc->zc_pool[nmc->zc_pool_cnt++] = idx;
+	d->nifp->ni_bufs_head = 0;
+
+	TRACE_LOG("Zero-copy fan-out enabled with %u spare buffers\n",
+		  nmc->zc_pool_cnt);
+	TRACE_NETMAP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Hands the spare buffers back to netmap (through ni_bufs_head) so that
+ * they are released on nm_close(). Buffers that are still referenced by
+ * pipe slots are freed along with the pipe rings.
+ */
+static void
+netmap_zc_fini(netmap_module_context *nmc)
+{
+	TRACE_NETMAP_FUNC_START();
+	struct nm_desc *d = nmc->local_nmd;
+	uint32_t i;
+
+	if (nmc->buf_refcnt == NULL) {
+		TRACE_NETMAP_FUNC_END();
+		return;
+	}
+
+	for (i = 0; i < nmc->zc_pool_cnt; i++)
+		*(uint32_t *)NETMAP_BUF(d->some_ring, nmc->zc_pool[i]) =
+			(i + 1 < nmc->zc_pool_cnt) ? nmc->zc_pool[i + 1] : 0;
+	d->nifp->ni_bufs_head = (nmc->zc_pool_cnt != 0) ? nmc->zc_pool[0] : 0;
+
+	free(nmc->buf_refcnt);
+	free(nmc->zc_pool);
+	nmc->buf_refcnt = NULL;
+	nmc->zc_pool = NULL;
+	nmc->zc_pool_cnt = nmc->nbufs = 0;
+	TRACE_NETMAP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Releases a buffer that was displaced from a pipe slot (or a reference
+ * that could not be delivered). Exclusively owned buffers go straight to
+ * the pool; shared buffers go there along with their last reference.
+ */
+static inline void
+zc_put(netmap_module_context *nmc, uint32_t idx)
+{
+	if (nmc->buf_refcnt[idx] == 0 || --nmc->buf_refcnt[idx] == 0)
+		nmc->zc_pool[nmc->zc_pool_cnt++] = idx;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Zero-copy fan-out is used as long as spare buffers are available and
+ * the engine has a single source (refcounts are kept per source).
+ */
+static inline int
+zc_enabled(netmap_module_context *nmc, engine *eng)
+{
+	return (nmc->buf_refcnt != NULL && eng->no_of_sources == 1);
+}
+/*---------------------------------------------------------------------*/
 int32_t
 netmap_link_iface(void *ctxt, const unsigned char *iface,
 		  const uint16_t batchsize, int8_t qid)
@@ -162,6 +268,12 @@ netmap_link_iface(void *ctxt, const unsigned char *iface,
 	/* setting batch size */
 	nmc->batch_size = batchsize;
 	
+	/* 
+	 * every engine-local descriptor asks for its own pool of
+	 * extra buffers (used for zero-copy fan-out)
+	 */
+	nic->global_nmd->req.nr_arg3 = NM_ZC_EXTRA_BUFS;
+
 	/* open handle */
 	nmc->local_nmd = nm_open((char *)nifname, NULL, nic->nmd_flags |
 				 NM_OPEN_IFNAME | NM_OPEN_NO_MMAP, 
@@ -176,6 +288,7 @@ netmap_link_iface(void *ctxt, const unsigned char *iface,
 		TRACE_DEBUG_LOG("zerocopy %s", 
 				(nic->global_nmd->mem == nmc->local_nmd->mem) ? 
 				"enabled\n" : "disabled\n");
+		netmap_zc_init(nmc);
 	}
 	
 	/* Wait for mandatory (& cautionary) PHY reset */
@@ -199,8 +312,10 @@ netmap_unlink_ifaces(void *engptr)
 	for (i = 0; i < eng->no_of_sources; i++) { 
 		nmc = (netmap_module_context *)eng->esrc[i]->private_context;
 		/* if local netmap desc is not closed, close it */
-		if (nmc->local_nmd != NULL)
+		if (nmc->local_nmd != NULL) {
+			netmap_zc_fini(nmc);
 			nm_close(nmc->local_nmd);
+		}
 		nmc->local_nmd = NULL;
 	}
 	
@@ -264,7 +379,7 @@ write_packets(CommNode *cn)
 		struct netmap_slot *src;
 		struct netmap_ring *sr = x[rx].ring;
 		src = &sr->slot[x[rx].slot_idx];
-		p = NETMAP_BUF(sr, src->buf_idx);
+		p = NETMAP_BUF(sr, x[rx].buf_idx);
 		
 		phdr.caplen = phdr.len = 
 			src->len;
@@ -277,12 +392,118 @@ write_packets(CommNode *cn)
 	return 0;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Free slots left in the TX rings of the pipe
+ */
+static inline u_int
+pipe_space(struct nm_desc *d)
+{
+	u_int r, space = 0;
+
+	for (r = d->first_tx_ring; r <= d->last_tx_ring; r++)
+		space += nm_ring_space(NETMAP_TXRING(d->nifp, r));
+	return space;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Lets the kernel reclaim the slots that the consumer of the pipe has
+ * read. Returns 1 if that made room for another try. Syncing again
+ * while the consumer makes no progress only burns cycles.
+ */
+static int
+pipe_sync(CommNode *cn)
+{
+	u_int space = pipe_space(cn->out_nmd);
+
+	cn->closed = (ioctl(cn->out_nmd->fd, NIOCTXSYNC) == -1);
+	return !cn->closed && pipe_space(cn->out_nmd) > space;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Takes the pipe out of (or puts it back into) the targets of the
+ * brick that feeds it. Only the LoadBalancer steers around links that
+ * are down (see lb_failover()); other bricks keep writing to them.
+ */
+static void
+pipe_set_down(CommNode *cn, netmap_module_context *nmc, uint8_t down)
+{
+	TRACE_NETMAP_FUNC_START();
+	/* the count is per engine: every source writes to the same leaves */
+	dispatch_plan *dp = nmc->eng->plan;
+
+	cn->down = down;
+	cn->stalls = 0;
+	if (dp != NULL) {
+		if (down)
+			dp->down_count++;
+		else
+			dp->down_count--;
+	}
+	if (cn->parent != NULL) {
+		if (down)
+			SET_BIT(cn->parent->down, cn->idx);
+		else
+			CLR_BIT(cn->parent->down, cn->idx);
+	}
+	TRACE_LOG("Pipe %s is %s\n", cn->nm_ifname,
+		  (down) ? ((cn->closed) ? "closed, taking it down" :
+			    "stalled, taking it down") : "back up");
+	TRACE_NETMAP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Accounts for a burst that left (left) packets that did not fit into
+ * the pipe. A pipe whose consumer went away, or which could not take
+ * PIPE_STALL_LIMIT bursts in a row, goes down until probe_pipes()
+ * finds it drained.
+ */
+static inline void
+pipe_health(CommNode *cn, netmap_module_context *nmc, u_int left)
+{
+	if (left == 0) {
+		cn->stalls = 0;
+		return;
+	}
+	if (cn->down == 0 &&
+	    (cn->closed || ++cn->stalls >= PIPE_STALL_LIMIT))
+		pipe_set_down(cn, nmc, 1);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Brings back the leaves that are down once their consumer has read
+ * at least half of what their TX rings hold.
+ */
+static void
+probe_pipes(dispatch_plan *dp, netmap_module_context *nmc)
+{
+	TRACE_NETMAP_FUNC_START();
+	struct nm_desc *d;
+	CommNode *cn;
+	u_int r, slots;
+	uint16_t i;
+
+	for (i = 0; i < dp->leaf_count && dp->down_count != 0; i++) {
+		cn = dp->leaves[i].cn;
+		d = cn->out_nmd;
+		if (cn->down == 0 || d == NULL)
+			continue;
+		cn->closed = (ioctl(d->fd, NIOCTXSYNC) == -1);
+		if (cn->closed)
+			continue;
+		for (slots = 0, r = d->first_tx_ring; r <= d->last_tx_ring; r++)
+			slots += NETMAP_TXRING(d->nifp, r)->num_slots - 1;
+		if (pipe_space(d) * 2 >= slots)
+			pipe_set_down(cn, nmc, 0);
+	}
+	TRACE_NETMAP_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
 /**
  * Passes a batch of packets to next netmap pipe endpoint.
  * Returns no. of packets that were dropped due to lack of empty rings.
  */
 static int32_t
-share_packets(CommNode *cn)
+share_packets(CommNode *cn, netmap_module_context *nmc)
 {
 	TRACE_NETMAP_FUNC_START();
         u_int dr; 			/* destination ring */
@@ -339,14 +560,13 @@ share_packets(CommNode *cn)
         }
 
         if (i < MIN(n, TXQ_MAX)) {
-                if (retry-- > 0) {
-                        ioctl(cn->out_nmd->fd, NIOCTXSYNC);
+		/* a pipe that is down gets no retries */
+                if (!cn->down && retry-- > 0 && pipe_sync(cn))
                         goto try_share_again;
-		} else {
-			TRACE_DEBUG_LOG("Giving up for now\n");
-		}
+		TRACE_DEBUG_LOG("Giving up for now\n");
                 TRACE_DEBUG_LOG("%d buffers leftover", n - i);
         }
+	pipe_health(cn, nmc, n - i);
 
         cn->cur_txq = 0;
 	
@@ -356,10 +576,12 @@ share_packets(CommNode *cn)
 /*---------------------------------------------------------------------*/
 /**
  * Passes a copy of the batch of packets to next netmap pipe endpoint.
+ * Packets that only go to this pipe (TXQ_OWN) are swapped instead, as
+ * in share_packets().
  * Returns no. of packets that were dropped due to lack of empty rings.
  */
 static int32_t
-copy_packets(CommNode *cn)
+copy_packets(CommNode *cn, netmap_module_context *nmc)
 {
 	TRACE_NETMAP_FUNC_START();
         u_int dr; 			/* destination ring */
@@ -403,112 +625,240 @@ copy_packets(CommNode *cn)
 			src = &sr->slot[x[i].slot_idx];
 			
 			dst->len = src->len;
-			srcbuf = NETMAP_BUF(sr, src->buf_idx);
-			dstbuf = NETMAP_BUF(ring, dst->buf_idx);
-			/* nm_pkt_copy() is not ideal for the real world, 
-			   it only copies 64-byte aligned data segments */
-			memcpy(dstbuf, srcbuf, dst->len);
+			if (x[i].mode == TXQ_OWN) {
+				/* nobody else reads it, swap now! */
+				register u_int tmp;
+				dst->flags = src->flags = NS_BUF_CHANGED;
+				tmp = dst->buf_idx;
+				dst->buf_idx = src->buf_idx;
+				src->buf_idx = tmp;
+			} else {
+				srcbuf = NETMAP_BUF(sr, src->buf_idx);
+				dstbuf = NETMAP_BUF(ring, dst->buf_idx);
+				/* nm_pkt_copy() is not ideal for the real world, 
+				   it only copies 64-byte aligned data segments */
+				memcpy(dstbuf, srcbuf, dst->len);
+			}
 			
 			ring->head = ring->cur = nm_ring_next(ring, ring->cur);
 			total_written++;
 		}
 	}
 	if (i < MIN(n, TXQ_MAX)) {
-		if (retry-- > 0) {
-			ioctl(cn->out_nmd->fd, NIOCTXSYNC);
+		/* a pipe that is down gets no retries */
+		if (!cn->down && retry-- > 0 && pipe_sync(cn))
 			goto try_copy_again;
-		} else {
-			TRACE_DEBUG_LOG("Giving up for now\n");
-		}
+		TRACE_DEBUG_LOG("Giving up for now\n");
 		TRACE_DEBUG_LOG("%d buffers leftover", n - i);
 	}
+	pipe_health(cn, nmc, n - i);
 	cn->cur_txq = 0;
 	
 	TRACE_NETMAP_FUNC_END();
         return (int)n - total_written;
 }
-/*------------------------------------------------------------------------*/
-void
-flush_all_cnodes(Brick *brick, engine *eng)
+/*---------------------------------------------------------------------*/
+/**
+ * Passes a batch of packets to the next netmap pipe endpoint without
+ * copying fanned-out packets: TXQ_REF entries hand out one more
+ * reference to the shared buffer. Buffers displaced from the pipe
+ * slots are released with zc_put(). A pipe slot that still holds a
+ * shared buffer is never swapped into an RX ring or written to.
+ * Returns no. of packets that were dropped due to lack of empty rings
+ * (or spare buffers).
+ */
+static int32_t
+zc_packets(CommNode *cn, netmap_module_context *nmc)
 {
 	TRACE_NETMAP_FUNC_START();
-	CommNode *cn;
-	uint32_t i;
-	linkdata *lnd = (linkdata *)(&brick->lnd);
-	for (i = 0; i < lnd->count; i++) {
-		cn = (CommNode *)lnd->external_links[i];
-		if (cn->brick != NULL) {
-			flush_all_cnodes(cn->brick, eng);
-		} else { /* cn->brick == NULL */
-			if (cn->cur_txq > 0) {
-				eng->pkt_dropped += (eng->mark_for_copy == 1) ? 
-					copy_packets(cn) :
-					share_packets(cn);
-			}
-		}
+        u_int dr; 			/* destination ring */
+        u_int i = 0, k;
+        const u_int n = cn->cur_txq;	/* how many queued packets */
+        struct txq_entry *x = cn->q;
+        int retry = TX_RETRIES;		/* max retries */
+        struct nm_desc *dst = cn->out_nmd;
+	int total_written = 0;
+
+	/* if dst is NULL, then this has to be pcap write request */
+	if (dst == NULL) {
+		write_packets(cn);
+		for (k = 0; k < n; k++)
+			if (x[k].mode == TXQ_REF)
+				zc_put(nmc, x[k].buf_idx);
+		TRACE_NETMAP_FUNC_END();
+		return 0;
 	}
+
+	/* if queued pkts are zero.... skip! */
+        if (n == 0) {
+                TRACE_DEBUG_LOG("Nothing to forward to pipe nmd: %p\n",
+				cn->out_nmd);
+		TRACE_NETMAP_FUNC_END();
+                return 0;
+        }
+
+ try_zc_again:	
+        /* scan all output rings; dr is the destination ring index */
+        for (dr = dst->first_tx_ring; i < MIN(n, TXQ_MAX) && dr <= dst->last_tx_ring; dr++) {
+                struct netmap_ring *ring = NETMAP_TXRING(dst->nifp, dr);
+
+                __builtin_prefetch(ring);
+		/* oops! try next ring */
+                if (nm_ring_empty(ring))
+                        continue;
+
+                for  (; i < MIN(n, TXQ_MAX) && !nm_ring_empty(ring); i++) {
+                        struct netmap_slot *ts, *rs;
+			struct netmap_ring *sr = x[i].ring;
+			uint32_t old, spare;
+
+                        ts = &ring->slot[ring->cur];
+			rs = &sr->slot[x[i].slot_idx];
+			old = ts->buf_idx;
+
+			if (x[i].mode == TXQ_REF) {
+				/* one more reader of the shared buffer */
+				ts->buf_idx = x[i].buf_idx;
+				zc_put(nmc, old);
+			} else if (nmc->buf_refcnt[old] == 0) {
+				/* the pipe slot owns its buffer */
+				if (x[i].mode == TXQ_OWN) {
+					ts->buf_idx = rs->buf_idx;
+					rs->buf_idx = old;
+					rs->flags = NS_BUF_CHANGED;
+				} else
+					memcpy(NETMAP_BUF(ring, old),
+					       NETMAP_BUF(sr, x[i].buf_idx),
+					       rs->len);
+			} else if (nmc->zc_pool_cnt != 0 ||
+				   nmc->buf_refcnt[old] == 1) {
+				/* the pipe slot still holds a shared buffer */
+				zc_put(nmc, old);
+				spare = nmc->zc_pool[--nmc->zc_pool_cnt];
+				if (x[i].mode == TXQ_OWN) {
+					ts->buf_idx = rs->buf_idx;
+					rs->buf_idx = spare;
+					rs->flags = NS_BUF_CHANGED;
+				} else {
+					memcpy(NETMAP_BUF(ring, spare),
+					       NETMAP_BUF(sr, x[i].buf_idx),
+					       rs->len);
+					ts->buf_idx = spare;
+				}
+			} else {
+				/* out of spare buffers, skip the packet */
+				continue;
+			}
+			ts->len = rs->len;
+			ts->flags = NS_BUF_CHANGED;
+
+			ring->head = ring->cur = nm_ring_next(ring, ring->cur);
+			total_written++;
+                }
+        }
+
+        if (i < MIN(n, TXQ_MAX)) {
+		/* a pipe that is down gets no retries */
+                if (!cn->down && retry-- > 0 && pipe_sync(cn))
+                        goto try_zc_again;
+		TRACE_DEBUG_LOG("Giving up for now\n");
+                TRACE_DEBUG_LOG("%d buffers leftover", n - i);
+        }
+	pipe_health(cn, nmc, n - i);
+
+	/* references that could not be delivered are released */
+	for (k = i; k < n; k++)
+		if (x[k].mode == TXQ_REF)
+			zc_put(nmc, x[k].buf_idx);
+
+        cn->cur_txq = 0;
+	
 	TRACE_NETMAP_FUNC_END();
+        return (int)n - total_written;
 }
 /*---------------------------------------------------------------------*/
-void
-update_cnode_ptrs(struct netmap_ring *rxring, Brick *brick,
-		  engine *eng, uint src)
+/**
+ * Counts how many leaves each packet of the burst is going to. Packets
+ * with a single reader keep TXQ_OWN and are swapped into their pipe.
+ * With zero-copy (zc), every packet with more than one reader gets its
+ * RX slot refilled from the spare pool and its original buffer is
+ * shared by reference. Otherwise (or if the pool is empty) the packet
+ * is copied.
+ */
+static void
+prepare_fanout(netmap_module_context *nmc, dispatch_plan *dp,
+	       struct netmap_ring *rxring, uint16_t *slots,
+	       uint16_t n, uint8_t *mode, int zc)
 {
 	TRACE_NETMAP_FUNC_START();
-	CommNode *cn;
-	uint32_t i;
-	linkdata *lnd = (linkdata *)(&brick->lnd);
-	for (i = 0; i < lnd->count; i++) {
-		cn = (CommNode *)lnd->external_links[i];
-		if (cn->brick != NULL) {
-			update_cnode_ptrs(rxring, cn->brick, eng, src);
-		} else {
-			uint dst = cn->cur_txq;
-			if (cn->mark == 1) {
-				cn->q[dst].ring = rxring;
-				cn->q[dst].slot_idx = src;
-				cn->cur_txq++;
-				cn->mark = 0;
-			}
+	uint16_t fanout[BATCH_SIZE];
+	struct netmap_slot *slot;
+	plan_leaf *leaf;
+	uint16_t i, k;
+
+	memset(fanout, 0, sizeof(uint16_t) * n);
+	for (i = 0; i < dp->touched_count; i++) {
+		leaf = &dp->leaves[dp->touched[i]];
+		for (k = 0; k < leaf->n; k++)
+			fanout[leaf->pkts[k]]++;
+	}
+
+	for (k = 0; k < n; k++) {
+		if (fanout[k] < 2)
+			continue;
+		if (!zc || nmc->zc_pool_cnt == 0) {
+			mode[k] = TXQ_COPY;
+			continue;
 		}
+		slot = &rxring->slot[slots[k]];
+		nmc->buf_refcnt[slot->buf_idx] = fanout[k];
+		slot->buf_idx = nmc->zc_pool[--nmc->zc_pool_cnt];
+		slot->flags |= NS_BUF_CHANGED;
+		mode[k] = TXQ_REF;
 	}
 	TRACE_NETMAP_FUNC_END();
 }
-/*---------------------------------------------------------------------*/
-void
-dispatch_pkt(struct netmap_ring *rxring,
-	     engine *eng,
-	     Brick *brick,
-	     uint8_t *buf,
-	     unsigned char level,
-	     time_t current_time)
+/*------------------------------------------------------------------------*/
+/**
+ * Moves the packets that the dispatch plan queued on each leaf into the
+ * leaf CommNode's txq and pushes them out to the respective pipe. Only
+ * the leaves that got packets in this burst are visited.
+ */
+static void
+flush_plan_leaves(dispatch_plan *dp, struct netmap_ring *rxring,
+		  uint16_t *slots, uint32_t *bidx, uint8_t *mode,
+		  netmap_module_context *nmc, engine *eng)
 {
 	TRACE_NETMAP_FUNC_START();
-	CommNode *cn = NULL;
-	uint j;
-	linkdata *lnd = (linkdata *)(&brick->lnd);
-	BITMAP b;
+	plan_leaf *leaf;
+	CommNode *cn;
+	uint16_t i, k;
 
-	TRACE_DEBUG_LOG("(ifname: %s, lnd_count: %d\n", 
-			lnd->ifname, lnd->count);
-	/* increment the per-brick nested level */
-	lnd->level = level + 1;
-	b = brick->elib->process(brick, buf);
-	for (j = 0; b != 0; j++) {
-		if (CHECK_BIT(b, j)) {
-			cn = (CommNode *)lnd->external_links[j];
-			if (cn->brick != NULL) {
-				dispatch_pkt(rxring, eng, 
-					     cn->brick, buf, 
-					     lnd->level,
-					     current_time);
-			} else {
-				cn->mark = 1;
-			}
+	for (i = 0; i < dp->touched_count; i++) {
+		leaf = &dp->leaves[dp->touched[i]];
+		cn = leaf->cn;
+		for (k = 0; k < leaf->n; k++) {
+			cn->q[cn->cur_txq].ring = rxring;
+			cn->q[cn->cur_txq].slot_idx = slots[leaf->pkts[k]];
+			cn->q[cn->cur_txq].buf_idx = bidx[leaf->pkts[k]];
+			cn->q[cn->cur_txq].mode = mode[leaf->pkts[k]];
+			cn->cur_txq++;
 		}
-		CLR_BIT(b, j);
+		leaf->n = 0;
+		/* only leaves below a duplicating brick can see shared pkts */
+		if (cn->copy == 0)
+			eng->pkt_dropped += share_packets(cn, nmc);
+		else if (zc_enabled(nmc, eng))
+			eng->pkt_dropped += zc_packets(cn, nmc);
+		else
+			eng->pkt_dropped += copy_packets(cn, nmc);
+	}
+	dp->touched_count = 0;
+	if (dp->down_count != 0 &&
+	    ++dp->probe_tick >= PIPE_PROBE_BURSTS) {
+		dp->probe_tick = 0;
+		probe_pipes(dp, nmc);
 	}
-
 	TRACE_NETMAP_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
@@ -524,14 +874,12 @@ netmap_callback(void *engsrcptr)
 	engine *eng;
 	engine_src *engsrc;
 	Brick *brick;
-	time_t current_time;
 	
 	engsrc = (engine_src *)engsrcptr;
 	brick = engsrc->brick;
 	eng = (engine *)brick->eng;
 	nmc = (netmap_module_context *)engsrc->private_context;
 	local_nmd = (struct nm_desc *)nmc->local_nmd;
-	current_time = time(NULL);
 
 	if (local_nmd == NULL) {
 		TRACE_LOG("netmap context was not properly initialized\n");
@@ -548,34 +896,49 @@ netmap_callback(void *engsrcptr)
 		__builtin_prefetch(rxring);
 		if (nm_ring_empty(rxring))
 			continue;
-		if (brick == NULL)
+		if (brick == NULL || eng->plan == NULL)
 			drop_packets(rxring, eng, engsrc);
 		else {
+			unsigned char *bufs[BATCH_SIZE];
+			uint32_t lens[BATCH_SIZE];
+			uint16_t slots[BATCH_SIZE];
+			uint32_t bidx[BATCH_SIZE];
+			uint8_t mode[BATCH_SIZE];
+			u_int src;
+
 			__builtin_prefetch(&rxring->slot[rxring->cur]);
-			for (n = 0; !nm_ring_empty(rxring) && n < BATCH_SIZE; n++) {
-				u_int src, idx;
+			src = rxring->cur;
+			for (n = 0; src != rxring->tail && n < BATCH_SIZE; n++) {
+				u_int idx;
 				struct netmap_slot *slot;
-				void *buf;
 				
-				src = rxring->cur;
 				slot = &rxring->slot[src];
 				__builtin_prefetch(slot+1);
 				idx = slot->buf_idx;
-				buf = (u_char *)NETMAP_BUF(rxring, idx);
 				if (idx < 2) {
 					TRACE_LOG("%s bogus RX index at offset %d",
 						  nifp->ni_name, src);
 					sleep(NETMAP_LINK_WAIT_TIME);
 				}
-				__builtin_prefetch(buf);
+				bufs[n] = (u_char *)NETMAP_BUF(rxring, idx);
+				lens[n] = slot->len;
+				slots[n] = src;
+				bidx[n] = idx;
+				mode[n] = TXQ_OWN;
+				__builtin_prefetch(bufs[n]);
 				eng->byte_count += slot->len;
 				eng->pkt_count++;
-				dispatch_pkt(rxring, eng, brick, buf, 0, current_time);
-				rxring->head = rxring->cur = nm_ring_next(rxring, src);
-				update_cnode_ptrs(rxring, brick, eng, src);
+				src = nm_ring_next(rxring, src);
 			}
+			/* hand the whole burst to the brick tree */
+			dispatch_plan_run(eng->plan, bufs, lens, n);
+			if (eng->plan->copy_count != 0)
+				prepare_fanout(nmc, eng->plan, rxring, slots,
+					       n, mode, zc_enabled(nmc, eng));
+			rxring->head = rxring->cur = src;
+			flush_plan_leaves(eng->plan, rxring, slots, bidx,
+					  mode, nmc, eng);
 		}
-		flush_all_cnodes(brick, eng);
 	}
 
 	TRACE_NETMAP_FUNC_END();
@@ -631,7 +994,7 @@ netmap_delete_all_channels(Brick *brick)
  * Function very poorly designed. Needs revision! For now.. does the
  * task correctly.
  */
-static Brick *
+Brick *
 enable_pipeline(Brick *brick, const char *ifname, Target t, const char *out_name)
 {
 	TRACE_NETMAP_FUNC_START();
@@ -653,6 +1016,7 @@ enable_pipeline(Brick *brick, const char *ifname, Target t, const char *out_name
 			if (cn->brick == NULL) {
 				cn->brick = createBrick(t);
 				Linker_Intf li;
+				memset(&li, 0, sizeof(li));
 				/* XXX - Fix it! */
 				li.hash_split = 4;
 				/* adding a test link for filter's sake */
@@ -666,10 +1030,8 @@ enable_pipeline(Brick *brick, const char *ifname, Target t, const char *out_name
 					free(cn->brick);
 					return NULL;
 				}
-				brick->eng->mark_for_copy = 
-					(brick->eng->mark_for_copy == 0 && 
-					 li.type == COPY) ? 1 : 0;
 				linkdata *lnd = &cn->brick->lnd;
+				lnd->copy = (li.type == COPY) ? 1 : 0;
 				strcpy((char *)lnd->ifname, (char *)ifname);
 				lnd->count++;
 				lnd->tgt = t;
@@ -755,6 +1117,8 @@ netmap_create_channel(char *in_name, char *out_name,
 	}
 
 	cn = (CommNode *)lnd->external_links[lnd->init_cur_idx];
+	cn->parent = lnd;
+	cn->idx = lnd->init_cur_idx;
 
 	if (t == WRITE) {
 		TRACE_LOG("Creating pcap writing element %p to file: %s\n",
@@ -765,7 +1129,8 @@ netmap_create_channel(char *in_name, char *out_name,
 	} else {		
 		/* setting the name */
 		snprintf(ifname, IFNAMSIZ, "netmap:%s", out_name);
-		cn->out_nmd = nm_open(ifname, NULL, NM_OPEN_NO_MMAP | NM_OPEN_ARG3, 
+		/* pipes don't need the engine's extra buffers */
+		cn->out_nmd = nm_open(ifname, NULL, NM_OPEN_NO_MMAP, 
 				      nmc->local_nmd); 
 		if (cn->out_nmd == NULL) {
 			TRACE_ERR("Can't open %p(%s)\n", cn->out_nmd, ifname);
@@ -809,11 +1174,10 @@ netmap_pcap_push_pkt(engine *eng, const uint8_t *pkt, const uint16_t len)
 	cn = NULL;
 
 
-	b = brick->elib->process(brick, (unsigned char *)pkt);
-	for (j = 0; b != 0; j++) {
-		if (CHECK_BIT(b, j))
+	b = brick->elib->process(brick, (unsigned char *)pkt, len);
+	FOR_EACH_BIT(b, j) {
+		if (j < lnd->count)
 			cn = (CommNode *)lnd->external_links[j];
-		CLR_BIT(b, j);
 	}
 
 	if (cn == NULL) {
@@ -164,7 +164,6 @@ unregister_interface_entry(const unsigned char *iface, engine *eng)
 	TRACE_IFACE_FUNC_START();
 	netiface *nif;
 	engine *e_iter, *e_itertmp;
-	netiface *n_iter, *n_itertmp;
 
 	/* retrieve the right interface entry */
 	nif = interface_find((char *)iface);
@@ -185,11 +184,9 @@ unregister_interface_entry(const unsigned char *iface, engine *eng)
 
 	/* remove the interface object if no engines are registered anymore */
 	if (TAILQ_EMPTY(&nif->registered_engines)) {
-		TAILQ_FOREACH_SAFE(n_iter, &niface_list, entry, n_itertmp) {
-			TAILQ_REMOVE(&niface_list, n_iter, entry);
-			TRACE_DEBUG_LOG("Removing interface %s from the system\n",
-					nif->ifname);
-		}
+		TAILQ_REMOVE(&niface_list, nif, entry);
+		TRACE_DEBUG_LOG("Removing interface %s from the system\n",
+				nif->ifname);
 		free(nif->ifname);
 		free(nif->context);
 		free(nif);
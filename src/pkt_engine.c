@@ -39,6 +39,8 @@
 #include "util.h"
 /* for backend */
 #include "backend.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
 /*---------------------------------------------------------------------*/
 static elist engine_list;
 /*---------------------------------------------------------------------*/
@@ -52,6 +54,20 @@ load_io_module(engine *e) {
 	case IO_NETMAP:
 		e->iom = netmap_module;
 		break;
+	case IO_FILE:
+		e->iom = file_module;
+		break;
+	case IO_SYNTH:
+		e->iom = synth_module;
+		break;
+#ifdef __linux__
+	case IO_LINUX:
+		e->iom = afpacket_module;
+		break;
+	case IO_XDP:
+		e->iom = xdp_module;
+		break;
+#endif
 	default:
 		TRACE_ERR("Control can never reach here!\n");
 	}
@@ -59,6 +75,46 @@ load_io_module(engine *e) {
 	
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Compares the io type part of name (i.e. up to the first ':')
+ */
+static inline int
+io_name_is(const char *name, const char *type)
+{
+	size_t len = strcspn(name, ":");
+	return (len == strlen(type) && !strncmp(name, type, len));
+}
+/*---------------------------------------------------------------------*/
+int32_t
+pktengine_io_type(const char *name)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	if (name == NULL || io_name_is(name, "netmap")) {
+		TRACE_PKTENGINE_FUNC_END();
+		return IO_NETMAP;
+	}
+	if (io_name_is(name, "file")) {
+		TRACE_PKTENGINE_FUNC_END();
+		return IO_FILE;
+	}
+	if (io_name_is(name, "synth")) {
+		TRACE_PKTENGINE_FUNC_END();
+		return IO_SYNTH;
+	}
+#ifdef __linux__
+	if (io_name_is(name, "linux") || io_name_is(name, "afpacket")) {
+		TRACE_PKTENGINE_FUNC_END();
+		return IO_LINUX;
+	}
+	if (io_name_is(name, "xdp")) {
+		TRACE_PKTENGINE_FUNC_END();
+		return IO_XDP;
+	}
+#endif
+	TRACE_PKTENGINE_FUNC_END();
+	return -1;
+}
+/*---------------------------------------------------------------------*/
 engine *
 engine_find(const unsigned char *name)
 {
@@ -151,7 +207,9 @@ pktengine_init()
 void
 pktengine_new(const unsigned char *name, 
 	      const int32_t buffer_sz,
-	      const int8_t cpu)
+	      const int8_t cpu,
+	      const io_type iot,
+	      const char *io_args)
 {
 	TRACE_PKTENGINE_FUNC_START();
 	engine *eng;
@@ -181,8 +239,18 @@ pktengine_new(const unsigned char *name,
 	}
 
 
-	/* default pkt I/O engine is NETMAP for the moment */
-	eng->iot = IO_DEFAULT;
+	/* pkt I/O engine (NETMAP unless asked otherwise) */
+	eng->iot = iot;
+	if (io_args != NULL) {
+		eng->io_args = strdup(io_args);
+		if (eng->io_args == NULL) {
+			free(eng->name);
+			free(eng);
+			TRACE_ERR("Can't strdup I/O options: %s\n", io_args);
+			TRACE_PKTENGINE_FUNC_END();
+			return;
+		}
+	}
 	
 	/* load the right I/O module */
 	load_io_module(eng);
@@ -235,11 +303,16 @@ pktengine_delete(const unsigned char *name)
 	/* check if ifaces have been unlinked */
 	eng->iom.unlink_ifaces(eng);
 
+	/* release the dispatch plan */
+	dispatch_plan_free(eng->plan);
+	eng->plan = NULL;
+
 	/* remove the entry from the engine list */
 	engine_remove(eng->name);
 
 	/* now delete it */
 	free(eng->name);
+	free(eng->io_args);
 
 	/* free the private context as well */
 	for (i = 0; i < eng->no_of_sources; i++) {
@@ -282,8 +355,9 @@ pktengine_link_iface(const unsigned char *name,
 		return;
 	}
 
-	/* set iface to promiscuous mode */
-	promisc((const char *)iface);
+	/* set iface to promiscuous mode (pcap files are no ifaces) */
+	if (eng->iot != IO_FILE && eng->iot != IO_SYNTH)
+		promisc((const char *)iface);
 
 	eng->no_of_sources++;
 	eng->esrc = realloc(eng->esrc, 
@@ -419,6 +493,38 @@ pktengine_dump_stats(const unsigned char *name)
 }
 /*---------------------------------------------------------------------*/
 void
+pktengine_show_plan(const unsigned char *name)
+{
+	TRACE_PKTENGINE_FUNC_START();
+	engine *eng;
+	dispatch_plan *dp;
+
+	eng = engine_find(name);
+	if (eng == NULL) {
+		TRACE_LOG("Can't find engine with name: %s\n",
+			  name);
+		TRACE_PKTENGINE_FUNC_END();
+		return;
+	}
+
+	/* a stopped engine gets its plan compiled on the fly */
+	dp = (eng->run == 1) ? eng->plan : dispatch_plan_compile(eng);
+	if (dp == NULL) {
+		TRACE_LOG("Engine %s has no dispatch plan\n", name);
+		TRACE_PKTENGINE_FUNC_END();
+		return;
+	}
+
+	fprintf(stdout, "---------- ENGINE (%s) DISPATCH PLAN ---------\n", name);
+	dispatch_plan_print(dp, stdout);
+	fprintf(stdout, "----------------------------------------\n\n");
+
+	if (dp != eng->plan)
+		dispatch_plan_free(dp);
+	TRACE_PKTENGINE_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+void
 pktengines_list_stats(FILE *f)
 {
 	TRACE_PKTENGINE_FUNC_START();
@@ -90,52 +90,96 @@ build_sym_key_cache(uint32_t *cache, int cache_len)
 	TRACE_PKTHASH_FUNC_END();
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Byte-wise lookup tables for the Toeplitz hash. The 96-bit input
+ * (sip, dip, sp, dp; all MSB first) is consumed one byte at a time:
+ * sym_hash_tbl[k][v] holds the xor of the key_cache windows that the
+ * bitwise algorithm would have picked for input byte k having value v.
+ * The result is therefore bit-identical to the per-bit loop, at 12
+ * table lookups per packet instead of 96 branches.
+ */
+#define KEY_CACHE_LEN			96
+#define SYM_HASH_TBL_BYTES		(KEY_CACHE_LEN / 8)
+static uint32_t sym_hash_tbl[SYM_HASH_TBL_BYTES][256];
+/*---------------------------------------------------------------------*/
+/**
+ * Builds the byte tables from the key cache. It is called only once
+ * when sym_hash_fn is called for the very first time
+ */
+static void
+build_sym_hash_tables(void)
+{
+	TRACE_PKTHASH_FUNC_START();
+	uint32_t key_cache[KEY_CACHE_LEN];
+	uint32_t rc;
+	int k, v, b;
+
+	build_sym_key_cache(key_cache, KEY_CACHE_LEN);
+	for (k = 0; k < SYM_HASH_TBL_BYTES; k++) {
+		for (v = 0; v < 256; v++) {
+			rc = 0;
+			for (b = 0; b < 8; b++) {
+				if (v & (0x80 >> b))
+					rc ^= key_cache[(k << 3) + b];
+			}
+			sym_hash_tbl[k][v] = rc;
+		}
+	}
+	TRACE_PKTHASH_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
 /**
  * Computes symmetric hash based on the 4-tuple header data
  */
 static uint32_t
 sym_hash_fn(uint32_t sip, uint32_t dip, uint16_t sp, uint32_t dp)
 {
-#define MSB32				0x80000000
-#define MSB16				0x8000
-#define KEY_CACHE_LEN			96
-
 	TRACE_PKTHASH_FUNC_START();
-	uint32_t rc = 0;
-	int i;
+	uint32_t rc;
 	static int first_time = 1;
-	static uint32_t key_cache[KEY_CACHE_LEN] = {0};
 	
-	if (first_time) {
-		build_sym_key_cache(key_cache, KEY_CACHE_LEN);
+	if (unlikely(first_time)) {
+		build_sym_hash_tables();
 		first_time = 0;
 	}
-	
-	for (i = 0; i < 32; i++) {
-                if (sip & MSB32)
-                        rc ^= key_cache[i];
-                sip <<= 1;
-        }
-        for (i = 0; i < 32; i++) {
-                if (dip & MSB32)
-			rc ^= key_cache[32+i];
-                dip <<= 1;
-        }
-        for (i = 0; i < 16; i++) {
-		if (sp & MSB16)
-                        rc ^= key_cache[64+i];
-                sp <<= 1;
-        }
-        for (i = 0; i < 16; i++) {
-                if (dp & MSB16)
-                        rc ^= key_cache[80+i];
-                dp <<= 1;
-        }
+
+	rc = sym_hash_tbl[0][sip >> 24] ^
+		sym_hash_tbl[1][(sip >> 16) & 0xFF] ^
+		sym_hash_tbl[2][(sip >> 8) & 0xFF] ^
+		sym_hash_tbl[3][sip & 0xFF] ^
+		sym_hash_tbl[4][dip >> 24] ^
+		sym_hash_tbl[5][(dip >> 16) & 0xFF] ^
+		sym_hash_tbl[6][(dip >> 8) & 0xFF] ^
+		sym_hash_tbl[7][dip & 0xFF] ^
+		sym_hash_tbl[8][sp >> 8] ^
+		sym_hash_tbl[9][sp & 0xFF] ^
+		/* only the lower 16 bits of dp are part of the key */
+		sym_hash_tbl[10][(dp >> 8) & 0xFF] ^
+		sym_hash_tbl[11][dp & 0xFF];
 
 	TRACE_PKTHASH_FUNC_END();
 	return rc;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Folds a 128-bit IPv6 address into 32 bits by xor-ing its words.
+ * The first 16 bytes of the Toeplitz key repeat every 16 bits (that
+ * is what makes the hash symmetric), so every key window that an
+ * address bit would pick is also picked by the bit 32 positions
+ * further on. Hashing the folded words therefore yields exactly
+ * the Toeplitz hash of the full 288-bit (saddr, daddr, sp, dp) input
+ * under that repeating key pattern (stretched to 320 bits), and
+ * src/dst symmetry is preserved.
+ */
+static inline uint32_t
+fold_ipv6_addr(const struct in6_addr *addr)
+{
+	uint32_t w[4];
+
+	memcpy(w, addr->s6_addr, sizeof(w));
+	return ntohl(w[0] ^ w[1] ^ w[2] ^ w[3]);
+}
+/*---------------------------------------------------------------------*/
 /**
  * Parser + hash function for the IPv4 packet
  */
@@ -191,57 +235,64 @@ decode_ip_n_hash(struct ip *iph, uint8_t hash_split, uint8_t seed)
 }
 /*---------------------------------------------------------------------*/
 /**
- * Parser + hash function for the IPv6 packet
+ * Parser + hash function for the IPv6 packet (of a frame ending at end)
  */
 static uint32_t
-decode_ipv6_n_hash(struct ip6_hdr *ipv6h, uint8_t hash_split, uint8_t seed)
+decode_ipv6_n_hash(struct ip6_hdr *ipv6h, const uint8_t *end,
+		   uint8_t hash_split, uint8_t seed)
 {
 	TRACE_PKTHASH_FUNC_START();
 	uint32_t saddr, daddr;
 	uint32_t rc = 0;
 	
-	/* Get only the first 4 octets */
-	saddr = ipv6h->ip6_src.s6_addr[0] |
-		(ipv6h->ip6_src.s6_addr[1] << 8) |
-		(ipv6h->ip6_src.s6_addr[2] << 16) |
-		(ipv6h->ip6_src.s6_addr[3] << 24);
-	daddr = ipv6h->ip6_dst.s6_addr[0] |
-		(ipv6h->ip6_dst.s6_addr[1] << 8) |
-		(ipv6h->ip6_dst.s6_addr[2] << 16) |
-		(ipv6h->ip6_dst.s6_addr[3] << 24);
+	/* all 128 bits count: the leading ones are mostly a shared prefix */
+	saddr = fold_ipv6_addr(&ipv6h->ip6_src);
+	daddr = fold_ipv6_addr(&ipv6h->ip6_dst);
 	
 	if (hash_split == 2) {
-		rc = sym_hash_fn(ntohl(saddr),
-				 ntohl(daddr),
+		rc = sym_hash_fn(saddr,
+				 daddr,
 				 ntohs(0xFFFD) + seed,
 				 ntohs(0xFFFE) + seed);
 	} else {
 		struct tcphdr *tcph = NULL;
 		struct udphdr *udph = NULL;
+		uint8_t *l4;
+		uint8_t proto;
+		int frag;
 		
-		switch(ntohs(ipv6h->ip6_ctlun.ip6_un1.ip6_un1_nxt)) {
+		l4 = (uint8_t *)ipv6_skip_ext_hdrs((uint8_t *)ipv6h, end,
+						   &proto, &frag);
+		/* 
+		 * all fragments of a datagram must land on the same pipe,
+		 * and only the first one has the ports
+		 */
+		if (l4 == NULL || frag)
+			proto = IPPROTO_NONE;
+
+		switch (proto) {
 		case IPPROTO_TCP:
-			tcph = (struct tcphdr *)(ipv6h + 1);
-			rc = sym_hash_fn(ntohl(saddr), 
-					 ntohl(daddr), 
+			tcph = (struct tcphdr *)l4;
+			rc = sym_hash_fn(saddr,
+					 daddr,
 					 ntohs(tcph->th_sport) + seed, 
 					 ntohs(tcph->th_dport) + seed);
 			break;
 		case IPPROTO_UDP:
-			udph = (struct udphdr *)(ipv6h + 1);
-			rc = sym_hash_fn(ntohl(saddr),
-					 ntohl(daddr),
+			udph = (struct udphdr *)l4;
+			rc = sym_hash_fn(saddr,
+					 daddr,
 					 ntohs(udph->uh_sport) + seed,
 					 ntohs(udph->uh_dport) + seed);
 			break;
 		case IPPROTO_IPIP:
 			/* tunneling */
-			rc = decode_ip_n_hash((struct ip *)(ipv6h + 1),
+			rc = decode_ip_n_hash((struct ip *)l4,
 					      hash_split, seed);
 			break;
 		case IPPROTO_IPV6:
 			/* tunneling */
-			rc = decode_ipv6_n_hash((struct ip6_hdr *)(ipv6h + 1),
+			rc = decode_ipv6_n_hash((struct ip6_hdr *)l4, end,
 						hash_split, seed);
 			break;
 		case IPPROTO_ICMP:
@@ -254,8 +305,8 @@ decode_ipv6_n_hash(struct ip6_hdr *ipv6h, uint8_t hash_split, uint8_t seed)
 			 * the hash strength (although weaker but) should still hold 
 			 * even with 2 fields 
 			 */
-			rc = sym_hash_fn(ntohl(saddr),
-					 ntohl(daddr),
+			rc = sym_hash_fn(saddr,
+					 daddr,
 					 ntohs(0xFFFD) + seed,
 					 ntohs(0xFFFE) + seed);
 		}
@@ -295,7 +346,8 @@ decode_others_n_hash(struct ether_header *ethh, uint8_t seed)
  * Parser + hash function for VLAN packet
  */
 static inline uint32_t
-decode_vlan_n_hash(struct ether_header *ethh, uint8_t hash_split, uint8_t seed)
+decode_vlan_n_hash(struct ether_header *ethh, const uint8_t *end,
+		   uint8_t hash_split, uint8_t seed)
 {
 	TRACE_PKTHASH_FUNC_START();
 	uint32_t rc = 0;
@@ -307,7 +359,7 @@ decode_vlan_n_hash(struct ether_header *ethh, uint8_t hash_split, uint8_t seed)
 				      hash_split, seed);
 		break;
 	case ETHERTYPE_IPV6:
-		rc = decode_ipv6_n_hash((struct ip6_hdr *)(vhdr + 1),
+		rc = decode_ipv6_n_hash((struct ip6_hdr *)(vhdr + 1), end,
 					hash_split, seed);
 		break;
 	default:
@@ -323,7 +375,8 @@ decode_vlan_n_hash(struct ether_header *ethh, uint8_t hash_split, uint8_t seed)
  * General parser + hash function...
  */
 uint32_t
-pkt_hdr_hash(const unsigned char *buffer, uint8_t hash_split, uint8_t seed)
+pkt_hdr_hash(const unsigned char *buffer, uint32_t len, uint8_t hash_split,
+	     uint8_t seed)
 {
 	TRACE_PKTHASH_FUNC_START();
 	int rc = 0;
@@ -336,10 +389,10 @@ pkt_hdr_hash(const unsigned char *buffer, uint8_t hash_split, uint8_t seed)
 		break;
 	case ETHERTYPE_IPV6:
 		rc = decode_ipv6_n_hash((struct ip6_hdr *)(ethh + 1),
-					hash_split, seed);
+					buffer + len, hash_split, seed);
 		break;
 	case ETHERTYPE_VLAN:
-		rc = decode_vlan_n_hash(ethh, hash_split, seed);
+		rc = decode_vlan_n_hash(ethh, buffer + len, hash_split, seed);
 		break;
 	default:
 		/* others */
@@ -351,3 +404,317 @@ pkt_hdr_hash(const unsigned char *buffer, uint8_t hash_split, uint8_t seed)
 	return rc;
 }
 /*---------------------------------------------------------------------*/
+/**
+ * Encapsulations that pkt_inner_hdr_hash() looks through
+ */
+#ifndef ETHERTYPE_MPLS
+#define ETHERTYPE_MPLS		0x8847
+#endif
+#define ETHERTYPE_MPLS_MCAST	0x8848
+#define ETHERTYPE_QINQ		0x88A8
+#define ETHERTYPE_QINQ_OLD	0x9100
+#define ETHERTYPE_TEB		0x6558	/* Ethernet over GRE (NVGRE) */
+#define VXLAN_PORT		4789
+#define GTPU_PORT		2152
+#define GTPU_GPDU		0xFF
+/* no more than this many headers (tags, labels, tunnels) are peeled */
+#define ENCAP_MAX_DEPTH		16
+/* nor is anything parsed at or past this offset */
+#define ENCAP_MAX_OFFSET	512
+/*---------------------------------------------------------------------*/
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+/*---------------------------------------------------------------------*/
+/* ethertype of the IP header at p, by its version nibble (0 if none) */
+static inline uint16_t
+ip_ethertype(const uint8_t *p)
+{
+	switch (p[0] >> 4) {
+	case 4:
+		return ETHERTYPE_IP;
+	case 6:
+		return ETHERTYPE_IPV6;
+	default:
+		return 0;
+	}
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Skips the GTP-U header at p. Returns its payload, or NULL if the
+ * message does not carry a user packet (G-PDU) or its header reaches
+ * lim
+ */
+static const uint8_t *
+skip_gtpu(const uint8_t *p, const uint8_t *lim)
+{
+	const uint8_t *q;
+	uint8_t next;
+	int i;
+
+	/* version 1, protocol type GTP */
+	if (lim - p < 8 || (p[0] & 0xF0) != 0x30 || p[1] != GTPU_GPDU)
+		return NULL;
+	q = p + 8;
+	/* sequence number, N-PDU number or extension headers present */
+	if (p[0] & 0x07) {
+		if (lim - q < 4)
+			return NULL;
+		next = q[3];
+		q += 4;
+		for (i = 0; next != 0 && i < ENCAP_MAX_DEPTH; i++) {
+			if (q >= lim || q[0] == 0 || lim - q < q[0] << 2)
+				return NULL;
+			next = q[(q[0] << 2) - 1];
+			q += q[0] << 2;
+		}
+		if (next != 0)
+			return NULL;
+	}
+	return q;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Skips the GRE header at p and sets *type to the ethertype of its
+ * payload. Returns NULL for GRE versions/flags it can't parse, or if
+ * the fixed header reaches lim
+ */
+static const uint8_t *
+skip_gre(const uint8_t *p, const uint8_t *lim, uint16_t *type)
+{
+	const uint8_t *q = p + 4;
+
+	/* version 0 without the (obsolete) routing field */
+	if (lim - p < 4 || (p[1] & 0x07) != 0 || (p[0] & 0x40))
+		return NULL;
+	if (p[0] & 0x80)	/* checksum */
+		q += 4;
+	if (p[0] & 0x20)	/* key */
+		q += 4;
+	if (p[0] & 0x10)	/* sequence number */
+		q += 4;
+	*type = get16(p + 2);
+	return q;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Looks through VLAN/QinQ tags, MPLS label stacks and IPIP, IPv6-in-IP,
+ * GRE, VXLAN and GTP-U tunnels and hashes the innermost IP header
+ * (and its ports, if hash_split is 4) like pkt_hdr_hash() would. The
+ * packet itself is not touched. Traffic without an IP header is hashed
+ * by pkt_hdr_hash().
+ */
+uint32_t
+pkt_inner_hdr_hash(const unsigned char *buffer, uint32_t len,
+		   uint8_t hash_split, uint8_t seed)
+{
+	TRACE_PKTHASH_FUNC_START();
+	const uint8_t *p, *l3, *l4, *lim;
+	uint16_t type;
+	uint8_t proto;
+	uint32_t rc;
+	int depth, frag, i;
+
+	l3 = l4 = NULL;
+	proto = IPPROTO_NONE;
+	lim = buffer + ((len < ENCAP_MAX_OFFSET) ? len : ENCAP_MAX_OFFSET);
+	/* every header is checked against lim before it is read */
+	type = (lim - buffer >= 14) ? get16(buffer + 12) : 0;
+	p = buffer + 14;
+	for (depth = 0; depth < ENCAP_MAX_DEPTH && p < lim; depth++) {
+		switch (type) {
+		case ETHERTYPE_VLAN:
+		case ETHERTYPE_QINQ:
+		case ETHERTYPE_QINQ_OLD:
+			if (lim - p < 4)
+				goto done;
+			type = get16(p + 2);
+			p += 4;
+			continue;
+		case ETHERTYPE_MPLS:
+		case ETHERTYPE_MPLS_MCAST:
+			/* pop up to the bottom of the stack */
+			for (i = 0; lim - p >= 4 && !(p[2] & 0x01) &&
+				     i < ENCAP_MAX_DEPTH; i++)
+				p += 4;
+			p += 4;
+			if (p >= lim)
+				goto done;
+			type = ip_ethertype(p);
+			if (type == 0 && (p[0] >> 4) == 0) {
+				/* pseudowire control word + Ethernet */
+				if (lim - p < 4 + 14)
+					goto done;
+				type = get16(p + 4 + 12);
+				p += 4 + 14;
+			}
+			continue;
+		case ETHERTYPE_TEB:
+			if (lim - p < 14)
+				goto done;
+			type = get16(p + 12);
+			p += 14;
+			continue;
+		case ETHERTYPE_IP:
+			if (lim - p < 20 || ip_ethertype(p) != ETHERTYPE_IP)
+				goto done;
+			l3 = p;
+			proto = p[9];
+			l4 = p + ((p[0] & 0x0F) << 2);
+			/* fragments: the inner headers may be elsewhere */
+			if (get16(p + 6) & 0x3FFF)
+				goto done;
+			break;
+		case ETHERTYPE_IPV6:
+			if (lim - p < IPV6_HDR_LEN ||
+			    ip_ethertype(p) != ETHERTYPE_IPV6)
+				goto done;
+			l3 = p;
+			l4 = ipv6_skip_ext_hdrs(p, lim, &proto, &frag);
+			if (l4 == NULL || frag)
+				goto done;
+			break;
+		default:
+			goto done;
+		}
+
+		/* an IP header: is it the outer header of a tunnel? */
+		switch (proto) {
+		case IPPROTO_IPIP:
+			type = ETHERTYPE_IP;
+			p = l4;
+			break;
+		case IPPROTO_IPV6:
+			type = ETHERTYPE_IPV6;
+			p = l4;
+			break;
+		case IPPROTO_GRE:
+			p = skip_gre(l4, lim, &type);
+			if (p == NULL)
+				goto done;
+			break;
+		case IPPROTO_UDP:
+			if (lim - l4 < 8)
+				goto done;
+			if (get16(l4 + 2) == VXLAN_PORT) {
+				type = ETHERTYPE_TEB;
+				p = l4 + 8 + 8;
+			} else if (get16(l4 + 2) == GTPU_PORT) {
+				p = skip_gtpu(l4 + 8, lim);
+				if (p == NULL || p >= lim)
+					goto done;
+				type = ip_ethertype(p);
+			} else
+				goto done;
+			break;
+		default:
+			goto done;
+		}
+	}
+
+ done:
+	if (l3 == NULL) {
+		rc = pkt_hdr_hash(buffer, len, hash_split, seed);
+		TRACE_PKTHASH_FUNC_END();
+		return rc;
+	}
+	/* ports that were not captured (or a cut inner header): addresses */
+	if ((proto != IPPROTO_TCP && proto != IPPROTO_UDP) ||
+	    l4 == NULL || lim - l4 < 4)
+		hash_split = 2;
+	if (ip_ethertype(l3) == ETHERTYPE_IP)
+		rc = decode_ip_n_hash((struct ip *)l3, hash_split, seed);
+	else
+		rc = decode_ipv6_n_hash((struct ip6_hdr *)l3, buffer + len,
+					hash_split, seed);
+	TRACE_PKTHASH_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Mixes a 128-bit address (IPv4 ones in addr[0]) with a port
+ */
+static inline uint64_t
+flow_end_hash(const uint32_t *addr, uint16_t port)
+{
+	uint64_t lo = ((uint64_t)addr[1] << 32) | addr[0];
+	uint64_t hi = ((uint64_t)addr[3] << 32) | addr[2];
+
+	return (lo * 0x9E3779B97F4A7C15ULL) ^ (hi * 0xC2B2AE3D27D4EB4FULL) ^
+		((port + 1) * 0x165667B19E3779F9ULL);
+}
+/*---------------------------------------------------------------------*/
+uint64_t
+pkt_flow_key(const unsigned char *buffer, uint32_t len, uint8_t hash_split)
+{
+	TRACE_PKTHASH_FUNC_START();
+	const uint8_t *end = buffer + len, *l3, *l4 = NULL;
+	uint32_t src[4] = {0, 0, 0, 0}, dst[4] = {0, 0, 0, 0};
+	uint16_t vlan = FLOW_VLAN_NONE, type = 0, sport = 0, dport = 0;
+	uint8_t proto = 0;
+	uint64_t a, b, h;
+	int tags;
+
+	if (len >= 14)
+		type = get16(buffer + 12);
+	/* the outermost VLAN tag counts; up to two tags are skipped */
+	l3 = buffer + 14;
+	for (tags = 0; tags < 2 && (type == ETHERTYPE_VLAN ||
+				    type == ETHERTYPE_QINQ); tags++) {
+		if (end - l3 < 4) {
+			type = 0;
+			break;
+		}
+		if (tags == 0)
+			vlan = get16(l3) & 0x0FFF;
+		type = get16(l3 + 2);
+		l3 += 4;
+	}
+
+	switch (type) {
+	case ETHERTYPE_IP:
+		if (end - l3 < 20)
+			break;
+		proto = l3[9];
+		memcpy(&src[0], l3 + 12, 4);
+		memcpy(&dst[0], l3 + 16, 4);
+		/* only the first fragment has the ports */
+		if ((get16(l3 + 6) & 0x1FFF) == 0)
+			l4 = l3 + ((l3[0] & 0x0F) << 2);
+		break;
+	case ETHERTYPE_IPV6:
+		if (end - l3 < IPV6_HDR_LEN)
+			break;
+		memcpy(src, l3 + 8, 16);
+		memcpy(dst, l3 + 24, 16);
+		l4 = ipv6_skip_ext_hdrs(l3, end, &proto, NULL);
+		break;
+	default:
+		break;
+	}
+
+	if (hash_split != 2 && l4 != NULL && end - l4 >= 4 &&
+	    (proto == IPPROTO_TCP || proto == IPPROTO_UDP ||
+	     proto == IPPROTO_SCTP)) {
+		sport = get16(l4);
+		dport = get16(l4 + 2);
+	}
+
+	/* both directions get the same key: sum and product commute */
+	a = flow_end_hash(src, sport);
+	b = flow_end_hash(dst, dport);
+	h = (a + b) ^ (a * b) ^
+		((((uint64_t)vlan << 48) | ((uint64_t)type << 32) | proto) *
+		 0xFF51AFD7ED558CCDULL);
+	/* murmur3 64-bit finalizer */
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	TRACE_PKTHASH_FUNC_END();
+	return h;
+}
+/*---------------------------------------------------------------------*/
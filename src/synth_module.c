@@ -0,0 +1,829 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *
+ * Synthetic traffic I/O module: generates packets in memory instead of
+ * reading them from an interface, so that the brick tree of an engine
+ * can be benchmarked without a traffic generator or NIC. The traffic
+ * profile (no. of flows, Zipf skew of the flow sizes, mix of IPv4,
+ * IPv6, VLAN-tagged and IPv4-in-IPv4 frames and the frame size
+ * distribution) is given in the I/O options of the engine (see
+ * synth_module.h). Packets reaching netmap pipes are discarded. The
+ * module reports the packet rate and the cycles spent per packet in
+ * the brick tree when it is done or stopped.
+ *
+ */
+/* for io_module struct defn */
+#include "io_module.h"
+/* for bricks logging */
+#include "bricks_log.h"
+/* for synth module structs */
+#include "synth_module.h"
+/* for brick def'n */
+#include "brick.h"
+/* for dispatch plan */
+#include "dispatch_plan.h"
+/* for vlanhdr */
+#include "pkt_hash.h"
+/* for read_cycles() */
+#include "bricks_cycles.h"
+/* for MIN()/MAX() */
+#include <sys/param.h>
+/* for close()/pipe() */
+#include <unistd.h>
+/* for clock_gettime() */
+#include <time.h>
+/* for gettimeofday() */
+#include <sys/time.h>
+/* for pow() */
+#include <math.h>
+/* for errno */
+#include <errno.h>
+/* for string functions */
+#include <string.h>
+/* for struct ether_header */
+#include <net/ethernet.h>
+/* for struct ip */
+#include <netinet/ip.h>
+/* for struct ip6_hdr */
+#include <netinet/ip6.h>
+/* for struct tcphdr */
+#include <netinet/tcp.h>
+/* for struct udphdr */
+#include <netinet/udp.h>
+/* for htons() */
+#include <arpa/inet.h>
+/*---------------------------------------------------------------------*/
+/* a flow of the generated traffic */
+typedef struct synth_flow {
+	uint8_t kind;				/* see enum synth_kind */
+	uint8_t proto;				/* IPPROTO_TCP or IPPROTO_UDP */
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t src[4];			/* only [0] is used by IPv4 */
+	uint32_t dst[4];
+	uint32_t tun_src;			/* outer addresses of IPIP */
+	uint32_t tun_dst;
+} synth_flow;
+
+static const char *synth_kind_names[SYNTH_KINDS] = {
+	"ipv4", "ipv6", "vlan", "ipip"
+};
+/*---------------------------------------------------------------------*/
+static inline uint64_t
+now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------*/
+/* xorshift64* */
+static inline uint64_t
+synth_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Picks an index out of n according to the weights
+ */
+static uint32_t
+synth_pick(const uint32_t *weights, uint32_t n, uint64_t *rng)
+{
+	uint64_t total, r;
+	uint32_t i;
+
+	for (total = 0, i = 0; i < n; i++)
+		total += weights[i];
+	if (total == 0)
+		return 0;
+
+	r = synth_rand(rng) % total;
+	for (i = 0; i < n - 1; i++) {
+		if (r < weights[i])
+			break;
+		r -= weights[i];
+	}
+	return i;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Parses "<name>:<weight>/<name>:<weight>/..." into the mix weights
+ */
+static int32_t
+parse_mix(synth_profile *sp, char *val)
+{
+	char *tok, *save, *w;
+	uint32_t i;
+
+	memset(sp->mix, 0, sizeof(sp->mix));
+	for (tok = strtok_r(val, "/", &save); tok != NULL;
+	     tok = strtok_r(NULL, "/", &save)) {
+		w = strchr(tok, ':');
+		if (w != NULL)
+			*w++ = '\0';
+		for (i = 0; i < SYNTH_KINDS; i++)
+			if (!strcmp(tok, synth_kind_names[i]))
+				break;
+		if (i == SYNTH_KINDS) {
+			TRACE_LOG("Unknown kind of traffic: %s\n", tok);
+			return -1;
+		}
+		sp->mix[i] = (w != NULL) ? strtoul(w, NULL, 10) : 1;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Parses "<size>:<weight>/<size>:<weight>/..." into the size table
+ */
+static int32_t
+parse_sizes(synth_profile *sp, char *val)
+{
+	char *tok, *save, *w;
+
+	sp->size_count = 0;
+	for (tok = strtok_r(val, "/", &save); tok != NULL;
+	     tok = strtok_r(NULL, "/", &save)) {
+		if (sp->size_count == SYNTH_MAX_SIZES) {
+			TRACE_LOG("Only %d frame sizes can be given\n",
+				  SYNTH_MAX_SIZES);
+			return -1;
+		}
+		w = strchr(tok, ':');
+		if (w != NULL)
+			*w++ = '\0';
+		sp->sizes[sp->size_count] =
+			MAX(MIN(strtoul(tok, NULL, 10), SYNTH_MAX_FRAME),
+			    SYNTH_MIN_FRAME);
+		sp->size_weights[sp->size_count] =
+			(w != NULL) ? strtoul(w, NULL, 10) : 1;
+		sp->size_count++;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Parses the comma-separated "key=value" options of the engine
+ */
+static int32_t
+parse_profile(synth_profile *sp, const char *args)
+{
+	TRACE_SYNTH_FUNC_START();
+	char *str, *tok, *save, *val;
+	int32_t rc = 0;
+
+	/* defaults: uniform IPv4 TCP traffic of min.-sized frames */
+	memset(sp, 0, sizeof(*sp));
+	sp->flows = SYNTH_DEF_FLOWS;
+	sp->mix[SYNTH_IPV4] = 1;
+	sp->size_count = 1;
+	sp->sizes[0] = SYNTH_DEF_SIZE;
+	sp->size_weights[0] = 1;
+	sp->seed = 1;
+
+	if (args == NULL) {
+		TRACE_SYNTH_FUNC_END();
+		return 0;
+	}
+	str = strdup(args);
+	if (str == NULL) {
+		TRACE_LOG("Can't strdup synth options\n");
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	for (tok = strtok_r(str, ",", &save); tok != NULL && rc == 0;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL) {
+			TRACE_LOG("Synth option %s has no value\n", tok);
+			rc = -1;
+			break;
+		}
+		*val++ = '\0';
+		if (!strcmp(tok, "flows"))
+			sp->flows = MAX(strtoul(val, NULL, 10), 1);
+		else if (!strcmp(tok, "zipf"))
+			sp->zipf = strtod(val, NULL);
+		else if (!strcmp(tok, "udp"))
+			sp->udp = MIN(strtoul(val, NULL, 10), 100);
+		else if (!strcmp(tok, "count"))
+			sp->count = strtoull(val, NULL, 10);
+		else if (!strcmp(tok, "seed"))
+			sp->seed = MAX(strtoull(val, NULL, 10), 1);
+		else if (!strcmp(tok, "mix"))
+			rc = parse_mix(sp, val);
+		else if (!strcmp(tok, "size"))
+			rc = parse_sizes(sp, val);
+		else {
+			TRACE_LOG("Unknown synth option: %s\n", tok);
+			rc = -1;
+		}
+	}
+
+	free(str);
+	TRACE_SYNTH_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+static uint16_t
+ip_cksum(const void *hdr, uint32_t len)
+{
+	const uint16_t *p = (const uint16_t *)hdr;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Length of all headers of the frames of a flow
+ */
+static inline uint16_t
+hdrs_len(const synth_flow *fl)
+{
+	uint16_t len = sizeof(struct ether_header);
+
+	switch (fl->kind) {
+	case SYNTH_IPV6:
+		len += sizeof(struct ip6_hdr);
+		break;
+	case SYNTH_VLAN:
+		len += sizeof(vlanhdr) + sizeof(struct ip);
+		break;
+	case SYNTH_IPIP:
+		len += 2 * sizeof(struct ip);
+		break;
+	default:
+		len += sizeof(struct ip);
+		break;
+	}
+	return len + ((fl->proto == IPPROTO_TCP) ?
+		      sizeof(struct tcphdr) : sizeof(struct udphdr));
+}
+/*---------------------------------------------------------------------*/
+static unsigned char *
+build_ipv4(unsigned char *p, uint32_t src, uint32_t dst,
+	   uint8_t proto, uint16_t len)
+{
+	struct ip *iph = (struct ip *)p;
+
+	iph->ip_v = 4;
+	iph->ip_hl = sizeof(struct ip) >> 2;
+	iph->ip_len = htons(len);
+	iph->ip_ttl = 64;
+	iph->ip_p = proto;
+	iph->ip_src.s_addr = src;
+	iph->ip_dst.s_addr = dst;
+	iph->ip_sum = ip_cksum(iph, sizeof(struct ip));
+	return p + sizeof(struct ip);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Writes a frame of the flow into buf. The frame is zeroed beforehand.
+ */
+static void
+build_frame(unsigned char *buf, const synth_flow *fl, uint16_t len)
+{
+	struct ether_header *ethh = (struct ether_header *)buf;
+	struct ip6_hdr *ip6h;
+	struct tcphdr *tcph;
+	struct udphdr *udph;
+	vlanhdr *vlanh;
+	unsigned char *p = buf + sizeof(struct ether_header);
+	uint16_t l3len = len - sizeof(struct ether_header);
+
+	memset(ethh->ether_dhost, 0x02, ETHER_ADDR_LEN);
+	memset(ethh->ether_shost, 0x04, ETHER_ADDR_LEN);
+	switch (fl->kind) {
+	case SYNTH_IPV6:
+		ethh->ether_type = htons(ETHERTYPE_IPV6);
+		ip6h = (struct ip6_hdr *)p;
+		ip6h->ip6_flow = htonl(6 << 28);
+		ip6h->ip6_plen = htons(l3len - sizeof(struct ip6_hdr));
+		ip6h->ip6_nxt = fl->proto;
+		ip6h->ip6_hlim = 64;
+		memcpy(&ip6h->ip6_src, fl->src, sizeof(ip6h->ip6_src));
+		memcpy(&ip6h->ip6_dst, fl->dst, sizeof(ip6h->ip6_dst));
+		p += sizeof(struct ip6_hdr);
+		break;
+	case SYNTH_VLAN:
+		ethh->ether_type = htons(ETHERTYPE_VLAN);
+		vlanh = (vlanhdr *)p;
+		vlanh->pri_cfi_vlan = htons((fl->sport ^ fl->dport) & 0x0FFF);
+		vlanh->proto = htons(ETHERTYPE_IP);
+		p += sizeof(vlanhdr);
+		p = build_ipv4(p, fl->src[0], fl->dst[0], fl->proto,
+			       l3len - sizeof(vlanhdr));
+		break;
+	case SYNTH_IPIP:
+		ethh->ether_type = htons(ETHERTYPE_IP);
+		p = build_ipv4(p, fl->tun_src, fl->tun_dst, IPPROTO_IPIP,
+			       l3len);
+		p = build_ipv4(p, fl->src[0], fl->dst[0], fl->proto,
+			       l3len - sizeof(struct ip));
+		break;
+	default:
+		ethh->ether_type = htons(ETHERTYPE_IP);
+		p = build_ipv4(p, fl->src[0], fl->dst[0], fl->proto, l3len);
+		break;
+	}
+
+	if (fl->proto == IPPROTO_TCP) {
+		tcph = (struct tcphdr *)p;
+		tcph->th_sport = htons(fl->sport);
+		tcph->th_dport = htons(fl->dport);
+		tcph->th_off = sizeof(struct tcphdr) >> 2;
+		tcph->th_flags = TH_ACK;
+		tcph->th_win = htons(65535);
+	} else {
+		udph = (struct udphdr *)p;
+		udph->uh_sport = htons(fl->sport);
+		udph->uh_dport = htons(fl->dport);
+		udph->uh_ulen = htons(len - (p - buf));
+	}
+}
+/*---------------------------------------------------------------------*/
+static void
+init_flow(synth_flow *fl, const synth_profile *sp, uint64_t *rng)
+{
+	uint64_t r;
+	int i;
+
+	fl->kind = synth_pick(sp->mix, SYNTH_KINDS, rng);
+	fl->proto = (synth_rand(rng) % 100 < sp->udp) ?
+		IPPROTO_UDP : IPPROTO_TCP;
+	r = synth_rand(rng);
+	fl->sport = 1024 + (r % 64512);
+	fl->dport = (r >> 32) % 1024;
+	for (i = 0; i < 4; i++) {
+		r = synth_rand(rng);
+		fl->src[i] = (uint32_t)r;
+		fl->dst[i] = (uint32_t)(r >> 32);
+	}
+	if (fl->kind == SYNTH_IPV6) {
+		/* 2001:db8::/32 */
+		fl->src[0] = fl->dst[0] = htonl(0x20010db8);
+	}
+	/* a handful of tunnel end points */
+	r = synth_rand(rng);
+	fl->tun_src = htonl(0xC0A80001 + (r & 0x3));
+	fl->tun_dst = htonl(0xC0A80101 + ((r >> 8) & 0x3));
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Builds the frame pool of the source according to the profile.
+ * Flows are drawn from a Zipf distribution (rank i is drawn with a
+ * probability proportional to 1/i^zipf), so the pool carries a mix
+ * of elephant and mice flows.
+ */
+static int32_t
+build_pool(synth_module_context *smc, const synth_profile *sp)
+{
+	TRACE_SYNTH_FUNC_START();
+	synth_flow *flows;
+	double *cdf, u;
+	uint32_t *pick, lo, hi, mid, i;
+	size_t area_len, off;
+	uint64_t rng = sp->seed;
+	int32_t rc = -1;
+
+	smc->pool_size = (sp->count != 0 && sp->count < SYNTH_POOL_PKTS) ?
+		sp->count : SYNTH_POOL_PKTS;
+	flows = calloc(sp->flows, sizeof(synth_flow));
+	cdf = calloc(sp->flows, sizeof(double));
+	pick = calloc(smc->pool_size, sizeof(uint32_t));
+	smc->pkts = calloc(smc->pool_size, sizeof(unsigned char *));
+	smc->lens = calloc(smc->pool_size, sizeof(uint32_t));
+	if (flows == NULL || cdf == NULL || pick == NULL ||
+	    smc->pkts == NULL || smc->lens == NULL) {
+		TRACE_LOG("Can't allocate memory for the frame pool\n");
+		goto out;
+	}
+
+	for (i = 0; i < sp->flows; i++) {
+		init_flow(&flows[i], sp, &rng);
+		cdf[i] = ((i == 0) ? 0 : cdf[i - 1]) +
+			((sp->zipf == 0) ? 1.0 : 1.0 / pow(i + 1, sp->zipf));
+	}
+
+	/* pick flow and length of every frame */
+	for (area_len = 0, i = 0; i < smc->pool_size; i++) {
+		u = (double)(synth_rand(&rng) >> 11) / (double)(1ULL << 53) *
+			cdf[sp->flows - 1];
+		for (lo = 0, hi = sp->flows - 1; lo < hi; ) {
+			mid = (lo + hi) / 2;
+			if (cdf[mid] <= u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		pick[i] = lo;
+		smc->lens[i] = MAX(sp->sizes[synth_pick(sp->size_weights,
+							sp->size_count, &rng)],
+				   hdrs_len(&flows[lo]));
+		/* keep frames cache-line aligned */
+		area_len += (smc->lens[i] + 63) & ~63;
+	}
+
+	smc->area = calloc(1, area_len);
+	if (smc->area == NULL) {
+		TRACE_LOG("Can't allocate %zu bytes for the frame pool\n",
+			  area_len);
+		goto out;
+	}
+	for (off = 0, i = 0; i < smc->pool_size; i++) {
+		smc->pkts[i] = smc->area + off;
+		build_frame(smc->pkts[i], &flows[pick[i]], smc->lens[i]);
+		off += (smc->lens[i] + 63) & ~63;
+	}
+
+	TRACE_LOG("Built %u frames (%zu bytes) of %u flows\n",
+		  smc->pool_size, area_len, sp->flows);
+	rc = 0;
+ out:
+	free(flows);
+	free(cdf);
+	free(pick);
+	TRACE_SYNTH_FUNC_END();
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+static void
+release_pool(synth_module_context *smc)
+{
+	free(smc->area);
+	free(smc->pkts);
+	free(smc->lens);
+	smc->area = NULL;
+	smc->pkts = NULL;
+	smc->lens = NULL;
+	smc->pool_size = 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Prints the packet rate and the cost of the brick tree per packet
+ */
+static void
+synth_report(engine *eng, synth_module_context *smc)
+{
+	TRACE_SYNTH_FUNC_START();
+	uint64_t ns = smc->last_ns - smc->start_ns;
+
+	fprintf(stdout, "Engine %s: %llu pkts (%llu to sinks) in %.3f secs: "
+		"%.3f Mpps, %.1f cycles/pkt\n", eng->name,
+		(long long unsigned int)smc->sent,
+		(long long unsigned int)smc->sunk, (double)ns / 1e9,
+		(ns == 0) ? 0 : (double)smc->sent * 1e3 / ns,
+		(smc->sent == 0) ? 0 : (double)smc->cycles / smc->sent);
+	fflush(stdout);
+	TRACE_SYNTH_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+int32_t
+synth_init(void **ctxt_ptr, void *engptr)
+{
+	TRACE_SYNTH_FUNC_START();
+	synth_module_context *smc;
+
+	/* create synth context */
+	*ctxt_ptr = calloc(1, sizeof(synth_module_context));
+	smc = (synth_module_context *) (*ctxt_ptr);
+	if (*ctxt_ptr == NULL) {
+		TRACE_LOG("Can't allocate memory for synth context\n");
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	smc->evfd[0] = smc->evfd[1] = -1;
+	smc->eng = (engine *)engptr;
+	TRACE_SYNTH_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+synth_link_iface(void *ctxt, const unsigned char *iface,
+		 const uint16_t batchsize, int8_t qid)
+{
+	TRACE_SYNTH_FUNC_START();
+	synth_module_context *smc = (synth_module_context *)ctxt;
+	synth_profile sp;
+
+	if (parse_profile(&sp, smc->eng->io_args) == -1) {
+		TRACE_LOG("Invalid synth options: %s\n", smc->eng->io_args);
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+	/* sources of the same engine carry different flows */
+	sp.seed += smc->eng->no_of_sources;
+	if (build_pool(smc, &sp) == -1) {
+		release_pool(smc);
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+	smc->count = sp.count;
+
+	/* the pipe keeps the engine polling this source till it is done */
+	if (pipe(smc->evfd) == -1 || write(smc->evfd[1], "", 1) != 1) {
+		TRACE_LOG("Unable to create event pipe for %s: %s\n",
+			  iface, strerror(errno));
+		release_pool(smc);
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	/* setting batch size */
+	smc->batch_size = (batchsize == 0 || batchsize > PLAN_MAX_BURST) ?
+		PLAN_MAX_BURST : batchsize;
+
+	TRACE_LOG("Generating traffic for %s\n", iface);
+	UNUSED(qid);
+	TRACE_SYNTH_FUNC_END();
+	return smc->evfd[0];
+}
+/*---------------------------------------------------------------------*/
+void
+synth_unlink_ifaces(void *engptr)
+{
+	TRACE_SYNTH_FUNC_START();
+	engine *eng = (engine *)engptr;
+	synth_module_context *smc;
+	uint i;
+
+	for (i = 0; i < eng->no_of_sources; i++) {
+		smc = (synth_module_context *)eng->esrc[i]->private_context;
+		release_pool(smc);
+		if (smc->evfd[0] != -1) {
+			close(smc->evfd[0]);
+			close(smc->evfd[1]);
+		}
+		smc->evfd[0] = smc->evfd[1] = -1;
+	}
+
+	TRACE_SYNTH_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Writes the packets queued on a leaf to its pcap file.
+ */
+static int32_t
+write_packets(CommNode *cn, plan_leaf *leaf,
+	      unsigned char **bufs, uint32_t *lens)
+{
+	TRACE_SYNTH_FUNC_START();
+	struct pcap_pkthdr phdr;
+	uint16_t k;
+
+	gettimeofday(&phdr.ts, NULL);
+	for (k = 0; k < leaf->n; k++) {
+		phdr.caplen = phdr.len = lens[leaf->pkts[k]];
+		pcap_dump((u_char *)cn->pdumper, &phdr, bufs[leaf->pkts[k]]);
+	}
+
+	TRACE_SYNTH_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+synth_callback(void *engsrcptr)
+{
+	TRACE_SYNTH_FUNC_START();
+	unsigned char *bufs[PLAN_MAX_BURST];
+	uint32_t lens[PLAN_MAX_BURST];
+	synth_module_context *smc;
+	engine_src *engsrc;
+	engine *eng;
+	dispatch_plan *dp;
+	plan_leaf *leaf;
+	uint64_t t0;
+	uint16_t n, i;
+	int b;
+	char c;
+
+	engsrc = (engine_src *)engsrcptr;
+	eng = (engine *)engsrc->brick->eng;
+	smc = (synth_module_context *)engsrc->private_context;
+	dp = eng->plan;
+
+	if (smc->pkts == NULL) {
+		TRACE_LOG("synth context was not properly initialized\n");
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	if (smc->start_ns == 0)
+		smc->start_ns = now_ns();
+	for (b = 0; b < SYNTH_BURSTS; b++) {
+		n = smc->batch_size;
+		if (smc->count != 0)
+			n = MIN(n, smc->count - smc->sent);
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++) {
+			bufs[i] = smc->pkts[smc->cur];
+			lens[i] = smc->lens[smc->cur];
+			eng->byte_count += lens[i];
+			if (++smc->cur == smc->pool_size)
+				smc->cur = 0;
+		}
+		eng->pkt_count += n;
+		smc->sent += n;
+		if (dp == NULL)
+			continue;
+
+		/* only the brick tree and the flush are measured */
+		t0 = read_cycles();
+		dispatch_plan_run(dp, bufs, lens, n);
+		for (i = 0; i < dp->touched_count; i++) {
+			leaf = &dp->leaves[dp->touched[i]];
+			if (leaf->cn->pdumper != NULL)
+				write_packets(leaf->cn, leaf, bufs, lens);
+			else
+				smc->sunk += leaf->n;
+			leaf->n = 0;
+		}
+		dp->touched_count = 0;
+		smc->cycles += read_cycles() - t0;
+	}
+	smc->last_ns = now_ns();
+
+	/* done: stop waking up the engine for this source */
+	if (smc->count != 0 && smc->sent == smc->count &&
+	    read(smc->evfd[0], &c, 1) == 1)
+		synth_report(eng, smc);
+
+	TRACE_SYNTH_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int32_t
+synth_shutdown(void *engptr)
+{
+	TRACE_SYNTH_FUNC_START();
+	engine *eng = (engine *)engptr;
+	uint i;
+
+	if (eng->run == 1) {
+		eng->run = 0;
+	} else {
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	for (i = 0; i < eng->no_of_sources; i++)
+		synth_report(eng, (synth_module_context *)
+			     eng->esrc[i]->private_context);
+
+	TRACE_SYNTH_FUNC_END();
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+void
+synth_delete_all_channels(Brick *brick)
+{
+	TRACE_SYNTH_FUNC_START();
+	CommNode *cn = NULL;
+	uint32_t i;
+	linkdata *lnd = (linkdata *)(&brick->lnd);
+
+	for (i = 0; i < lnd->count; i++) {
+		cn = (CommNode *)lnd->external_links[i];
+		if (cn->pd != NULL || cn->pdumper) {
+			pcap_close(cn->pd);
+			pcap_dump_close(cn->pdumper);
+			cn->pd = NULL;
+			cn->pdumper = NULL;
+		}
+		if (cn->brick != NULL) {
+			synth_delete_all_channels(cn->brick);
+			cn->brick = NULL;
+		}
+		free(cn);
+	}
+
+	brick->elib->deinit(brick);
+	TRACE_SYNTH_FUNC_END();
+}
+/*---------------------------------------------------------------------*/
+int32_t
+synth_create_channel(char *in_name, char *out_name,
+		     Target t, void *esrcptr)
+{
+	TRACE_SYNTH_FUNC_START();
+	int32_t fd;
+	engine *eng;
+	CommNode *cn;
+	linkdata *lnd;
+	engine_src *esrc;
+	Brick *brick;
+
+	fd = -1;
+	esrc = (engine_src *)esrcptr;
+	brick = esrc->brick;
+	eng = (engine *)brick->eng;
+
+	lnd = (linkdata *)(&brick->lnd);
+	/* first locate the source */
+	if (strcmp((char *)lnd->ifname, in_name) != 0) {
+		brick = enable_pipeline(brick, in_name, t, out_name);
+		if (brick == NULL) {
+			TRACE_LOG("Pipelining failed!! Could not find an appropriate "
+				  "source (%s) for engine %s!\n", in_name, eng->name);
+			TRACE_SYNTH_FUNC_END();
+			return -1;
+		}
+	}
+
+	/* reinitialize lnd if brick is reset */
+	lnd = (linkdata *)(&brick->lnd);
+
+	/* create a comm. interface */
+	lnd->external_links[lnd->init_cur_idx] = calloc(1, sizeof(CommNode));
+	if (lnd->external_links[lnd->init_cur_idx] == NULL) {
+		TRACE_ERR("Can't allocate mem for destInfo[%d] for engine %s\n",
+			  lnd->init_cur_idx, eng->name);
+		TRACE_SYNTH_FUNC_END();
+		return -1;
+	}
+
+	cn = (CommNode *)lnd->external_links[lnd->init_cur_idx];
+
+	if (t == WRITE) {
+		TRACE_LOG("Creating pcap writing element %p to file: %s\n",
+			  brick, out_name);
+		cn->pd = pcap_open_dead(DLT_EN10MB, ETH_FRAME_LEN);
+		cn->pdumper = (cn->pd == NULL) ? NULL :
+			pcap_dump_open(cn->pd, out_name);
+		if (cn->pdumper == NULL) {
+			TRACE_LOG("Can't open %s for writing: %s\n", out_name,
+				  (cn->pd == NULL) ? "no pcap handle" :
+				  pcap_geterr(cn->pd));
+			if (cn->pd != NULL)
+				pcap_close(cn->pd);
+			free(cn);
+			lnd->external_links[lnd->init_cur_idx] = NULL;
+			TRACE_SYNTH_FUNC_END();
+			return -1;
+		}
+	} else {
+		/* every other output is a null sink */
+		strcpy_with_reverse_pipe(cn->nm_ifname, out_name);
+	}
+	fd = 0;
+
+	lnd->init_cur_idx++;
+	TRACE_LOG("Created %s interface\n", out_name);
+
+	TRACE_SYNTH_FUNC_END();
+	return fd;
+}
+/*---------------------------------------------------------------------*/
+io_module_funcs synth_module = {
+	.init_context  		= 	synth_init,
+	.link_iface		= 	synth_link_iface,
+	.unlink_ifaces		= 	synth_unlink_ifaces,
+	.callback		= 	synth_callback,
+	.create_external_link 	=	synth_create_channel,
+	.delete_all_channels 	=	synth_delete_all_channels,
+	.shutdown		= 	synth_shutdown,
+};
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,253 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the threaded-code BPF evaluator of the BPFFilter brick
+ * against libpcap's bpf_filter(): a corpus of tcpdump expressions is
+ * compiled with pcap_compile() as the brick does, and every program
+ * is run by both on random frames, at their real length:
+ *
+ *	- Ethernet/VLAN frames carrying IPv4 (with and without options,
+ *	  fragments), IPv6 (with a hop-by-hop header) and ARP, with TCP,
+ *	  UDP and ICMP on top, from a small pool of addresses and ports;
+ *	- frames cut short anywhere (loads past the end reject), and
+ *	  frames of random bytes.
+ *
+ * Both have to return the same value on every frame. It also reports
+ * cycles/packet of both.
+ *
+ * Usage: bpf-bench [frames]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the evaluator */
+#include "../src/bricks_bpf.c"
+/* for pcap_compile() and bpf_filter() */
+#include <pcap/pcap.h>
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for memcpy */
+#include <string.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_FRAMES		4000
+#define MAX_FRAME_LEN		1514
+/* as in src/bricks/bpf-filter.c */
+#define BPF_SNAPLEN		2048
+/*---------------------------------------------------------------------*/
+static const char *exprs[] = {
+	"ip", "ip6", "arp", "tcp", "udp", "icmp", "icmp6", "vlan",
+	"udp port 53", "tcp dst port 80", "tcp src portrange 1000-2000",
+	"host 10.0.0.1", "src net 192.168.0.0/16", "dst host 10.0.0.2 and tcp",
+	"ip6 and tcp port 443", "ip6 host 2001:db8::1", "vlan 10 and udp",
+	"tcp[tcpflags] & (tcp-syn|tcp-ack) == tcp-syn",
+	"ip[6:2] & 0x1fff != 0", "ip[0] & 0xf > 5",
+	"len > 600", "less 100", "greater 1000", "len == 60",
+	"ether broadcast", "not ip and not ip6",
+	"udp and udp[8:2] == 0x1234",
+	"tcp and ip[2:2] - ((ip[0] & 0xf) << 2) - ((tcp[12] & 0xf0) >> 2) > 0",
+	"ip[2:2] / 4 > 100", "ip[8] * 3 > 200", "ip[4:2] % 7 == 3",
+	"ip[5] ^ ip[9] == 0x11", "ip6 proto 58", "ip6 protochain 6",
+};
+#define NUM_EXPRS	(sizeof(exprs) / sizeof(exprs[0]))
+/*---------------------------------------------------------------------*/
+static const uint8_t ip4_pool[][4] = {
+	{10, 0, 0, 1}, {10, 0, 0, 2}, {192, 168, 1, 7}, {172, 16, 0, 9},
+};
+static const uint8_t ip6_pool[][16] = {
+	{0x20, 0x01, 0x0d, 0xb8, [15] = 1}, {0x20, 0x01, 0x0d, 0xb8, [15] = 2},
+	{0xfe, 0x80, [15] = 7},
+};
+static const uint16_t port_pool[] = {53, 80, 443, 1500, 4242};
+/*---------------------------------------------------------------------*/
+#define PICK(state, pool)	\
+	((pool)[xorshift32(state) % (sizeof(pool) / sizeof((pool)[0]))])
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+/*---------------------------------------------------------------------*/
+/* L4 header of proto at p; returns its length */
+static uint32_t
+build_l4(uint32_t *state, uint8_t *p, uint8_t proto)
+{
+	switch (proto) {
+	case IPPROTO_TCP:
+		put16(p, PICK(state, port_pool));
+		put16(p + 2, PICK(state, port_pool));
+		p[12] = 5 << 4;
+		p[13] = xorshift32(state) & 0x3F;
+		return 20;
+	case IPPROTO_UDP:
+		put16(p, PICK(state, port_pool));
+		put16(p + 2, PICK(state, port_pool));
+		if (xorshift32(state) & 1)
+			put16(p + 8, 0x1234);
+		return 8;
+	default:
+		/* ICMP, ICMPv6 */
+		return 8;
+	}
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Random frame at f. Returns its length, which is cut short every
+ * now and then.
+ */
+static uint32_t
+build_frame(uint32_t *state, uint8_t *f)
+{
+	static const uint8_t protos[] = {IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP};
+	uint32_t r = xorshift32(state), len, i;
+	uint8_t *p = f + 12, *l3;
+	uint8_t proto;
+
+	for (i = 0; i < MAX_FRAME_LEN; i++)
+		f[i] = xorshift32(state);
+	if ((r & 15) == 0)
+		/* random bytes */
+		return 14 + xorshift32(state) % (MAX_FRAME_LEN - 13);
+	if (r & 16)
+		memset(f, 0xFF, 6);
+	if (r & 32) {
+		put16(p, 0x8100);
+		put16(p + 2, (r & 64) ? 10 : 20);
+		p += 4;
+	}
+	l3 = p + 2;
+	proto = PICK(state, protos);
+	switch ((r >> 8) % 5) {
+	case 0:
+		put16(p, 0x0806);
+		len = l3 - f + 28;
+		break;
+	case 1:
+	case 2:
+		/* IPv6, perhaps with a hop-by-hop header */
+		put16(p, 0x86DD);
+		l3[0] = 0x60;
+		memcpy(l3 + 8, PICK(state, ip6_pool), 16);
+		memcpy(l3 + 24, PICK(state, ip6_pool), 16);
+		p = l3 + 40;
+		proto = (proto == IPPROTO_ICMP) ? IPPROTO_ICMPV6 : proto;
+		if (r & 128) {
+			l3[6] = IPPROTO_HOPOPTS;
+			p[0] = proto;
+			p[1] = 0;
+			p += 8;
+		} else
+			l3[6] = proto;
+		p += build_l4(state, p, proto);
+		put16(l3 + 4, p - l3 - 40);
+		len = p - f;
+		break;
+	default:
+		/* IPv4, perhaps with options or a fragment */
+		put16(p, 0x0800);
+		l3[0] = (r & 128) ? 0x46 : 0x45;
+		put16(l3 + 6, (r & 256) ? xorshift32(state) & 0x3FFF : 0x4000);
+		l3[9] = proto;
+		memcpy(l3 + 12, PICK(state, ip4_pool), 4);
+		memcpy(l3 + 16, PICK(state, ip4_pool), 4);
+		p = l3 + ((l3[0] & 0xF) << 2);
+		p += build_l4(state, p, proto);
+		len = p - f;
+		break;
+	}
+	/* payload */
+	len += xorshift32(state) % (MAX_FRAME_LEN - len + 1);
+	if (l3[-2] == 0x08 && l3[-1] == 0x00)
+		put16(l3 + 2, len - (l3 - f));
+	/* cut short */
+	if ((r >> 12) % 6 == 0)
+		len = xorshift32(state) % (len + 1);
+	return len;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t n = DEFAULT_FRAMES, state = 0x9e3779b9, i, e;
+	uint32_t *lens, a, b, matched, mismatched, fail = 0;
+	uint64_t start, tc_cyc = 0, ref_cyc = 0;
+	struct bpf_program fp;
+	uint8_t *frames;
+	pcap_t *pd;
+	bpf_tc tc;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 10);
+	frames = malloc((size_t)n * MAX_FRAME_LEN);
+	lens = malloc(n * sizeof(uint32_t));
+	if (n == 0 || frames == NULL || lens == NULL) {
+		fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n; i++)
+		lens[i] = build_frame(&state, frames + (size_t)i * MAX_FRAME_LEN);
+
+	pd = pcap_open_dead(DLT_EN10MB, BPF_SNAPLEN);
+	if (pd == NULL) {
+		fprintf(stderr, "Can't create a pcap handle\n");
+		return EXIT_FAILURE;
+	}
+	for (e = 0; e < NUM_EXPRS; e++) {
+		if (pcap_compile(pd, &fp, exprs[e], 1,
+				 PCAP_NETMASK_UNKNOWN) == -1) {
+			fprintf(stderr, "Can't compile \"%s\": %s\n", exprs[e],
+				pcap_geterr(pd));
+			fail++;
+			continue;
+		}
+		if (bpf_tc_compile(&tc, fp.bf_insns, fp.bf_len) == -1) {
+			fprintf(stderr, "Can't translate \"%s\"\n", exprs[e]);
+			pcap_freecode(&fp);
+			fail++;
+			continue;
+		}
+
+		for (i = matched = mismatched = 0; i < n; i++) {
+			a = bpf_tc_run(&tc, frames + (size_t)i * MAX_FRAME_LEN,
+				       lens[i]);
+			b = bpf_filter(fp.bf_insns,
+				       frames + (size_t)i * MAX_FRAME_LEN,
+				       lens[i], lens[i]);
+			matched += (b != 0);
+			mismatched += (a != b);
+		}
+		start = read_cycles();
+		for (i = 0; i < n; i++)
+			bpf_tc_run(&tc, frames + (size_t)i * MAX_FRAME_LEN,
+				   lens[i]);
+		tc_cyc += read_cycles() - start;
+		start = read_cycles();
+		for (i = 0; i < n; i++)
+			bpf_filter(fp.bf_insns, frames + (size_t)i * MAX_FRAME_LEN,
+				   lens[i], lens[i]);
+		ref_cyc += read_cycles() - start;
+
+		fprintf((mismatched != 0) ? stderr : stdout,
+			"%-70s %5u matched, %u mismatched\n", exprs[e],
+			matched, mismatched);
+		fail += mismatched;
+		bpf_tc_free(&tc);
+		pcap_freecode(&fp);
+	}
+	pcap_close(pd);
+
+	fprintf(stdout, "bpf_tc_run: %.2f cycles/packet, bpf_filter: "
+		"%.2f cycles/packet\n", (double)tc_cyc / ((double)n * NUM_EXPRS),
+		(double)ref_cyc / ((double)n * NUM_EXPRS));
+	free(frames);
+	free(lens);
+	if (fail != 0) {
+		fprintf(stderr, "The evaluator differs from bpf_filter()\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,246 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Microbenchmark for the tuple-space classifier of the Classifier
+ * brick. It builds random rule sets of 1k and 10k rules over VLAN,
+ * ethertype, IP protocol, ports and IPv4 prefixes, checks that the
+ * tuple space search returns what a linear scan of the rules returns,
+ * and reports cycles/packet for both (key extraction included).
+ *
+ * Usage: classifier-bench [packets]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the classifier */
+#include "../src/bricks_classify.c"
+/* for fprintf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define NUM_FRAMES		4096
+#define DEFAULT_PKTS		(1 << 20)
+#define FRAME_LEN		64
+/*---------------------------------------------------------------------*/
+/* small pools, so that rules overlap and packets hit them */
+static uint32_t
+rand_addr(uint32_t *state)
+{
+	return htonl(0x0A000000 | (xorshift32(state) & 0x00FFFFFF));
+}
+
+static uint16_t
+rand_port(uint32_t *state)
+{
+	static const uint16_t ports[] = {22, 53, 80, 123, 443, 8080};
+
+	return (xorshift32(state) & 1) ? ports[xorshift32(state) % 6] :
+		1024 + (xorshift32(state) & 0x3FF);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Rules come in a handful of shapes, like a real steering rule set:
+ * host/subnet + service, subnet pairs, VLANs, non-IP ethertypes
+ */
+static void
+make_rule(cls_rule *r, uint32_t *state)
+{
+	memset(r, 0, sizeof(cls_rule));
+	switch (xorshift32(state) % 5) {
+	case 0:
+		r->fields = CLS_ETHER | CLS_PROTO | CLS_DPORT;
+		r->key.src[0] = rand_addr(state);
+		r->src_len = 16 + (xorshift32(state) % 17);
+		r->key.proto = PROTO_TCP;
+		r->key.dport = rand_port(state);
+		break;
+	case 1:
+		r->fields = CLS_ETHER | CLS_PROTO | CLS_SPORT;
+		r->key.dst[0] = rand_addr(state);
+		r->dst_len = 24 + (xorshift32(state) % 9);
+		r->key.proto = PROTO_UDP;
+		r->key.sport = rand_port(state);
+		break;
+	case 2:
+		r->fields = CLS_ETHER;
+		r->key.src[0] = rand_addr(state);
+		r->src_len = 16 + 8 * (xorshift32(state) % 2);
+		r->key.dst[0] = rand_addr(state);
+		r->dst_len = 16 + 8 * (xorshift32(state) % 2);
+		break;
+	case 3:
+		r->fields = CLS_VLAN | CLS_ETHER;
+		r->key.vlan = xorshift32(state) % 64;
+		break;
+	default:
+		r->fields = CLS_PROTO | CLS_DPORT;
+		r->key.proto = (xorshift32(state) & 1) ? PROTO_TCP : PROTO_UDP;
+		r->key.dport = 1024 + (xorshift32(state) & 0x3FF);
+		break;
+	}
+	r->key.ether = ETHERTYPE_IPV4;
+	r->out = 1ULL << (xorshift32(state) % 64);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Half of the frames are made to hit a random rule, the rest are
+ * random TCP/UDP frames (a third of them VLAN tagged)
+ */
+static void
+make_frame(unsigned char *f, const cls_rule *rules, uint32_t n,
+	   uint32_t *state)
+{
+	const cls_rule *r = &rules[xorshift32(state) % n];
+	uint32_t src = rand_addr(state), dst = rand_addr(state);
+	uint16_t sport = rand_port(state), dport = rand_port(state);
+	uint8_t proto = (xorshift32(state) & 1) ? PROTO_TCP : PROTO_UDP;
+	int vlan = (xorshift32(state) % 3 == 0) ?
+		(int)(xorshift32(state) % 64) : -1;
+	unsigned char *l3;
+
+	if (xorshift32(state) & 1) {
+		if (r->src_len != 0)
+			src = r->key.src[0];
+		if (r->dst_len != 0)
+			dst = r->key.dst[0];
+		if (r->fields & CLS_PROTO)
+			proto = r->key.proto;
+		if (r->fields & CLS_SPORT)
+			sport = r->key.sport;
+		if (r->fields & CLS_DPORT)
+			dport = r->key.dport;
+		if (r->fields & CLS_VLAN)
+			vlan = r->key.vlan;
+	}
+
+	memset(f, 0, FRAME_LEN);
+	l3 = f + 14;
+	if (vlan >= 0) {
+		f[12] = ETHERTYPE_VLAN >> 8;
+		f[13] = ETHERTYPE_VLAN & 0xFF;
+		f[14] = vlan >> 8;
+		f[15] = vlan & 0xFF;
+		l3 += 4;
+	}
+	l3[-2] = ETHERTYPE_IPV4 >> 8;
+	l3[-1] = ETHERTYPE_IPV4 & 0xFF;
+	l3[0] = 0x45;
+	l3[9] = proto;
+	memcpy(l3 + 12, &src, 4);
+	memcpy(l3 + 16, &dst, 4);
+	l3[20] = sport >> 8;
+	l3[21] = sport & 0xFF;
+	l3[22] = dport >> 8;
+	l3[23] = dport & 0xFF;
+}
+/*---------------------------------------------------------------------*/
+typedef struct masked_rule {
+	cls_key mask;
+	cls_key key;
+	uint64_t out;
+} masked_rule;
+
+/* the baseline: first match of a linear scan */
+static uint64_t
+linear_lookup(const masked_rule *mr, uint32_t n, const cls_key *key)
+{
+	cls_key k;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		cls_mask_key(&k, key, &mr[i].mask);
+		if (!memcmp(&k, &mr[i].key, sizeof(cls_key)))
+			return mr[i].out;
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+static int
+run(uint32_t n, uint64_t pkts, uint32_t *state)
+{
+	static unsigned char frames[NUM_FRAMES][FRAME_LEN];
+	cls_rule *rules = calloc(n, sizeof(cls_rule));
+	masked_rule *mr = calloc(n, sizeof(masked_rule));
+	uint64_t i, start, tss_cyc, lin_cyc;
+	uint64_t sink = 0;
+	uint32_t hits = 0;
+	classifier c;
+	cls_key key;
+
+	if (rules == NULL || mr == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		make_rule(&rules[i], state);
+		make_mask(&mr[i].mask, rules[i].fields, rules[i].src_len,
+			  rules[i].dst_len);
+		cls_mask_key(&mr[i].key, &rules[i].key, &mr[i].mask);
+		mr[i].out = rules[i].out;
+	}
+	for (i = 0; i < NUM_FRAMES; i++)
+		make_frame(frames[i], rules, n, state);
+	if (cls_build(&c, rules, n) == -1) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	/* correctness: both must pick the same rule for every frame */
+	for (i = 0; i < NUM_FRAMES; i++) {
+		cls_key_from_pkt(&key, frames[i], FRAME_LEN);
+		if (cls_lookup(&c, &key) != linear_lookup(mr, n, &key)) {
+			fprintf(stderr, "Mismatch for frame %u\n", (uint32_t)i);
+			return -1;
+		}
+		hits += (cls_lookup(&c, &key) != 0);
+	}
+
+	start = read_cycles();
+	for (i = 0; i < pkts; i++) {
+		cls_key_from_pkt(&key, frames[i & (NUM_FRAMES - 1)],
+				 FRAME_LEN);
+		sink ^= cls_lookup(&c, &key);
+	}
+	tss_cyc = read_cycles() - start;
+
+	/* the linear scan is slow; run it on fewer packets */
+	start = read_cycles();
+	for (i = 0; i < pkts / 16; i++) {
+		cls_key_from_pkt(&key, frames[i & (NUM_FRAMES - 1)],
+				 FRAME_LEN);
+		sink ^= linear_lookup(mr, n, &key);
+	}
+	lin_cyc = read_cycles() - start;
+
+	fprintf(stdout, "%5u rules, %3u tuples, %4.1f%% hits: "
+		"tuple space %8.2f, linear %10.2f cycles/packet "
+		"(checksum: %08x)\n", n, c.count,
+		100.0 * hits / NUM_FRAMES, (double)tss_cyc / pkts,
+		(double)lin_cyc / (pkts / 16), (uint32_t)sink);
+
+	cls_free(&c);
+	free(mr);
+	free(rules);
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint64_t pkts = DEFAULT_PKTS;
+	uint32_t state = 0x9e3779b9;
+
+	if (argc > 1)
+		pkts = strtoul(argv[1], NULL, 10);
+	if (pkts < 16) {
+		fprintf(stderr, "Usage: %s [packets (>= 16)]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (run(1000, pkts, &state) == -1 ||
+	    run(10000, pkts, &state) == -1)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,455 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the connection table of the filter brick, on tables built by
+ * build_filter_table() as commit_filters() builds them:
+ *
+ *	- a connection filter matches both directions of its connection
+ *	  (IPv4 and IPv6), and no other connection;
+ *	- the table grows well past its initial buckets and still finds
+ *	  every connection;
+ *	- a whitelisting filter wins over a dropping one on the same
+ *	  connection, whatever order and direction they come in, and
+ *	  over a dropping IP filter on one of its hosts;
+ *	- commit_filters() publishes every rule committed so far, whether
+ *	  it reuses the table it replaced last or has to build one;
+ *	- while the engine is not passing quiescent points, commits keep
+ *	  no more than FILTER_MAX_RETIRED replaced tables, and the engine
+ *	  publishes the rules held back at its next one.
+ *
+ * It also reports cycles/packet of analyze_packet() on the grown
+ * table, and cycles/commit of one rule on top of many IP filters.
+ *
+ * Usage: filter-bench [connections]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the filter tables and what they are built of */
+#include "../src/bricks_lpm.c"
+#include "../src/bricks_timer.c"
+#include "../src/bricks_filter.c"
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_CONNS		20000
+#define FRAME_LEN		80
+/*---------------------------------------------------------------------*/
+/**
+ * TCP frame from (saddr, sp) to (daddr, dp). Addresses are 4 (IPv4)
+ * or 16 (IPv6) bytes.
+ */
+static void
+build_frame(uint8_t *f, int v6, const uint8_t *saddr, const uint8_t *daddr,
+	    uint16_t sp, uint16_t dp)
+{
+	struct ether_header *eh = (struct ether_header *)f;
+	struct tcphdr *th;
+
+	memset(f, 0, FRAME_LEN);
+	if (v6) {
+		struct ip6_hdr *ip6 = (struct ip6_hdr *)(eh + 1);
+
+		eh->ether_type = htons(ETHERTYPE_IPV6);
+		ip6->ip6_vfc = 0x60;
+		ip6->ip6_plen = htons(sizeof(struct tcphdr));
+		ip6->ip6_nxt = IPPROTO_TCP;
+		memcpy(&ip6->ip6_src, saddr, 16);
+		memcpy(&ip6->ip6_dst, daddr, 16);
+		th = (struct tcphdr *)(ip6 + 1);
+	} else {
+		struct ip *ip = (struct ip *)(eh + 1);
+
+		eh->ether_type = htons(ETHERTYPE_IP);
+		ip->ip_v = 4;
+		ip->ip_hl = 5;
+		ip->ip_len = htons(sizeof(struct ip) + sizeof(struct tcphdr));
+		ip->ip_p = IPPROTO_TCP;
+		memcpy(&ip->ip_src, saddr, 4);
+		memcpy(&ip->ip_dst, daddr, 4);
+		th = (struct tcphdr *)(ip + 1);
+	}
+	th->th_sport = htons(sp);
+	th->th_dport = htons(dp);
+}
+/*---------------------------------------------------------------------*/
+/* adds a permanent connection filter to rules */
+static void
+add_conn(flist *rules, int v6, const uint8_t *saddr, const uint8_t *daddr,
+	 uint16_t sp, uint16_t dp, Target tgt)
+{
+	Filter *f = calloc(1, sizeof(Filter));
+
+	if (f == NULL) {
+		fprintf(stderr, "Can't allocate a filter\n");
+		exit(EXIT_FAILURE);
+	}
+	f->filter_type_flag = BRICKS_CONNECTION_FILTER;
+	f->proto = (v6) ? IPV6_VERSION : IPVERSION;
+	memcpy((v6) ? f->conn.sip6addr.addr8 : f->conn.sip4addr.addr8,
+	       saddr, (v6) ? 16 : 4);
+	memcpy((v6) ? f->conn.dip6addr.addr8 : f->conn.dip4addr.addr8,
+	       daddr, (v6) ? 16 : 4);
+	f->conn.sport = htons(sp);
+	f->conn.dport = htons(dp);
+	f->filt_time_period = -1;
+	f->tgt = tgt;
+	adjustMasks(f);
+	TAILQ_INSERT_TAIL(rules, f, entry);
+}
+/*---------------------------------------------------------------------*/
+/* adds a permanent filter on IPv4 host addr to rules */
+static void
+add_ip(flist *rules, const uint8_t *addr, Target tgt)
+{
+	Filter *f = calloc(1, sizeof(Filter));
+
+	if (f == NULL) {
+		fprintf(stderr, "Can't allocate a filter\n");
+		exit(EXIT_FAILURE);
+	}
+	f->filter_type_flag = BRICKS_IP_FILTER;
+	f->proto = IPVERSION;
+	memcpy(f->ip4addr.addr8, addr, 4);
+	f->filt_time_period = -1;
+	f->tgt = tgt;
+	adjustMasks(f);
+	TAILQ_INSERT_TAIL(rules, f, entry);
+}
+/*---------------------------------------------------------------------*/
+static void
+free_rules(flist *rules)
+{
+	Filter *f;
+
+	while ((f = TAILQ_FIRST(rules)) != NULL) {
+		TAILQ_REMOVE(rules, f, entry);
+		free(f);
+	}
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Runs frame through a table built from rules. Returns what
+ * analyze_packet() does: 1 if the frame passes, 0 if it is dropped.
+ */
+static int
+verdict(flist *rules, uint8_t *frame)
+{
+	FilterContext cn;
+	int rc;
+
+	memset(&cn, 0, sizeof(cn));
+	cn.tbl = build_filter_table(rules, 0);
+	if (cn.tbl == NULL) {
+		fprintf(stderr, "Can't build a filter table\n");
+		exit(EXIT_FAILURE);
+	}
+	rc = analyze_packet(frame, FRAME_LEN, &cn);
+	free_filter_table(cn.tbl);
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_directions(void)
+{
+	static const uint8_t a4[4] = {10, 0, 0, 1}, b4[4] = {10, 0, 0, 2};
+	uint8_t a6[16] = {0x20, 0x01, 0x0d, 0xb8}, b6[16] = {0x20, 0x01};
+	uint8_t fwd[FRAME_LEN], rev[FRAME_LEN], other[FRAME_LEN];
+	const uint8_t *sa, *da;
+	flist rules;
+	int v6, fail = 0;
+
+	a6[15] = 1;
+	b6[15] = 2;
+	for (v6 = 0; v6 < 2; v6++) {
+		sa = (v6) ? a6 : a4;
+		da = (v6) ? b6 : b4;
+		TAILQ_INIT(&rules);
+		add_conn(&rules, v6, sa, da, 40000, 80, DROP);
+		build_frame(fwd, v6, sa, da, 40000, 80);
+		build_frame(rev, v6, da, sa, 80, 40000);
+		build_frame(other, v6, sa, da, 40001, 80);
+		if (verdict(&rules, fwd) != 0 || verdict(&rules, rev) != 0) {
+			fprintf(stderr, "%s: a direction is not filtered\n",
+				(v6) ? "IPv6" : "IPv4");
+			fail++;
+		}
+		if (verdict(&rules, other) != 1) {
+			fprintf(stderr, "%s: another connection is filtered\n",
+				(v6) ? "IPv6" : "IPv4");
+			fail++;
+		}
+		free_rules(&rules);
+	}
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_precedence(void)
+{
+	static const uint8_t a[4] = {10, 0, 0, 1}, b[4] = {10, 0, 0, 2};
+	static const uint8_t c[4] = {10, 0, 0, 3};
+	uint8_t fwd[FRAME_LEN], rev[FRAME_LEN], other[FRAME_LEN];
+	flist rules;
+	int fail = 0;
+
+	build_frame(fwd, 0, a, b, 40000, 80);
+	build_frame(rev, 0, b, a, 80, 40000);
+	build_frame(other, 0, a, c, 40000, 80);
+
+	/* drop, then whitelist the same direction */
+	TAILQ_INIT(&rules);
+	add_conn(&rules, 0, a, b, 40000, 80, DROP);
+	add_conn(&rules, 0, a, b, 40000, 80, WHITELIST);
+	fail += (verdict(&rules, fwd) != 1 || verdict(&rules, rev) != 1);
+	free_rules(&rules);
+
+	/* whitelist the reverse direction, then drop */
+	TAILQ_INIT(&rules);
+	add_conn(&rules, 0, b, a, 80, 40000, WHITELIST);
+	add_conn(&rules, 0, a, b, 40000, 80, DROP);
+	fail += (verdict(&rules, fwd) != 1 || verdict(&rules, rev) != 1);
+	free_rules(&rules);
+
+	/* a dropped host keeps its whitelisted connection only */
+	TAILQ_INIT(&rules);
+	add_ip(&rules, a, DROP);
+	add_conn(&rules, 0, a, b, 40000, 80, WHITELIST);
+	fail += (verdict(&rules, fwd) != 1 || verdict(&rules, rev) != 1 ||
+		 verdict(&rules, other) != 0);
+	free_rules(&rules);
+
+	if (fail != 0)
+		fprintf(stderr, "Whitelisting filters do not win\n");
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/* drops connection (a, b, i, 80) until the next commit */
+static void
+apply_conn(FilterContext *cn, const uint8_t *a, const uint8_t *b, uint16_t i)
+{
+	flist rules;
+	Filter *f;
+
+	TAILQ_INIT(&rules);
+	add_conn(&rules, 0, a, b, i, 80, DROP);
+	f = TAILQ_FIRST(&rules);
+	apply_filter(cn, f);
+	free_rules(&rules);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Commits rules one by one, with and without the engine going through
+ * a quiescent point in between. Returns the no. of failed checks.
+ */
+static int
+check_commits(uint32_t conns)
+{
+	static const uint8_t a[4] = {10, 0, 0, 1}, b[4] = {10, 0, 0, 2};
+	uint8_t frame[FRAME_LEN], addr[4];
+	uint64_t start, reuse = 0, build = 0;
+	filter_table *spare;
+	FilterContext cn;
+	flist rules;
+	uint16_t i, j;
+	int fail = 0;
+
+	memset(&cn, 0, sizeof(cn));
+	if (init_filters(&cn) == -1) {
+		fprintf(stderr, "Can't set up filters\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 1; i <= 8; i++) {
+		/* every other commit, the engine is done with the old table */
+		if (i & 1)
+			cn.qs_seq++;
+		spare = cn.retired;
+		apply_conn(&cn, a, b, i);
+		if (commit_filters(&cn) != 1 || commit_filters(&cn) != 0) {
+			fprintf(stderr, "Commit %u failed\n", i);
+			fail++;
+		}
+		if (i > 1 && (i & 1) && cn.tbl != spare) {
+			fprintf(stderr, "Commit %u did not reuse its table\n", i);
+			fail++;
+		}
+		for (j = 1; j <= i + 1; j++) {
+			build_frame(frame, 0, b, a, 80, j);
+			if (analyze_packet(frame, FRAME_LEN, &cn) != (j > i)) {
+				fprintf(stderr, "Commit %u lost rule %u\n", i, j);
+				fail++;
+			}
+		}
+	}
+
+	/* one more rule on top of many IP filters */
+	TAILQ_INIT(&rules);
+	for (j = 0; j < conns; j++) {
+		addr[0] = 192;
+		addr[1] = j >> 8;
+		addr[2] = j;
+		addr[3] = 1;
+		add_ip(&rules, addr, DROP);
+		apply_filter(&cn, TAILQ_LAST(&rules, flist));
+	}
+	free_rules(&rules);
+	for (i = 0; i < 4; i++) {
+		cn.qs_seq += (i & 1);
+		/* tables freed here are not part of the commit's cost */
+		commit_filters(&cn);
+		apply_conn(&cn, b, a, i);
+		start = read_cycles();
+		fail += (commit_filters(&cn) != 1);
+		/* the first two also add the IP filters */
+		if (i == 2)
+			build = read_cycles() - start;
+		else if (i == 3)
+			reuse = read_cycles() - start;
+	}
+	fprintf(stdout, "commit of 1 rule over %u: %lu cycles when reusing "
+		"a table, %lu when building one\n", conns,
+		(unsigned long)reuse, (unsigned long)build);
+
+	flush_filters(&cn);
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Commits rules to a brick whose engine does not move on, then lets
+ * the engine pass one quiescent point. Returns the no. of failed
+ * checks.
+ */
+static int
+check_stalled_engine(void)
+{
+	static const uint8_t a[4] = {10, 0, 0, 1}, b[4] = {10, 0, 0, 2};
+	uint8_t frame[FRAME_LEN];
+	FilterContext cn;
+	filter_table *t;
+	engine eng;
+	uint32_t n;
+	uint16_t i;
+	int fail = 0;
+
+	memset(&cn, 0, sizeof(cn));
+	memset(&eng, 0, sizeof(eng));
+	if (init_filters(&cn) == -1) {
+		fprintf(stderr, "Can't set up filters\n");
+		exit(EXIT_FAILURE);
+	}
+	TAILQ_INIT(&eng.filter_list);
+	TAILQ_INSERT_TAIL(&eng.filter_list, &cn, entry);
+
+	for (i = 1; i <= 16; i++) {
+		apply_conn(&cn, a, b, i);
+		commit_filters(&cn);
+		for (n = 0, t = cn.retired; t != NULL; t = t->next)
+			n++;
+		if (n > FILTER_MAX_RETIRED) {
+			fprintf(stderr, "Stalled engine: %u tables retired\n", n);
+			fail++;
+			break;
+		}
+	}
+	if (cn.deferred == 0) {
+		fprintf(stderr, "Stalled engine: no commit was deferred\n");
+		fail++;
+	}
+
+	/* the engine moves on and publishes the rest */
+	expire_filters(&eng, time(NULL));
+	for (i = 1; i <= 17; i++) {
+		build_frame(frame, 0, b, a, 80, i);
+		if (analyze_packet(frame, FRAME_LEN, &cn) != (i > 16)) {
+			fprintf(stderr, "Stalled engine: rule %u lost\n", i);
+			fail++;
+		}
+	}
+	if (cn.deferred != 0 || cn.pending != 0) {
+		fprintf(stderr, "Stalled engine: rules left pending\n");
+		fail++;
+	}
+
+	flush_filters(&cn);
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t conns = DEFAULT_CONNS, state = 0x9e3779b9, i, tmp;
+	uint32_t missed = 0, wrong = 0;
+	uint8_t (*frame)[3][FRAME_LEN];
+	uint8_t sa[4], da[4];
+	uint64_t start, cyc;
+	FilterContext cn;
+	flist rules;
+	int fail;
+
+	if (argc > 1)
+		conns = strtoul(argv[1], NULL, 10);
+	frame = calloc(conns, sizeof(*frame));
+	if (conns == 0 || frame == NULL) {
+		fprintf(stderr, "Usage: %s [connections]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fail = check_directions() + check_precedence() + check_commits(conns) +
+		check_stalled_engine();
+
+	/* random connections: forward, reverse and a neighbour frame */
+	TAILQ_INIT(&rules);
+	for (i = 0; i < conns; i++) {
+		tmp = xorshift32(&state);
+		memcpy(sa, &tmp, 4);
+		tmp = xorshift32(&state);
+		memcpy(da, &tmp, 4);
+		tmp = xorshift32(&state) | 1;
+		add_conn(&rules, 0, sa, da, tmp, tmp >> 16, DROP);
+		build_frame(frame[i][0], 0, sa, da, tmp, tmp >> 16);
+		build_frame(frame[i][1], 0, da, sa, tmp >> 16, tmp);
+		build_frame(frame[i][2], 0, sa, da, tmp - 1, tmp >> 16);
+	}
+	memset(&cn, 0, sizeof(cn));
+	cn.tbl = build_filter_table(&rules, 0);
+	if (cn.tbl == NULL) {
+		fprintf(stderr, "Can't build a filter table\n");
+		return EXIT_FAILURE;
+	}
+	if (cn.tbl->conn_tbl.count != conns ||
+	    (conns > CONN_TABLE_MIN_BUCKETS &&
+	     cn.tbl->conn_tbl.mask < CONN_TABLE_MIN_BUCKETS)) {
+		fprintf(stderr, "Connection table did not grow: %u entries, "
+			"%u buckets\n", cn.tbl->conn_tbl.count,
+			cn.tbl->conn_tbl.mask + 1);
+		fail++;
+	}
+
+	start = read_cycles();
+	for (i = 0; i < conns; i++) {
+		missed += analyze_packet(frame[i][0], FRAME_LEN, &cn);
+		missed += analyze_packet(frame[i][1], FRAME_LEN, &cn);
+		wrong += !analyze_packet(frame[i][2], FRAME_LEN, &cn);
+	}
+	cyc = read_cycles() - start;
+
+	fprintf(stdout, "%u connections in %u buckets: %u directions missed, "
+		"%u other connections dropped\n", conns,
+		cn.tbl->conn_tbl.mask + 1, missed, wrong);
+	fprintf(stdout, "analyze_packet: %.2f cycles/packet\n",
+		(double)cyc / (3.0 * conns));
+	if (missed != 0 || wrong != 0) {
+		fprintf(stderr, "Connection table lookups are off\n");
+		fail++;
+	}
+
+	free_filter_table(cn.tbl);
+	free_rules(&rules);
+	free(frame);
+	return (fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Microbenchmark for the symmetric Toeplitz hash used by pkt_hdr_hash().
+ * It compares the table-driven sym_hash_fn() against the original
+ * bit-at-a-time loop, checks that both produce identical values, and
+ * reports cycles/packet for each variant as well as for the complete
+ * pkt_hdr_hash() path over a set of synthetic TCP/IPv4 frames.
+ *
+ * It also spreads synthetic IPv6 flows between hosts of a few /64s
+ * under one /32 over PIPES pipes, the way a LoadBalancer does, and
+ * fails if the load is uneven or the hash is not symmetric. The old
+ * hash (first 4 octets of each address) is shown for comparison.
+ * Extension headers that run past the IPv6 payload or the captured
+ * bytes must leave the ports out of the hash.
+ *
+ * Finally, TCP/IPv4 flows are wrapped in VXLAN, GRE, GTP-U, MPLS and
+ * QinQ between a single pair of tunnel end points; the inner hash must
+ * equal the hash of the bare flow, and spread as evenly. A GTP-U
+ * extension header that runs off the frame must not be followed. Nor
+ * may any header of a tunnel frame that is cut short be read past
+ * the capture: the hash falls back to the inner addresses, then to
+ * the outer headers.
+ *
+ * Usage: hash-bench [iterations]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the static hash routines */
+#include "../src/pkt_hash.c"
+/* for fprintf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define NUM_TUPLES		4096
+#define DEFAULT_ITERS		(1 << 24)
+#define FRAME_LEN		64
+#define FRAME6_LEN		96
+#define NUM_FLOWS6		(1 << 16)
+#define NUM_SERVERS6		16
+#define PIPES			48
+/* the busiest pipe may carry at most this much over the mean */
+#define MAX_IMBALANCE		1.15
+#define TUNNEL_FRAME_LEN	160
+#define NUM_TUNNEL_FLOWS	(1 << 14)
+/* length of the first GTP-U extension header in a tunnel frame */
+#define GTPU_EXT_OFF		(14 + 20 + 8 + 12)
+/* flows whose tunnel frames are cut at every length */
+#define NUM_CUT_FLOWS		64
+/*---------------------------------------------------------------------*/
+/**
+ * The original bitwise implementation of sym_hash_fn, kept here as the
+ * reference for both correctness and speed.
+ */
+static uint32_t
+legacy_sym_hash_fn(uint32_t sip, uint32_t dip, uint16_t sp, uint32_t dp)
+{
+	uint32_t rc = 0;
+	int i;
+	static int first_time = 1;
+	static uint32_t key_cache[KEY_CACHE_LEN] = {0};
+
+	if (first_time) {
+		build_sym_key_cache(key_cache, KEY_CACHE_LEN);
+		first_time = 0;
+	}
+
+	for (i = 0; i < 32; i++) {
+		if (sip & 0x80000000)
+			rc ^= key_cache[i];
+		sip <<= 1;
+	}
+	for (i = 0; i < 32; i++) {
+		if (dip & 0x80000000)
+			rc ^= key_cache[32+i];
+		dip <<= 1;
+	}
+	for (i = 0; i < 16; i++) {
+		if (sp & 0x8000)
+			rc ^= key_cache[64+i];
+		sp <<= 1;
+	}
+	for (i = 0; i < 16; i++) {
+		if (dp & 0x8000)
+			rc ^= key_cache[80+i];
+		dp <<= 1;
+	}
+	return rc;
+}
+/*---------------------------------------------------------------------*/
+typedef struct tuple {
+	uint32_t sip;
+	uint32_t dip;
+	uint16_t sp;
+	uint16_t dp;
+} tuple;
+/*---------------------------------------------------------------------*/
+static void
+build_frame(unsigned char *frame, const tuple *t)
+{
+	struct ether_header *ethh = (struct ether_header *)frame;
+	struct ip *iph = (struct ip *)(ethh + 1);
+	struct tcphdr *tcph = (struct tcphdr *)(iph + 1);
+
+	memset(frame, 0, FRAME_LEN);
+	ethh->ether_type = htons(ETHERTYPE_IP);
+	iph->ip_v = 4;
+	iph->ip_hl = 5;
+	iph->ip_p = IPPROTO_TCP;
+	iph->ip_src.s_addr = htonl(t->sip);
+	iph->ip_dst.s_addr = htonl(t->dip);
+	tcph->th_sport = htons(t->sp);
+	tcph->th_dport = htons(t->dp);
+}
+/*---------------------------------------------------------------------*/
+typedef struct tuple6 {
+	struct in6_addr sip;
+	struct in6_addr dip;
+	uint16_t sp;
+	uint16_t dp;
+} tuple6;
+/*---------------------------------------------------------------------*/
+/* hbh: put a hop-by-hop options header in front of the TCP header */
+static void
+build_frame6(unsigned char *frame, const tuple6 *t, int hbh)
+{
+	struct ether_header *ethh = (struct ether_header *)frame;
+	struct ip6_hdr *ipv6h = (struct ip6_hdr *)(ethh + 1);
+	struct tcphdr *tcph = (struct tcphdr *)(ipv6h + 1);
+
+	memset(frame, 0, FRAME6_LEN);
+	ethh->ether_type = htons(ETHERTYPE_IPV6);
+	ipv6h->ip6_vfc = 6 << 4;
+	ipv6h->ip6_plen = htons(FRAME6_LEN - sizeof(struct ether_header) -
+				sizeof(struct ip6_hdr));
+	ipv6h->ip6_nxt = IPPROTO_TCP;
+	if (hbh) {
+		struct ip6_hbh *ext = (struct ip6_hbh *)(ipv6h + 1);
+
+		ipv6h->ip6_nxt = IPPROTO_HOPOPTS;
+		ext->ip6h_nxt = IPPROTO_TCP;
+		ext->ip6h_len = 0;
+		tcph = (struct tcphdr *)((uint8_t *)ext + 8);
+	}
+	ipv6h->ip6_src = t->sip;
+	ipv6h->ip6_dst = t->dip;
+	tcph->th_sport = htons(t->sp);
+	tcph->th_dport = htons(t->dp);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * The hash pkt_hdr_hash() used to compute for any IPv6 packet: only
+ * the first 4 octets of each address, never the ports.
+ */
+static uint32_t
+legacy_ipv6_hash(const tuple6 *t, uint8_t seed)
+{
+	uint32_t saddr, daddr;
+
+	memcpy(&saddr, t->sip.s6_addr, sizeof(saddr));
+	memcpy(&daddr, t->dip.s6_addr, sizeof(daddr));
+	return sym_hash_fn(ntohl(saddr), ntohl(daddr),
+			   ntohs(0xFFFD) + seed, ntohs(0xFFFE) + seed);
+}
+/*---------------------------------------------------------------------*/
+/* 2001:db8:0:<subnet>::/64 with a random interface id */
+static void
+make_ipv6_host(struct in6_addr *addr, uint16_t subnet, uint32_t *state)
+{
+	uint32_t iid[2];
+
+	memset(addr, 0, sizeof(*addr));
+	addr->s6_addr[0] = 0x20;
+	addr->s6_addr[1] = 0x01;
+	addr->s6_addr[2] = 0x0d;
+	addr->s6_addr[3] = 0xb8;
+	addr->s6_addr[6] = subnet >> 8;
+	addr->s6_addr[7] = subnet & 0xFF;
+	iid[0] = xorshift32(state);
+	iid[1] = xorshift32(state);
+	memcpy(&addr->s6_addr[8], iid, sizeof(iid));
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Busiest pipe over the mean, and the chi-square statistic of the
+ * pipe loads against a uniform spread (expected: ~PIPES - 1)
+ */
+static double
+imbalance(const uint32_t *load, uint32_t total, double *chi2)
+{
+	double mean = (double)total / PIPES;
+	uint32_t i, max = 0;
+
+	*chi2 = 0;
+	for (i = 0; i < PIPES; i++) {
+		if (load[i] > max)
+			max = load[i];
+		*chi2 += (load[i] - mean) * (load[i] - mean) / mean;
+	}
+	return max / mean;
+}
+/*---------------------------------------------------------------------*/
+static int
+ipv6_distribution(uint32_t *state)
+{
+	static tuple6 flows[NUM_FLOWS6];
+	static unsigned char frame[FRAME6_LEN], rframe[FRAME6_LEN];
+	uint32_t load2[PIPES] = {0}, load4[PIPES] = {0}, old[PIPES] = {0};
+	struct in6_addr servers[NUM_SERVERS6];
+	double r2, r4, rold, c2, c4, cold;
+	tuple6 *f, rev;
+	uint32_t i;
+
+	for (i = 0; i < NUM_SERVERS6; i++)
+		make_ipv6_host(&servers[i], 0x100, state);
+	for (i = 0; i < NUM_FLOWS6; i++) {
+		f = &flows[i];
+		/* clients in two /64s talk to a handful of servers */
+		make_ipv6_host(&f->sip, 1 + (xorshift32(state) & 1), state);
+		f->dip = servers[xorshift32(state) % NUM_SERVERS6];
+		f->sp = 1024 + xorshift32(state) % 64512;
+		f->dp = (xorshift32(state) & 1) ? 443 : 80;
+
+		rev.sip = f->dip;
+		rev.dip = f->sip;
+		rev.sp = f->dp;
+		rev.dp = f->sp;
+		build_frame6(frame, f, 0);
+		/* extension headers must not change the hash either */
+		build_frame6(rframe, &rev, i & 1);
+		if (pkt_hdr_hash(frame, FRAME6_LEN, 2, 0) !=
+		    pkt_hdr_hash(rframe, FRAME6_LEN, 2, 0) ||
+		    pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) !=
+		    pkt_hdr_hash(rframe, FRAME6_LEN, 4, 0)) {
+			fprintf(stderr, "IPv6 hash is not symmetric for flow %u\n",
+				i);
+			return -1;
+		}
+		load2[pkt_hdr_hash(frame, FRAME6_LEN, 2, 0) % PIPES]++;
+		load4[pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) % PIPES]++;
+		old[legacy_ipv6_hash(f, 0) % PIPES]++;
+	}
+
+	r2 = imbalance(load2, NUM_FLOWS6, &c2);
+	r4 = imbalance(load4, NUM_FLOWS6, &c4);
+	rold = imbalance(old, NUM_FLOWS6, &cold);
+	fprintf(stdout, "ipv6 over %d pipes (max/mean, chi2): "
+		"2-tuple %.3f %.1f, 4-tuple %.3f %.1f, old %.3f %.1f\n",
+		PIPES, r2, c2, r4, c4, rold, cold);
+	if (r2 > MAX_IMBALANCE || r4 > MAX_IMBALANCE) {
+		fprintf(stderr, "IPv6 flows are unevenly spread\n");
+		return -1;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * A hop-by-hop header that is cut short, by the payload length or by
+ * the end of the capture, hides the ports: the 4-tuple hash must fall
+ * back to the 2-tuple one.
+ */
+static int
+ipv6_bounds(uint32_t *state)
+{
+	static unsigned char frame[FRAME6_LEN];
+	struct ip6_hdr *ipv6h = (struct ip6_hdr *)(frame + 14);
+	struct ip6_hbh *ext = (struct ip6_hbh *)(ipv6h + 1);
+	uint32_t h2, i;
+	tuple6 f;
+
+	for (i = 0; i < 1024; i++) {
+		make_ipv6_host(&f.sip, 1, state);
+		make_ipv6_host(&f.dip, 2, state);
+		f.sp = 1024 + xorshift32(state) % 64512;
+		f.dp = 80;
+		build_frame6(frame, &f, 1);
+		h2 = pkt_hdr_hash(frame, FRAME6_LEN, 2, 0);
+		if (pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) == h2 ||
+		    pkt_hdr_hash(frame, 14 + 40 + 8 + 4, 4, 0) == h2)
+			goto bad;
+		/* the header ends past the capture */
+		if (pkt_hdr_hash(frame, 14 + 40 + 4, 4, 0) != h2)
+			goto bad;
+		/* ... past the payload */
+		ipv6h->ip6_plen = htons(4);
+		if (pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) != h2)
+			goto bad;
+		/* ... or claims to be longer than both */
+		build_frame6(frame, &f, 1);
+		ext->ip6h_len = 255;
+		if (pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) != h2)
+			goto bad;
+		/* no room for the ports */
+		build_frame6(frame, &f, 1);
+		ipv6h->ip6_plen = htons(8);
+		if (pkt_hdr_hash(frame, FRAME6_LEN, 4, 0) != h2)
+			goto bad;
+	}
+	return 0;
+
+ bad:
+	fprintf(stderr, "IPv6 headers past the payload are hashed "
+		"(flow %u)\n", i);
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+enum {ENCAP_VXLAN, ENCAP_GRE, ENCAP_GTPU, ENCAP_MPLS, ENCAP_QINQ,
+      ENCAP_COUNT};
+static const char *encap_name[ENCAP_COUNT] = {
+	"vxlan", "gre", "gtp-u", "mpls", "qinq"
+};
+/* bytes of the outer headers that pkt_hdr_hash() reads */
+static const uint32_t outer_len[ENCAP_COUNT] = {
+	14 + 20 + 4, 14 + 20, 14 + 20 + 4, 14, 14
+};
+/*---------------------------------------------------------------------*/
+static uint8_t *
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+	return p + 2;
+}
+/*---------------------------------------------------------------------*/
+/* outer IPv4 header between two fixed tunnel end points */
+static uint8_t *
+put_outer_ip(uint8_t *p, uint8_t proto)
+{
+	struct ip *iph = (struct ip *)p;
+
+	iph->ip_v = 4;
+	iph->ip_hl = 5;
+	iph->ip_p = proto;
+	iph->ip_src.s_addr = htonl(0x0A000001);
+	iph->ip_dst.s_addr = htonl(0x0A000002);
+	return p + sizeof(struct ip);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Wraps the IPv4 packet of the bare frame in (one of) the supported
+ * encapsulations. Returns the offset of the inner IPv4 header.
+ */
+static uint32_t
+build_tunnel_frame(unsigned char *frame, const unsigned char *bare, int encap)
+{
+	const uint8_t *inner = bare + sizeof(struct ether_header);
+	uint8_t *p = frame + 12;
+	int len = FRAME_LEN - sizeof(struct ether_header);
+
+	memset(frame, 0, TUNNEL_FRAME_LEN);
+	switch (encap) {
+	case ENCAP_VXLAN:
+		p = put16(p, ETHERTYPE_IP);
+		p = put_outer_ip(p, IPPROTO_UDP);
+		p = put16(p, 4789);		/* udp */
+		p = put16(p, VXLAN_PORT);
+		p += 4;
+		*p = 0x08;			/* vxlan: VNI valid */
+		p += 8;
+		p += 12;			/* inner ethernet */
+		p = put16(p, ETHERTYPE_IP);
+		break;
+	case ENCAP_GRE:
+		p = put16(p, ETHERTYPE_IP);
+		p = put_outer_ip(p, IPPROTO_GRE);
+		p = put16(p, 0x2000);		/* key present */
+		p = put16(p, ETHERTYPE_IP);
+		p += 4;
+		break;
+	case ENCAP_GTPU:
+		p = put16(p, ETHERTYPE_IP);
+		p = put_outer_ip(p, IPPROTO_UDP);
+		p = put16(p, GTPU_PORT);
+		p = put16(p, GTPU_PORT);
+		p += 4;
+		*p++ = 0x34;			/* v1, GTP, extension hdr */
+		*p++ = GTPU_GPDU;
+		p += 6;
+		p += 3;
+		*p++ = 0x85;			/* PDU session container */
+		*p++ = 1;
+		p += 2;
+		*p++ = 0;			/* no more extensions */
+		break;
+	case ENCAP_MPLS:
+		p = put16(p, ETHERTYPE_MPLS);
+		p += 4;				/* label, not bottom */
+		p[2] = 0x01;			/* bottom of stack */
+		p += 4;
+		break;
+	case ENCAP_QINQ:
+		p = put16(p, ETHERTYPE_QINQ);
+		p = put16(p, 100);
+		p = put16(p, ETHERTYPE_VLAN);
+		p = put16(p, 200);
+		p = put16(p, ETHERTYPE_IP);
+		break;
+	}
+	memcpy(p, inner, len);
+	return p - frame;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * pkt_inner_hdr_hash() of the first len bytes of frame, copied into a
+ * buffer without slack after the capture (memory checkers catch
+ * overreads)
+ */
+static int
+cut_hash(const unsigned char *frame, uint32_t len, uint32_t *h)
+{
+	unsigned char *cut = malloc(len);
+
+	if (cut == NULL)
+		return -1;
+	memcpy(cut, frame, len);
+	*h = pkt_inner_hdr_hash(cut, len, 4, 1);
+	free(cut);
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Cuts the tunnel frames of a few flows at every length past what
+ * pkt_hdr_hash() reads. The inner hash must be that of the bare flow
+ * once its ports are captured, that of its addresses once its IP
+ * header is, and the outer hash before. The same goes for IP options
+ * that put the ports past the capture.
+ */
+static int
+cut_tunnels(uint32_t *state)
+{
+	static unsigned char bare[FRAME_LEN], frame[TUNNEL_FRAME_LEN];
+	uint32_t i, l3, len, h, want;
+	tuple t;
+	int e;
+
+	for (i = 0; i < NUM_CUT_FLOWS; i++) {
+		t.sip = xorshift32(state);
+		t.dip = xorshift32(state);
+		t.sp = xorshift32(state) & 0xFFFF;
+		t.dp = xorshift32(state) & 0xFFFF;
+		build_frame(bare, &t);
+		for (e = 0; e < ENCAP_COUNT; e++) {
+			l3 = build_tunnel_frame(frame, bare, e);
+			for (len = outer_len[e]; len < TUNNEL_FRAME_LEN; len++) {
+				if (len >= l3 + sizeof(struct ip) + 4)
+					want = pkt_hdr_hash(bare, FRAME_LEN, 4, 1);
+				else if (len >= l3 + sizeof(struct ip))
+					want = pkt_hdr_hash(bare, FRAME_LEN, 2, 1);
+				else
+					want = pkt_hdr_hash(frame, len, 4, 1);
+				if (cut_hash(frame, len, &h) == -1)
+					return -1;
+				if (h != want)
+					goto bad;
+			}
+		}
+
+		/* 40 bytes of options and a UDP header past them */
+		bare[sizeof(struct ether_header)] = 0x4F;
+		bare[sizeof(struct ether_header) + 9] = IPPROTO_UDP;
+		e = ENCAP_QINQ;
+		l3 = build_tunnel_frame(frame, bare, e);
+		want = pkt_hdr_hash(bare, FRAME_LEN, 2, 1);
+		for (len = l3 + sizeof(struct ip); len < l3 + 60 + 4; len++) {
+			if (cut_hash(frame, len, &h) == -1)
+				return -1;
+			if (h != want)
+				goto bad;
+		}
+	}
+	return 0;
+
+ bad:
+	fprintf(stderr, "Inner %s hash of a frame cut at %u bytes is off "
+		"for flow %u\n", encap_name[e], len, i);
+	return -1;
+}
+/*---------------------------------------------------------------------*/
+static int
+tunnels(uint32_t *state)
+{
+	static unsigned char bare[FRAME_LEN], frame[TUNNEL_FRAME_LEN];
+	uint32_t inner[ENCAP_COUNT][PIPES], outer[ENCAP_COUNT][PIPES];
+	/* no slack after the capture: memory checkers catch overreads */
+	unsigned char *cut = malloc(GTPU_EXT_OFF + 1);
+	double ri, ro, ci, co;
+	tuple t;
+	uint32_t i;
+	int e;
+
+	if (cut == NULL)
+		return -1;
+	memset(inner, 0, sizeof(inner));
+	memset(outer, 0, sizeof(outer));
+	for (i = 0; i < NUM_TUNNEL_FLOWS; i++) {
+		t.sip = xorshift32(state);
+		t.dip = xorshift32(state);
+		t.sp = xorshift32(state) & 0xFFFF;
+		t.dp = xorshift32(state) & 0xFFFF;
+		build_frame(bare, &t);
+		for (e = 0; e < ENCAP_COUNT; e++) {
+			build_tunnel_frame(frame, bare, e);
+			if (pkt_inner_hdr_hash(frame, TUNNEL_FRAME_LEN, 4, 1) !=
+			    pkt_hdr_hash(bare, FRAME_LEN, 4, 1)) {
+				fprintf(stderr, "Inner %s hash differs for "
+					"flow %u\n", encap_name[e], i);
+				return -1;
+			}
+			inner[e][pkt_inner_hdr_hash(frame, TUNNEL_FRAME_LEN,
+						    4, 1) % PIPES]++;
+			outer[e][pkt_hdr_hash(frame, TUNNEL_FRAME_LEN,
+					      4, 1) % PIPES]++;
+			if (e != ENCAP_GTPU)
+				continue;
+			/* an extension header that runs off the frame, or
+			   off the capture, ends the walk at the outer header */
+			memcpy(cut, frame, GTPU_EXT_OFF + 1);
+			frame[GTPU_EXT_OFF] = 255;
+			if (pkt_inner_hdr_hash(frame, TUNNEL_FRAME_LEN, 4, 1) !=
+			    pkt_hdr_hash(frame, TUNNEL_FRAME_LEN, 4, 1) ||
+			    pkt_inner_hdr_hash(cut, GTPU_EXT_OFF + 1, 4, 1) !=
+			    pkt_hdr_hash(cut, GTPU_EXT_OFF + 1, 4, 1)) {
+				fprintf(stderr, "GTP-U extensions are walked "
+					"past the frame for flow %u\n", i);
+				free(cut);
+				return -1;
+			}
+		}
+	}
+	free(cut);
+
+	for (e = 0; e < ENCAP_COUNT; e++) {
+		ri = imbalance(inner[e], NUM_TUNNEL_FLOWS, &ci);
+		ro = imbalance(outer[e], NUM_TUNNEL_FLOWS, &co);
+		fprintf(stdout, "%-5s over %d pipes (max/mean, chi2): "
+			"inner %.3f %.1f, outer %.3f %.1f\n", encap_name[e],
+			PIPES, ri, ci, ro, co);
+		if (ri > MAX_IMBALANCE) {
+			fprintf(stderr, "Inner %s flows are unevenly spread\n",
+				encap_name[e]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	static tuple tuples[NUM_TUPLES];
+	static unsigned char frames[NUM_TUPLES][FRAME_LEN];
+	static unsigned char frames6[NUM_TUPLES][FRAME6_LEN];
+	static unsigned char vxlan[NUM_TUPLES][TUNNEL_FRAME_LEN];
+	uint64_t iters = DEFAULT_ITERS;
+	uint64_t i, start, legacy_cyc, table_cyc, pkt_cyc, pkt6_cyc, vxlan_cyc;
+	uint32_t state = 0x9e3779b9;
+	uint32_t sink = 0;
+	tuple *t;
+
+	if (argc > 1)
+		iters = strtoul(argv[1], NULL, 10);
+	if (iters == 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < NUM_TUPLES; i++) {
+		tuples[i].sip = xorshift32(&state);
+		tuples[i].dip = xorshift32(&state);
+		tuples[i].sp = xorshift32(&state) & 0xFFFF;
+		tuples[i].dp = xorshift32(&state) & 0xFFFF;
+		build_frame(frames[i], &tuples[i]);
+		build_tunnel_frame(vxlan[i], frames[i], ENCAP_VXLAN);
+	}
+	for (i = 0; i < NUM_TUPLES; i++) {
+		tuple6 t6;
+
+		make_ipv6_host(&t6.sip, 1, &state);
+		make_ipv6_host(&t6.dip, 2, &state);
+		t6.sp = xorshift32(&state) & 0xFFFF;
+		t6.dp = xorshift32(&state) & 0xFFFF;
+		build_frame6(frames6[i], &t6, 0);
+	}
+
+	if (ipv6_distribution(&state) == -1 || ipv6_bounds(&state) == -1 ||
+	    tunnels(&state) == -1 || cut_tunnels(&state) == -1)
+		return EXIT_FAILURE;
+
+	/* correctness: both variants must agree on every input */
+	for (i = 0; i < iters; i++) {
+		uint32_t sip = xorshift32(&state);
+		uint32_t dip = xorshift32(&state);
+		uint16_t sp = xorshift32(&state);
+		uint32_t dp = xorshift32(&state);
+		if (legacy_sym_hash_fn(sip, dip, sp, dp) !=
+		    sym_hash_fn(sip, dip, sp, dp)) {
+			fprintf(stderr, "Mismatch for %08x %08x %04x %08x\n",
+				sip, dip, sp, dp);
+			return EXIT_FAILURE;
+		}
+	}
+
+	start = read_cycles();
+	for (i = 0; i < iters; i++) {
+		t = &tuples[i & (NUM_TUPLES - 1)];
+		sink ^= legacy_sym_hash_fn(t->sip, t->dip, t->sp, t->dp);
+	}
+	legacy_cyc = read_cycles() - start;
+
+	start = read_cycles();
+	for (i = 0; i < iters; i++) {
+		t = &tuples[i & (NUM_TUPLES - 1)];
+		sink ^= sym_hash_fn(t->sip, t->dip, t->sp, t->dp);
+	}
+	table_cyc = read_cycles() - start;
+
+	start = read_cycles();
+	for (i = 0; i < iters; i++)
+		sink ^= pkt_hdr_hash(frames[i & (NUM_TUPLES - 1)], FRAME_LEN,
+				     4, 1);
+	pkt_cyc = read_cycles() - start;
+
+	start = read_cycles();
+	for (i = 0; i < iters; i++)
+		sink ^= pkt_hdr_hash(frames6[i & (NUM_TUPLES - 1)], FRAME6_LEN,
+				     4, 1);
+	pkt6_cyc = read_cycles() - start;
+
+	start = read_cycles();
+	for (i = 0; i < iters; i++)
+		sink ^= pkt_inner_hdr_hash(vxlan[i & (NUM_TUPLES - 1)],
+					   TUNNEL_FRAME_LEN, 4, 1);
+	vxlan_cyc = read_cycles() - start;
+
+	fprintf(stdout, "sym_hash_fn (bitwise)  : %.2f cycles/packet\n",
+		(double)legacy_cyc / iters);
+	fprintf(stdout, "sym_hash_fn (table)    : %.2f cycles/packet\n",
+		(double)table_cyc / iters);
+	fprintf(stdout, "pkt_hdr_hash (tcp/ipv4): %.2f cycles/packet\n",
+		(double)pkt_cyc / iters);
+	fprintf(stdout, "pkt_hdr_hash (tcp/ipv6): %.2f cycles/packet\n",
+		(double)pkt6_cyc / iters);
+	fprintf(stdout, "pkt_inner_hdr_hash (vxlan): %.2f cycles/packet\n",
+		(double)vxlan_cyc / iters);
+	fprintf(stdout, "(checksum: %08x)\n", sink);
+
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2014, Asim Jamshed, Robin Sommer, Seth Hall
+ * and the International Computer Science Institute. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * (1) Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * (2) Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the lookup tables of the LoadBalancer's weighted and
+ * consistent modes on pkt_hdr_hash() values of random TCP/IPv4 flows:
+ *
+ *	- consistent: the share of flows that change output when one of
+ *	  N outputs is removed or one is added (ideally 1/N), next to
+ *	  what plain (hash % N) moves;
+ *	- weighted, and consistent with weights: each output's share of
+ *	  the flows against its share of the total weight;
+ *	- failover: with a few outputs down, the share of each live
+ *	  output, consistent and modulo;
+ *	- sticky: the busiest of STICKY_OUTPUTS outputs against the mean
+ *	  under skewed traffic (flow k of F gets about k^-3/4 of the
+ *	  packets), next to modulo. No flow may change output, nor may
+ *	  two of the STICKY_FLOWS flows share a flow key (the no. that
+ *	  share a hash is shown for comparison).
+ *
+ * It fails if more than twice the ideal share of flows moves, if a
+ * flow fails over to an output that is down, if a share is off by
+ * more than MAX_SHARE_ERROR, or if sticky does not beat modulo under
+ * skew. It also reports
+ * cycles/packet of a table lookup.
+ *
+ * Usage: lb-bench [flows]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the hash function, the flow key and the lookup tables */
+#include "../src/pkt_hash.c"
+#include "../src/bricks_lb.c"
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_FLOWS		(1 << 20)
+#define OUTPUTS			48
+#define MAX_SHARE_ERROR		0.05	/* relative */
+#define NAME_LEN		16
+/* sticky mode: outputs, flows, packets and seconds of the trace */
+#define STICKY_OUTPUTS		16
+#define STICKY_FLOWS		(1 << 16)
+#define STICKY_PKTS		(1 << 22)
+#define STICKY_SECS		60
+/* outputs 5, 17 and 30 are down */
+#define DOWN			((1ULL << 5) | (1ULL << 17) | (1ULL << 30))
+/*---------------------------------------------------------------------*/
+/* pkt_hdr_hash() and (in *key) pkt_flow_key() of a random TCP/IPv4 flow */
+static uint32_t
+flow_hash(uint32_t *state, uint64_t *key)
+{
+	unsigned char frame[64];
+	struct ether_header *ethh = (struct ether_header *)frame;
+	struct ip *iph = (struct ip *)(ethh + 1);
+	struct tcphdr *tcph = (struct tcphdr *)(iph + 1);
+
+	memset(frame, 0, sizeof(frame));
+	ethh->ether_type = htons(ETHERTYPE_IP);
+	iph->ip_v = 4;
+	iph->ip_hl = 5;
+	iph->ip_p = IPPROTO_TCP;
+	iph->ip_src.s_addr = xorshift32(state);
+	iph->ip_dst.s_addr = xorshift32(state);
+	tcph->th_sport = xorshift32(state);
+	tcph->th_dport = xorshift32(state);
+	*key = pkt_flow_key(frame, sizeof(frame), 4);
+	return pkt_hdr_hash(frame, sizeof(frame), 4, 0);
+}
+/*---------------------------------------------------------------------*/
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+/*---------------------------------------------------------------------*/
+/* no. of the n values (sorted in place) that equal another one */
+static uint32_t
+shared(uint64_t *v, uint32_t n)
+{
+	uint32_t i, c = 0;
+
+	qsort(v, n, sizeof(uint64_t), cmp_u64);
+	for (i = 0; i < n; i++)
+		c += (i > 0 && v[i] == v[i - 1]) ||
+			(i + 1 < n && v[i] == v[i + 1]);
+	return c;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Share of the flows whose output (by name) differs between tables a
+ * (outputs na) and b (outputs nb)
+ */
+static double
+moved(const uint32_t *hash, uint32_t flows, const lb_table *a,
+      const char * const *na, const lb_table *b, const char * const *nb)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < flows; i++)
+		n += (strcmp(na[lb_table_pick(a, hash[i])],
+			     nb[lb_table_pick(b, hash[i])]) != 0);
+	return (double)n / flows;
+}
+/*---------------------------------------------------------------------*/
+/* largest relative error of the outputs' shares against their weights */
+static double
+share_error(const uint32_t *hash, uint32_t flows, const lb_table *t,
+	    const uint32_t *weight, uint32_t n)
+{
+	uint32_t load[OUTPUTS] = {0};
+	uint32_t i, total = 0;
+	double want, err, max = 0;
+
+	for (i = 0; i < flows; i++)
+		load[lb_table_pick(t, hash[i])]++;
+	for (i = 0; i < n; i++)
+		total += weight[i];
+	for (i = 0; i < n; i++) {
+		want = (double)flows * weight[i] / total;
+		err = (load[i] > want) ? load[i] - want : want - load[i];
+		if (err / want > max)
+			max = err / want;
+	}
+	return max;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Largest relative error of the live outputs' shares against an even
+ * split once the outputs in down are taken out of t (no slots:
+ * modulo), or -1 if a flow fails over to an output that is down
+ */
+static double
+failover_error(const uint32_t *hash, uint32_t flows, const lb_table *t,
+	       uint64_t down)
+{
+	uint32_t load[OUTPUTS] = {0};
+	uint32_t i, key, live = 0;
+	double want, err, max = 0;
+
+	for (i = 0; i < flows; i++) {
+		key = (t->slot == NULL) ? hash[i] % OUTPUTS :
+			lb_table_pick(t, hash[i]);
+		if ((down >> key) & 1) {
+			key = lb_failover(t, down, OUTPUTS, hash[i], key);
+			if ((down >> key) & 1)
+				return -1;
+		}
+		load[key]++;
+	}
+	for (i = 0; i < OUTPUTS; i++)
+		live += ((down >> i) & 1) == 0;
+	want = (double)flows / live;
+	for (i = 0; i < OUTPUTS; i++) {
+		if ((down >> i) & 1)
+			continue;
+		err = (load[i] > want) ? load[i] - want : want - load[i];
+		if (err / want > max)
+			max = err / want;
+	}
+	return max;
+}
+/*---------------------------------------------------------------------*/
+/* busiest output against the mean */
+static double
+imbalance(const uint32_t *load, uint32_t n)
+{
+	uint32_t i, max = 0;
+	uint64_t total = 0;
+
+	for (i = 0; i < n; i++) {
+		total += load[i];
+		if (load[i] > max)
+			max = load[i];
+	}
+	return (double)max * n / total;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Replays a skewed trace over the first STICKY_FLOWS flows through a
+ * sticky flow table (by key) and through modulo (by hash). Returns the no. of packets
+ * whose flow changed output (sticky), or -1 if the table can't be set
+ * up. Also takes down the output of the busiest flow at the end and
+ * checks that only its flows move.
+ */
+static int
+sticky(const uint64_t *key, const uint32_t *hash, double *st, double *mod,
+       double *cyc)
+{
+	uint32_t st_load[STICKY_OUTPUTS] = {0}, mod_load[STICKY_OUTPUTS] = {0};
+	uint32_t state = 0x2545f491, i, f, k, moves = 0;
+	uint32_t *pkt;
+	uint8_t *first, *out;
+	uint64_t start;
+	lb_flows flows;
+	double u;
+
+	pkt = calloc(STICKY_PKTS, sizeof(uint32_t));
+	out = malloc(STICKY_PKTS);
+	first = malloc(STICKY_FLOWS);
+	if (pkt == NULL || out == NULL || first == NULL ||
+	    lb_flows_init(&flows, STICKY_FLOWS, STICKY_SECS * 2) == -1) {
+		free(pkt);
+		free(out);
+		free(first);
+		return -1;
+	}
+	memset(first, 0xFF, STICKY_FLOWS);
+	for (i = 0; i < STICKY_PKTS; i++) {
+		u = (double)xorshift32(&state) / 4294967296.0;
+		pkt[i] = (uint32_t)(STICKY_FLOWS * u * u * u * u);
+	}
+
+	/* bursts as lb_process_batch() handles them */
+	start = read_cycles();
+	for (i = 0; i < STICKY_PKTS; i += LB_FLOW_BATCH) {
+		lb_flows_tick(&flows, (uint64_t)i * STICKY_SECS / STICKY_PKTS);
+		for (k = i; k < i + LB_FLOW_BATCH; k++)
+			lb_flows_prefetch(&flows, key[pkt[k]]);
+		for (k = i; k < i + LB_FLOW_BATCH; k++)
+			out[k] = lb_flows_pick(&flows, key[pkt[k]],
+					       STICKY_OUTPUTS, 0, NULL);
+	}
+	*cyc = (double)(read_cycles() - start) / STICKY_PKTS;
+
+	for (i = 0; i < STICKY_PKTS; i++) {
+		f = pkt[i];
+		if (first[f] == 0xFF)
+			first[f] = out[i];
+		moves += (first[f] != out[i]);
+		st_load[out[i]]++;
+		mod_load[hash[f] % STICKY_OUTPUTS]++;
+	}
+	*st = imbalance(st_load, STICKY_OUTPUTS);
+	*mod = imbalance(mod_load, STICKY_OUTPUTS);
+
+	/* the busiest flow's output goes down */
+	k = first[0];
+	for (f = 0; f < STICKY_FLOWS; f++) {
+		if (first[f] == 0xFF)
+			continue;
+		i = lb_flows_pick(&flows, key[f], STICKY_OUTPUTS,
+				  1ULL << k, NULL);
+		moves += (first[f] == k) ? (i == k) : (i != first[f]);
+	}
+
+	lb_flows_free(&flows);
+	free(pkt);
+	free(out);
+	free(first);
+	return moves;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	static char names[OUTPUTS + 1][NAME_LEN];
+	const char *all[OUTPUTS + 1], *less[OUTPUTS];
+	uint32_t weight[OUTPUTS];
+	uint32_t flows = DEFAULT_FLOWS;
+	uint32_t state = 0x9e3779b9;
+	uint32_t *hash, i, n, sink = 0, hash_shared, key_shared;
+	uint64_t *key, *tmp, k;
+	double rm, add, mod_rm, wt, cwt, fo, mod_fo, st, st_mod, st_cyc;
+	int st_moves;
+	lb_table t_all, t_less, t_more, t_w, t_cw, t_mod = {NULL, 0};
+	uint64_t start, cyc;
+
+	if (argc > 1)
+		flows = strtoul(argv[1], NULL, 10);
+	hash = calloc(flows, sizeof(uint32_t));
+	key = calloc(STICKY_FLOWS, sizeof(uint64_t));
+	tmp = calloc(STICKY_FLOWS, sizeof(uint64_t));
+	if (flows < STICKY_FLOWS || hash == NULL || key == NULL ||
+	    tmp == NULL) {
+		fprintf(stderr, "Usage: %s [flows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < flows; i++) {
+		hash[i] = flow_hash(&state, &k);
+		if (i < STICKY_FLOWS)
+			key[i] = k;
+	}
+	for (i = 0; i < STICKY_FLOWS; i++)
+		tmp[i] = hash[i];
+	hash_shared = shared(tmp, STICKY_FLOWS);
+	memcpy(tmp, key, STICKY_FLOWS * sizeof(uint64_t));
+	key_shared = shared(tmp, STICKY_FLOWS);
+	free(tmp);
+
+	/* netmap pipes as connect_outputs("eth3", 49) would name them */
+	for (i = 0; i <= OUTPUTS; i++) {
+		snprintf(names[i], NAME_LEN, "eth3{%u", i);
+		all[i] = names[i];
+	}
+	/* the same outputs without a middle one */
+	for (i = 0, n = 0; i < OUTPUTS; i++)
+		if (i != OUTPUTS / 3)
+			less[n++] = names[i];
+	/* 4:2:1:1 ... */
+	for (i = 0; i < OUTPUTS; i++)
+		weight[i] = (i == 0) ? 4 : (i == 1) ? 2 : 1;
+
+	if (lb_table_consistent(&t_all, all, NULL, OUTPUTS) == -1 ||
+	    lb_table_consistent(&t_less, less, NULL, OUTPUTS - 1) == -1 ||
+	    lb_table_consistent(&t_more, all, NULL, OUTPUTS + 1) == -1 ||
+	    lb_table_weighted(&t_w, weight, OUTPUTS) == -1 ||
+	    lb_table_consistent(&t_cw, all, weight, OUTPUTS) == -1) {
+		fprintf(stderr, "Can't build the tables\n");
+		return EXIT_FAILURE;
+	}
+
+	rm = moved(hash, flows, &t_all, all, &t_less, less);
+	add = moved(hash, flows, &t_all, all, &t_more, all);
+	for (i = 0, n = 0; i < flows; i++)
+		n += (hash[i] % OUTPUTS != hash[i] % (OUTPUTS + 1));
+	mod_rm = (double)n / flows;
+	wt = share_error(hash, flows, &t_w, weight, OUTPUTS);
+	cwt = share_error(hash, flows, &t_cw, weight, OUTPUTS);
+	fo = failover_error(hash, flows, &t_all, DOWN);
+	mod_fo = failover_error(hash, flows, &t_mod, DOWN);
+	st_moves = sticky(key, hash, &st, &st_mod, &st_cyc);
+	if (st_moves == -1) {
+		fprintf(stderr, "Can't set up the flow table\n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "consistent: %.1f%% of flows move when 1 of %d "
+		"outputs goes, %.1f%% when one is added (ideal: %.1f%%)\n",
+		100 * rm, OUTPUTS, 100 * add, 100.0 / OUTPUTS);
+	fprintf(stdout, "modulo    : %.1f%% of flows move when one is added\n",
+		100 * mod_rm);
+	fprintf(stdout, "weighted  : max. share error %.1f%%, consistent "
+		"weighted: %.1f%%\n", 100 * wt, 100 * cwt);
+	fprintf(stdout, "failover  : max. share error %.1f%% with 3 of %d "
+		"outputs down, modulo: %.1f%%\n", 100 * fo, OUTPUTS,
+		100 * mod_fo);
+	fprintf(stdout, "sticky    : busiest of %d outputs at %.2fx the mean "
+		"under skew (modulo: %.2fx), %d pkts moved, %.2f "
+		"cycles/packet\n", STICKY_OUTPUTS, st, st_mod, st_moves,
+		st_cyc);
+	fprintf(stdout, "flow keys : %u of %d flows share a key, %u share "
+		"a hash\n", key_shared, STICKY_FLOWS, hash_shared);
+
+	start = read_cycles();
+	for (i = 0; i < flows; i++)
+		sink += lb_table_pick(&t_all, hash[i]);
+	cyc = read_cycles() - start;
+	fprintf(stdout, "table lookup: %.2f cycles/packet (checksum: %08x)\n",
+		(double)cyc / flows, sink);
+
+	lb_table_free(&t_all);
+	lb_table_free(&t_less);
+	lb_table_free(&t_more);
+	lb_table_free(&t_w);
+	lb_table_free(&t_cw);
+	free(hash);
+	free(key);
+
+	if (rm > 2.0 / OUTPUTS || add > 2.0 / (OUTPUTS + 1)) {
+		fprintf(stderr, "Too many flows move\n");
+		return EXIT_FAILURE;
+	}
+	if (fo < 0 || mod_fo < 0) {
+		fprintf(stderr, "Flows failed over to an output that is down\n");
+		return EXIT_FAILURE;
+	}
+	if (st_moves != 0 || st >= st_mod) {
+		fprintf(stderr, "Sticky flows moved or were not spread\n");
+		return EXIT_FAILURE;
+	}
+	if (key_shared != 0) {
+		fprintf(stderr, "Sticky flows share a key\n");
+		return EXIT_FAILURE;
+	}
+	if (wt > MAX_SHARE_ERROR || cwt > MAX_SHARE_ERROR ||
+	    fo > MAX_SHARE_ERROR || mod_fo > MAX_SHARE_ERROR) {
+		fprintf(stderr, "Shares do not follow the weights\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,258 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the longest prefix match tables of the filter brick against
+ * a brute-force longest match over the same prefixes:
+ *
+ *	- random IPv4 and IPv6 prefixes around a few base addresses, so
+ *	  that many of them nest, including /0 and /32 (/128) and, for
+ *	  IPv4, /24s with /25+ prefixes in and next to them (tbl8 groups
+ *	  made before and after their /24);
+ *	- the prefix found for an address, and the chain of shorter
+ *	  covering prefixes that ->parent links to, halfway through the
+ *	  insertions and after all of them.
+ *
+ * It also reports cycles/lookup of lpm4_lookup() and lpm6_lookup().
+ *
+ * Usage: lpm-bench [prefixes]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the lpm tables */
+#include "../src/bricks_lpm.c"
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_PREFIXES	2000
+#define NUM_BASES		8
+#define NUM_LOOKUPS		5000
+/*---------------------------------------------------------------------*/
+typedef struct test_prefix {
+	uint8_t addr[16];			/* host bits cleared */
+	uint8_t len;
+	lpm_prefix *p;				/* what lpm*_insert() returned */
+} test_prefix;
+/*---------------------------------------------------------------------*/
+static void
+random_bytes(uint32_t *state, uint8_t *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		b[i] = xorshift32(state);
+}
+/*---------------------------------------------------------------------*/
+/* clears the bits of a (bits long) past len */
+static void
+mask_addr(uint8_t *a, uint8_t len, uint8_t bits)
+{
+	uint8_t i;
+
+	for (i = len; i < bits; i++)
+		a[i >> 3] &= ~(0x80 >> (i & 7));
+}
+/*---------------------------------------------------------------------*/
+/* sets the bits of a (bits long) from i on to random values */
+static void
+randomize_from(uint32_t *state, uint8_t *a, uint8_t i, uint8_t bits)
+{
+	for (; i < bits; i++) {
+		if (xorshift32(state) & 1)
+			a[i >> 3] ^= 0x80 >> (i & 7);
+	}
+}
+/*---------------------------------------------------------------------*/
+static int
+covers(const test_prefix *t, const uint8_t *a)
+{
+	uint8_t i;
+
+	for (i = 0; i < t->len; i++) {
+		if ((t->addr[i >> 3] ^ a[i >> 3]) & (0x80 >> (i & 7)))
+			return 0;
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------*/
+/* longest of the first n prefixes covering a, shorter than below */
+static const test_prefix *
+brute_force(const test_prefix *t, uint32_t n, const uint8_t *a, int below)
+{
+	const test_prefix *best = NULL;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		if (t[i].len < below && (best == NULL || t[i].len > best->len) &&
+		    covers(&t[i], a))
+			best = &t[i];
+	}
+	return best;
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Random prefixes (bits long addresses): each one starts out as one of
+ * bases, with random bits past a random point
+ */
+static void
+make_prefixes(uint32_t *state, test_prefix *t, uint32_t n, uint8_t bits)
+{
+	uint8_t bases[NUM_BASES][16];
+	uint32_t i, b, r;
+
+	for (b = 0; b < NUM_BASES; b++)
+		random_bytes(state, bases[b], 16);
+	for (i = 0; i < n; i++) {
+		b = xorshift32(state) % NUM_BASES;
+		memcpy(t[i].addr, bases[b], 16);
+		r = xorshift32(state);
+		switch (r & 7) {
+		case 0:
+			/* and the extremes */
+			t[i].len = (r & 8) ? bits : 0;
+			break;
+		case 1:
+		case 2:
+			/* IPv4: a /24 group split up */
+			t[i].len = (bits == 32) ? 24 + (r >> 8) % 9 :
+				(r >> 8) % (bits + 1);
+			break;
+		default:
+			t[i].len = (r >> 8) % (bits + 1);
+			break;
+		}
+		/* keep some prefixes of a base apart past their /24 */
+		randomize_from(state, t[i].addr, (bits == 32 && (r & 16)) ? 24 :
+			       (r >> 16) % (bits + 1), bits);
+		mask_addr(t[i].addr, t[i].len, 128);
+	}
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Looks up addresses in and next to the first n prefixes. Returns the
+ * no. of mismatches.
+ */
+static uint32_t
+check(uint32_t *state, const void *tbl, int v6, test_prefix *t, uint32_t n)
+{
+	const test_prefix *want;
+	uint8_t bits = (v6) ? 128 : 32;
+	uint8_t a[16];
+	lpm_prefix *got;
+	uint32_t i, a4, fail = 0;
+
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		memcpy(a, t[xorshift32(state) % n].addr, 16);
+		if (i & 1)
+			randomize_from(state, a, 0, bits);
+		else
+			randomize_from(state, a, xorshift32(state) % (bits + 1), bits);
+		mask_addr(a, bits, 128);
+
+		if (v6) {
+			got = lpm6_lookup((const lpm6 *)tbl, a);
+		} else {
+			memcpy(&a4, a, 4);
+			got = lpm4_lookup((const lpm4 *)tbl, a4);
+		}
+		/* the result and all of its covering prefixes */
+		want = brute_force(t, n, a, bits + 1);
+		while (want != NULL && got == want->p) {
+			got = got->parent;
+			want = brute_force(t, n, a, want->len);
+		}
+		if (want != NULL || got != NULL)
+			fail++;
+	}
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/* inserts all n prefixes, checking halfway and at the end */
+static uint32_t
+run(uint32_t *state, int v6, test_prefix *t, uint32_t n)
+{
+	lpm4 t4;
+	lpm6 t6;
+	uint32_t i, j, a4, dups = 0, fail = 0;
+	uint64_t start, cyc;
+
+	memset(&t4, 0, sizeof(t4));
+	memset(&t6, 0, sizeof(t6));
+	make_prefixes(state, t, n, (v6) ? 128 : 32);
+	for (i = 0; i < n; i++) {
+		if (v6) {
+			t[i].p = lpm6_insert(&t6, t[i].addr, t[i].len);
+		} else {
+			memcpy(&a4, t[i].addr, 4);
+			t[i].p = lpm4_insert(&t4, a4, t[i].len);
+		}
+		if (t[i].p == NULL) {
+			fprintf(stderr, "Can't insert a prefix\n");
+			exit(EXIT_FAILURE);
+		}
+		/* duplicates share their prefix */
+		for (j = 0; j < i; j++) {
+			if (t[j].len == t[i].len &&
+			    !memcmp(t[j].addr, t[i].addr, 16) && t[j].p != t[i].p)
+				dups++;
+		}
+		if (i + 1 == n / 2 || i + 1 == n)
+			fail += check(state, (v6) ? (void *)&t6 : (void *)&t4,
+				      v6, t, i + 1);
+	}
+
+	start = read_cycles();
+	for (i = 0; i < n; i++) {
+		if (v6) {
+			fail += (lpm6_lookup(&t6, t[i].addr) == NULL);
+		} else {
+			memcpy(&a4, t[i].addr, 4);
+			fail += (lpm4_lookup(&t4, a4) == NULL);
+		}
+	}
+	cyc = read_cycles() - start;
+
+	if (dups != 0) {
+		fprintf(stderr, "%u duplicate prefixes were added\n", dups);
+		fail += dups;
+	}
+	if (v6)
+		fprintf(stdout, "lpm6: %u prefixes: ", t6.count);
+	else
+		fprintf(stdout, "lpm4: %u prefixes (%u tbl8 groups): ",
+			t4.count + (t4.def != NULL), t4.tbl8_used);
+	fprintf(stdout, "%u mismatches, %.2f cycles/lookup\n", fail,
+		(double)cyc / n);
+	lpm4_free(&t4, NULL);
+	lpm6_free(&t6, NULL);
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t n = DEFAULT_PREFIXES, state = 0x9e3779b9;
+	test_prefix *t;
+	uint32_t fail;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 10);
+	t = calloc(n, sizeof(test_prefix));
+	if (n < 2 || t == NULL) {
+		fprintf(stderr, "Usage: %s [prefixes]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fail = run(&state, 0, t, n);
+	fail += run(&state, 1, t, n);
+	free(t);
+
+	if (fail != 0) {
+		fprintf(stderr, "Lookups differ from the longest match\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,200 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the token buckets of the RateLimiter brick on a simulated
+ * clock:
+ *
+ *	- offered twice its pps (bps) limit, a bucket lets through the
+ *	  limit plus its burst, and not a packet (byte) more;
+ *	- offered less than its limit, it holds nothing back;
+ *	- a packet held back by the link bucket does not use up its
+ *	  flow's bucket;
+ *	- rl_clock_hz() agrees with CLOCK_MONOTONIC.
+ *
+ * It also reports cycles/packet of a flow and a link limit, with the
+ * clock read once per burst as the brick does.
+ *
+ * Usage: ratelimit-bench [flows]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the token buckets */
+#include "../src/bricks_ratelimit.c"
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_FLOWS		50000
+#define PKTS			(1 << 22)
+/* simulated clock: nsecs */
+#define HZ			1000000000ULL
+#define SECS			10
+#define MIN_LEN			64
+#define MAX_LEN			1500
+/*---------------------------------------------------------------------*/
+/**
+ * Offers (load) times the pps limit (pps != 0) or the bps limit of r
+ * to a fresh bucket for SECS secs, in packets of random sizes. Returns
+ * what got through and stores what was offered in *offered, in pkts
+ * or bytes.
+ */
+static uint64_t
+offer(const rl_rate *r, uint64_t pps, uint64_t bps, double load,
+      uint64_t *offered)
+{
+	uint32_t state = 0x9e3779b9, len;
+	uint64_t now = 0, passed = 0, gap;
+	rl_bucket b, next;
+
+	memset(&b, 0, sizeof(b));
+	*offered = 0;
+	/* average frame: (MIN_LEN + MAX_LEN) / 2 */
+	gap = (pps != 0) ? HZ / (pps * load) :
+		HZ * 8 * (MIN_LEN + MAX_LEN) / 2 / (bps * load);
+	for (now = 0; now < SECS * HZ; now += gap) {
+		len = MIN_LEN + xorshift32(&state) % (MAX_LEN - MIN_LEN + 1);
+		*offered += (pps != 0) ? 1 : len;
+		if (rl_take(r, &b, now, len, &next)) {
+			b = next;
+			passed += (pps != 0) ? 1 : len;
+		}
+	}
+	return passed;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_rates(void)
+{
+	const uint64_t pps = 100000, bps = 100000000;
+	uint64_t got, want, offered;
+	rl_rate r;
+	int fail = 0;
+
+	/* pps: the limit, plus a burst of 10 msecs (and the first pkt) */
+	rl_rate_init(&r, HZ, pps, 0, 10);
+	got = offer(&r, pps, 0, 2.0, &offered);
+	want = pps * SECS + pps / 100 + 1;
+	fprintf(stdout, "%llu pps limit, 2x offered: %llu pkts through in "
+		"%u secs (%llu expected)\n", (unsigned long long)pps,
+		(unsigned long long)got, SECS, (unsigned long long)want);
+	fail += (got > want || got + 2 < want);
+	fail += (offer(&r, pps, 0, 0.9, &offered) != offered);
+
+	/* bps: up to one frame over the limit and burst */
+	rl_rate_init(&r, HZ, 0, bps, 10);
+	got = offer(&r, 0, bps, 2.0, &offered);
+	want = bps / 8 * SECS + bps / 8 / 100;
+	fprintf(stdout, "%llu bps limit, 2x offered: %llu bytes through in "
+		"%u secs (%llu expected)\n", (unsigned long long)bps,
+		(unsigned long long)got, SECS, (unsigned long long)want);
+	fail += (got > want + MAX_LEN || got + 2 * MAX_LEN < want);
+	fail += (offer(&r, 0, bps, 0.9, &offered) != offered);
+
+	/* a bucket that says no is left alone */
+	{
+		rl_bucket flow, link, nf, nl;
+		rl_rate fr, lr;
+		int i, passed = 0;
+
+		rl_rate_init(&fr, HZ, 10, 0, 1000);
+		rl_rate_init(&lr, HZ, 1, 0, 1);
+		memset(&flow, 0, sizeof(flow));
+		memset(&link, 0, sizeof(link));
+		for (i = 0; i < 5; i++) {
+			if (rl_take(&fr, &flow, 0, MIN_LEN, &nf) &&
+			    rl_take(&lr, &link, 0, MIN_LEN, &nl)) {
+				flow = nf;
+				link = nl;
+				passed++;
+			}
+		}
+		/* link took one; the flow was charged for that one only */
+		fail += (passed != 1 || flow.pkt_tat != HZ / 10);
+	}
+
+	if (fail != 0)
+		fprintf(stderr, "Buckets are off their limits\n");
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_clock(void)
+{
+	struct timespec t0, t1, nap = {0, 100000000L};
+	uint64_t hz = rl_clock_hz(), c0, c1, ns;
+	double err;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c0 = read_cycles();
+	nanosleep(&nap, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c1 = read_cycles();
+	ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+		t1.tv_nsec - t0.tv_nsec;
+	err = ((double)(c1 - c0) / hz * 1e9 - ns) / ns;
+	fprintf(stdout, "clock: %.3f GHz, %+.3f%% off CLOCK_MONOTONIC\n",
+		hz / 1e9, 100.0 * err);
+	if (err > 0.01 || err < -0.01) {
+		fprintf(stderr, "rl_clock_hz() is off\n");
+		return 1;
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t flows = DEFAULT_FLOWS, state = 0x9e3779b9;
+	uint32_t i, k, c, *flow, len = MAX_LEN, passed = 0;
+	uint64_t hz, now, start, cyc;
+	rl_bucket *fb, link, nf, nl;
+	rl_rate fr, lr;
+	int fail;
+
+	if (argc > 1)
+		flows = strtoul(argv[1], NULL, 10);
+	flow = calloc(PKTS, sizeof(uint32_t));
+	fb = calloc(RL_FLOW_BUCKETS, sizeof(rl_bucket));
+	if (flows == 0 || flow == NULL || fb == NULL) {
+		fprintf(stderr, "Usage: %s [flows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fail = check_rates() + check_clock();
+
+	/* flow buckets of random flows, one link, on the real clock */
+	for (i = 0; i < PKTS; i++)
+		flow[i] = (xorshift32(&state) % flows) & (RL_FLOW_BUCKETS - 1);
+	hz = rl_clock_hz();
+	rl_rate_init(&fr, hz, 1000, 8000000, 0);
+	rl_rate_init(&lr, hz, 1000000, 10000000000ULL, 0);
+	memset(&link, 0, sizeof(link));
+	start = read_cycles();
+	for (i = 0; i < PKTS; i += c) {
+		c = (PKTS - i < RL_BATCH) ? PKTS - i : RL_BATCH;
+		now = read_cycles();
+		for (k = 0; k < c; k++)
+			__builtin_prefetch(&fb[flow[i + k]]);
+		for (k = 0; k < c; k++) {
+			if (rl_take(&fr, &fb[flow[i + k]], now, len, &nf) &&
+			    rl_take(&lr, &link, now, len, &nl)) {
+				fb[flow[i + k]] = nf;
+				link = nl;
+				passed++;
+			}
+		}
+	}
+	cyc = read_cycles() - start;
+	fprintf(stdout, "flow + link buckets: %.2f cycles/packet (%u flows, "
+		"%u of %u pkts through)\n", (double)cyc / PKTS, flows, passed,
+		PKTS);
+
+	free(fb);
+	free(flow);
+	return (fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*---------------------------------------------------------------------*/
@@ -0,0 +1,274 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the flow table of the Shunt brick:
+ *
+ *	- both directions of a connection (IPv4, IPv6, VLAN) share a
+ *	  key, different connections do not, and split mode 2 only
+ *	  looks at the addresses;
+ *	- a flow is cut off right after the packet that reaches the
+ *	  byte (or packet) cutoff, and starts over once it idled;
+ *	- on a mix of heavy-tailed flows, no flow is cut off before it
+ *	  reached the cutoff, and how much of the volume gets cut.
+ *
+ * It also reports cycles/packet (key extraction included), with the
+ * buckets of a burst prefetched as the brick does.
+ *
+ * Usage: shunt-bench [flows]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the shunt table and its key extraction */
+#include "../src/pkt_hash.c"
+#include "../src/bricks_shunt.c"
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_FLOWS		50000
+#define ETH_HLEN		14
+#define FRAME_LEN		64
+#define PKT_LEN			1500
+#define CUTOFF			(1 << 20)
+/* flow sizes (pkts) are Pareto distributed (alpha = 1), capped at
+   MAX_FLOW_PKTS */
+#define MIN_FLOW_PKTS		2
+#define MAX_FLOW_PKTS		(1 << 16)
+/*---------------------------------------------------------------------*/
+/**
+ * TCP frame of PKT_LEN bytes from (saddr, sp) to (daddr, dp), tagged
+ * with VLAN 7 if vlan. Addresses are 4 (IPv4) or 16 (IPv6) bytes.
+ */
+static void
+build_frame(uint8_t *f, int v6, int vlan, const uint8_t *saddr,
+	    const uint8_t *daddr, uint16_t sp, uint16_t dp)
+{
+	uint8_t *l3 = f + ETH_HLEN;
+	uint8_t *l4;
+	uint16_t type = v6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP;
+	uint16_t l3len = PKT_LEN - ETH_HLEN;
+
+	memset(f, 0, FRAME_LEN);
+	if (vlan) {
+		f[12] = ETHERTYPE_VLAN >> 8;
+		f[13] = ETHERTYPE_VLAN & 0xFF;
+		l3[1] = 7;
+		l3[2] = type >> 8;
+		l3[3] = type & 0xFF;
+		l3 += 4;
+		l3len -= 4;
+	} else {
+		f[12] = type >> 8;
+		f[13] = type & 0xFF;
+	}
+	if (v6) {
+		l3[0] = 0x60;
+		l3[4] = (l3len - IPV6_HDR_LEN) >> 8;
+		l3[5] = (l3len - IPV6_HDR_LEN) & 0xFF;
+		l3[6] = IPPROTO_TCP;
+		memcpy(l3 + 8, saddr, 16);
+		memcpy(l3 + 24, daddr, 16);
+		l4 = l3 + IPV6_HDR_LEN;
+	} else {
+		l3[0] = 0x45;
+		l3[2] = l3len >> 8;
+		l3[3] = l3len & 0xFF;
+		l3[9] = IPPROTO_TCP;
+		memcpy(l3 + 12, saddr, 4);
+		memcpy(l3 + 16, daddr, 4);
+		l4 = l3 + 20;
+	}
+	l4[0] = sp >> 8;
+	l4[1] = sp & 0xFF;
+	l4[2] = dp >> 8;
+	l4[3] = dp & 0xFF;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_keys(void)
+{
+	static const uint8_t a4[4] = {10, 0, 0, 1}, b4[4] = {10, 0, 0, 2};
+	uint8_t a6[16] = {0x20, 0x01, 0x0d, 0xb8}, b6[16] = {0x20, 0x01};
+	uint8_t fwd[FRAME_LEN], rev[FRAME_LEN], other[FRAME_LEN];
+	int v6, vlan, fail = 0;
+	const uint8_t *sa, *da;
+
+	a6[15] = 1;
+	b6[15] = 2;
+	for (v6 = 0; v6 < 2; v6++) {
+		for (vlan = 0; vlan < 2; vlan++) {
+			sa = v6 ? a6 : a4;
+			da = v6 ? b6 : b4;
+			build_frame(fwd, v6, vlan, sa, da, 40000, 80);
+			build_frame(rev, v6, vlan, da, sa, 80, 40000);
+			build_frame(other, v6, vlan, sa, da, 40001, 80);
+			if (pkt_flow_key(fwd, FRAME_LEN, 4) !=
+			    pkt_flow_key(rev, FRAME_LEN, 4)) {
+				fprintf(stderr, "%s%s: directions differ\n",
+					v6 ? "IPv6" : "IPv4", vlan ? "/VLAN" : "");
+				fail++;
+			}
+			if (pkt_flow_key(fwd, FRAME_LEN, 4) ==
+			    pkt_flow_key(other, FRAME_LEN, 4) ||
+			    pkt_flow_key(fwd, FRAME_LEN, 2) !=
+			    pkt_flow_key(other, FRAME_LEN, 2)) {
+				fprintf(stderr, "%s%s: split modes are off\n",
+					v6 ? "IPv6" : "IPv4", vlan ? "/VLAN" : "");
+				fail++;
+			}
+		}
+	}
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static int
+check_cutoff(void)
+{
+	shunt_table t;
+	uint32_t i, passed;
+	int fail = 0;
+
+	/* bytes: the packet that reaches the cutoff still goes through */
+	if (shunt_table_init(&t, 16, 10 * PKT_LEN - 1, 0, 5) == -1)
+		return 1;
+	for (i = 0, passed = 0; i < 20; i++)
+		passed += !shunt_table_account(&t, 42, PKT_LEN);
+	fail += (passed != 10);
+	/* an idle flow starts over */
+	shunt_table_tick(&t, 5);
+	fail += (shunt_table_account(&t, 42, PKT_LEN) != 1);
+	shunt_table_tick(&t, 11);
+	fail += (shunt_table_account(&t, 42, PKT_LEN) != 0);
+	shunt_table_free(&t);
+
+	/* packets */
+	if (shunt_table_init(&t, 16, 0, 3, 0) == -1)
+		return fail + 1;
+	for (i = 0, passed = 0; i < 10; i++)
+		passed += !shunt_table_account(&t, 42, 1);
+	fail += (passed != 3);
+	shunt_table_free(&t);
+
+	if (fail != 0)
+		fprintf(stderr, "Flows are not cut off at the cutoff\n");
+	return fail;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t flows = DEFAULT_FLOWS, state = 0x9e3779b9;
+	uint32_t i, j, k, n, c, tmp, npkts = 0;
+	uint32_t *size, *pkt, *passed, early = 0, late = 0, want;
+	uint64_t key[SHUNT_BATCH], bytes = 0, cut = 0, start, cyc;
+	uint8_t (*frame)[2][FRAME_LEN];
+	uint8_t sa[4], da[4];
+	shunt_table t;
+	double u;
+	int fail;
+
+	if (argc > 1)
+		flows = strtoul(argv[1], NULL, 10);
+	size = calloc(flows, sizeof(uint32_t));
+	passed = calloc(flows, sizeof(uint32_t));
+	frame = calloc(flows, sizeof(*frame));
+	if (flows == 0 || size == NULL || passed == NULL || frame == NULL) {
+		fprintf(stderr, "Usage: %s [flows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fail = check_keys() + check_cutoff();
+
+	/* flows of Pareto distributed sizes, random directions */
+	for (i = 0; i < flows; i++) {
+		u = ((double)xorshift32(&state) + 1) / 4294967296.0;
+		u = MIN_FLOW_PKTS / u;
+		size[i] = (u < MAX_FLOW_PKTS) ? (uint32_t)u : MAX_FLOW_PKTS;
+		npkts += size[i];
+		tmp = xorshift32(&state);
+		memcpy(sa, &tmp, 4);
+		tmp = xorshift32(&state);
+		memcpy(da, &tmp, 4);
+		tmp = xorshift32(&state);
+		build_frame(frame[i][0], 0, 0, sa, da, tmp, tmp >> 16);
+		build_frame(frame[i][1], 0, 0, da, sa, tmp >> 16, tmp);
+	}
+	/* interleave their packets at random */
+	pkt = calloc(npkts, sizeof(uint32_t));
+	if (pkt == NULL) {
+		fprintf(stderr, "Can't allocate %u packets\n", npkts);
+		return EXIT_FAILURE;
+	}
+	for (i = 0, k = 0; i < flows; i++)
+		for (j = 0; j < size[i]; j++)
+			pkt[k++] = i;
+	for (i = npkts - 1; i > 0; i--) {
+		j = xorshift32(&state) % (i + 1);
+		tmp = pkt[i];
+		pkt[i] = pkt[j];
+		pkt[j] = tmp;
+	}
+
+	if (shunt_table_init(&t, 0, CUTOFF, 0, 0) == -1) {
+		fprintf(stderr, "Can't set up the shunt table\n");
+		return EXIT_FAILURE;
+	}
+	/* bursts as shunt_process_batch() handles them */
+	start = read_cycles();
+	for (i = 0; i < npkts; i += c) {
+		c = (npkts - i < SHUNT_BATCH) ? npkts - i : SHUNT_BATCH;
+		for (k = 0; k < c; k++) {
+			if (i + k + 1 < npkts)
+				__builtin_prefetch(frame[pkt[i + k + 1]]
+						   [(i + k + 1) & 1]);
+			n = pkt[i + k];
+			key[k] = pkt_flow_key(frame[n][(i + k) & 1],
+					      FRAME_LEN, 4);
+			shunt_table_prefetch(&t, key[k]);
+		}
+		for (k = 0; k < c; k++) {
+			/* the brick is handed the captured length: here,
+			   whole frames of PKT_LEN bytes */
+			if (shunt_table_account(&t, key[k], PKT_LEN) == 0)
+				passed[pkt[i + k]]++;
+			else
+				cut += PKT_LEN;
+			bytes += PKT_LEN;
+		}
+	}
+	cyc = read_cycles() - start;
+
+	/* a flow gets (CUTOFF / PKT_LEN) + 1 pkts through, more if it
+	   was evicted in between, never less */
+	for (i = 0; i < flows; i++) {
+		want = (size[i] < CUTOFF / PKT_LEN + 1) ? size[i] :
+			CUTOFF / PKT_LEN + 1;
+		early += (passed[i] < want);
+		late += (passed[i] > want);
+	}
+
+	fprintf(stdout, "%u flows, %u pkts: %.1f%% of the bytes cut off at "
+		"%u bytes/flow\n", flows, npkts, 100.0 * cut / bytes, CUTOFF);
+	fprintf(stdout, "%u flows cut off early, %u late (evicted)\n",
+		early, late);
+	fprintf(stdout, "key + table: %.2f cycles/packet (frames of %u "
+		"flows, not in cache)\n",
+		(double)cyc / npkts, flows);
+
+	shunt_table_free(&t);
+	free(pkt);
+	free(frame);
+	free(passed);
+	free(size);
+
+	if (early != 0) {
+		fprintf(stderr, "Flows were cut off before the cutoff\n");
+		fail++;
+	}
+	return (fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*---------------------------------------------------------------------*/
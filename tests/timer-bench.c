@@ -0,0 +1,211 @@
+/*---------------------------------------------------------------------*/
+/*---------------------------------------------------------------------*/
+/**
+ * Checks the hierarchical timer wheel of the filter brick against the
+ * ticks its timers are due at:
+ *
+ *	- timers right below, at and right above the range of every
+ *	  level, and beyond the range of the outermost one, armed from a
+ *	  clock that is not aligned to any slot;
+ *	- random timers armed while the clock moves in random steps,
+ *	  some of them re-armed or cancelled before they are due.
+ *
+ * Every timer has to fire exactly once, at the tick it is due, and
+ * cancelled ones never. It also reports cycles/timer of timer_add()
+ * and timer_advance().
+ *
+ * Usage: timer-bench [timers]
+ */
+/*---------------------------------------------------------------------*/
+/* pull in the timer wheel */
+#include "../src/bricks_timer.c"
+/* for printf */
+#include <stdio.h>
+/* for strtoul/exit */
+#include <stdlib.h>
+/* for memset */
+#include <string.h>
+/* for read_cycles()/xorshift32() */
+#include "include/bench.h"
+/*---------------------------------------------------------------------*/
+#define DEFAULT_TIMERS		100000
+/* clock steps are up to this many ticks */
+#define MAX_STEP		4096
+/*---------------------------------------------------------------------*/
+typedef struct test_timer {
+	timer_entry te;
+	uint64_t due;				/* tick it has to fire at; 0 if idle */
+	uint32_t fired;				/* no. of times it fired */
+} test_timer;
+
+typedef struct test_state {
+	timer_wheel *tw;
+	uint32_t early;				/* fired before they were due */
+	uint32_t late;				/* fired after they were due */
+	uint32_t spurious;			/* fired while not armed */
+} test_state;
+/*---------------------------------------------------------------------*/
+static void
+on_timer(timer_entry *te, void *arg)
+{
+	test_state *ts = (test_state *)arg;
+	test_timer *t = (test_timer *)te->arg;
+
+	if (t->due == 0 || te->expires != 0)
+		ts->spurious++;
+	else if (ts->tw->now < t->due)
+		ts->early++;
+	else if (ts->tw->now > t->due)
+		ts->late++;
+	t->fired++;
+	t->due = 0;
+}
+/*---------------------------------------------------------------------*/
+static void
+arm(timer_wheel *tw, test_timer *t, uint64_t expires)
+{
+	t->te.arg = t;
+	timer_add(tw, &t->te, expires);
+	t->due = (expires > tw->now) ? expires : tw->now + 1;
+}
+/*---------------------------------------------------------------------*/
+/* returns the no. of failed checks */
+static uint32_t
+report(const char *what, const test_state *ts, const test_timer *t,
+       uint32_t n, uint32_t want_fired)
+{
+	uint32_t i, fired = 0, pending = 0, twice = 0;
+
+	for (i = 0; i < n; i++) {
+		fired += t[i].fired;
+		pending += (t[i].due != 0);
+		twice += (t[i].fired > 1);
+	}
+	fprintf(stdout, "%s: %u timers fired (%u early, %u late, %u spurious, "
+		"%u more than once), %u pending\n", what, fired, ts->early,
+		ts->late, ts->spurious, twice, pending);
+	return ts->early + ts->late + ts->spurious + twice + pending +
+		ts->tw->count + (fired != want_fired);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * Timers around the range of each level and past the whole wheel.
+ * Returns the no. of failed checks.
+ */
+static uint32_t
+check_levels(void)
+{
+	static const int64_t around[] = {-1, 0, 1};
+	uint64_t start = TW_RANGE - 12345, span[TW_LEVELS + 2], due;
+	test_timer t[(TW_LEVELS + 2) * 3 + 2];
+	uint32_t n = 0, i, k;
+	timer_wheel tw;
+	test_state ts;
+
+	memset(t, 0, sizeof(t));
+	memset(&ts, 0, sizeof(ts));
+	ts.tw = &tw;
+	timer_wheel_init(&tw, start);
+
+	/* the range of each level, and twice and thrice that of the wheel */
+	for (i = 0; i < TW_LEVELS; i++)
+		span[i] = 1ULL << (TW_SLOT_BITS * (i + 1));
+	span[TW_LEVELS] = 2 * TW_RANGE;
+	span[TW_LEVELS + 1] = 3 * TW_RANGE;
+	for (i = 0; i < TW_LEVELS + 2; i++)
+		for (k = 0; k < 3; k++)
+			arm(&tw, &t[n++], start + span[i] + around[k]);
+	/* plus the next tick and one that has passed */
+	arm(&tw, &t[n++], start + 1);
+	arm(&tw, &t[n++], start - 100);
+
+	/* tick by tick, up to the last one due */
+	for (due = 0, i = 0; i < n; i++)
+		due = (t[i].due > due) ? t[i].due : due;
+	timer_advance(&tw, due + TW_RANGE, on_timer, &ts);
+
+	return report("levels", &ts, t, n, n);
+}
+/*---------------------------------------------------------------------*/
+/**
+ * n random timers: armed, re-armed and cancelled as the clock moves in
+ * random steps. Returns the no. of failed checks.
+ */
+static uint32_t
+check_random(uint32_t n)
+{
+	uint32_t state = 0x9e3779b9, i, j, r, armed = 0, fired = 0, cancelled = 0;
+	uint64_t add_cyc = 0, adv_cyc = 0, start, expires;
+	test_timer *t = calloc(n, sizeof(test_timer));
+	timer_wheel tw;
+	test_state ts;
+
+	if (t == NULL) {
+		fprintf(stderr, "Can't allocate timers\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(&ts, 0, sizeof(ts));
+	ts.tw = &tw;
+	timer_wheel_init(&tw, xorshift32(&state));
+
+	while (armed < n || tw.count != 0) {
+		/* arm a few new timers, due up to twice the wheel's range out */
+		for (j = 0; j < 16 && armed < n; j++, armed++) {
+			r = xorshift32(&state);
+			expires = tw.now + (((uint64_t)xorshift32(&state) << 32 |
+					     xorshift32(&state)) >>
+					    (64 - 1 - (r % (TW_SLOT_BITS *
+							    TW_LEVELS + 2))));
+			start = read_cycles();
+			arm(&tw, &t[armed], expires);
+			add_cyc += read_cycles() - start;
+		}
+		/* re-arm or cancel one of the recent ones */
+		i = armed - 1 - xorshift32(&state) % ((armed < 256) ? armed : 256);
+		r = xorshift32(&state);
+		if (t[i].due != 0 && (r & 3) == 0) {
+			arm(&tw, &t[i], tw.now + (r >> 8));
+		} else if (t[i].due != 0 && (r & 3) == 1) {
+			timer_del(&tw, &t[i].te);
+			t[i].due = 0;
+			cancelled++;
+		}
+		/* and move on */
+		r = xorshift32(&state);
+		start = read_cycles();
+		fired += timer_advance(&tw, tw.now + ((r & 0xFF) == 0 ?
+						      TW_RANGE >> (r >> 28) :
+						      r % MAX_STEP), on_timer, &ts);
+		adv_cyc += read_cycles() - start;
+	}
+
+	fprintf(stdout, "random: %u cancelled, %.2f cycles/add, "
+		"%.2f cycles/fired timer\n", cancelled, (double)add_cyc / n,
+		(fired != 0) ? (double)adv_cyc / fired : 0.0);
+	r = report("random", &ts, t, n, n - cancelled);
+	free(t);
+	return r;
+}
+/*---------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t n = DEFAULT_TIMERS, fail;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 10);
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [timers]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fail = check_levels();
+	fail += check_random(n);
+
+	if (fail != 0) {
+		fprintf(stderr, "Timers did not fire when they were due\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------*/